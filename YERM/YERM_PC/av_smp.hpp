@@ -0,0 +1,41 @@
+#ifndef __AV_SMP_HPP__
+#define __AV_SMP_HPP__
+
+// owning pointer for FFmpeg objects, shared by the yerm and yerm_bench front ends
+
+extern "C" {
+    #include "../externals/ffmpeg/include/libavformat/avformat.h"
+    #include "../externals/ffmpeg/include/libavcodec/avcodec.h"
+    #include "../externals/ffmpeg/include/libswscale/swscale.h"
+}
+
+template<class T>
+void freec(T*) {}
+
+template<class T>
+struct smp {
+    T* ptr;
+    inline smp(T* p) :ptr(p) {}
+    inline smp& operator=(T* p) {
+        if (ptr) freec(ptr);
+        ptr = p;
+        return *this;
+    }
+    T* operator->() const { return ptr; }
+    T& operator*() const { return *ptr; }
+    T** operator&() const { return &ptr; }
+    inline operator T* () const { return ptr; }
+    T** operator&() { return &ptr; }
+    ~smp() {
+        if (ptr) freec(ptr);
+    }
+};
+
+template<> inline void freec<AVFormatContext>(AVFormatContext* ctx) { avformat_free_context(ctx); }
+template<> inline void freec<AVCodecContext>(AVCodecContext* ctx) { avcodec_free_context(&ctx); }
+template<> inline void freec<AVFrame>(AVFrame* ctx) { av_frame_free(&ctx); }
+template<> inline void freec<AVDictionary>(AVDictionary* d) { av_dict_free(&d); }
+template<> inline void freec<SwsContext>(SwsContext* ctx) { sws_freeContext(ctx); }
+template<> inline void freec<AVPacket>(AVPacket* pkt) { av_packet_free(&pkt); }
+
+#endif
@@ -0,0 +1,396 @@
+// yerm_bench: times each stage of the decode -> filter -> encode pipeline on deterministic sources, driving the same
+// VideoDecoder, Converter and VideoEncoder the transcoder is built from. Each stage runs on its own thread as in production.
+// The source is encoded into memory and demuxed from there, so disk reads don't show up in the numbers. Stage times are
+// taken per frame from the pipeline's trace spans.
+// Runs on any Vulkan device. To force a software device on a GPU host, point VK_ICD_FILENAMES at the lavapipe ICD json.
+#include "logger.hpp"
+#include "yr_sys.h"
+#include "yr_graphics.h"
+#include "../../fmp.h"
+#include "av_smp.hpp"
+#include "yr_trace.hpp"
+
+extern "C" {
+    #include "../externals/ffmpeg/include/libavutil/imgutils.h"
+    #include "../externals/ffmpeg/include/libavutil/pixdesc.h"
+}
+
+#ifndef YR_USE_VULKAN
+#error "yerm_bench is written against the Vulkan backend"
+#endif
+#ifdef YR_NO_TRACE
+#error "yerm_bench times the stages from their trace spans"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // stages in pipeline order, each timed per frame from a trace span minus the spans nested in it.
+    // PIPELINE is the interval between frames coming out of the encoder
+    enum Stage { DEMUX, DECODE, DECODE_CONVERT, UPLOAD, RENDER, READBACK, ENCODE_CONVERT, ENCODE, MUX, PIPELINE, STAGE_COUNT };
+    const char* STAGE_NAMES[STAGE_COUNT] = { "demux", "decode", "decode_convert", "upload", "render", "readback", "encode_convert", "encode", "mux", "pipeline" };
+    struct StageSpan { const char* span; const char* nested; };
+    const StageSpan STAGE_SPANS[PIPELINE] = {
+        { "demux", nullptr },
+        { "decode packet", nullptr },
+        { "decode convert", nullptr }, // YUV -> BGRA into the staging memory. absent when frames are imported as they are
+        { "upload", "decode convert" },
+        { "render", nullptr },         // submit and fence wait
+        { "readback", nullptr },
+        { "encode convert", nullptr }, // RGBA -> the encoder's format
+        { "encode", "mux write" },
+        { "mux write", nullptr },
+    };
+
+    // moving diagonal gradient, different per plane. identical bytes for identical arguments
+    void fillPattern(AVFrame* frame, int index) {
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+        int widths[4]{};
+        av_image_fill_linesizes(widths, (AVPixelFormat)frame->format, frame->width);
+        for (int p = 0; p < 4 && frame->data[p]; p++) {
+            const int height = (p == 1 || p == 2) ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+            for (int y = 0; y < height; y++) {
+                uint8_t* row = frame->data[p] + (ptrdiff_t)y * frame->linesize[p];
+                for (int x = 0; x < widths[p]; x++) {
+                    row[x] = (uint8_t)(x + y * 2 + index * 3 + p * 50);
+                }
+            }
+        }
+    }
+
+    bool supportsFormat(const AVCodec* codec, AVPixelFormat fmt) {
+        if (!codec->pix_fmts) return true;
+        for (const AVPixelFormat* f = codec->pix_fmts; *f != AV_PIX_FMT_NONE; f++) {
+            if (*f == fmt) return true;
+        }
+        return false;
+    }
+
+    // the synthetic frames encoded and muxed into nut in memory, one frame per tick of its 1/30 time base.
+    // rawvideo is used when the requested codec can't take the format
+    bool makeSource(int w, int h, AVPixelFormat fmt, int frameCount, const char* codecName, std::vector<uint8_t>& source) {
+        const AVCodec* codec = avcodec_find_encoder_by_name(codecName);
+        if (!codec || !supportsFormat(codec, fmt)) codec = avcodec_find_encoder(AV_CODEC_ID_RAWVIDEO);
+        smp<AVCodecContext> ctx = avcodec_alloc_context3(codec);
+        ctx->width = w;
+        ctx->height = h;
+        ctx->pix_fmt = fmt;
+        ctx->time_base = { 1, 30 };
+        ctx->framerate = { 30, 1 };
+        ctx->gop_size = 1;
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        if (avcodec_open2(ctx, codec, nullptr) < 0) {
+            LOGRAW("Failed to open source encoder", codec->name);
+            return false;
+        }
+
+        smp<AVFormatContext> oc = nullptr;
+        avformat_alloc_output_context2(&oc, nullptr, "nut", nullptr);
+        if (!oc || avio_open_dyn_buf(&oc->pb) < 0) {
+            LOGRAW("Failed to create the source muxer");
+            return false;
+        }
+        AVStream* stream = avformat_new_stream(oc, nullptr);
+        avcodec_parameters_from_context(stream->codecpar, ctx);
+        stream->time_base = ctx->time_base;
+        bool ok = avformat_write_header(oc, nullptr) >= 0;
+
+        smp<AVFrame> frame = av_frame_alloc();
+        frame->format = fmt;
+        frame->width = w;
+        frame->height = h;
+        av_frame_get_buffer(frame, 0);
+        smp<AVPacket> pkt = av_packet_alloc();
+        for (int i = 0; ok && i <= frameCount; i++) {
+            if (i < frameCount) {
+                av_frame_make_writable(frame);
+                fillPattern(frame, i);
+                frame->pts = i;
+            }
+            avcodec_send_frame(ctx, i < frameCount ? (AVFrame*)frame : nullptr);
+            while (avcodec_receive_packet(ctx, pkt) == 0) {
+                av_packet_rescale_ts(pkt, ctx->time_base, stream->time_base);
+                pkt->stream_index = 0;
+                ok = av_interleaved_write_frame(oc, pkt) >= 0;
+            }
+        }
+        if (ok) ok = av_write_trailer(oc) >= 0;
+        uint8_t* bytes = nullptr;
+        const int size = avio_close_dyn_buf(oc->pb, &bytes);
+        oc->pb = nullptr;
+        if (ok && size > 0) source.assign(bytes, bytes + size);
+        av_free(bytes);
+        return ok && size > 0;
+    }
+
+    // read-only view of the source for the demuxer
+    struct MemoryInput {
+        const std::vector<uint8_t>* data;
+        size_t pos = 0;
+
+        static int read(void* opaque, uint8_t* buf, int size) {
+            MemoryInput* in = reinterpret_cast<MemoryInput*>(opaque);
+            const size_t left = in->data->size() - in->pos;
+            if (left == 0) return AVERROR_EOF;
+            const size_t n = std::min(left, (size_t)size);
+            std::memcpy(buf, in->data->data() + in->pos, n);
+            in->pos += n;
+            return (int)n;
+        }
+        static int64_t seek(void* opaque, int64_t offset, int whence) {
+            MemoryInput* in = reinterpret_cast<MemoryInput*>(opaque);
+            const int64_t size = (int64_t)in->data->size();
+            switch (whence & ~AVSEEK_FORCE) {
+            case AVSEEK_SIZE: return size;
+            case SEEK_SET: break;
+            case SEEK_CUR: offset += (int64_t)in->pos; break;
+            case SEEK_END: offset += size; break;
+            default: return AVERROR(EINVAL);
+            }
+            if (offset < 0 || offset > size) return AVERROR(EINVAL);
+            in->pos = (size_t)offset;
+            return offset;
+        }
+    };
+
+    // exact percentiles of the samples, in microseconds
+    onart::LatencyStats distribution(std::vector<int64_t>& us) {
+        onart::LatencyStats ret;
+        ret.frames = us.size();
+        if (us.empty()) return ret;
+        std::sort(us.begin(), us.end());
+        int64_t total = 0;
+        for (int64_t v : us) total += v;
+        auto at = [&us](size_t percent) { return us[std::max<size_t>(1, (percent * us.size() + 99) / 100) - 1] / 1e3; };
+        ret.meanMs = total / 1e3 / us.size();
+        ret.p50Ms = at(50);
+        ret.p95Ms = at(95);
+        ret.p99Ms = at(99);
+        ret.maxMs = us.back() / 1e3;
+        return ret;
+    }
+
+    // per-frame time of every stage from the spans recorded during the run
+    void stageTimes(onart::LatencyStats (&stages)[STAGE_COUNT]) {
+        struct Span { const char* name; int64_t begin, end; };
+        std::map<uint32_t, std::vector<Span>> threads;
+        onart::Tracer::forEachEvent([&threads](const char* name, int64_t begin, int64_t end, uint32_t tid) { threads[tid].push_back({ name, begin, end }); });
+        for (int s = 0; s < PIPELINE; s++) {
+            std::vector<int64_t> samples;
+            for (auto& thread : threads) {
+                const std::vector<Span>& spans = thread.second;
+                for (size_t i = 0; i < spans.size(); i++) {
+                    if (std::strcmp(spans[i].name, STAGE_SPANS[s].span) != 0) continue;
+                    int64_t us = spans[i].end - spans[i].begin;
+                    // nested spans end earlier on the same thread, so they are listed before the outer one
+                    for (size_t j = i; STAGE_SPANS[s].nested && j-- > 0 && spans[j].end >= spans[i].begin;) {
+                        if (spans[j].begin >= spans[i].begin && std::strcmp(spans[j].name, STAGE_SPANS[s].nested) == 0) us -= spans[j].end - spans[j].begin;
+                    }
+                    samples.push_back(us);
+                }
+            }
+            stages[s] = distribution(samples);
+        }
+    }
+
+    struct Resolution { const char* name; int w, h; };
+    const Resolution RESOLUTIONS[] = {
+        { "360p", 640, 360 }, { "720p", 1280, 720 }, { "1080p", 1920, 1080 },
+        { "1440p", 2560, 1440 }, { "2160p", 3840, 2160 }, { "4320p", 7680, 4320 },
+    };
+
+    struct Result {
+        int w, h;
+        std::string pixFmt;
+        onart::LatencyStats stages[STAGE_COUNT];
+        double fps = 0; // frames out of the encoder per second of the whole run
+    };
+
+    struct Bench {
+        int frames = 60;
+        std::string sourceCodec = "ffv1";
+        std::string outputCodec = "mpeg4";
+        std::filesystem::path workDir = std::filesystem::temp_directory_path();
+
+        bool run(int w, int h, AVPixelFormat fmt, Result& result) {
+            const std::string tag = std::to_string(w) + "x" + std::to_string(h) + "_" + av_get_pix_fmt_name(fmt);
+            // the output still goes to a file, as writing it is part of the mux stage
+            const std::string outputPath = (workDir / ("yerm_bench_" + tag + "_out.nut")).u8string();
+            std::vector<uint8_t> source;
+            if (!makeSource(w, h, fmt, frames, sourceCodec.c_str(), source)) return false;
+            const bool ok = runPipeline(w, h, source, outputPath.c_str(), result);
+            std::error_code ec;
+            std::filesystem::remove(outputPath, ec);
+            if (!ok) return false;
+            result.w = w;
+            result.h = h;
+            result.pixFmt = av_get_pix_fmt_name(fmt);
+            return true;
+        }
+
+        bool runPipeline(int w, int h, const std::vector<uint8_t>& source, const char* outputPath, Result& result) {
+            MemoryInput input{ &source };
+            const int ioSize = 1 << 16;
+            uint8_t* ioBuffer = (uint8_t*)av_malloc(ioSize);
+            AVIOContext* io = ioBuffer ? avio_alloc_context(ioBuffer, ioSize, 0, &input, MemoryInput::read, nullptr, MemoryInput::seek) : nullptr;
+            if (!io) {
+                av_free(ioBuffer);
+                LOGRAW("Failed to allocate the source I/O context");
+                return false;
+            }
+            bool ok = false;
+            {
+                onart::VideoDecoder decoder; // gone before io, which it reads through
+                if (decoder.open(io, "synthetic.nut")) ok = runStages(w, h, decoder, outputPath, result);
+                else LOGRAW("Failed to open synthetic source");
+            }
+            av_freep(&io->buffer);
+            avio_context_free(&io);
+            return ok;
+        }
+
+        bool runStages(int w, int h, onart::VideoDecoder& decoder, const char* outputPath, Result& result) {
+            onart::EncoderOptions encOpts;
+            encOpts.codec = outputCodec;
+            encOpts.gopSize = 12;
+            encOpts.maxBFrames = 0; // B frames would hold frames back and blur the output interval
+            std::unique_ptr<onart::VideoEncoder> encoder = decoder.makeEncoder(w, h, encOpts);
+            if (!encoder) return false;
+            encoder->start(outputPath);
+            std::unique_ptr<onart::Converter> converter = decoder.makeFormatConverter();
+            onart::OffscreenFilter filter(w, h);
+            onart::RingBuffer4Frame decoded(4);
+            onart::RingBuffer4Texture uploaded(4);
+            std::vector<int64_t> intervals;
+            intervals.reserve(frames);
+
+            onart::Tracer::start(""); // no file; the spans are read back below
+            const auto begin = std::chrono::steady_clock::now();
+            converter->start(&decoded, &uploaded, false); // first, so decoded frames are allocated on its node
+            decoder.start(&decoded);
+            auto last = begin;
+            while (filter.onLoop(&uploaded, encoder.get(), 1)) { // the source's time base is one frame
+                const auto now = std::chrono::steady_clock::now();
+                intervals.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - last).count());
+                last = now;
+            }
+            encoder->end();
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            onart::Tracer::stop();
+
+            stageTimes(result.stages);
+            result.stages[PIPELINE] = distribution(intervals);
+            result.fps = seconds > 0 ? intervals.size() / seconds : 0;
+            return encoder->report().frames > 0;
+        }
+    };
+
+    // per stage: frames and the distribution of per-frame times. fps is the encoder's output rate for the pipeline, and the
+    // rate the stage alone could keep up (1000 / mean) for the others
+    void writeReport(FILE* out, const std::vector<Result>& results, bool json, const std::string& label) {
+        if (json) fprintf(out, "[\n");
+        else fprintf(out, "label,width,height,pix_fmt,stage,frames,fps,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+        bool first = true;
+        for (const Result& r : results) {
+            for (int s = 0; s < STAGE_COUNT; s++) {
+                const onart::LatencyStats& st = r.stages[s];
+                const double fps = s == PIPELINE ? r.fps : st.meanMs > 0 ? 1000.0 / st.meanMs : 0;
+                if (json) {
+                    fprintf(out, "%s  {\"label\":\"%s\",\"width\":%d,\"height\":%d,\"pix_fmt\":\"%s\",\"stage\":\"%s\",\"frames\":%llu,\"fps\":%.3f,"
+                        "\"mean_ms\":%.4f,\"p50_ms\":%.4f,\"p95_ms\":%.4f,\"p99_ms\":%.4f,\"max_ms\":%.4f}",
+                        first ? "" : ",\n", label.c_str(), r.w, r.h, r.pixFmt.c_str(), STAGE_NAMES[s], (unsigned long long)st.frames, fps,
+                        st.meanMs, st.p50Ms, st.p95Ms, st.p99Ms, st.maxMs);
+                }
+                else {
+                    fprintf(out, "%s,%d,%d,%s,%s,%llu,%.3f,%.4f,%.4f,%.4f,%.4f,%.4f\n", label.c_str(), r.w, r.h, r.pixFmt.c_str(), STAGE_NAMES[s],
+                        (unsigned long long)st.frames, fps, st.meanMs, st.p50Ms, st.p95Ms, st.p99Ms, st.maxMs);
+                }
+                first = false;
+            }
+        }
+        if (json) fprintf(out, "\n]\n");
+    }
+
+    std::vector<std::string> split(const std::string& list) {
+        std::vector<std::string> ret;
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos) end = list.size();
+            if (end > start) ret.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+        return ret;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Bench bench;
+    std::string sizes = "360p,720p,1080p,1440p,2160p,4320p";
+    std::string formats = "yuv420p,nv12,yuv444p";
+    std::string outPath, label = "current";
+    bool json = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string { return i + 1 < argc ? argv[++i] : ""; };
+        if (arg == "--frames") bench.frames = std::max(1, std::atoi(next().c_str()));
+        else if (arg == "--sizes") sizes = next();
+        else if (arg == "--formats") formats = next();
+        else if (arg == "--source-codec") bench.sourceCodec = next();
+        else if (arg == "--codec") bench.outputCodec = next();
+        else if (arg == "--json") json = true;
+        else if (arg == "--csv") json = false;
+        else if (arg == "--out") outPath = next();
+        else if (arg == "--label") label = next();
+        else {
+            LOGRAW("usage:", argv[0], "[--frames 60] [--sizes 360p,720p,1080p,1440p,2160p,4320p|WxH] [--formats yuv420p,nv12,yuv444p] [--source-codec ffv1] [--codec mpeg4] [--csv|--json] [--out file] [--label name]");
+            return 0;
+        }
+    }
+
+    onart::Window::init(); // may fail on headless hosts; offscreen passes don't need a surface
+    onart::YRGraphics* _gr(new onart::YRGraphics);
+
+    std::vector<Result> results;
+    for (const std::string& size : split(sizes)) {
+        int w = 0, h = 0;
+        for (const Resolution& r : RESOLUTIONS) {
+            if (size == r.name) { w = r.w; h = r.h; }
+        }
+        if (!w && std::sscanf(size.c_str(), "%dx%d", &w, &h) != 2) {
+            LOGRAW("Unknown size", size);
+            continue;
+        }
+        for (const std::string& fmtName : split(formats)) {
+            AVPixelFormat fmt = av_get_pix_fmt(fmtName.c_str());
+            if (fmt == AV_PIX_FMT_NONE) {
+                LOGRAW("Unknown pixel format", fmtName);
+                continue;
+            }
+            LOGRAW("Running", w, h, fmtName);
+            Result result;
+            if (bench.run(w, h, fmt, result)) results.push_back(std::move(result));
+            else LOGRAW("Skipped", w, h, fmtName);
+        }
+    }
+
+    FILE* out = outPath.empty() ? stdout : fopen(outPath.c_str(), "w");
+    if (!out) {
+        LOGRAW("Failed to open", outPath);
+        out = stdout;
+    }
+    writeReport(out, results, json, label);
+    if (out != stdout) fclose(out);
+
+    delete _gr;
+    onart::Window::terminate();
+    return 0;
+}
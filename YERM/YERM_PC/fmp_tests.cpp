@@ -0,0 +1,194 @@
+// yerm_tests: checks for the parts of fmp that don't need a graphics device. Returns nonzero when any check fails.
+#include "logger.hpp"
+#include "../../fmp.h"
+#include "av_smp.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { LOGRAW(__FILE__, __LINE__, "check failed:", #cond); failures++; } } while (0)
+
+    std::string tempPath(const char* name) {
+        return (std::filesystem::temp_directory_path() / name).string();
+    }
+
+    // a few rawvideo frames muxed into nut, written to path (which may be a FIFO)
+    bool writeSource(const std::string& path, int w, int h, int frameCount) {
+        const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_RAWVIDEO);
+        smp<AVCodecContext> ctx = avcodec_alloc_context3(codec);
+        ctx->width = w;
+        ctx->height = h;
+        ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+        ctx->time_base = { 1, 30 };
+        ctx->framerate = { 30, 1 };
+        if (avcodec_open2(ctx, codec, nullptr) < 0) return false;
+        smp<AVFormatContext> oc = nullptr;
+        avformat_alloc_output_context2(&oc, nullptr, "nut", path.c_str());
+        if (!oc || avio_open(&oc->pb, path.c_str(), AVIO_FLAG_WRITE) < 0) return false;
+        AVStream* stream = avformat_new_stream(oc, nullptr);
+        avcodec_parameters_from_context(stream->codecpar, ctx);
+        stream->time_base = ctx->time_base;
+        bool ok = avformat_write_header(oc, nullptr) >= 0;
+        smp<AVFrame> frame = av_frame_alloc();
+        frame->format = ctx->pix_fmt;
+        frame->width = w;
+        frame->height = h;
+        av_frame_get_buffer(frame, 0);
+        smp<AVPacket> pkt = av_packet_alloc();
+        for (int i = 0; ok && i <= frameCount; i++) {
+            if (i < frameCount) {
+                av_frame_make_writable(frame);
+                for (int p = 0; p < 3; p++) std::fill_n(frame->data[p], frame->linesize[p] * (p ? h / 2 : h), (uint8_t)(i * 16 + p));
+                frame->pts = i;
+            }
+            avcodec_send_frame(ctx, i < frameCount ? (AVFrame*)frame : nullptr);
+            while (avcodec_receive_packet(ctx, pkt) == 0) {
+                av_packet_rescale_ts(pkt, ctx->time_base, stream->time_base);
+                pkt->stream_index = 0;
+                ok = av_interleaved_write_frame(oc, pkt) >= 0;
+            }
+        }
+        if (ok) ok = av_write_trailer(oc) >= 0;
+        avio_closep(&oc->pb);
+        return ok;
+    }
+
+    void testInputFileModes() {
+        const std::string path = tempPath("yerm_tests_regular.nut");
+        CHECK(writeSource(path, 64, 48, 3));
+        {
+            onart::InputFile file;
+            CHECK(file.open(path.c_str()));
+            CHECK(file.mode() != onart::InputFile::Mode::DEFAULT);
+            CHECK(file.context() != nullptr);
+        }
+        {
+            onart::InputFile file;
+            CHECK(file.open("http://127.0.0.1:9/never_opened.nut"));
+            CHECK(file.mode() == onart::InputFile::Mode::DEFAULT);
+            CHECK(file.context() == nullptr);
+        }
+        std::remove(path.c_str());
+    }
+
+    void testSectionsAtCuts() {
+        constexpr int64_t S = 1'000'000;
+        // 4 s is within minLength of the 3 s cut, 11.5 s within minLength of the end
+        auto sections = onart::sectionsAtCuts({ 3 * S, 4 * S, 10 * S, 11 * S + S / 2 }, 12 * S, 2 * S);
+        CHECK(sections.size() == 3);
+        if (sections.size() == 3) {
+            CHECK(sections[0].start == 0 && sections[0].end == 3 * S - 1);
+            CHECK(sections[1].start == 3 * S && sections[1].end == 10 * S - 1);
+            CHECK(sections[2].start == 10 * S && sections[2].end == 12 * S); // the final section runs to the duration
+        }
+
+        sections = onart::sectionsAtCuts({}, 5 * S, 2 * S);
+        CHECK(sections.size() == 1 && sections[0].start == 0 && sections[0].end == 5 * S);
+
+        // an hour is past what 32 bits of microseconds hold; cuts there must neither wrap nor be dropped
+        sections = onart::sectionsAtCuts({ 60 * S, 3000 * S }, 3600 * S, 2 * S);
+        CHECK(sections.size() == 3);
+        if (sections.size() == 3) {
+            CHECK(sections[0].start == 0 && sections[0].end == 60 * S - 1);
+            CHECK(sections[1].start == 60 * S && sections[1].end == 3000 * S - 1);
+            CHECK(sections[2].start == 3000 * S && sections[2].end == 3600 * S);
+        }
+        for (const onart::section& s : sections) CHECK(s.start >= 0 && s.start <= s.end);
+    }
+
+    // with a queue of 2 the repeat lands in slot 1, and the last picture in the same slot after it
+    void testFanOutRepeatSlot() {
+        const std::string source = tempPath("yerm_tests_fanout_src.nut"), output = tempPath("yerm_tests_fanout_out.nut");
+        CHECK(writeSource(source, 64, 48, 1));
+        onart::VideoDecoder decoder;
+        CHECK(decoder.open(source.c_str()));
+        std::unique_ptr<onart::VideoEncoder> encoder = decoder.makeEncoder(64, 48);
+        CHECK(encoder != nullptr);
+        if (encoder) {
+            encoder->start(output.c_str());
+            std::vector<uint8_t> picture(64 * 48 * 4, 0x80);
+            {
+                onart::EncoderFanOut fanOut(2);
+                fanOut.add(encoder.get());
+                fanOut.push(nullptr, 1); // before any picture: dropped
+                fanOut.push(picture.data(), 1);
+                fanOut.push(nullptr, 1);
+                fanOut.push(picture.data(), 1);
+                fanOut.push(picture.data(), 1);
+            }
+            CHECK(encoder->report().frames == 4);
+        }
+        std::remove(source.c_str());
+        std::remove(output.c_str());
+    }
+
+#if !defined(_WIN32)
+    // a FIFO has no size, so AUTO must leave it to FFmpeg instead of mapping or reading ahead
+    void testFifoInput() {
+        const std::string path = tempPath("yerm_tests_fifo.nut");
+        std::remove(path.c_str());
+        if (mkfifo(path.c_str(), 0600) != 0) {
+            LOGRAW("mkfifo failed; skipping FIFO input test");
+            return;
+        }
+        {
+            onart::InputFile file;
+            CHECK(file.open(path.c_str())); // would block here if AUTO opened the FIFO itself
+            CHECK(file.mode() == onart::InputFile::Mode::DEFAULT);
+            CHECK(file.context() == nullptr);
+        }
+        std::atomic_bool written = false;
+        std::thread writer([&]() { writeSource(path, 64, 48, 3); written = true; }); // fails if the decoder stops reading first, which is fine here
+        bool opened;
+        {
+            onart::VideoDecoder decoder;
+            opened = decoder.open(path.c_str());
+            CHECK(opened);
+            CHECK(decoder.getWidth() == 64 && decoder.getHeight() == 48);
+        }
+        if (!opened) { // the writer may still be waiting for a reader, so be one until it gives up
+            const int fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK);
+            char sink[4096];
+            while (!written) {
+                if (fd < 0 || ::read(fd, sink, sizeof(sink)) <= 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (fd >= 0) ::close(fd);
+        }
+        writer.join();
+        std::remove(path.c_str());
+    }
+#endif
+
+}
+
+int main() {
+    testInputFileModes();
+    testSectionsAtCuts();
+    testFanOutRepeatSlot();
+#if !defined(_WIN32)
+    std::signal(SIGPIPE, SIG_IGN); // the FIFO writer may outlive its reader
+    testFifoInput();
+#endif
+    if (failures) LOGRAW(failures, "checks failed");
+    else LOGRAW("all checks passed");
+    return failures ? 1 : 0;
+}
@@ -71,4 +71,286 @@ inline std::string toString(const T&... extra) {
     #endif
 #endif
 
-#endif
\ No newline at end of file
+// Levelled asynchronous logging for hot paths.
+// Arguments are captured by value into a per-thread ring and formatted by a background thread, so the caller never waits
+// for I/O. Records with strings, or too large to keep, are formatted at once into a fixed per-thread buffer and kept as text
+// of at most Record::PAYLOAD bytes, so logging never allocates. When a ring is full the record is dropped and counted
+// instead of blocking. After the logger is destroyed (logging from static destructors) records are written synchronously.
+// Each call site passes at most YR_LOG_RATE_LIMIT records per second; the rest are counted and reported with the next one.
+// Compile-time filter: YR_LOG_MIN_LEVEL (0: trace ~ 4: error). Runtime filter: onart::AsyncLogger::setLevel.
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#ifdef BOOST_PLAT_ANDROID_AVAILABLE
+#include <android/log.h>
+#elif defined(YR_USE_WEBGPU)
+#include "../externals/wasm_webgpu/miniprintf.h"
+#endif
+
+#ifndef YR_LOG_MIN_LEVEL
+#define YR_LOG_MIN_LEVEL 1
+#endif
+#ifndef YR_LOG_RATE_LIMIT
+#define YR_LOG_RATE_LIMIT 20
+#endif
+
+namespace onart {
+    enum class LogLevel : uint8_t { TRACE = 0, DEBUG = 1, INFO = 2, WARN = 3, ERR = 4, OFF = 5 };
+
+    /// @brief 호출 위치별 초당 기록 수 제한 상태입니다. 매크로가 위치마다 하나씩 만듭니다.
+    struct LogSite {
+        std::atomic<int64_t> window{ -1 };
+        std::atomic<uint32_t> passed{ 0 };
+        std::atomic<uint32_t> suppressed{ 0 };
+        /// @brief 이번 기록을 통과시킬지 정합니다. 통과하면 그 전까지 막힌 수를 *skipped에 넣습니다.
+        inline bool allow(uint32_t* skipped) {
+            const int64_t sec = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            if (window.load(std::memory_order_relaxed) != sec) {
+                window.store(sec, std::memory_order_relaxed);
+                passed.store(0, std::memory_order_relaxed);
+            }
+            if (passed.fetch_add(1, std::memory_order_relaxed) >= YR_LOG_RATE_LIMIT) {
+                suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            *skipped = suppressed.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+    };
+
+    class AsyncLogger {
+        public:
+            /// @brief 런타임 최소 레벨을 정합니다. 컴파일 시 YR_LOG_MIN_LEVEL보다 낮은 기록은 이와 무관하게 제거됩니다.
+            inline static void setLevel(LogLevel level) { minLevel.store((uint8_t)level, std::memory_order_relaxed); }
+            inline static bool enabled(LogLevel level) { return (uint8_t)level >= minLevel.load(std::memory_order_relaxed); }
+            /// @brief 지금까지 들어온 기록을 모두 출력할 때까지 기다립니다.
+            inline static void flush() {
+                if (closed.load(std::memory_order_acquire)) return;
+                AsyncLogger& self = instance();
+                std::unique_lock<std::mutex> _(self.drainGuard);
+                self.drain();
+            }
+
+            template<class... T>
+            inline static void log(LogSite& site, LogLevel level, const T&... args) {
+                if (!enabled(level)) return;
+                uint32_t skipped = 0;
+                if (!site.allow(&skipped)) return;
+#if !defined(YR_USE_WEBGPU)
+                if (!closed.load(std::memory_order_acquire)) {
+                    append(level, skipped, args...);
+                    return;
+                }
+#endif
+                // no worker thread (any more). thread_local objects may already be gone in static destructors
+                LineBuffer line;
+                line.out << prefix(level);
+                if (skipped) line.out << "(" << skipped << " similar suppressed) ";
+                __getMultiple(line.out, args...);
+#if defined(YR_USE_WEBGPU)
+                emscripten_mini_stdio_printf("%s", line.c_str());
+#elif defined(BOOST_PLAT_ANDROID_AVAILABLE)
+                __android_log_print(ANDROID_LOG_WARN, "", "%s", line.c_str());
+#else
+                std::cout.write(line.c_str(), (std::streamsize)line.size());
+                std::cout.flush();
+#endif
+            }
+        private:
+            template<class T>
+            static constexpr bool isText = std::is_same_v<std::decay_t<T>, const char*> || std::is_same_v<std::decay_t<T>, char*> || std::is_same_v<std::decay_t<T>, std::string>;
+
+            /// @brief 스레드별 고정 크기 출력 버퍼입니다. 넘치는 부분은 버립니다.
+            struct LineBuffer : std::streambuf {
+                static constexpr size_t SIZE = 1024;
+                char text[SIZE + 1];
+                std::ostream out;
+                inline LineBuffer() : out(this) { setp(text, text + SIZE); }
+                /// @brief 현재 스레드의 버퍼를 비워 리턴합니다.
+                inline static LineBuffer& local() {
+                    thread_local LineBuffer buf;
+                    buf.setp(buf.text, buf.text + SIZE);
+                    buf.out.clear();
+                    return buf;
+                }
+                inline size_t size() const { return (size_t)(pptr() - pbase()); }
+                inline const char* c_str() { *pptr() = 0; return text; }
+            };
+
+            template<class... T>
+            inline static void append(LogLevel level, uint32_t skipped, const T&... args) {
+                Ring* ring = instance().local();
+                const uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+                const uint32_t next = (tail + 1) % Ring::CAPACITY;
+                if (next == ring->head.load(std::memory_order_acquire)) {
+                    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                Record& rec = ring->slots[tail];
+                rec.level = level;
+                rec.skipped = skipped;
+                using Captured = std::tuple<std::decay_t<T>...>;
+                if constexpr (!(isText<T> || ...) && sizeof(Captured) <= Record::PAYLOAD && alignof(Captured) <= alignof(std::max_align_t)) {
+                    new (rec.payload) Captured(args...);
+                    rec.format = [](std::ostream& strm, void* p) { std::apply([&strm](const auto&... a) { __getMultiple(strm, a...); }, *reinterpret_cast<Captured*>(p)); };
+                    rec.destroy = [](void* p) { reinterpret_cast<Captured*>(p)->~Captured(); };
+                }
+                else { // strings or too large to keep: format now
+                    LineBuffer& line = LineBuffer::local();
+                    __getMultiple(line.out, args...);
+                    size_t n = line.size();
+                    if (n >= Record::PAYLOAD) {
+                        n = Record::PAYLOAD - 1;
+                        line.text[n - 1] = '\n';
+                    }
+                    std::memcpy(rec.payload, line.text, n);
+                    rec.payload[n] = 0;
+                    rec.format = [](std::ostream& strm, void* p) { strm << reinterpret_cast<const char*>(p); };
+                    rec.destroy = [](void*) {};
+                }
+                ring->tail.store(next, std::memory_order_release);
+                if (level >= LogLevel::ERR) instance().wake.notify_one();
+            }
+            struct Record {
+                static constexpr size_t PAYLOAD = 256;
+                LogLevel level;
+                uint32_t skipped;
+                void (*format)(std::ostream&, void*);
+                void (*destroy)(void*);
+                alignas(std::max_align_t) unsigned char payload[PAYLOAD];
+            };
+            /// @brief 한 스레드가 쓰고 로거 스레드가 읽는 링
+            struct Ring {
+                static constexpr uint32_t CAPACITY = 512;
+                Record slots[CAPACITY];
+                std::atomic<uint32_t> head{ 0 }, tail{ 0 };
+                std::atomic<uint64_t> dropped{ 0 };
+            };
+
+            inline static const char* prefix(LogLevel level) {
+                switch (level) {
+                case LogLevel::TRACE: return "[T] ";
+                case LogLevel::DEBUG: return "[D] ";
+                case LogLevel::INFO: return "[I] ";
+                case LogLevel::WARN: return "[W] ";
+                default: return "[E] ";
+                }
+            }
+
+            inline static AsyncLogger& instance() {
+                static AsyncLogger logger;
+                return logger;
+            }
+
+            inline AsyncLogger() = default;
+            inline ~AsyncLogger() {
+                {
+                    std::unique_lock<std::mutex> _(drainGuard);
+                    stop = true;
+                }
+                wake.notify_one();
+                if (worker.joinable()) worker.join();
+                std::unique_lock<std::mutex> _(drainGuard);
+                drain();
+                closed.store(true, std::memory_order_release);
+            }
+
+            inline Ring* local() {
+                thread_local std::shared_ptr<Ring> mine;
+                if (mine) return mine.get();
+                mine = std::make_shared<Ring>();
+                std::unique_lock<std::mutex> _(drainGuard);
+                rings.push_back(mine);
+                if (!worker.joinable()) worker = std::thread([this]() { run(); });
+                return mine.get();
+            }
+
+            inline void run() {
+                std::unique_lock<std::mutex> _(drainGuard);
+                while (!stop) {
+                    drain();
+                    wake.wait_for(_, std::chrono::milliseconds(5));
+                }
+            }
+
+            /// @brief drainGuard를 잡은 상태로 호출
+            inline void drain() {
+                std::ostringstream out;
+                for (size_t i = 0; i < rings.size(); i++) {
+                    Ring* ring = rings[i].get();
+                    uint32_t head = ring->head.load(std::memory_order_relaxed);
+                    const uint32_t tail = ring->tail.load(std::memory_order_acquire);
+                    while (head != tail) {
+                        Record& rec = ring->slots[head];
+#ifdef BOOST_PLAT_ANDROID_AVAILABLE
+                        std::ostringstream one;
+                        if (rec.skipped) one << "(" << rec.skipped << " similar suppressed) ";
+                        rec.format(one, rec.payload);
+                        static const int PRIORITY[] = { ANDROID_LOG_VERBOSE, ANDROID_LOG_DEBUG, ANDROID_LOG_INFO, ANDROID_LOG_WARN, ANDROID_LOG_ERROR };
+                        __android_log_print(PRIORITY[(int)rec.level], "", "%s", one.str().c_str());
+#else
+                        out << prefix(rec.level);
+                        if (rec.skipped) out << "(" << rec.skipped << " similar suppressed) ";
+                        rec.format(out, rec.payload);
+#endif
+                        rec.destroy(rec.payload);
+                        head = (head + 1) % Ring::CAPACITY;
+                        ring->head.store(head, std::memory_order_release);
+                    }
+                    if (uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed)) {
+                        out << "[W] " << dropped << " log records dropped (ring full)\n";
+                    }
+                    if (rings[i].use_count() == 1 && ring->tail.load(std::memory_order_acquire) == head) { // its thread has ended
+                        rings.erase(rings.begin() + i);
+                        i--;
+                    }
+                }
+                const std::string text = out.str();
+                if (!text.empty()) {
+#ifdef BOOST_PLAT_ANDROID_AVAILABLE
+                    __android_log_print(ANDROID_LOG_WARN, "", "%s", text.c_str());
+#else
+                    std::cout.write(text.data(), (std::streamsize)text.size());
+                    std::cout.flush();
+#endif
+                }
+            }
+
+            inline static std::atomic<uint8_t> minLevel{ YR_LOG_MIN_LEVEL };
+            inline static std::atomic<bool> closed{ false }; // 소멸 후. 이후 기록은 바로 출력
+            std::mutex drainGuard; // rings 목록과 출력
+            std::condition_variable wake;
+            std::vector<std::shared_ptr<Ring>> rings;
+            std::thread worker;
+            bool stop = false;
+    };
+}
+
+#ifdef YR_NO_LOG
+    #define LOGLEVEL(level, ...)
+#else
+    /// @brief 주어진 레벨로 비동기 기록합니다. 레벨은 onart::LogLevel의 값입니다.
+    #define LOGLEVEL(level, ...) do { \
+        if constexpr ((int)(level) >= YR_LOG_MIN_LEVEL) { \
+            static ::onart::LogSite __yrLogSite; \
+            ::onart::AsyncLogger::log(__yrLogSite, level, __VA_ARGS__); \
+        } \
+    } while (0)
+#endif
+#define LOGTRACE(...) LOGLEVEL(::onart::LogLevel::TRACE, __VA_ARGS__)
+#define LOGDEBUG(...) LOGLEVEL(::onart::LogLevel::DEBUG, __VA_ARGS__)
+#define LOGINFO(...) LOGLEVEL(::onart::LogLevel::INFO, __VA_ARGS__)
+#define LOGWARN(...) LOGLEVEL(::onart::LogLevel::WARN, __VA_ARGS__)
+#define LOGERR(...) LOGLEVEL(::onart::LogLevel::ERR, __VA_ARGS__)
+
+#endif
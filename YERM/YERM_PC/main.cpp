@@ -4,7 +4,11 @@
 #include "yr_game.h"
 #include "yr_constants.hpp"
 
+#include "yr_trace.hpp"
+#include "yr_threadpool.hpp"
+#include "yr_arena.hpp"
 #include "../../fmp.h"
+#include "av_smp.hpp"
 extern "C" {
     #include "../externals/ffmpeg/include/libavformat/avformat.h"
     #include "../externals/ffmpeg/include/libavcodec/avcodec.h"
@@ -22,36 +26,15 @@ extern "C" {
 
 #include <filesystem>
 #include <cstdlib>
+#include <cstring>
+#include <chrono>
 #include <vector>
-
-template<class T>
-void freec(T*) {}
-
-template<class T>
-struct smp {
-    T* ptr;
-    inline smp(T* p) :ptr(p) {}
-    inline smp& operator=(T* p) {
-        if (ptr) freec(ptr);
-        ptr = p;
-        return *this;
-    }
-    T* operator->() const { return ptr; }
-    T& operator*() const { return *ptr; }
-    T** operator&() const { return &ptr; }
-    inline operator T* () const { return ptr; }
-    T** operator&() { return &ptr; }
-    ~smp() {
-        if (ptr) freec(ptr);
-    }
-};
-
-template<> void freec<AVFormatContext>(AVFormatContext* ctx) { avformat_free_context(ctx); }
-template<> void freec<AVCodecContext>(AVCodecContext* ctx) { avcodec_free_context(&ctx); }
-template<> void freec<AVFrame>(AVFrame* ctx) { av_frame_free(&ctx); }
-template<> void freec<AVDictionary>(AVDictionary* d) { av_dict_free(&d); }
-template<> void freec<SwsContext>(SwsContext* ctx) { sws_freeContext(ctx); }
-template<> void freec<AVPacket>(AVPacket* pkt) { av_packet_free(&pkt); }
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <cctype>
 
 thread_local char errorString[128];
 
@@ -60,30 +43,172 @@ int main(int argc, char* argv[]){
     system("chcp 65001");
 #endif
     std::filesystem::current_path(std::filesystem::path(argv[0]).parent_path());
+    const auto start = std::chrono::steady_clock::now();
     
+    // options may appear anywhere and are removed from the positional arguments
+    double statsInterval = 0;
+    bool gpuTiming = false;
+    bool dedup = true;
+    int filterRadius = -1; // >= 0 declares the filter spatially local, enabling dirty-tile processing
+    int tileSize = 64;
+    std::vector<int> ladderHeights; // extra outputs at these heights, scaled from the filtered frame
+    std::vector<std::string> extraCodecs; // extra encodes of the filtered frame, one thread each
+    onart::EncoderOptions encOpts; // shared by every output; other codecs only replace the codec
+    double sceneThreshold = -1; // >= 0 forces keyframes at detected scene cuts
+    int minScene = 8;
+    bool writeSections = false; // writes the sections between scene cuts next to the output, for a segment-parallel run
+    bool live = false; // the input is a stream (UDP, pipe, ..) to be passed on with as little delay as possible
+    double latencyBudget = 0; // ms. in live mode, frames that would be written later than this after their packet arrived are dropped
+    onart::SegmentOptions segments; // every output is laid out the same way
+    const char* batchFile = nullptr; // job list, "-" for stdin
+    onart::InputFile::Options ioOpts;
+    onart::OutputFile::Options outIoOpts;
+    {
+        int positional = 1;
+        for (int i = 1; i < argc; i++) {
+            if (std::strcmp(argv[i], "--no-stats") == 0) { onart::setStatsEnabled(false); }
+            else if (std::strcmp(argv[i], "--stats-every") == 0 && i + 1 < argc) { statsInterval = std::atof(argv[++i]); }
+            else if (std::strcmp(argv[i], "--gpu-timing") == 0) { gpuTiming = true; }
+            else if (std::strcmp(argv[i], "--no-dedup") == 0) { dedup = false; }
+            else if (std::strcmp(argv[i], "--filter-radius") == 0 && i + 1 < argc) { filterRadius = std::max(0, std::atoi(argv[++i])); }
+            else if (std::strcmp(argv[i], "--tile") == 0 && i + 1 < argc) { tileSize = std::atoi(argv[++i]); }
+            else if (std::strcmp(argv[i], "--ladder") == 0 && i + 1 < argc) {
+                for (const char* c = argv[++i]; *c;) {
+                    char* end;
+                    long v = std::strtol(c, &end, 10);
+                    if (end == c) { c++; continue; }
+                    if (v > 0) ladderHeights.push_back((int)v);
+                    c = end;
+                }
+            }
+            else if (std::strcmp(argv[i], "--also-codec") == 0 && i + 1 < argc) { extraCodecs.push_back(argv[++i]); }
+            else if (std::strcmp(argv[i], "--codec") == 0 && i + 1 < argc) { encOpts.codec = argv[++i]; }
+            else if (std::strcmp(argv[i], "--crf") == 0 && i + 1 < argc) {
+                encOpts.rateControl = onart::EncoderOptions::RateControl::CRF;
+                encOpts.quality = std::atoi(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--qp") == 0 && i + 1 < argc) {
+                encOpts.rateControl = onart::EncoderOptions::RateControl::CQP;
+                encOpts.quality = std::atoi(argv[++i]);
+            }
+            else if ((std::strcmp(argv[i], "--bitrate") == 0 || std::strcmp(argv[i], "--cbr") == 0) && i + 1 < argc) {
+                encOpts.rateControl = argv[i][2] == 'c' ? onart::EncoderOptions::RateControl::CBR : onart::EncoderOptions::RateControl::ABR;
+                encOpts.bitRate = (int64_t)(std::atof(argv[++i]) * 1000); // kbps
+            }
+            else if (std::strcmp(argv[i], "--gop") == 0 && i + 1 < argc) { encOpts.gopSize = std::atoi(argv[++i]); }
+            else if (std::strcmp(argv[i], "--bframes") == 0 && i + 1 < argc) { encOpts.maxBFrames = std::atoi(argv[++i]); }
+            else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) { encOpts.threads = std::max(0, std::atoi(argv[++i])); }
+            else if ((std::strcmp(argv[i], "--preset") == 0 || std::strcmp(argv[i], "--tune") == 0) && i + 1 < argc) {
+                encOpts.privateOptions.emplace_back(argv[i] + 2, argv[i + 1]);
+                i++;
+            }
+            else if (std::strcmp(argv[i], "--enc-opts") == 0 && i + 1 < argc) { encOpts.parsePrivateOptions(argv[++i]); }
+            else if (std::strcmp(argv[i], "--scene-cut") == 0 && i + 1 < argc) { sceneThreshold = std::atof(argv[++i]); }
+            else if (std::strcmp(argv[i], "--min-scene") == 0 && i + 1 < argc) { minScene = std::atoi(argv[++i]); }
+            else if (std::strcmp(argv[i], "--write-sections") == 0) { writeSections = true; }
+            else if (std::strcmp(argv[i], "--segment") == 0 && i + 1 < argc) {
+                const char* mode = argv[++i];
+                if (std::strcmp(mode, "fmp4") == 0) segments.mode = onart::SegmentOptions::Mode::FRAGMENTED_MP4;
+                else if (std::strcmp(mode, "hls") == 0) segments.mode = onart::SegmentOptions::Mode::HLS;
+                else if (std::strcmp(mode, "dash") == 0) segments.mode = onart::SegmentOptions::Mode::DASH;
+                else segments.mode = onart::SegmentOptions::Mode::FILE;
+            }
+            else if (std::strcmp(argv[i], "--segment-length") == 0 && i + 1 < argc) { segments.segmentSeconds = std::max(0.1, std::atof(argv[++i])); }
+            else if (std::strcmp(argv[i], "--segment-window") == 0 && i + 1 < argc) { segments.window = std::max(0, std::atoi(argv[++i])); }
+            else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) { batchFile = argv[++i]; }
+            else if (std::strcmp(argv[i], "--live") == 0) { live = true; }
+            else if (std::strcmp(argv[i], "--latency-budget") == 0 && i + 1 < argc) { latencyBudget = std::atof(argv[++i]); }
+            else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) { onart::Tracer::start(argv[++i]); } // written on exit
+            else if (std::strcmp(argv[i], "--io") == 0 && i + 1 < argc) {
+                const char* mode = argv[++i];
+                if (std::strcmp(mode, "mmap") == 0) ioOpts.mode = onart::InputFile::Mode::MMAP;
+                else if (std::strcmp(mode, "readahead") == 0) ioOpts.mode = onart::InputFile::Mode::READ_AHEAD;
+                else if (std::strcmp(mode, "default") == 0) ioOpts.mode = onart::InputFile::Mode::DEFAULT;
+                else ioOpts.mode = onart::InputFile::Mode::AUTO;
+            }
+            else if (std::strcmp(argv[i], "--out-io") == 0 && i + 1 < argc) {
+                const char* mode = argv[++i];
+                if (std::strcmp(mode, "uring") == 0) outIoOpts.mode = onart::OutputFile::Mode::IO_URING;
+                else if (std::strcmp(mode, "thread") == 0) outIoOpts.mode = onart::OutputFile::Mode::THREAD;
+                else if (std::strcmp(mode, "default") == 0) outIoOpts.mode = onart::OutputFile::Mode::DEFAULT;
+                else outIoOpts.mode = onart::OutputFile::Mode::AUTO;
+            }
+            else if (std::strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) { ioOpts.prefetchBlocks = (size_t)std::max(2, std::atoi(argv[++i])); }
+            else { argv[positional++] = argv[i]; }
+        }
+        argc = positional;
+    }
     
-    if (argc < 4) {
-        LOGRAW("usage:", argv[0], "input.mp4 filter.frag output.mp4 [new width] [new height]");
+    if (argc < (batchFile ? 2 : 4)) {
+        LOGRAW("usage:", argv[0], "input.mp4 filter.frag output.mp4 [new width] [new height] [--stats-every seconds] [--no-stats] [--gpu-timing] [--trace trace.json] [--io auto|mmap|readahead|default] [--prefetch blocks] [--out-io auto|uring|thread|default] [--no-dedup] [--filter-radius px] [--tile px] [--ladder height,height,..] [--also-codec name].. [--codec name] [--crf q | --qp q | --bitrate kbps | --cbr kbps] [--gop frames] [--bframes n] [--threads n] [--preset p] [--tune t] [--enc-opts key=value:..] [--scene-cut threshold] [--min-scene frames] [--write-sections] [--segment file|fmp4|hls|dash] [--segment-length seconds] [--segment-window segments] [--live] [--latency-budget ms]");
+        LOGRAW("   or:", argv[0], "--batch jobs.txt|- filter.frag [options], where each line of the job list is: input output [new width] [new height]. Jobs run one after another");
         return 0;
     }
-    std::filesystem::path video(argv[1]);
-    std::filesystem::path fs(argv[2]);
-    std::filesystem::path output(argv[3]);
-    if (!std::filesystem::exists(video)) {
-        LOGRAW("video file", video.u8string(), "does not exist");
-        return 1;
+    // a batch runs its jobs one after another, all on one device, shader, pipeline and render pass
+    struct Job {
+        std::string input, output;
+        int width = 0, height = 0;
+    };
+    std::vector<Job> jobs;
+    if (batchFile) {
+        FILE* list = std::strcmp(batchFile, "-") == 0 ? stdin : fopen(batchFile, "r");
+        if (!list) {
+            LOGRAW("Job list", batchFile, "could not be opened");
+            return 1;
+        }
+        char line[4096];
+        for (int lineNumber = 1; fgets(line, sizeof(line), list); lineNumber++) {
+            // whitespace separated, double quotes around paths with spaces. # starts a comment
+            std::vector<std::string> fields;
+            for (const char* c = line; *c && *c != '#';) {
+                if (std::isspace((unsigned char)*c)) { c++; continue; }
+                std::string field;
+                if (*c == '"') {
+                    for (c++; *c && *c != '"'; c++) field += *c;
+                    if (*c) c++;
+                }
+                else {
+                    for (; *c && !std::isspace((unsigned char)*c); c++) field += *c;
+                }
+                fields.push_back(std::move(field));
+            }
+            if (fields.empty()) continue;
+            if (fields.size() < 2) {
+                LOGRAW("Job list line", lineNumber, "needs an input and an output. Skipped");
+                continue;
+            }
+            Job job;
+            job.input = fields[0];
+            job.output = fields[1];
+            if (fields.size() >= 3) job.width = std::atoi(fields[2].c_str());
+            if (fields.size() >= 4) job.height = std::atoi(fields[3].c_str());
+            jobs.push_back(std::move(job));
+        }
+        if (list != stdin) fclose(list);
+        if (jobs.empty()) {
+            LOGRAW("No jobs in", batchFile);
+            return 0;
+        }
+    }
+    else {
+        Job job;
+        job.input = argv[1];
+        job.output = argv[3];
+        if (argc >= 5) job.width = std::atoi(argv[4]);
+        if (argc >= 6) job.height = std::atoi(argv[5]);
+        jobs.push_back(std::move(job));
+    }
+    std::filesystem::path fs(argv[batchFile ? 1 : 2]);
+    if (live) {
+        // FFmpeg's own protocols read and write each packet as it comes, where the file layers would wait to fill a block
+        ioOpts.mode = onart::InputFile::Mode::DEFAULT;
+        outIoOpts.mode = onart::OutputFile::Mode::DEFAULT;
+        encOpts.lowLatency = true;
     }
     if (!std::filesystem::exists(fs)) {
         LOGRAW("Fragment shader code file", fs.u8string(), "does not exist");
         return 1;
     }
-    int w = 0, h = 0;
-    if (argc >= 5) {
-        w = std::atoi(argv[4]);
-    }
-    if (argc >= 6) {
-        h = std::atoi(argv[5]);
-    }
 
     LOGRAW("Compiling shader..");
     onart::Window::init();
@@ -93,6 +218,11 @@ int main(int argc, char* argv[]){
     wopts.width = 1280;
     onart::Window* window = new onart::Window(nullptr, &wopts);
     _gr->addWindow(0, window);
+#ifdef YR_USE_VULKAN
+    if (gpuTiming && !onart::YRGraphics::setGpuTiming(true)) {
+        LOGRAW("GPU timing is not available on this device");
+    }
+#endif
 
     onart::YRGraphics::ShaderModuleCreationOptions shaderOpts{};
     onart::shader_t vertShader{}, fragShader{};
@@ -176,289 +306,1015 @@ int main(int argc, char* argv[]){
         return 2;
     }
 #endif
-    LOGRAW("Compile done\n\nMuxing input video..");
-    smp<AVFormatContext> inputFmt = avformat_alloc_context();
+    LOGRAW("Compile done");
+
+    // the device, shaders, pipeline, render passes and stream texture are kept from one job to the next
+    onart::YRGraphics::RenderPass* renderPass = nullptr;
+    onart::YRGraphics::RenderPass2Screen* wd = nullptr;
+    onart::YRGraphics::pMesh quad;
+    onart::YRGraphics::pStreamTexture tex;
+    bool texLinear = false;
+    // the pass under key, resized when a job needs another size than the last one
+    std::map<int32_t, std::pair<int, int>> passSizes;
+    auto acquirePass = [&passSizes](int32_t key, const onart::YRGraphics::RenderPassCreationOptions& opts) {
+        onart::YRGraphics::RenderPass* pass = onart::YRGraphics::createRenderPass(key, opts); // the existing one when the key is taken
+        if (!pass) return pass;
+        auto it = passSizes.find(key);
+        if (it != passSizes.end() && it->second != std::make_pair((int)opts.width, (int)opts.height)) pass->resize(opts.width, opts.height, opts.linearSampled);
+        passSizes[key] = { (int)opts.width, (int)opts.height };
+        return pass;
+    };
+
+    auto runJob = [&](const std::filesystem::path& video, const std::filesystem::path& output, int w, int h, onart::ThreadPool& cpuPool, onart::FrameArenaRing& frameArenas) -> int {
+        LOGRAW("\nMuxing input video..");
+        // the job adjusts these to its input and output; the next job starts again from the command line
+        onart::EncoderOptions jobEncOpts = encOpts;
+        std::vector<int> jobLadderHeights = ladderHeights;
+        // a live input may be a URL
+        if (!live && !std::filesystem::exists(video)) {
+            LOGRAW("video file", video.u8string(), "does not exist");
+            return 1;
+        }
+        // demuxing reads through this, so it must be closed after inputFmt
+        onart::InputFile input;
+        if (!input.open(video.string().c_str(), ioOpts)) {
+            return 3;
+        }
+        smp<AVFormatContext> inputFmt = avformat_alloc_context();
+        if (AVIOContext* pb = input.context()) {
+            inputFmt->pb = pb;
+            inputFmt->flags |= AVFMT_FLAG_CUSTOM_IO;
+        }
+        if (live) { // start on the first packets rather than buffering and probing seconds of the stream
+            inputFmt->flags |= AVFMT_FLAG_NOBUFFER;
+            inputFmt->probesize = 500'000;
+            inputFmt->max_analyze_duration = 500'000;
+        }
 #define ON_ERROR_RETURN(type, val)  if(errcode < 0){ LOGRAW(toString(type, av_make_error_string(errorString, sizeof(errorString), errcode))); return val; }
-    int errcode = avformat_open_input(&inputFmt, video.string().c_str(), nullptr, nullptr);
-    ON_ERROR_RETURN("Open input", 3);
-    errcode = avformat_find_stream_info(inputFmt, nullptr);
-    ON_ERROR_RETURN("Find stream info", 3);
-    int videoStreamIndex = -1;
-    int audioStreamIndex = -1;
-    for (int i = 0; i < inputFmt->nb_streams; i++) {
-        switch (inputFmt->streams[i]->codecpar->codec_type)
-        {
-        case AVMEDIA_TYPE_AUDIO: audioStreamIndex = i; break;
-        case AVMEDIA_TYPE_VIDEO: videoStreamIndex = i; break;
-        default: break;
+        int errcode = avformat_open_input(&inputFmt, video.string().c_str(), nullptr, nullptr);
+        ON_ERROR_RETURN("Open input", 3);
+        errcode = avformat_find_stream_info(inputFmt, nullptr);
+        ON_ERROR_RETURN("Find stream info", 3);
+        int videoStreamIndex = -1;
+        int audioStreamIndex = -1;
+        for (int i = 0; i < inputFmt->nb_streams; i++) {
+            switch (inputFmt->streams[i]->codecpar->codec_type)
+            {
+            case AVMEDIA_TYPE_AUDIO: audioStreamIndex = i; break;
+            case AVMEDIA_TYPE_VIDEO: videoStreamIndex = i; break;
+            default: break;
+            }
         }
-    }
-    if (videoStreamIndex == -1) {
-        LOGRAW("Video stream not found from", video);
-        return 3;
-    }
-    AVStream* videoStream = inputFmt->streams[videoStreamIndex];
-    const AVCodec* decoder = avcodec_find_decoder(videoStream->codecpar->codec_id);
-    const AVCodec* encoder = avcodec_find_encoder(videoStream->codecpar->codec_id);
-    smp<AVCodecContext> decContext = avcodec_alloc_context3(decoder);
-    smp<AVCodecContext> encContext = avcodec_alloc_context3(encoder);
-    avcodec_parameters_to_context(decContext, videoStream->codecpar);
-    errcode = avcodec_open2(decContext, decoder, nullptr);
-    ON_ERROR_RETURN("Decoder open", 6);
-    double duration = inputFmt->duration / 1'000'000.0;
-    LOGRAW("Mux done: Duration", duration, "s | Resolution", videoStream->codecpar->width, videoStream->codecpar->height);
-    if (w <= 0) {
-        if (h > 0) {
-            double realW = (double)h * videoStream->codecpar->width / videoStream->codecpar->height;
-            w = std::lround(realW);
-            w += w & 1;
-        }
-        else {
-            w = videoStream->codecpar->width;
+        if (videoStreamIndex == -1) {
+            LOGRAW("Video stream not found from", video);
+            return 3;
         }
-    }
-    if (h <= 0) {
-        double realH = (double)w * videoStream->codecpar->height / videoStream->codecpar->width;
-        h = std::lround(realH);
-        h += h & 1;
-    }
-    LOGRAW("->", w, h);
-    onart::YRGraphics::RenderPassCreationOptions rpOpts{};
-    rpOpts.autoclear.use = true;
-    rpOpts.canCopy = true;
-    rpOpts.depthInput = false;
-    rpOpts.width = w;
-    rpOpts.height = h;
-    rpOpts.subpassCount = 1;
-    auto renderPass = onart::YRGraphics::createRenderPass(0, rpOpts);
-    auto wd = onart::YRGraphics::createRenderPass2Screen(0, 0, rpOpts);
-    auto quad = onart::YRGraphics::createNullMesh(0, 3);
-    {
-        onart::YRGraphics::PipelineCreationOptions pipeOpts;
-        pipeOpts.vertexShader = vertShader;
-        pipeOpts.fragmentShader = fragShader;
-        pipeOpts.vertexSize = 0;
-        pipeOpts.vertexAttributeCount = 0;
-        pipeOpts.pass = renderPass;
-        pipeOpts.shaderResources.pos0 = onart::YRGraphics::ShaderResourceType::TEXTURE_1;
-
-        auto pp = onart::YRGraphics::createPipeline(0, pipeOpts);
-        wd->usePipeline(pp, 0);
-    }
+        AVStream* videoStream = inputFmt->streams[videoStreamIndex];
+        const AVCodec* decoder = avcodec_find_decoder(videoStream->codecpar->codec_id);
+        const AVCodec* encoder = onart::findEncoder(jobEncOpts, videoStream->codecpar->codec_id);
+        if (!encoder) {
+            LOGRAW("Encoder not found:", jobEncOpts.codec.empty() ? avcodec_get_name(videoStream->codecpar->codec_id) : jobEncOpts.codec);
+            return 4;
+        }
+        onart::HostImportFramePool importPool;
+        smp<AVCodecContext> decContext = avcodec_alloc_context3(decoder);
+        smp<AVCodecContext> encContext = avcodec_alloc_context3(encoder);
+        avcodec_parameters_to_context(decContext, videoStream->codecpar);
+        if (live) {
+            decContext->flags |= AV_CODEC_FLAG_LOW_DELAY | AV_CODEC_FLAG_COPY_OPAQUE; // opaque carries a packet's arrival time to its frame
+            decContext->thread_type = FF_THREAD_SLICE; // frame threads hold back a frame each
+        }
+        if (importPool.attach(decContext)) {
+            LOGRAW("Decoded frames will be imported to GPU without copy");
+        }
+        errcode = avcodec_open2(decContext, decoder, nullptr);
+        ON_ERROR_RETURN("Decoder open", 6);
+        double duration = inputFmt->duration / 1'000'000.0;
+        LOGRAW("Mux done: Duration", duration, "s | Resolution", videoStream->codecpar->width, videoStream->codecpar->height);
+        if (w <= 0) {
+            if (h > 0) {
+                double realW = (double)h * videoStream->codecpar->width / videoStream->codecpar->height;
+                w = std::lround(realW);
+                w += w & 1;
+            }
+            else {
+                w = videoStream->codecpar->width;
+            }
+        }
+        if (h <= 0) {
+            double realH = (double)w * videoStream->codecpar->height / videoStream->codecpar->width;
+            h = std::lround(realH);
+            h += h & 1;
+        }
+        LOGRAW("->", w, h);
+        onart::YRGraphics::RenderPassCreationOptions rpOpts{};
+        rpOpts.autoclear.use = true;
+        rpOpts.canCopy = true;
+        rpOpts.hostVisibleTarget = true;
+        rpOpts.depthInput = nullptr;
+        rpOpts.width = w;
+        rpOpts.height = h;
+        rpOpts.subpassCount = 1;
+        renderPass = acquirePass(0, rpOpts);
+        if (!wd) {
+            wd = onart::YRGraphics::createRenderPass2Screen(0, 0, rpOpts);
+            quad = onart::YRGraphics::createNullMesh(0, 3);
+            onart::YRGraphics::PipelineCreationOptions pipeOpts;
+            pipeOpts.vertexShader = vertShader;
+            pipeOpts.fragmentShader = fragShader;
+            pipeOpts.vertexSize = 0;
+            pipeOpts.vertexAttributeCount = 0;
+            pipeOpts.pass = renderPass;
+            pipeOpts.shaderResources.pos0 = onart::YRGraphics::ShaderResourceType::TEXTURE_1;
 
-    onart::YRGraphics::pStreamTexture tex = onart::YRGraphics::createStreamTexture(0, videoStream->codecpar->width, videoStream->codecpar->height, !(w % videoStream->codecpar->width == 0 && h % videoStream->codecpar->height == 0));
-    if (!tex) {
-        LOGRAW("Failed to create stream texture");
-        return 5;
-    }
+            auto pp = onart::YRGraphics::createPipeline(0, pipeOpts);
+            wd->usePipeline(pp, 0);
+        }
 
-    AVRational timeBase = decContext->time_base;
-    if (timeBase.den * timeBase.num == 0) { timeBase = videoStream->time_base; }
+        // ABR ladder: each rung is another encode of the filtered frame at a lower resolution, written next to the output as <stem>_<height>p<ext>.
+        // the filter runs once at the top resolution; rungs are blitted from it on the GPU when the device can, or scaled on the CPU
+        struct LadderRung {
+            int width, height;
+            std::filesystem::path path;
+            onart::YRGraphics::RenderPass* pass = nullptr;
+            smp<AVCodecContext> enc{ nullptr };
+            smp<AVFormatContext> fmt{ nullptr };
+            onart::OutputFile file;
+            smp<SwsContext> scaler{ nullptr };
+            smp<AVFrame> frame{ nullptr };
+            smp<AVPacket> packet{ nullptr };
+            onart::StageMeter scaleMeter, encodeMeter;
+            onart::EncodeReport report; // written by the worker
+            std::thread worker;
+            // one-slot handoff to the worker. src == nullptr repeats the previous picture
+            std::mutex guard;
+            std::condition_variable signal;
+            const uint8_t* src = nullptr;
+            int srcPitch = 0, srcRows = 0;
+            int64_t pts = 0, duration = 0;
+            bool keyframe = false;
+            bool pending = false, released = true, finished = false;
+        };
+        std::vector<std::unique_ptr<LadderRung>> ladder;
+        if (!jobLadderHeights.empty() && live && (output.string().find("://") != std::string::npos || output.string().rfind("pipe:", 0) == 0)) {
+            LOGRAW("Ladder rungs are written next to the output, which a stream URL does not have. Skipped");
+            jobLadderHeights.clear();
+        }
+        // largest first: each rung is blitted from the one above it, which keeps every step a small reduction for the linear filter
+        std::sort(jobLadderHeights.begin(), jobLadderHeights.end(), std::greater<int>());
+        for (int& rh : jobLadderHeights) rh -= rh & 1;
+        jobLadderHeights.erase(std::unique(jobLadderHeights.begin(), jobLadderHeights.end()), jobLadderHeights.end());
+        for (int rh : jobLadderHeights) {
+            if (rh >= h || rh < 2) {
+                LOGRAW("Ladder rung", rh, "is not below the output height. Skipped");
+                continue;
+            }
+            auto rung = std::make_unique<LadderRung>();
+            rung->height = rh;
+            rung->width = (int)std::lround((double)rung->height * w / h);
+            rung->width += rung->width & 1;
+            rung->path = output.parent_path() / (output.stem().string() + "_" + std::to_string(rung->height) + "p" + output.extension().string());
+            ladder.push_back(std::move(rung));
+        }
+        bool gpuLadder = false;
+#ifdef YR_USE_VULKAN
+        if (!ladder.empty()) {
+            std::vector<onart::YRGraphics::RenderPass*> chain;
+            for (size_t i = 0; i < ladder.size(); i++) {
+                onart::YRGraphics::RenderPassCreationOptions rungOpts = rpOpts;
+                rungOpts.autoclear.use = false;
+                rungOpts.width = ladder[i]->width;
+                rungOpts.height = ladder[i]->height;
+                ladder[i]->pass = acquirePass((int32_t)i + 1, rungOpts);
+                if (!ladder[i]->pass) break;
+                chain.push_back(ladder[i]->pass);
+            }
+            gpuLadder = chain.size() == ladder.size() && renderPass->setDownscaleChain(chain.data(), (uint32_t)chain.size());
+            if (!gpuLadder) LOGRAW("GPU downscaling is not available. Ladder rungs are scaled on the CPU");
+        }
+        else renderPass->setDownscaleChain(nullptr, 0); // a ladder of an earlier job
+#endif
 
-    LOGRAW("Preparing encoder..");
-    smp<AVFormatContext> outputFmt(nullptr);
-    errcode = avformat_alloc_output_context2(&outputFmt, nullptr, nullptr, output.string().c_str());
-    ON_ERROR_RETURN("Allocate output context", 4);
-    for (int i = 0; i < inputFmt->nb_streams; i++) {
-        avformat_new_stream(outputFmt, NULL);
-        avcodec_parameters_copy(outputFmt->streams[i]->codecpar, inputFmt->streams[i]->codecpar);
-    }
-    AVStream* outputVideoStream = outputFmt->streams[videoStreamIndex];
-
-    outputVideoStream->time_base = videoStream->time_base;
-    LOGWITH(decContext->framerate.num, decContext->framerate.den);
-    LOGWITH(videoStream->time_base.num, videoStream->time_base.den);
-    double totalFrame = 1.0 / outputVideoStream->nb_frames;
-    encContext->bit_rate = decContext->bit_rate * w * h / (videoStream->codecpar->width * videoStream->codecpar->height);
-    if (encContext->bit_rate == 0) {
-        encContext->bit_rate = (int64_t)w * h * decContext->framerate.num / decContext->framerate.den;
-    }
-    encContext->width = w;
-    encContext->height = h;
-    encContext->time_base = outputVideoStream->time_base;
-    encContext->framerate = decContext->framerate;
-    encContext->gop_size = 4;
-    encContext->max_b_frames = 1;
-    encContext->pix_fmt = decContext->pix_fmt;
-    avcodec_parameters_from_context(outputVideoStream->codecpar, encContext);
-    //av_opt_set(encContext->priv_data, "crf", "1", 0);
-    
-    errcode = avcodec_open2(encContext, encoder, nullptr);
-    ON_ERROR_RETURN("Encoder codec context open", 4);
+        const bool linearTexture = !(w % videoStream->codecpar->width == 0 && h % videoStream->codecpar->height == 0);
+        if (tex && (tex->width != videoStream->codecpar->width || tex->height != videoStream->codecpar->height || linearTexture != texLinear)) {
+            tex.reset();
+            onart::YRGraphics::StreamTexture::drop(0);
+        }
+        tex = onart::YRGraphics::createStreamTexture(0, videoStream->codecpar->width, videoStream->codecpar->height, linearTexture);
+        texLinear = linearTexture;
+        if (!tex) {
+            LOGRAW("Failed to create stream texture");
+            return 5;
+        }
+#ifdef YR_USE_VULKAN
+        tex->setDeferred(true); // upload, filter and readback go in one submission per frame
+#endif
 
-    if (outputFmt->oformat->flags & AVFMT_GLOBALHEADER)
-        outputFmt->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        AVRational timeBase = decContext->time_base;
+        if (timeBase.den * timeBase.num == 0) { timeBase = videoStream->time_base; }
 
-    if (!(outputFmt->oformat->flags & AVFMT_NOFILE)) {
-        if (avio_open(&outputFmt->pb, output.string().c_str(), AVIO_FLAG_WRITE) < 0) {
-            LOGRAW("Output file open fail");
-            return 4;
+        LOGRAW("Preparing encoder..");
+        // muxing writes through this, so it must be closed after outputFmt is done writing
+        onart::OutputFile outputFile;
+        smp<AVFormatContext> outputFmt(nullptr);
+        errcode = avformat_alloc_output_context2(&outputFmt, nullptr, segments.format(), output.string().c_str());
+        if (errcode < 0 && live) { // a URL without an extension
+            errcode = avformat_alloc_output_context2(&outputFmt, nullptr, "mpegts", output.string().c_str());
         }
-    }
-    avformat_write_header(outputFmt, nullptr);
+        ON_ERROR_RETURN("Allocate output context", 4);
+        if (live) outputFmt->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+        for (int i = 0; i < inputFmt->nb_streams; i++) {
+            avformat_new_stream(outputFmt, NULL);
+            avcodec_parameters_copy(outputFmt->streams[i]->codecpar, inputFmt->streams[i]->codecpar);
+        }
+        AVStream* outputVideoStream = outputFmt->streams[videoStreamIndex];
 
-    LOGRAW("Decoder ready:", decoder->long_name);
-    LOGRAW("Encoder ready:", encoder->long_name);
+        outputVideoStream->time_base = videoStream->time_base;
+        LOGWITH(decContext->framerate.num, decContext->framerate.den);
+        LOGWITH(videoStream->time_base.num, videoStream->time_base.den);
+        double totalFrame = 1.0 / outputVideoStream->nb_frames;
+        int64_t autoBitRate = decContext->bit_rate * w * h / (videoStream->codecpar->width * videoStream->codecpar->height);
+        if (autoBitRate == 0) {
+            autoBitRate = (int64_t)w * h * decContext->framerate.num / decContext->framerate.den;
+        }
+        encContext->width = w;
+        encContext->height = h;
+        encContext->time_base = outputVideoStream->time_base;
+        encContext->framerate = decContext->framerate;
+        encContext->pix_fmt = (AVPixelFormat)onart::encoderPixelFormat(encoder, decContext->pix_fmt);
+        if (segments.mode != onart::SegmentOptions::Mode::FILE && jobEncOpts.gopSize <= 0) { // a keyframe at least once a segment, so segments come out at their length
+            const AVRational rate = decContext->framerate.num ? decContext->framerate : videoStream->avg_frame_rate;
+            if (rate.num && rate.den) jobEncOpts.gopSize = std::max(1, (int)std::lround(segments.segmentSeconds * rate.num / rate.den));
+        }
+        jobEncOpts.forceIdr = sceneThreshold >= 0; // so a forced keyframe at a cut also starts a closed GOP
+        smp<AVDictionary> encDict(nullptr);
+        onart::configureEncoder(encContext, jobEncOpts, autoBitRate, &encDict);
+        if (outputFmt->oformat->flags & AVFMT_GLOBALHEADER)
+            encContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+        errcode = onart::openEncoder(encContext, encoder, &encDict);
+        ON_ERROR_RETURN("Encoder codec context open", 4);
+        avcodec_parameters_from_context(outputVideoStream->codecpar, encContext);
+
+        if (!(outputFmt->oformat->flags & AVFMT_NOFILE)) {
+            if (!outputFile.open(output.string().c_str(), outIoOpts)) {
+                LOGRAW("Output file open fail");
+                return 4;
+            }
+            if (AVIOContext* pb = outputFile.context()) {
+                outputFmt->pb = pb;
+                outputFmt->flags |= AVFMT_FLAG_CUSTOM_IO;
+            }
+            else if (avio_open(&outputFmt->pb, output.string().c_str(), AVIO_FLAG_WRITE) < 0) {
+                LOGRAW("Output file open fail");
+                return 4;
+            }
+        }
+        smp<AVDictionary> muxerOpts(nullptr);
+        segments.muxerOptions(output.string().c_str(), encContext->codec_id, &muxerOpts);
+        errcode = onart::openMuxer(outputFmt, &muxerOpts);
+        ON_ERROR_RETURN("Write header", 4);
+
+        LOGRAW("Decoder ready:", decoder->long_name);
+        LOGRAW("Encoder ready:", encoder->long_name);
     
-    smp<SwsContext> preproc1{ nullptr }, preproc2{ nullptr };
-    if (decContext->pix_fmt != AV_PIX_FMT_BGRA) {
-        preproc1 = sws_getContext(videoStream->codecpar->width, videoStream->codecpar->height, decContext->pix_fmt, videoStream->codecpar->width, videoStream->codecpar->height, AV_PIX_FMT_BGRA, SWS_POINT, nullptr, nullptr, nullptr);
-    }
-    if (encContext->pix_fmt != AV_PIX_FMT_RGBA) {
-        preproc2 = sws_getContext(videoStream->codecpar->width, videoStream->codecpar->height, AV_PIX_FMT_RGBA, videoStream->codecpar->width, videoStream->codecpar->height, encContext->pix_fmt, SWS_POINT, nullptr, nullptr, nullptr);
-    }
-    smp<AVPacket> decPacket = av_packet_alloc(), encPacket = av_packet_alloc();
-    smp<AVFrame> 
-        decFrame = av_frame_alloc(), 
-        procFrame = av_frame_alloc(), 
-        encFrame = av_frame_alloc();
-
-    procFrame->format = decContext->pix_fmt;
-    procFrame->width = videoStream->codecpar->width;
-    procFrame->height = videoStream->codecpar->height;
-    av_frame_get_buffer(procFrame, 0);
-
-    encFrame->format = decContext->pix_fmt;
-    encFrame->width = w;
-    encFrame->height = h;
-    av_frame_get_buffer(encFrame, 0);
+        smp<SwsContext> preproc1{ nullptr }, preproc2{ nullptr };
+        if (decContext->pix_fmt != AV_PIX_FMT_BGRA) {
+            preproc1 = sws_getContext(videoStream->codecpar->width, videoStream->codecpar->height, decContext->pix_fmt, videoStream->codecpar->width, videoStream->codecpar->height, AV_PIX_FMT_BGRA, SWS_POINT, nullptr, nullptr, nullptr);
+        }
+        if (encContext->pix_fmt != AV_PIX_FMT_RGBA) {
+            preproc2 = sws_getContext(w, h, AV_PIX_FMT_RGBA, w, h, encContext->pix_fmt, SWS_POINT, nullptr, nullptr, nullptr);
+        }
+        constexpr size_t ROW_GRAIN = 64;
+        smp<AVPacket> decPacket = av_packet_alloc(), encPacket = av_packet_alloc();
+        smp<AVFrame> 
+            decFrame = av_frame_alloc(), 
+            procFrame = av_frame_alloc(), 
+            uploadedFrame = av_frame_alloc(), // the imported frame the texture's last copy reads from
+            encFrame = av_frame_alloc();
+
+        encFrame->format = encContext->pix_fmt;
+        encFrame->width = w;
+        encFrame->height = h;
+        onart::getFrameBuffer(encFrame);
     
-    printf("0%%"); fflush(stdout);
-
-    bool invoked = false;
-    int64_t pts = 0;
-    int64_t frameDuration = 0;
-
-    while (av_read_frame(inputFmt, decPacket) == 0) {
-        if (decPacket->stream_index == videoStreamIndex) {
-            errcode = avcodec_send_packet(decContext, decPacket);
-            if (errcode == AVERROR(EAGAIN)) {}
-            else if (errcode == AVERROR_EOF) { break; }
-            else if (errcode) {
-                av_make_error_string(errorString, sizeof(errorString), errcode);
-                LOGRAW(errorString);
-                break;
-            }
-            errcode = avcodec_receive_frame(decContext, decFrame);
-            if (errcode == AVERROR(EAGAIN)) { continue; }
-            else if (errcode == AVERROR_EOF) {
-                avcodec_flush_buffers(decContext);
-                break;
-            }
-            av_frame_copy(procFrame, decFrame);
-            av_frame_copy_props(procFrame, decFrame);
-            //av_packet_unref(decPacket); // this was incorrect..
-            if (invoked) {
-                // encode
+        using onart::StageMeter;
+        // rung encoders run on their own threads and mux into their own files, so the slowest one only holds back the frame after next
+        auto encodeRung = [](LadderRung& rung, AVFrame* frame) {
+            StageMeter::Scope encoding(rung.encodeMeter, StageMeter::State::BUSY);
+            if (frame) {
+                rung.encodeMeter.count();
+                rung.report.frames++;
+                rung.report.mediaSeconds += (double)frame->duration * rung.enc->time_base.num / rung.enc->time_base.den;
+            }
+            int err = avcodec_send_frame(rung.enc, frame);
+            if (err < 0) {
+                LOGERR("Failed to send frame to", rung.path.u8string(), av_make_error_string(errorString, sizeof(errorString), err));
+                return;
+            }
+            while ((err = avcodec_receive_packet(rung.enc, rung.packet)) == 0) {
+                rung.report.bytes += rung.packet->size;
+                rung.packet->stream_index = 0;
+                av_packet_rescale_ts(rung.packet, rung.enc->time_base, rung.fmt->streams[0]->time_base);
+                av_interleaved_write_frame(rung.fmt, rung.packet);
+            }
+            if (err != AVERROR(EAGAIN) && err != AVERROR_EOF) {
+                LOGERR("Failed to receive packet for", rung.path.u8string(), av_make_error_string(errorString, sizeof(errorString), err));
+            }
+        };
+        auto runRung = [&encodeRung](LadderRung* rung) {
+            while (true) {
+                std::unique_lock<std::mutex> lock(rung->guard);
+                rung->signal.wait(lock, [rung]() { return rung->pending || rung->finished; });
+                if (!rung->pending) break;
+                const uint8_t* src = rung->src;
+                const int srcPitch = rung->srcPitch;
+                rung->frame->pts = rung->pts;
+                rung->frame->duration = rung->duration;
+                rung->frame->pict_type = rung->keyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+                rung->pending = false;
+                lock.unlock();
+                if (src) {
+                    StageMeter::Scope scaling(rung->scaleMeter, StageMeter::State::BUSY);
+                    YR_TRACE("rung scale");
+                    rung->scaleMeter.count();
+                    av_frame_make_writable(rung->frame); // the encoder may still hold the last picture
+                    sws_scale(rung->scaler, &src, &srcPitch, 0, rung->srcRows, rung->frame->data, rung->frame->linesize);
+                }
+                {
+                    std::unique_lock<std::mutex> _(rung->guard);
+                    rung->released = true;
+                }
+                rung->signal.notify_all();
+                encodeRung(*rung, rung->frame);
+            }
+            encodeRung(*rung, nullptr);
+            rung->report.wallSeconds = rung->encodeMeter.snapshot().wallUS / 1e6;
+            av_write_trailer(rung->fmt);
+        };
+        for (auto& rung : ladder) {
+            rung->enc = avcodec_alloc_context3(encoder);
+            rung->enc->width = rung->width;
+            rung->enc->height = rung->height;
+            rung->enc->time_base = encContext->time_base;
+            rung->enc->framerate = encContext->framerate;
+            rung->enc->pix_fmt = encContext->pix_fmt;
+            // same settings, with bitrates scaled by the pixel count
+            const double pixelRatio = (double)rung->width * rung->height / ((double)w * h);
+            onart::EncoderOptions rungOpts = jobEncOpts;
+            rungOpts.bitRate = (int64_t)(jobEncOpts.bitRate * pixelRatio);
+            smp<AVDictionary> rungDict(nullptr);
+            onart::configureEncoder(rung->enc, rungOpts, (int64_t)(autoBitRate * pixelRatio), &rungDict);
+            errcode = avformat_alloc_output_context2(&rung->fmt, nullptr, segments.format(), rung->path.string().c_str());
+            ON_ERROR_RETURN("Allocate rung output context", 4);
+            if (rung->fmt->oformat->flags & AVFMT_GLOBALHEADER) rung->enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+            if (live) rung->fmt->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+            errcode = onart::openEncoder(rung->enc, encoder, &rungDict);
+            ON_ERROR_RETURN("Rung encoder open", 4);
+            AVStream* stream = avformat_new_stream(rung->fmt, nullptr);
+            avcodec_parameters_from_context(stream->codecpar, rung->enc);
+            stream->time_base = rung->enc->time_base;
+            if (!(rung->fmt->oformat->flags & AVFMT_NOFILE)) {
+                if (!rung->file.open(rung->path.string().c_str(), outIoOpts)) {
+                    LOGRAW("Output file open fail:", rung->path.u8string());
+                    return 4;
+                }
+                if (AVIOContext* pb = rung->file.context()) {
+                    rung->fmt->pb = pb;
+                    rung->fmt->flags |= AVFMT_FLAG_CUSTOM_IO;
+                }
+                else if (avio_open(&rung->fmt->pb, rung->path.string().c_str(), AVIO_FLAG_WRITE) < 0) {
+                    LOGRAW("Output file open fail:", rung->path.u8string());
+                    return 4;
+                }
+            }
+            smp<AVDictionary> rungMuxerOpts(nullptr);
+            segments.muxerOptions(rung->path.string().c_str(), rung->enc->codec_id, &rungMuxerOpts);
+            errcode = onart::openMuxer(rung->fmt, &rungMuxerOpts);
+            ON_ERROR_RETURN("Rung header", 4);
+            // a blitted rung only changes pixel format; otherwise the full-size output is scaled down here
+            const int srcW = gpuLadder ? rung->width : w;
+            rung->srcRows = gpuLadder ? rung->height : h;
+            rung->scaler = sws_getContext(srcW, rung->srcRows, AV_PIX_FMT_RGBA, rung->width, rung->height, rung->enc->pix_fmt, gpuLadder ? SWS_POINT : SWS_AREA, nullptr, nullptr, nullptr);
+            rung->packet = av_packet_alloc();
+            rung->frame = av_frame_alloc();
+            rung->frame->format = rung->enc->pix_fmt;
+            rung->frame->width = rung->width;
+            rung->frame->height = rung->height;
+            onart::getFrameBuffer(rung->frame);
+            LOGRAW("Ladder rung:", rung->width, rung->height, "->", rung->path.u8string());
+        }
+        for (auto& rung : ladder) rung->worker = std::thread(runRung, rung.get());
+        if (segments.mode == onart::SegmentOptions::Mode::HLS && !ladder.empty()) {
+            // a multivariant playlist over the output and its rungs, so players can switch between them. the bandwidths are the
+            // configured rates (the estimate of RateControl::AUTO when there are none), as the real peaks are only known at the end
+            auto bandwidth = [](AVCodecContext* ctx, int64_t fallback) { return ctx->rc_max_rate ? ctx->rc_max_rate : ctx->bit_rate ? ctx->bit_rate : fallback; };
+            const std::filesystem::path masterPath = output.parent_path() / (output.stem().string() + "_master.m3u8");
+            if (FILE* master = fopen(masterPath.string().c_str(), "w")) {
+                fprintf(master, "#EXTM3U\n#EXT-X-VERSION:%d\n#EXT-X-INDEPENDENT-SEGMENTS\n", encContext->codec_id == AV_CODEC_ID_H264 ? 3 : 7);
+                fprintf(master, "#EXT-X-STREAM-INF:BANDWIDTH=%lld,RESOLUTION=%dx%d\n%s\n", (long long)bandwidth(encContext, autoBitRate), w, h, output.filename().string().c_str());
+                for (auto& rung : ladder) {
+                    const int64_t rungAuto = (int64_t)(autoBitRate * ((double)rung->width * rung->height / ((double)w * h)));
+                    fprintf(master, "#EXT-X-STREAM-INF:BANDWIDTH=%lld,RESOLUTION=%dx%d\n%s\n", (long long)bandwidth(rung->enc, rungAuto), rung->width, rung->height, rung->path.filename().string().c_str());
+                }
+                fclose(master);
+                LOGRAW("Playlist of all renditions:", masterPath.u8string());
+            }
+            else LOGRAW("Failed to write", masterPath.u8string());
+        }
+
+        // other codecs of the top rendition, written as <stem>_<codec><ext>. the fan-out copies each frame once for all of them
+        std::vector<std::unique_ptr<onart::VideoEncoder>> extraEncoders;
+        std::vector<std::string> extraNames;
+        std::unique_ptr<onart::EncoderFanOut> fanOut;
+        if (!extraCodecs.empty() && live && (output.string().find("://") != std::string::npos || output.string().rfind("pipe:", 0) == 0)) {
+            LOGRAW("Other codecs are written next to the output, which a stream URL does not have. Skipped");
+        }
+        else if (!extraCodecs.empty()) {
+            fanOut = std::make_unique<onart::EncoderFanOut>();
+            for (const std::string& codec : extraCodecs) {
+                onart::EncoderOptions codecOpts = jobEncOpts;
+                codecOpts.codec = codec;
+                // built from the stream already being demuxed, in the time base frameDur is pushed in
+                auto extra = onart::VideoDecoder::makeEncoder(videoStream->codecpar, encContext->time_base, decContext->framerate, w, h, codecOpts);
+                if (!extra) continue;
+                const std::filesystem::path path = output.parent_path() / (output.stem().string() + "_" + codec + output.extension().string());
+                extra->start(path.string().c_str(), segments, outIoOpts);
+                LOGRAW("Also encoding", codec, "->", path.u8string());
+                fanOut->add(extra.get());
+                extraEncoders.push_back(std::move(extra));
+                extraNames.push_back(codec);
+            }
+        }
+
+        StageMeter demuxMeter, decodeMeter, hashMeter, sceneMeter, uploadMeter, renderMeter, readbackMeter, encodeMeter, muxMeter;
+        auto snapshot = [&]() {
+            onart::StatsSnapshot ret;
+            ret.stages = {
+                { "demux", demuxMeter.snapshot() }, { "decode", decodeMeter.snapshot() }, { "hash", hashMeter.snapshot() }, { "scene", sceneMeter.snapshot() }, { "upload", uploadMeter.snapshot() },
+                { "render", renderMeter.snapshot() }, { "readback", readbackMeter.snapshot() }, { "encode", encodeMeter.snapshot() }, { "mux", muxMeter.snapshot() }
+            };
+            ret.io = { { "input", input.stats() }, { "output", outputFile.stats() } };
+            for (auto& rung : ladder) {
+                const std::string name = std::to_string(rung->height) + "p";
+                ret.stages.push_back({ "scale " + name, rung->scaleMeter.snapshot() });
+                ret.stages.push_back({ "encode " + name, rung->encodeMeter.snapshot() });
+                ret.io.push_back({ "out " + name, rung->file.stats() });
+            }
+            for (size_t i = 0; i < extraEncoders.size(); i++) {
+                ret.stages.push_back({ "encode " + extraNames[i], extraEncoders[i]->stats() });
+                ret.io.push_back({ "out " + extraNames[i], extraEncoders[i]->ioStats() });
+            }
+            if (fanOut) ret.rings.push_back({ "fan-out", fanOut->stats() });
+            return ret;
+        };
+
+        // set when the frame was not rendered because it repeats the previous one; encFrame then already holds its output
+        bool reuseOutput = false;
+        uint64_t lastHash = 0;
+        size_t reusedFrames = 0;
+
+        // dirty tiles: with a filter declared spatially local (an output pixel depends on input texels at most filterRadius away),
+        // only changed input tiles are uploaded, and only the output tiles they reach are drawn under scissors, read back and
+        // patched into encFrame, which keeps the rest from earlier frames. other filters get full frames
+        const int inW = videoStream->codecpar->width, inH = videoStream->codecpar->height;
+        bool tiling = filterRadius >= 0;
+        if (tiling && (!ladder.empty() || fanOut)) {
+            LOGRAW("Ladder rungs and other codecs take whole frames. Processing full frames");
+            tiling = false;
+        }
+#ifndef YR_USE_VULKAN
+        if (tiling) LOGRAW("--filter-radius needs the Vulkan backend. Processing full frames");
+        tiling = false;
+#endif
+        onart::FrameTiles inputTiles(tileSize);
+        bool partialOutput = false; // the frame in flight only has outputAreas drawn
+        size_t partialFrames = 0, drawnTiles = 0, outputTiles = 0;
+#ifdef YR_USE_VULKAN
+        onart::AreaConverter uploadConverter(decContext->pix_fmt, AV_PIX_FMT_BGRA), outputConverter(AV_PIX_FMT_RGBA, encContext->pix_fmt);
+        std::vector<onart::YRGraphics::TextureArea2D> uploadAreas, outputAreas;
+        // fills uploadAreas with the changed input tiles and outputAreas with the output tiles whose input footprint, widened by
+        // the filter radius (and a texel for filtering when resizing), touches one. both are merged into horizontal runs.
+        // returns the number of output tiles to draw
+        auto planTiles = [&]() {
+            const int T = inputTiles.tileSize();
+            uploadAreas.clear();
+            outputAreas.clear();
+            for (int r = 0; r < inputTiles.rows(); r++) {
+                for (int c = 0, run = -1; c <= inputTiles.columns(); c++) {
+                    const bool dirty = c < inputTiles.columns() && inputTiles.dirty(c, r);
+                    if (dirty && run < 0) { run = c; }
+                    else if (!dirty && run >= 0) {
+                        uploadAreas.push_back({ (uint32_t)(run * T), (uint32_t)(r * T), (uint32_t)(std::min(c * T, inW) - run * T), (uint32_t)(std::min(r * T + T, inH) - r * T) });
+                        run = -1;
+                    }
+                }
+            }
+            const int margin = filterRadius + ((w != inW || h != inH) ? 1 : 0);
+            const int columns = (w + T - 1) / T, rows = (h + T - 1) / T;
+            size_t drawn = 0;
+            for (int r = 0; r < rows; r++) {
+                const int iy0 = std::max<int>(0, (int)((int64_t)r * T * inH / h) - margin);
+                const int iy1 = std::min<int>(inH, (int)(((int64_t)std::min(r * T + T, h) * inH + h - 1) / h) + margin);
+                for (int c = 0, run = -1; c <= columns; c++) {
+                    bool dirty = false;
+                    if (c < columns) {
+                        const int ix0 = std::max<int>(0, (int)((int64_t)c * T * inW / w) - margin);
+                        const int ix1 = std::min<int>(inW, (int)(((int64_t)std::min(c * T + T, w) * inW + w - 1) / w) + margin);
+                        for (int ty = iy0 / T; ty <= (iy1 - 1) / T && !dirty; ty++) {
+                            for (int tx = ix0 / T; tx <= (ix1 - 1) / T && !dirty; tx++) { dirty = inputTiles.dirty(tx, ty); }
+                        }
+                        drawn += dirty;
+                    }
+                    if (dirty && run < 0) { run = c; }
+                    else if (!dirty && run >= 0) {
+                        outputAreas.push_back({ (uint32_t)(run * T), (uint32_t)(r * T), (uint32_t)(std::min(c * T, w) - run * T), (uint32_t)(std::min(r * T + T, h) - r * T) });
+                        run = -1;
+                    }
+                }
+            }
+            outputTiles = (size_t)columns * rows;
+            return drawn;
+        };
+#endif
+
+        // the filtered frame fetchOutput last read. CPU-scaled rungs read it until they release it
+        std::unique_ptr<uint8_t[]> outputPixels;
+        const uint8_t* outputSrc = nullptr;
+        int outputPitch = 0;
+        // copies the filtered output into encFrame, reading the host visible target in place when the device allows it
+        auto fetchOutput = [&]() {
+            if (reuseOutput) return;
+            {
+                StageMeter::Scope blocked(readbackMeter, StageMeter::State::BLOCKED);
                 renderPass->wait();
-                auto pix = renderPass->readBack(0);
-                auto src = pix.get();
-                if (preproc2) {
-                    int srcPitch = w * 4;
-                    sws_scale(preproc2, &src, &srcPitch, 0, h, encFrame->data, encFrame->linesize);
+            }
+            StageMeter::Scope busy(readbackMeter, StageMeter::State::BUSY);
+            YR_TRACE("fetch output");
+            readbackMeter.count();
+            const uint8_t* src = nullptr;
+            int srcPitch = w * 4;
+#ifdef YR_USE_VULKAN
+            uint32_t rowPitch;
+            if ((src = renderPass->mapTarget(&rowPitch))) { srcPitch = (int)rowPitch; }
+#endif
+            if (!src) {
+#ifdef YR_USE_VULKAN
+                src = renderPass->readBack(0, frameArenas.next());
+#else
+                outputPixels = renderPass->readBack(0);
+                src = outputPixels.get();
+#endif
+            }
+#ifdef YR_USE_VULKAN
+            if (partialOutput) { // tile by tile, so the converter sees at most 4 sizes
+                const int T = inputTiles.tileSize();
+                for (const auto& area : outputAreas) {
+                    for (uint32_t x = area.x; x < area.x + area.width; x += T) {
+                        outputConverter.convert(&src, &srcPitch, encFrame->data, encFrame->linesize, (int)x, (int)area.y, std::min<int>(T, (int)(area.x + area.width - x)), (int)area.height);
+                    }
                 }
-                else {
-                    for (int i = 0; i < procFrame->height; i++) {
-                        std::memcpy(encFrame->data[0], src, w * 4);
-                        src += w * 4;
+                return;
+            }
+#endif
+            outputSrc = src;
+            outputPitch = srcPitch;
+            if (preproc2) {
+                sws_scale(preproc2, &src, &srcPitch, 0, h, encFrame->data, encFrame->linesize);
+            }
+            else {
+                onart::parallel_for(cpuPool, 0, h, ROW_GRAIN, [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++) {
+                        std::memcpy(encFrame->data[0] + i * encFrame->linesize[0], src + (ptrdiff_t)i * srcPitch, w * 4);
                     }
+                });
+            }
+        };
+
+        // hands the frame fetchOutput just read to every rung, waiting for a rung that has not taken the last one yet, and to the other codecs
+        auto feedLadder = [&](int64_t framePts, int64_t frameDur, bool keyframe) {
+            for (auto& rung : ladder) {
+                const uint8_t* src = nullptr;
+                int srcPitch = outputPitch;
+                if (!reuseOutput) {
+#ifdef YR_USE_VULKAN
+                    if (gpuLadder) {
+                        uint32_t rowPitch;
+                        src = rung->pass->mapTarget(&rowPitch);
+                        srcPitch = (int)rowPitch;
+                    }
+                    else
+#endif
+                    src = outputSrc;
                 }
+                std::unique_lock<std::mutex> lock(rung->guard);
+                rung->signal.wait(lock, [&rung]() { return !rung->pending; });
+                rung->src = src;
+                rung->srcPitch = srcPitch;
+                rung->pts = framePts;
+                rung->duration = frameDur;
+                rung->keyframe = keyframe;
+                rung->pending = true;
+                rung->released = !src;
+                lock.unlock();
+                rung->signal.notify_all();
+            }
+            if (fanOut) fanOut->push(reuseOutput ? nullptr : outputSrc, (size_t)frameDur, outputPitch, keyframe);
+        };
+        // the next frame overwrites what the rungs read, so this is called before it is rendered
+        auto waitLadder = [&]() {
+            for (auto& rung : ladder) {
+                std::unique_lock<std::mutex> lock(rung->guard);
+                rung->signal.wait(lock, [&rung]() { return rung->released; });
+            }
+        };
+
+        printf("0%%"); fflush(stdout);
+
+        bool invoked = false;
+        bool pending = false; // a frame is rendered (or repeated) and not encoded yet
+        int64_t pts = 0;
+        int64_t frameDuration = 0;
+        bool keyframe = false; // the frame in flight starts a scene
+        int64_t arrivalUS = 0, decodedUS = 0; // of the frame in flight, in live mode
+        onart::SceneCutDetector sceneCuts(sceneThreshold, minScene);
+        const auto jobStart = std::chrono::steady_clock::now();
+        auto lastStatsLine = jobStart;
+        onart::EncodeReport mainReport;
+
+        // live mode: latency is measured from the packet's arrival at av_read_frame to its encoded frame being written out
+        auto nowUS = []() { return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); };
+        struct InFlight { int64_t pts, arrivalUS, decodedUS; };
+        std::deque<InFlight> inFlight; // sent to the encoder, not written yet
+        onart::LatencyMeter latency;
+        int64_t processingUS = 0; // moving average of the time from decoded to written
+        const int64_t latencyBudgetUS = (int64_t)(latencyBudget * 1000);
+        size_t droppedFrames = 0;
 
-                encFrame->pts = pts;
-                encFrame->duration = frameDuration;
+        auto writePacket = [&](AVPacket* packet) {
+            if (!live) return av_interleaved_write_frame(outputFmt, packet);
+            // interleaving would hold video back until the other streams catch up; FLUSH_PACKETS sends each one on at once
+            const int ret = av_write_frame(outputFmt, packet);
+            av_packet_unref(packet);
+            return ret;
+        };
+        // encodes the frame in flight. normally called when the next frame is decoded, so the GPU works on one frame while the
+        // CPU encodes the one before; live mode calls it right after rendering instead, trading that overlap for a frame less delay
+        auto encodePending = [&]() {
+            if (!pending) return;
+            pending = false;
+            fetchOutput();
+            feedLadder(pts, frameDuration, keyframe);
+
+            encFrame->pts = pts;
+            encFrame->duration = frameDuration;
+            encFrame->pict_type = keyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+            {
+                StageMeter::Scope encoding(encodeMeter, StageMeter::State::BUSY);
+                YR_TRACE("encode send");
+                encodeMeter.count();
+                mainReport.frames++;
+                mainReport.mediaSeconds += (double)frameDuration * timeBase.num / timeBase.den;
                 errcode = avcodec_send_frame(encContext, encFrame);
+            }
+            if (errcode < 0) {
+                LOGERR("Failed to send frame", encFrame->pts);
+                // todo: appropriate process on failure
+            }
+            else if (live) {
+                inFlight.push_back({ pts, arrivalUS, decodedUS });
+            }
+            while (true) {
+                {
+                    StageMeter::Scope encoding(encodeMeter, StageMeter::State::BUSY);
+                    YR_TRACE("encode receive");
+                    errcode = avcodec_receive_packet(encContext, encPacket);
+                }
+                if (errcode == AVERROR(EAGAIN)) break;
                 if (errcode < 0) {
-                    LOGRAW("Failed to send frame", encFrame->pts);
+                    LOGERR("Failed to receive packet", encFrame->pts, av_make_error_string(errorString, sizeof(errorString), errcode));
                     // todo: appropriate process on failure
+                    break;
+                }
+                StageMeter::Scope muxing(muxMeter, StageMeter::State::BUSY);
+                YR_TRACE("mux write");
+                muxMeter.count();
+                mainReport.bytes += encPacket->size;
+                const int64_t packetPts = encPacket->pts;
+                encPacket->stream_index = videoStreamIndex;
+                av_packet_rescale_ts(encPacket, videoStream->time_base, outputVideoStream->time_base);
+                writePacket(encPacket);
+                if (live) { // without B-frames packets come out in pts order, so this packet completes every frame up to it
+                    const int64_t now = nowUS();
+                    while (!inFlight.empty() && inFlight.front().pts <= packetPts) {
+                        latency.add(now - inFlight.front().arrivalUS);
+                        const int64_t processing = now - inFlight.front().decodedUS;
+                        processingUS = processingUS ? (processingUS * 7 + processing) / 8 : processing;
+                        inFlight.pop_front();
+                    }
+                }
+            }
+            if (live || duration <= 0) printf("\r%.1f s, %zu dropped", mainReport.mediaSeconds, droppedFrames);
+            else printf("\r%.2f%%", encFrame->pts * 100 * timeBase.num / timeBase.den / duration);
+            if (statsInterval > 0 && onart::statsEnabled()) {
+                auto now = std::chrono::steady_clock::now();
+                if (std::chrono::duration<double>(now - lastStatsLine).count() >= statsInterval) {
+                    printf("\n%s\n", snapshot().line().c_str());
+                    if (live) printf("latency: %s\n", latency.stats().line().c_str());
+                    lastStatsLine = now;
                 }
-                errcode = avcodec_receive_packet(encContext, encPacket);
-                if (errcode == AVERROR(EAGAIN)) {
+            }
+        };
 
+        while (true) {
+            {
+                StageMeter::Scope busy(demuxMeter, StageMeter::State::BUSY);
+                YR_TRACE("demux");
+                if (av_read_frame(inputFmt, decPacket) != 0) break;
+                if (live) decPacket->opaque = (void*)(intptr_t)nowUS();
+                demuxMeter.count();
+            }
+            if (decPacket->stream_index == videoStreamIndex) {
+                StageMeter::Scope decoding(decodeMeter, StageMeter::State::BUSY);
+                onart::TraceScope decodeTrace("decode packet");
+                errcode = avcodec_send_packet(decContext, decPacket);
+                if (errcode == AVERROR(EAGAIN)) {}
+                else if (errcode == AVERROR_EOF) { break; }
+                else if (errcode) {
+                    av_make_error_string(errorString, sizeof(errorString), errcode);
+                    LOGERR("decode:", errorString);
+                    break;
                 }
-                else if (errcode < 0) {
-                    LOGRAW("Failed to receive packet", encFrame->pts);
-                    LOGRAW(toString(av_make_error_string(errorString, sizeof(errorString), errcode)));
-                    // todo: appropriate process on failure
+                errcode = avcodec_receive_frame(decContext, decFrame);
+                if (errcode == AVERROR(EAGAIN)) { continue; }
+                else if (errcode == AVERROR_EOF) {
+                    avcodec_flush_buffers(decContext);
+                    break;
                 }
-                else {
-                    encPacket->stream_index = videoStreamIndex;
-                    av_packet_rescale_ts(encPacket, videoStream->time_base, outputVideoStream->time_base);
-                    av_interleaved_write_frame(outputFmt, encPacket);
+                decoding.end();
+                decodeTrace.end();
+                decodeMeter.count();
+                int64_t frameArrivalUS = 0;
+                if (live) {
+                    const int64_t now = nowUS();
+                    frameArrivalUS = decFrame->opaque ? (int64_t)(intptr_t)decFrame->opaque : now;
+                    // a frame that is already too late, or will be by the time it usually takes to get out, is not processed at all.
+                    // the estimate counts for at most half the budget, so fresh frames still go through (and keep it current)
+                    // when the pipeline cannot meet the budget
+                    if (latencyBudgetUS > 0 && invoked && now - frameArrivalUS + std::min(processingUS, latencyBudgetUS / 2) > latencyBudgetUS) {
+                        droppedFrames++;
+                        continue;
+                    }
                 }
-                printf("\r%.2f%%", encFrame->pts * 100 * timeBase.num / timeBase.den / duration);
-            }
-            else { invoked = true; }
-            pts = decFrame->pts;
-            frameDuration = decFrame->duration;
-            tex->updateBy([&preproc1, &procFrame](void* data, uint32_t) {
-                if (preproc1) {
-                    uint8_t* castedData = (uint8_t*)data;
-                    int dstPitch = procFrame->width * 4;
-                    sws_scale(preproc1, procFrame->data, procFrame->linesize, 0, procFrame->height, &castedData, &dstPitch);
+                av_frame_unref(procFrame);
+                av_frame_ref(procFrame, decFrame);
+                // the filter's only input is the frame, so a repeated frame would be filtered to the same output
+                bool duplicate = false;
+                bool tilesKnown = false;
+                if (dedup || tiling) {
+                    StageMeter::Scope hashing(hashMeter, StageMeter::State::BUSY);
+                    YR_TRACE("hash");
+                    hashMeter.count();
+                    if (tiling) { // an unchanged frame is one without dirty tiles
+                        tilesKnown = inputTiles.update(procFrame);
+                        duplicate = dedup && invoked && tilesKnown && inputTiles.dirtyCount() == 0;
+                    }
+                    else {
+                        const uint64_t frameHash = onart::hashFrame(procFrame);
+                        duplicate = invoked && frameHash && frameHash == lastHash;
+                        lastHash = frameHash;
+                    }
                 }
-                else {
+                // a cut is a property of the decoded frame, so the decode side finds it and every encoder starts a GOP there
+                bool cut = false;
+                if (sceneThreshold >= 0 && !duplicate) {
+                    StageMeter::Scope detecting(sceneMeter, StageMeter::State::BUSY);
+                    YR_TRACE("scene cut");
+                    sceneMeter.count();
+                    cut = sceneCuts.update(procFrame);
+                }
+                //av_packet_unref(decPacket); // this was incorrect..
+                encodePending();
+                invoked = true;
+                pts = decFrame->pts;
+                frameDuration = decFrame->duration;
+                keyframe = cut;
+                arrivalUS = frameArrivalUS;
+                decodedUS = live ? nowUS() : 0;
+                reuseOutput = duplicate;
+                pending = true;
+                if (duplicate) {
+                    reusedFrames++;
+                    if (live) encodePending();
+                    continue; // skips upload, render and readback. the frame is still encoded with its own timestamp
+                }
+                StageMeter::Scope uploading(uploadMeter, StageMeter::State::BUSY);
+                onart::TraceScope uploadTrace("upload");
+                uploadMeter.count();
+                // the previous frame was fully drawn into the texture and encFrame, so unchanged tiles can be left as they are
+                bool partial = false;
+#ifdef YR_USE_VULKAN
+                if (tiling && tilesKnown && inputTiles.dirtyCount() > 0 && inputTiles.dirtyCount() < (size_t)inputTiles.columns() * inputTiles.rows()) {
+                    const size_t drawn = planTiles();
+                    partial = drawn < outputTiles;
+                    if (partial) {
+                        partialFrames++;
+                        drawnTiles += drawn;
+                        tex->setUpdateAreas(uploadAreas.data(), (uint32_t)uploadAreas.size());
+                    }
+                }
+#endif
+                uint64_t importedOffset;
+                void* imported = importPool.importedMemory(procFrame, &importedOffset);
+                if (imported) {
+#ifdef YR_USE_VULKAN
+                    // the previous copy may still be reading the frame it was given
+                    tex->wait();
+                    av_frame_unref(uploadedFrame);
+                    av_frame_ref(uploadedFrame, procFrame);
+                    tex->update(reinterpret_cast<onart::YRGraphics::ImportedHostMemory*>(imported), importedOffset, procFrame->linesize[0]);
+#endif
+                }
+#ifdef YR_USE_VULKAN
+                else if (partial) tex->updateBy([&](void* data, uint32_t) {
+                    YR_TRACE("sws tiles");
                     uint8_t* castedData = (uint8_t*)data;
-                    uint8_t* src = procFrame->data[0];
-                    for (int i = 0; i < procFrame->height; i++) {
-                        std::memcpy(castedData, src, procFrame->width * 4);
-                        src += procFrame->linesize[0];
+                    const int dstPitch = procFrame->width * 4;
+                    const int T = inputTiles.tileSize();
+                    for (const auto& area : uploadAreas) {
+                        for (uint32_t x = area.x; x < area.x + area.width; x += T) {
+                            uploadConverter.convert(procFrame->data, procFrame->linesize, &castedData, &dstPitch, (int)x, (int)area.y, std::min<int>(T, (int)(area.x + area.width - x)), (int)area.height);
+                        }
                     }
+                });
+#endif
+                else tex->updateBy([&preproc1, &procFrame, &cpuPool](void* data, uint32_t) {
+                    YR_TRACE("sws");
+                    if (preproc1) {
+                        uint8_t* castedData = (uint8_t*)data;
+                        int dstPitch = procFrame->width * 4;
+                        sws_scale(preproc1, procFrame->data, procFrame->linesize, 0, procFrame->height, &castedData, &dstPitch);
+                    }
+                    else {
+                        uint8_t* castedData = (uint8_t*)data;
+                        const uint8_t* src = procFrame->data[0];
+                        const size_t rowBytes = (size_t)procFrame->width * 4;
+                        const int srcPitch = procFrame->linesize[0];
+                        onart::parallel_for(cpuPool, 0, procFrame->height, ROW_GRAIN, [&](size_t begin, size_t end) {
+                            for (size_t i = begin; i < end; i++) {
+                                std::memcpy(castedData + i * rowBytes, src + (ptrdiff_t)i * srcPitch, rowBytes);
+                            }
+                        });
+                    }
+                });
+                if (!imported) av_frame_unref(uploadedFrame); // updateBy waited for the previous copy
+                uploading.end();
+                uploadTrace.end();
+                waitLadder();
+                StageMeter::Scope rendering(renderMeter, StageMeter::State::BUSY);
+                YR_TRACE("render");
+                renderMeter.count();
+#ifdef YR_USE_VULKAN
+                renderPass->startFrame(&tex, 1);
+                renderPass->bind(0, tex);
+                if (partial) {
+                    for (const auto& area : outputAreas) {
+                        renderPass->setScissor(area.width, area.height, (int32_t)area.x, (int32_t)area.y, true);
+                        renderPass->invoke(quad);
+                    }
+                    renderPass->setScissor(w, h, 0, 0);
+                    renderPass->executeFrame(outputAreas.data(), (uint32_t)outputAreas.size());
                 }
-            });
-            renderPass->start();
-            renderPass->bind(0, tex);
-            renderPass->invoke(quad);
-            renderPass->execute();
-            wd->start();
-            wd->bind(0, renderPass);
-            wd->invoke(quad);
-            wd->execute(renderPass);
-        }
-        else {
-            av_packet_rescale_ts(encPacket, videoStream->time_base, outputVideoStream->time_base);
-            av_interleaved_write_frame(outputFmt, decPacket);
+                else {
+                    renderPass->invoke(quad);
+                    renderPass->executeFrame(true);
+                }
+#else
+                renderPass->start();
+                renderPass->bind(0, tex);
+                renderPass->invoke(quad);
+                renderPass->execute();
+#endif
+                partialOutput = partial;
+                if (!partial) { // the target of a partial frame is cleared outside the drawn tiles, so the preview keeps the last full one
+                    wd->start();
+                    wd->bind(0, renderPass);
+                    wd->invoke(quad);
+                    wd->execute(renderPass);
+                }
+                if (live) encodePending();
+            }
+            else {
+                StageMeter::Scope muxing(muxMeter, StageMeter::State::BUSY);
+                YR_TRACE("mux write");
+                const int index = decPacket->stream_index; // copied as is, from the input stream's time base to the one the muxer chose
+                av_packet_rescale_ts(decPacket, inputFmt->streams[index]->time_base, outputFmt->streams[index]->time_base);
+                writePacket(decPacket);
+            }
         }
-    }
 
-    // encode last one
-    {
-        renderPass->wait();
-        auto pix = renderPass->readBack(0);
-        auto src = pix.get();
-        if (preproc2) {
-            int srcPitch = w * 4;
-            sws_scale(preproc2, &src, &srcPitch, 0, h, encFrame->data, encFrame->linesize);
+        encodePending(); // the last one
+        av_write_trailer(outputFmt);
+        mainReport.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+        if (fanOut) fanOut->end(); // each encoder flushes and closes its file
+        for (auto& rung : ladder) {
+            {
+                std::unique_lock<std::mutex> _(rung->guard);
+                rung->finished = true;
+            }
+            rung->signal.notify_all();
+            rung->worker.join(); // drains the encoder and writes the trailer
+            if (rung->file.context()) {
+                rung->fmt->pb = nullptr;
+                if (!rung->file.close()) LOGRAW("Failed to write", rung->path.u8string());
+            }
+            else if (rung->fmt->pb) avio_closep(&rung->fmt->pb);
         }
-        else {
-            for (int i = 0; i < procFrame->height; i++) {
-                std::memcpy(encFrame->data[0], src, w * 4);
-                src += w * 4;
+        LOGRAW("\n" + mainReport.line(output.filename().u8string()));
+        for (auto& rung : ladder) LOGRAW(rung->report.line(rung->path.filename().u8string()));
+        for (size_t i = 0; i < extraEncoders.size(); i++) LOGRAW(extraEncoders[i]->report().line(extraNames[i]));
+        if (!sceneCuts.cuts().empty() && inputFmt->duration > 0) {
+            // segment boundaries for a segment-parallel run of the same input, each of which decodes one section
+            const auto& cuts = sceneCuts.cuts();
+            std::vector<int64_t> cutsUS(cuts.size());
+            for (size_t i = 0; i < cuts.size(); i++) cutsUS[i] = av_rescale_q(cuts[i], videoStream->time_base, AVRational{ 1, 1'000'000 });
+            const auto sections = onart::sectionsAtCuts(cutsUS, inputFmt->duration, 2'000'000);
+            LOGRAW("\nForced keyframes at", cuts.size(), "scene cuts, giving", sections.size(), "segments of 2 s or longer");
+            if (writeSections && output.string().find("://") == std::string::npos && output.string().rfind("pipe:", 0) != 0) {
+                // one section per line: first and last microsecond, as VideoDecoder::start takes them
+                const std::filesystem::path sectionsPath = output.parent_path() / (output.stem().string() + "_sections.txt");
+                if (FILE* list = fopen(sectionsPath.string().c_str(), "w")) {
+                    for (const onart::section& s : sections) fprintf(list, "%lld %lld\n", (long long)s.start, (long long)s.end);
+                    fclose(list);
+                    LOGRAW("Sections:", sectionsPath.u8string());
+                }
+                else LOGRAW("Failed to write", sectionsPath.u8string());
             }
         }
+        if (live) {
+            LOGRAW("\nLatency from packet arrival to output:", latency.stats().line());
+            if (droppedFrames) LOGRAW("Dropped", droppedFrames, "frames over the", latencyBudget, "ms budget");
+        }
+        if (reusedFrames) {
+            LOGRAW("\nReused the filtered output for", reusedFrames, "repeated frames");
+        }
+        if (partialFrames) {
+            LOGRAW("\nDrew", drawnTiles * 100.0 / ((double)partialFrames * outputTiles), "% of the tiles on", partialFrames, "partially changed frames");
+        }
+        if (outputFile.context()) {
+            outputFmt->pb = nullptr;
+            if (!outputFile.close()) LOGRAW("Failed to write", output.u8string());
+        }
+        onart::AsyncLogger::flush();
+        if (onart::statsEnabled()) {
+            LOGRAW("\n" + snapshot().table());
+        }
+
+        avformat_close_input(&inputFmt);
+        if (outputFile.mode() == onart::OutputFile::Mode::DEFAULT) avio_close(outputFmt->pb);
+        // frames may live in GPU-imported memory, which must be released before the graphics context
+#ifdef YR_USE_VULKAN
+        if (tex) tex->wait();
+#endif
+        uploadedFrame = nullptr;
+        procFrame = nullptr;
+        decFrame = nullptr;
+        decContext = nullptr;
+        return 0;
+    };
 
-        encFrame->pts = pts;
-        encFrame->duration = frameDuration;
-        errcode = avcodec_send_frame(encContext, encFrame);
-        if (errcode < 0) {
-            LOGRAW("Failed to send frame", encFrame->pts);
-            // todo: appropriate process on failure
+    // row copies of a frame are split into bands over this pool; the calling thread works on them too
+    onart::ThreadPool cpuPool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    // transient per-frame memory; a frame's arena is reused once the frame after next starts
+    onart::FrameArenaRing frameArenas(2);
+    const auto setupEnd = std::chrono::steady_clock::now();
+    int result = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++) { // one after another: the device records and submits from this thread only
+        if (jobs.size() > 1) LOGRAW("\n[Job", i + 1, "/", jobs.size(), "]", jobs[i].input, "->", jobs[i].output);
+        const int code = runJob(jobs[i].input, jobs[i].output, jobs[i].width, jobs[i].height, cpuPool, frameArenas);
+        if (code) {
+            if (!result) result = code;
+            failed++;
         }
-        errcode = avcodec_receive_packet(encContext, encPacket);
-        if (errcode < 0) {
-            LOGRAW("Failed to receive packet", encFrame->pts);
-            // todo: appropriate process on failure
-            LOGRAW(toString(av_make_error_string(errorString, sizeof(errorString), errcode)));
+    }
+    if (jobs.size() > 1) {
+        const auto end = std::chrono::steady_clock::now();
+        LOGRAW("\nBatch:", jobs.size() - failed, "of", jobs.size(), "jobs done | setup", std::chrono::duration<double>(setupEnd - start).count(), "s | jobs", std::chrono::duration<double>(end - setupEnd).count(), "s");
+    }
+#ifdef YR_USE_VULKAN
+    if (gpuTiming && renderPass && tex) {
+        auto gpu = renderPass->getGpuTiming();
+        auto upload = tex->getGpuTiming();
+        if (gpu.frames) {
+            LOGRAW("GPU ms/frame: pass", gpu.passMs / gpu.frames, "| upload", (gpu.uploadMs + upload.uploadMs) / gpu.frames, "| readback", gpu.readBackMs / gpu.frames, "| frames", gpu.frames);
         }
-        encPacket->stream_index = videoStreamIndex;
-        av_packet_rescale_ts(encPacket, videoStream->time_base, outputVideoStream->time_base);
-        av_interleaved_write_frame(outputFmt, encPacket);
     }
-    av_write_trailer(outputFmt);
+#endif
 
-    avformat_close_input(&inputFmt);
-    avio_close(outputFmt->pb);
     quad.reset();
     tex.reset();
     delete _gr;
     onart::Window::terminate();
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,201 @@
+// Copyright 2022 onart@github. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef __YR_ARENA_HPP__
+#define __YR_ARENA_HPP__
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+#include "yr_framemem.h"
+
+namespace onart {
+
+    /// @brief 한 프레임 동안만 쓰이는 메모리를 위한 선형(bump) 할당기입니다. 할당은 포인터를 앞으로 옮기는 것뿐이며, 개별 해제 없이 @ref reset 으로 한꺼번에 비웁니다.
+    /// 공간이 모자라면 추가 블록을 할당하되, 다음 reset에서 그때까지 쓴 전체 크기의 블록 하나로 합치므로 처리량이 일정해지면 더 이상 할당하지 않습니다.
+    /// 스레드 안전하지 않습니다.
+    class FrameArena {
+        public:
+            /// @param initialSize 처음 확보할 크기(바이트). 0이면 첫 할당 때 확보합니다.
+            inline FrameArena(size_t initialSize = 0) { if (initialSize) addBlock(initialSize); }
+            inline ~FrameArena() {
+                runDestructors();
+                for (Block& b : blocks) FrameMemory::free(b.base);
+            }
+            FrameArena(const FrameArena&) = delete;
+            FrameArena& operator=(const FrameArena&) = delete;
+
+            /// @brief 메모리를 할당합니다. 리턴된 메모리는 다음 @ref reset 까지 유효합니다.
+            /// @param alignment 2의 거듭제곱이어야 합니다.
+            /// @return 메모리가 부족하면 nullptr
+            inline void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+                if (!blocks.empty()) {
+                    Block& b = blocks.back();
+                    const size_t at = (b.used + alignment - 1) & ~(alignment - 1);
+                    if (at + size <= b.size) {
+                        b.used = at + size;
+                        total += size;
+                        return b.base + at;
+                    }
+                }
+                const size_t last = blocks.empty() ? 0 : blocks.back().size;
+                size_t next = last ? last * 2 : DEFAULT_BLOCK;
+                while (next < size + alignment) next *= 2;
+                if (!addBlock(next)) return nullptr;
+                return allocate(size, alignment);
+            }
+            /// @brief 객체 하나를 생성합니다. 소멸자가 필요한 타입이면 @ref reset 때 생성의 역순으로 호출됩니다.
+            template<class T, class... Args>
+            inline T* make(Args&&... args) {
+                void* p = allocate(sizeof(T), alignof(T));
+                if (!p) return nullptr;
+                T* ret = new (p) T(std::forward<Args>(args)...);
+                if constexpr (!std::is_trivially_destructible<T>::value) {
+                    Destructor* d = (Destructor*)allocate(sizeof(Destructor), alignof(Destructor));
+                    if (!d) {
+                        ret->~T();
+                        return nullptr;
+                    }
+                    d->destroy = [](void* obj) { reinterpret_cast<T*>(obj)->~T(); };
+                    d->object = ret;
+                    d->next = destructors;
+                    destructors = d;
+                }
+                return ret;
+            }
+            /// @brief 값 초기화되지 않은 배열을 할당합니다. 소멸자가 필요 없는 타입만 가능합니다.
+            template<class T>
+            inline T* makeArray(size_t count) {
+                static_assert(std::is_trivially_destructible<T>::value, "FrameArena::makeArray requires a trivially destructible type");
+                return reinterpret_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+            }
+            /// @brief 등록된 소멸자를 호출하고 모든 할당을 되돌립니다. 이전에 할당한 메모리는 더 이상 사용할 수 없습니다.
+            inline void reset() {
+                runDestructors();
+                if (blocks.size() > 1) { // 이번 프레임에 넘친 만큼 키운 블록 하나로 교체
+                    size_t sum = 0;
+                    for (Block& b : blocks) {
+                        sum += b.size;
+                        FrameMemory::free(b.base);
+                    }
+                    blocks.clear();
+                    addBlock(sum);
+                }
+                else if (!blocks.empty()) {
+                    blocks.back().used = 0;
+                }
+                if (total > peak) peak = total;
+                total = 0;
+            }
+            /// @brief 마지막 reset 이후 할당된 바이트 수
+            inline size_t used() const { return total; }
+            /// @brief 현재 확보한 전체 크기(바이트)
+            inline size_t capacity() const {
+                size_t sum = 0;
+                for (const Block& b : blocks) sum += b.size;
+                return sum;
+            }
+            /// @brief 지금까지 한 프레임에 쓴 최대 바이트 수. 현재 프레임은 reset 이후에 반영됩니다.
+            inline size_t highWater() const { return peak; }
+            /// @brief 지금까지 힙에서 블록을 할당한 횟수. 정상 상태에서는 늘지 않아야 합니다.
+            inline size_t heapAllocations() const { return growCount; }
+        private:
+            constexpr static size_t DEFAULT_BLOCK = 64 << 10;
+            constexpr static size_t BLOCK_ALIGN = 64;
+            struct Block {
+                uint8_t* base;
+                size_t size;
+                size_t used;
+            };
+            struct Destructor {
+                void (*destroy)(void*);
+                void* object;
+                Destructor* next;
+            };
+            inline bool addBlock(size_t size) {
+                size = (size + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1);
+                FrameMemory::Options opts;
+                opts.alignment = BLOCK_ALIGN;
+                uint8_t* base = (uint8_t*)FrameMemory::allocate(size, opts); // 프레임 크기의 블록은 큰 페이지에 놓임
+                if (!base) return false;
+                blocks.push_back({ base, size, 0 });
+                growCount++;
+                return true;
+            }
+            inline void runDestructors() {
+                for (Destructor* d = destructors; d; d = d->next) d->destroy(d->object);
+                destructors = nullptr;
+            }
+            std::vector<Block> blocks;
+            Destructor* destructors = nullptr;
+            size_t total = 0;
+            size_t peak = 0;
+            size_t growCount = 0;
+    };
+
+    /// @brief 동시에 진행 중일 수 있는 프레임 수만큼의 @ref FrameArena 를 돌려 가며 씁니다.
+    /// 새 프레임을 시작할 때 가장 오래된 아레나를 비워서 주므로, 그 아레나를 쓰던 프레임은 그 전에 끝나(retire) 있어야 합니다.
+    class FrameArenaRing {
+        public:
+            /// @param inFlight 동시에 진행 중일 수 있는 프레임 수
+            /// @param initialSize 아레나마다 처음 확보할 크기(바이트)
+            inline FrameArenaRing(size_t inFlight = 2, size_t initialSize = 0) {
+                if (inFlight == 0) inFlight = 1;
+                arenas.reserve(inFlight);
+                for (size_t i = 0; i < inFlight; i++) arenas.emplace_back(new FrameArena(initialSize));
+            }
+            /// @brief 다음 프레임에 쓸 아레나를 비워서 리턴합니다.
+            inline FrameArena& next() {
+                FrameArena& ret = *arenas[cursor];
+                cursor = (cursor + 1) % arenas.size();
+                ret.reset();
+                return ret;
+            }
+            /// @brief 모든 아레나가 힙에서 블록을 할당한 횟수의 합
+            inline size_t heapAllocations() const {
+                size_t sum = 0;
+                for (auto& a : arenas) sum += a->heapAllocations();
+                return sum;
+            }
+        private:
+            std::vector<std::unique_ptr<FrameArena>> arenas;
+            size_t cursor = 0;
+    };
+
+    template<class>
+    class FunctionRef;
+
+    /// @brief 호출 가능한 객체를 복사하지 않고 참조만 하는 함수 타입입니다. std::function과 달리 캡처가 커도 할당하지 않으며,
+    /// 호출되는 동안만 대상이 살아 있으면 되는 동기 콜백(예: 스트림 텍스처의 updateBy)의 인수로 씁니다. 저장해 두었다가 나중에 호출하면 안 됩니다.
+    template<class R, class... Args>
+    class FunctionRef<R(Args...)> {
+        public:
+            template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, FunctionRef>::value>::type>
+            inline FunctionRef(F&& f) : object((void*)std::addressof(f)) {
+                call = [](void* o, Args... args) -> R {
+                    return (*reinterpret_cast<typename std::add_pointer<F>::type>(o))(std::forward<Args>(args)...);
+                };
+            }
+            inline R operator()(Args... args) const { return call(object, std::forward<Args>(args)...); }
+        private:
+            void* object;
+            R (*call)(void*, Args...);
+    };
+}
+
+#endif
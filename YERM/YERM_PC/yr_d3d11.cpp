@@ -2570,7 +2570,7 @@ namespace onart {
         singleton->context->Unmap(txo, 0);
     }
 
-    void D3D11Machine::StreamTexture::updateBy(std::function<void*, uint32_t> function) {
+    void D3D11Machine::StreamTexture::updateBy(FunctionRef<void(void*, uint32_t)> function) {
         D3D11_MAPPED_SUBRESOURCE mapped;
         HRESULT result = singleton->context->Map(tx0, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
         if (!SUCCEEDED(result)) {
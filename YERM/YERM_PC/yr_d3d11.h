@@ -21,6 +21,7 @@
 
 #include "yr_math.hpp"
 #include "yr_threadpool.hpp"
+#include "yr_arena.hpp"
 #include <d3d11.h>
 
 #include <type_traits>
@@ -606,7 +607,8 @@ namespace onart {
         static void drop(int32_t name);
         /// @brief 이미지 데이터를 다시 설정합니다.
         void update(void* img);
-        void updateBy(std::function<void(void*, uint32_t)> function);
+        /// @brief 텍스처의 매핑된 메모리에 직접 작성하는 함수로 이미지 데이터를 다시 설정합니다. 함수는 이 호출 안에서만 실행되며 복사되지 않으므로 큰 캡처도 할당 없이 넘길 수 있습니다.
+        void updateBy(FunctionRef<void(void*, uint32_t)> function);
         const uint16_t width, height;
     protected:
         StreamTexture(ID3D11Texture2D* txo, ID3D11ShaderResourceView* srv, uint16_t width, uint16_t height, bool linearSampler);
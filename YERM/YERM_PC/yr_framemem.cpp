@@ -0,0 +1,242 @@
+// Copyright 2022 onart@github. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "yr_framemem.h"
+#include "yr_compiler_specific.hpp"
+#include "logger.hpp"
+
+#include "../externals/boost/predef/os.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#if BOOST_OS_WINDOWS
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <Windows.h>
+#elif BOOST_OS_LINUX
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace onart {
+
+    struct Mapping {
+        size_t length;
+        bool huge; // 명시적 큰 페이지로 받았는지
+    };
+
+    // OS 페이지로 직접 받은 할당. 여기에 없는 주소는 힙에서 받은 것
+    static std::map<void*, Mapping> mappings;
+    static std::mutex mappingGuard;
+    static std::atomic<size_t> hugeTotal{ 0 };
+
+    static inline size_t roundUp(size_t size, size_t unit) { return (size + unit - 1) / unit * unit; }
+
+#if BOOST_OS_LINUX
+    static size_t readHugePageSize() {
+        FILE* fp = std::fopen("/proc/meminfo", "r");
+        if (!fp) return 0;
+        char line[128];
+        size_t kb = 0;
+        while (std::fgets(line, sizeof(line), fp)) {
+            if (std::sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) break;
+        }
+        std::fclose(fp);
+        return kb * 1024;
+    }
+
+    static int readNodeCount() {
+        FILE* fp = std::fopen("/sys/devices/system/node/online", "r");
+        if (!fp) return 1;
+        char buf[256]{};
+        const bool read = std::fgets(buf, sizeof(buf), fp) != nullptr;
+        std::fclose(fp);
+        if (!read) return 1;
+        int highest = 0;
+        for (const char* c = buf; *c;) { // "0", "0-1", "0,2-3" 등. 가장 큰 번호 + 1
+            char* end;
+            long v = std::strtol(c, &end, 10);
+            if (end == c) { c++; continue; }
+            if ((int)v > highest) highest = (int)v;
+            c = end;
+        }
+        return highest + 1;
+    }
+
+    /// @brief [p, p + length) 범위의 페이지를 node에 우선 배치하도록 합니다. 페이지가 처음 쓰이기 전에 호출해야 합니다.
+    static void bindToNode(void* p, size_t length, int node) {
+#ifdef SYS_mbind
+        constexpr int MPOL_PREFERRED_ = 1;
+        constexpr size_t MASK_BITS = 1024;
+        unsigned long mask[MASK_BITS / (8 * sizeof(unsigned long))]{};
+        if (node < 0 || (size_t)node >= MASK_BITS) return;
+        mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_mbind, p, length, MPOL_PREFERRED_, mask, MASK_BITS, 0) != 0) {
+            LOGWITH("mbind failed; frame memory is placed by the default policy");
+        }
+#endif
+    }
+
+    static void* mapLarge(size_t size, const FrameMemory::Options& opts, Mapping* info) {
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        const size_t huge = opts.hugePages ? FrameMemory::hugePageSize() : 0; // 0이면 큰 페이지를 시도하지 않음
+        void* p = MAP_FAILED;
+        size_t length = roundUp(size, page);
+#ifdef MAP_HUGETLB
+        if (huge && opts.alignment <= huge) { // 미리 예약된 hugetlbfs 페이지가 있을 때만 성공
+            length = roundUp(size, huge);
+            p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            info->huge = p != MAP_FAILED;
+        }
+#endif
+        if (p == MAP_FAILED) {
+            // 투명 큰 페이지(THP)가 쓰일 수 있도록 큰 페이지 경계에 맞춰 받음
+            const size_t align = huge ? std::max(opts.alignment, huge) : std::max(opts.alignment, page);
+            length = huge ? roundUp(size, huge) : roundUp(size, page);
+            const size_t reserve = length + align - page;
+            uint8_t* raw = (uint8_t*)mmap(nullptr, reserve, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED) return nullptr;
+            uint8_t* aligned = (uint8_t*)roundUp((uintptr_t)raw, align);
+            if (aligned > raw) munmap(raw, aligned - raw);
+            if (raw + reserve > aligned + length) munmap(aligned + length, raw + reserve - (aligned + length));
+            p = aligned;
+            info->huge = false;
+#ifdef MADV_HUGEPAGE
+            if (huge) madvise(p, length, MADV_HUGEPAGE);
+#endif
+        }
+        info->length = length;
+        if (opts.numaNode != FrameMemory::ANY_NODE && FrameMemory::nodeCount() > 1) {
+            bindToNode(p, length, opts.numaNode == FrameMemory::CURRENT_NODE ? FrameMemory::currentNode() : opts.numaNode);
+        }
+        return p;
+    }
+
+    static void unmapLarge(void* p, const Mapping& info) { munmap(p, info.length); }
+
+#elif BOOST_OS_WINDOWS
+    static void* mapLarge(size_t size, const FrameMemory::Options& opts, Mapping* info) {
+        int node = opts.numaNode == FrameMemory::CURRENT_NODE ? FrameMemory::currentNode() : opts.numaNode;
+        if (FrameMemory::nodeCount() <= 1) node = -1;
+        const size_t large = GetLargePageMinimum();
+        void* p = nullptr;
+        if (opts.hugePages && large) { // SeLockMemoryPrivilege가 없으면 실패
+            const size_t length = roundUp(size, large);
+            const DWORD type = MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+            p = node >= 0 ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, length, type, PAGE_READWRITE, (DWORD)node) : VirtualAlloc(nullptr, length, type, PAGE_READWRITE);
+            if (p) {
+                info->length = length;
+                info->huge = true;
+            }
+        }
+        if (!p) {
+            const DWORD type = MEM_RESERVE | MEM_COMMIT;
+            p = node >= 0 ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, type, PAGE_READWRITE, (DWORD)node) : VirtualAlloc(nullptr, size, type, PAGE_READWRITE);
+            info->length = size;
+            info->huge = false;
+        }
+        return p; // 64KB 단위로 정렬되어 있음
+    }
+
+    static void unmapLarge(void* p, const Mapping&) { VirtualFree(p, 0, MEM_RELEASE); }
+#endif
+
+    void* FrameMemory::allocate(size_t size, const Options& opts) {
+        if (size == 0) return nullptr;
+        const size_t alignment = opts.alignment < sizeof(void*) ? sizeof(void*) : opts.alignment;
+#if BOOST_OS_LINUX || BOOST_OS_WINDOWS
+        if (size >= LARGE_THRESHOLD) {
+            Mapping info{};
+            Options o = opts;
+            o.alignment = alignment;
+            if (void* p = mapLarge(size, o, &info)) {
+                if (info.huge) hugeTotal.fetch_add(info.length, std::memory_order_relaxed);
+                std::unique_lock<std::mutex> _(mappingGuard);
+                mappings[p] = info;
+                return p;
+            }
+        }
+#endif
+        return aligned_malloc(alignment, roundUp(size, alignment));
+    }
+
+    void* FrameMemory::allocate(size_t size) { return allocate(size, Options{}); }
+
+    void FrameMemory::free(void* p) {
+        if (!p) return;
+#if BOOST_OS_LINUX || BOOST_OS_WINDOWS
+        {
+            std::unique_lock<std::mutex> _(mappingGuard);
+            auto it = mappings.find(p);
+            if (it != mappings.end()) {
+                Mapping info = it->second;
+                mappings.erase(it);
+                _.unlock();
+                if (info.huge) hugeTotal.fetch_sub(info.length, std::memory_order_relaxed);
+                unmapLarge(p, info);
+                return;
+            }
+        }
+#endif
+        aligned_free(p);
+    }
+
+    int FrameMemory::currentNode() {
+#if BOOST_OS_LINUX && defined(SYS_getcpu)
+        unsigned cpu = 0, node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) return (int)node;
+        return -1;
+#elif BOOST_OS_WINDOWS
+        PROCESSOR_NUMBER pn;
+        GetCurrentProcessorNumberEx(&pn);
+        USHORT node;
+        if (GetNumaProcessorNodeEx(&pn, &node)) return (int)node;
+        return -1;
+#else
+        return -1;
+#endif
+    }
+
+    int FrameMemory::nodeCount() {
+#if BOOST_OS_LINUX
+        static const int count = readNodeCount();
+        return count;
+#elif BOOST_OS_WINDOWS
+        ULONG highest = 0;
+        if (GetNumaHighestNodeNumber(&highest)) return (int)highest + 1;
+        return 1;
+#else
+        return 1;
+#endif
+    }
+
+    size_t FrameMemory::hugePageSize() {
+#if BOOST_OS_LINUX
+        static const size_t size = readHugePageSize();
+        return size;
+#elif BOOST_OS_WINDOWS
+        return GetLargePageMinimum();
+#else
+        return 0;
+#endif
+    }
+
+    size_t FrameMemory::hugeBytes() { return hugeTotal.load(std::memory_order_relaxed); }
+}
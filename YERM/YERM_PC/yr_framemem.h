@@ -0,0 +1,76 @@
+// Copyright 2022 onart@github. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef __YR_FRAMEMEM_H__
+#define __YR_FRAMEMEM_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace onart {
+
+    /// @brief 프레임처럼 크고 오래 재사용되는 버퍼를 위한 메모리 공급자입니다.
+    /// 큰 할당은 OS에서 페이지 단위로 직접 받아 가능하면 큰 페이지(2MB)를 쓰고, 지정한 NUMA 노드에 배치합니다. 작은 할당은 정렬된 일반 힙 메모리입니다.
+    /// 큰 페이지나 NUMA를 지원하지 않는 환경에서는 조용히 일반 페이지로 대체됩니다. 모든 함수는 스레드 안전합니다.
+    class FrameMemory {
+        public:
+            /// @brief 호출 스레드가 실행 중인 NUMA 노드를 뜻하는 값
+            constexpr static int CURRENT_NODE = -1;
+            /// @brief 노드를 지정하지 않음(OS 기본 정책)을 뜻하는 값
+            constexpr static int ANY_NODE = -2;
+            struct Options {
+                /// @brief 시작 주소의 정렬 단위(바이트). 2의 거듭제곱이어야 합니다. 기본값은 AVX-512 레지스터 폭인 64입니다.
+                size_t alignment = 64;
+                /// @brief true이면 @ref LARGE_THRESHOLD 이상의 할당에 큰 페이지를 시도합니다. 기본값 true
+                bool hugePages = true;
+                /// @brief 메모리를 둘 NUMA 노드. 기본값은 호출 스레드의 노드이며, 소비 스레드에서 할당하거나 그 스레드의 @ref currentNode 값을 주는 것을 권장합니다.
+                int numaNode = CURRENT_NODE;
+            };
+            /// @brief 이 크기(바이트) 이상이면 OS 페이지를 직접 받습니다.
+            constexpr static size_t LARGE_THRESHOLD = 1 << 20;
+            /// @brief 메모리를 할당합니다. 내용은 초기화되지 않습니다.
+            /// @return 실패 시 nullptr
+            static void* allocate(size_t size, const Options& opts);
+            /// @brief 기본 옵션으로 메모리를 할당합니다.
+            static void* allocate(size_t size);
+            /// @brief @ref allocate 로 받은 메모리를 해제합니다. nullptr는 무시합니다.
+            static void free(void* p);
+            /// @brief 호출 스레드가 현재 실행 중인 NUMA 노드 번호를 리턴합니다. 알 수 없으면 -1입니다.
+            static int currentNode();
+            /// @brief 시스템의 NUMA 노드 수를 리턴합니다. 알 수 없으면 1입니다.
+            static int nodeCount();
+            /// @brief 큰 페이지 크기(바이트)를 리턴합니다. 지원하지 않으면 0입니다.
+            static size_t hugePageSize();
+            /// @brief 지금까지 큰 페이지로 할당된 바이트 수(현재 해제되지 않은 것)를 리턴합니다. 큰 페이지가 실제로 쓰이는지 확인하는 용도입니다.
+            static size_t hugeBytes();
+    };
+
+    /// @brief @ref FrameMemory 를 쓰는 표준 할당기입니다. 프레임 크기의 std::vector 등에 사용합니다.
+    template<class T>
+    struct FrameAllocator {
+        using value_type = T;
+        FrameAllocator() = default;
+        template<class U> inline FrameAllocator(const FrameAllocator<U>&) {}
+        inline T* allocate(size_t n) {
+            void* p = FrameMemory::allocate(n * sizeof(T));
+            if (!p) throw std::bad_alloc();
+            return reinterpret_cast<T*>(p);
+        }
+        inline void deallocate(T* p, size_t) { FrameMemory::free(p); }
+        template<class U> inline bool operator==(const FrameAllocator<U>&) const { return true; }
+        template<class U> inline bool operator!=(const FrameAllocator<U>&) const { return false; }
+    };
+}
+
+#endif
@@ -0,0 +1,143 @@
+// Copyright 2022 onart@github. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef __YR_HASH_HPP__
+#define __YR_HASH_HPP__
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+// yr_simd.hpp는 intrinsic 헤더를 이름공간 안에서 포함하므로 전역에서 먼저 포함해 둠
+#include "../externals/boost/predef/hardware.h"
+#if !defined(YR_NOSIMD) && !defined(YR_USE_WEBGPU)
+#if BOOST_HW_SIMD_X86 >= BOOST_HW_SIMD_X86_SSE2_VERSION
+#include <emmintrin.h>
+#elif BOOST_HW_SIMD_ARM >= BOOST_HW_SIMD_ARM_NEON_VERSION
+#include "../externals/single_header/sse2neon.h"
+#endif
+#endif
+#include "yr_simd.hpp"
+
+namespace onart {
+
+    namespace hash_detail {
+        constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ull;
+        constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+        constexpr uint32_t PRIME32_1 = 0x9E3779B1u;
+        constexpr size_t STRIPE = 64;
+        constexpr size_t STRIPES_PER_BLOCK = 16;
+        alignas(16) constexpr uint64_t KEY[8] = {
+            0xBE4BA423396CFEB8ull, 0x1CAD21F72C81017Cull, 0xDB979083E96DD4DEull, 0x1F67B3B7A4A44072ull,
+            0x78E5C0CC4EE679CBull, 0x2172FFCC7DD05A82ull, 0x8E2443F7744608B8ull, 0x4C263A81E69035E0ull
+        };
+        alignas(16) constexpr uint64_t SCRAMBLE_KEY[8] = {
+            0xCB00C391BB52283Cull, 0xA32E531B8B65D088ull, 0x4EF90DA297486471ull, 0xD8ACDEA946EF1938ull,
+            0x3F349CE33F76FAA8ull, 0x1D4F0BC7C7BBDCF9ull, 0x3159B4CD4BE0518Aull, 0x647378D9C97E9FC8ull
+        };
+
+        inline uint64_t fmix64(uint64_t h) {
+            h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull;
+            h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull;
+            h ^= h >> 33;
+            return h;
+        }
+
+        inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+#ifdef YR_USING_SIMD
+        /// @brief 64바이트 묶음 count개를 누적합니다. 64비트 레인마다 acc[i] += data[i^1] + lo32(data[i]^key[i]) * hi32(data[i]^key[i]) 입니다.
+        inline void accumulate(uint64_t* acc, const uint8_t* p, size_t count) {
+            __m128i a[4];
+            for (int i = 0; i < 4; i++) a[i] = _mm_load_si128((const __m128i*)acc + i);
+            for (size_t s = 0; s < count; s++, p += STRIPE) {
+                for (int i = 0; i < 4; i++) {
+                    const __m128i d = _mm_loadu_si128((const __m128i*)p + i);
+                    const __m128i k = _mm_xor_si128(d, _mm_load_si128((const __m128i*)KEY + i));
+                    const __m128i product = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+                    a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+                }
+            }
+            for (int i = 0; i < 4; i++) _mm_store_si128((__m128i*)acc + i, a[i]);
+        }
+
+        /// @brief 곱셈 결과가 0에 머무르지 않도록 누적값을 섞습니다.
+        inline void scramble(uint64_t* acc) {
+            const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+            for (int i = 0; i < 4; i++) {
+                __m128i a = _mm_load_si128((const __m128i*)acc + i);
+                a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+                a = _mm_xor_si128(a, _mm_load_si128((const __m128i*)SCRAMBLE_KEY + i));
+                const __m128i lo = _mm_mul_epu32(a, prime);
+                const __m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+                _mm_store_si128((__m128i*)acc + i, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+            }
+        }
+#else
+        inline void accumulate(uint64_t* acc, const uint8_t* p, size_t count) {
+            for (size_t s = 0; s < count; s++, p += STRIPE) {
+                uint64_t d[8];
+                std::memcpy(d, p, STRIPE);
+                for (int i = 0; i < 8; i++) {
+                    const uint64_t k = d[i] ^ KEY[i];
+                    acc[i] += d[i ^ 1] + (k & 0xFFFFFFFFull) * (k >> 32);
+                }
+            }
+        }
+
+        inline void scramble(uint64_t* acc) {
+            for (int i = 0; i < 8; i++) {
+                uint64_t a = acc[i];
+                a ^= a >> 47;
+                a ^= SCRAMBLE_KEY[i];
+                acc[i] = a * PRIME32_1;
+            }
+        }
+#endif
+    }
+
+    /// @brief 바이트 배열의 64비트 해시를 계산합니다. 같은 내용인지 빠르게 비교하기 위한 것으로, 암호학적 해시가 아닙니다.
+    /// 64바이트 단위로 SIMD(SSE2 또는 NEON) 연산을 하며, 결과는 SIMD 사용 여부와 관계없이 같습니다.
+    /// @param seed 앞선 해시를 주면 여러 구간을 이어서 하나의 해시로 만들 수 있습니다.
+    inline uint64_t hash64(const void* data, size_t size, uint64_t seed = 0) {
+        using namespace hash_detail;
+        alignas(16) uint64_t acc[8] = {
+            seed ^ PRIME64_1, seed + PRIME64_2, seed ^ PRIME32_1, seed - PRIME64_1,
+            seed ^ PRIME64_2, seed + PRIME32_1, seed ^ ~PRIME64_1, seed - PRIME64_2
+        };
+        const uint8_t* p = (const uint8_t*)data;
+        size_t stripes = size / STRIPE;
+        while (stripes >= STRIPES_PER_BLOCK) {
+            accumulate(acc, p, STRIPES_PER_BLOCK);
+            scramble(acc);
+            p += STRIPE * STRIPES_PER_BLOCK;
+            stripes -= STRIPES_PER_BLOCK;
+        }
+        accumulate(acc, p, stripes);
+        p += STRIPE * stripes;
+        if (const size_t rest = size % STRIPE) {
+            alignas(16) uint8_t last[STRIPE] = {};
+            std::memcpy(last, p, rest);
+            accumulate(acc, last, 1);
+        }
+        uint64_t h = size * PRIME64_1 + seed;
+        for (int i = 0; i < 8; i++) {
+            h += fmix64(acc[i] ^ SCRAMBLE_KEY[i]);
+            h = rotl64(h, 31) * PRIME64_2;
+        }
+        return fmix64(h);
+    }
+}
+
+#endif
@@ -605,7 +605,7 @@ namespace onart {
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, src);
     }
 
-    void GLMachine::StreamTexture::updateBy(std::function<void(void*, uint32_t)> function) {
+    void GLMachine::StreamTexture::updateBy(FunctionRef<void(void*, uint32_t)> function) {
         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
         void* data = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
         function(data, width * 4);
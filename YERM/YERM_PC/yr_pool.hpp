@@ -22,8 +22,10 @@
 #include <mutex>
 #include <new>
 #include <forward_list>
+#include <atomic>
 
 #include "logger.hpp"
+#include "yr_compiler_specific.hpp"
 
 namespace onart{
     /// @brief 일정량의 데이터를 보유하는 메모리 풀입니다. shared_ptr를 하나씩 꺼낼 수 있으며, 더 꺼낼 것이 없는 경우 빈 포인터를 리턴합니다. 여기서 꺼낸 포인터에 대하여 명시적으로 delete를 수행할 수 없습니다.
@@ -245,6 +247,180 @@ namespace onart{
                 return ret;
             }
     };
+
+    /// @brief 크기와 정렬이 같은 메모리 블록을 여러 스레드가 잠금 없이 꺼내고 돌려놓을 수 있는 풀입니다.
+    /// 빈 블록은 슬롯 번호로 이은 Treiber 스택에 있으며, ABA 문제를 피하기 위해 스택 머리에 번호와 함께 변경 횟수를 둡니다.
+    /// 스택이 비었을 때만 잠금을 잡고 묶음(chunk) 단위로 늘리며, 늘어난 메모리는 풀이 소멸할 때까지 해제하지 않으므로 정상 상태에서는 할당과 해제가 없습니다.
+    /// 풀은 복사와 이동이 불가능합니다.
+    class LockFreeBlockPool{
+        public:
+            /// @brief 풀이 만들 수 있는 최대 묶음 수
+            constexpr static size_t MAX_CHUNKS = 4096;
+            /// @param blockSize 블록 하나의 크기(바이트)
+            /// @param alignment 블록 시작 주소의 정렬 단위. 2의 거듭제곱이어야 합니다.
+            /// @param blocksPerChunk 한 번에 늘릴 블록 수. 프레임처럼 큰 블록이면 1에 가깝게 줍니다.
+            inline LockFreeBlockPool(size_t blockSize, size_t alignment = 64, size_t blocksPerChunk = 16)
+                :size(blockSize), perChunk(blocksPerChunk ? blocksPerChunk : 1) {
+                if(alignment < alignof(Header)) alignment = alignof(Header);
+                align = alignment;
+                payloadOffset = (sizeof(Header) + align - 1) / align * align;
+                stride = (payloadOffset + size + align - 1) / align * align;
+                for(auto& c: chunks) c.store(nullptr, std::memory_order_relaxed);
+            }
+            inline ~LockFreeBlockPool(){
+                if(available() != capacity()) {
+                    LOGWITH("FATAL ERROR: A POOL DESTROYED BEFORE THE ENTITIES INSIDE. You can Ignore this if this is called after the main function have returned");
+                }
+                const uint32_t n = chunkCount.load();
+                for(uint32_t i = 0; i < n; i++) aligned_free(chunks[i].load());
+            }
+            LockFreeBlockPool(const LockFreeBlockPool&) = delete;
+            LockFreeBlockPool& operator=(const LockFreeBlockPool&) = delete;
+
+            /// @brief 블록 하나를 꺼냅니다. 빈 블록이 없으면 풀을 늘립니다.
+            /// @return 메모리 할당에 실패했거나 최대 묶음 수에 도달하면 nullptr
+            inline void* acquire(){
+                uint64_t h = head.load(std::memory_order_acquire);
+                while(true){
+                    const uint32_t top = (uint32_t)h;
+                    if(top == 0) {
+                        void* p = nullptr;
+                        if(!grow(p)) return nullptr;
+                        if(p) return p;
+                        h = head.load(std::memory_order_acquire); // 다른 스레드가 먼저 늘렸으므로 다시 시도. 그 사이 다 꺼내졌으면 다시 늘림
+                        continue;
+                    }
+                    Header* hd = header(top - 1);
+                    const uint32_t next = hd->next.load(std::memory_order_relaxed); // 다른 스레드가 먼저 가져갔다면 CAS가 실패하므로 값은 버려짐
+                    if(head.compare_exchange_weak(h, tagged(h, next), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                        freeCount.fetch_sub(1, std::memory_order_relaxed);
+                        return (uint8_t*)hd + payloadOffset;
+                    }
+                }
+            }
+            /// @brief 이 풀에서 꺼낸 블록을 돌려놓습니다. 어느 스레드에서든 호출할 수 있습니다.
+            inline void release(void* block){
+                if(!block) return;
+                Header* hd = fromPayload(block);
+                push(hd, hd);
+                freeCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            /// @brief AVBufferRef 해제 콜백과 같은 형태로, opaque로 풀을 받아 블록을 돌려놓습니다.
+            inline static void releaseOpaque(void* opaque, uint8_t* data){
+                reinterpret_cast<LockFreeBlockPool*>(opaque)->release(data);
+            }
+            /// @brief 블록마다 하나씩 둘 수 있는 사용자 값입니다. 블록이 풀로 돌아가도 유지되므로, 블록에 붙인 자원(예: 외부 메모리 가져오기)을 재사용할 때 씁니다. 처음에는 nullptr입니다.
+            inline void*& userData(void* block){ return fromPayload(block)->user; }
+            /// @brief 블록 하나의 크기(바이트)
+            inline size_t blockSize() const { return size; }
+            /// @brief 지금까지 만든 블록 수
+            inline size_t capacity() const { return (size_t)chunkCount.load(std::memory_order_acquire) * perChunk; }
+            /// @brief 풀에 들어 있는 블록 수. 다른 스레드가 동시에 사용 중이면 근사값입니다.
+            inline size_t available() const { return freeCount.load(std::memory_order_relaxed); }
+            /// @brief 지금까지 만든 모든 블록과 그 사용자 값에 대하여 함수를 호출합니다. 다른 스레드가 풀을 사용하지 않을 때 호출해야 합니다.
+            /// @param fn void(void* block, void*& userData) 형태
+            template<class F>
+            inline void forEachBlock(F&& fn){
+                const uint32_t n = (uint32_t)capacity();
+                for(uint32_t i = 0; i < n; i++) {
+                    Header* hd = header(i);
+                    fn((void*)((uint8_t*)hd + payloadOffset), hd->user);
+                }
+            }
+        private:
+            struct Header{
+                std::atomic<uint32_t> next; // 스택에서 아래 슬롯 번호 + 1. 0이면 끝
+                uint32_t index;
+                void* user;
+            };
+            inline static uint64_t tagged(uint64_t old, uint32_t top) { return (((old >> 32) + 1) << 32) | top; }
+            inline Header* header(uint32_t index) const {
+                return reinterpret_cast<Header*>(chunks[index / perChunk].load(std::memory_order_acquire) + (index % perChunk) * stride);
+            }
+            inline Header* fromPayload(void* block) const { return reinterpret_cast<Header*>((uint8_t*)block - payloadOffset); }
+            /// @brief first부터 next로 이어진 last까지를 한 번에 스택에 올립니다.
+            inline void push(Header* first, Header* last){
+                uint64_t h = head.load(std::memory_order_relaxed);
+                do {
+                    last->next.store((uint32_t)h, std::memory_order_relaxed);
+                } while(!head.compare_exchange_weak(h, tagged(h, first->index + 1), std::memory_order_release, std::memory_order_relaxed));
+            }
+            /// @brief 묶음 하나를 만들어 첫 블록을 block에 주고 나머지를 스택에 올립니다. 다른 스레드가 먼저 늘렸으면 block은 nullptr로 둡니다.
+            /// @return 최대 묶음 수에 도달했거나 메모리 할당에 실패하면 false
+            inline bool grow(void*& block){
+                std::unique_lock<std::mutex> _(growGuard);
+                if((uint32_t)head.load(std::memory_order_acquire) != 0) return true;
+                const uint32_t c = chunkCount.load(std::memory_order_relaxed);
+                if(c >= MAX_CHUNKS) return false;
+                uint8_t* chunk = (uint8_t*)aligned_malloc(align, stride * perChunk);
+                if(!chunk) return false;
+                const uint32_t base = c * (uint32_t)perChunk;
+                for(size_t i = 0; i < perChunk; i++) {
+                    Header* hd = new(chunk + i * stride) Header;
+                    hd->index = base + (uint32_t)i;
+                    hd->user = nullptr;
+                    hd->next.store(base + (uint32_t)i + 2, std::memory_order_relaxed);
+                }
+                chunks[c].store(chunk, std::memory_order_release);
+                chunkCount.store(c + 1, std::memory_order_release);
+                if(perChunk > 1) {
+                    freeCount.fetch_add(perChunk - 1, std::memory_order_relaxed);
+                    push(header(base + 1), header(base + (uint32_t)perChunk - 1));
+                }
+                block = chunk + payloadOffset;
+                return true;
+            }
+            size_t size, perChunk, align, payloadOffset, stride;
+            alignas(64) std::atomic<uint64_t> head{0}; // 상위 32비트: 변경 횟수, 하위 32비트: 맨 위 슬롯 번호 + 1
+            alignas(64) std::atomic<size_t> freeCount{0};
+            std::atomic<uint32_t> chunkCount{0};
+            std::mutex growGuard;
+            std::atomic<uint8_t*> chunks[MAX_CHUNKS];
+    };
+
+    /// @brief 여러 스레드가 잠금 없이 객체를 만들고 돌려놓을 수 있는 풀입니다. 최대 크기는 정해져 있지 않으며 @ref LockFreeBlockPool 과 같이 필요할 때 묶음 단위로 늘어납니다.
+    /// 스레드 간에 오가는 프레임, 패킷, 스테이징 버퍼의 메타데이터에 사용합니다. 풀은 복사와 이동이 불가능합니다.
+    /// @tparam T 개별 객체의 타입입니다.
+    /// @tparam CHUNK 한 번에 늘릴 객체 수입니다.
+    template<class T, size_t CHUNK = 64>
+    struct LockFreePool{
+        /// @brief @ref get 으로 얻은 포인터가 소멸할 때 객체를 풀로 돌려놓습니다.
+        struct Returner{
+            LockFreePool* pool;
+            inline void operator()(T* p) const { pool->returnRaw(p); }
+        };
+        using Handle = std::unique_ptr<T, Returner>;
+        inline LockFreePool():blocks(sizeof(T), alignof(T), CHUNK) {}
+        LockFreePool(const LockFreePool&) = delete;
+        LockFreePool& operator=(const LockFreePool&) = delete;
+
+        /// @brief 풀에서 객체 하나를 초기화하여 얻어옵니다. 소멸하면 자동으로 풀에 돌아가며, shared_ptr와 달리 제어 블록을 할당하지 않습니다.
+        /// @return 메모리가 부족하면 빈 포인터를 리턴합니다.
+        template<class... Args>
+        inline Handle get(Args&&... args){
+            return Handle(getRaw(std::forward<Args>(args)...), Returner{this});
+        }
+        /// @brief 풀에서 객체 하나를 초기화하여 기본 포인터 형태로 얻어옵니다. 명시적으로 @ref returnRaw 를 통해 돌려놓아야 합니다.
+        /// @return 메모리가 부족하면 빈 포인터를 리턴합니다.
+        template<class... Args>
+        inline T* getRaw(Args&&... args){
+            void* p = blocks.acquire();
+            if(!p) return nullptr;
+            return new(p) T(std::forward<Args>(args)...);
+        }
+        /// @brief 이 풀에서 나온 객체를 소멸시키고 풀에 되돌려 놓습니다. 어느 스레드에서든 호출할 수 있습니다.
+        inline void returnRaw(T* p){
+            if(!p) return;
+            p->~T();
+            blocks.release(p);
+        }
+        /// @brief 지금까지 만든 객체 자리 수
+        inline size_t capacity() const { return blocks.capacity(); }
+        /// @brief 비어 있는 객체 자리 수
+        inline size_t available() const { return blocks.available(); }
+    private:
+        LockFreeBlockPool blocks;
+    };
 }
 
 #endif
\ No newline at end of file
@@ -23,6 +23,11 @@
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <memory>
+#include <cstddef>
+#include <new>
+#include <algorithm>
+#include <type_traits>
 
 namespace onart{
 
@@ -130,28 +135,122 @@ namespace onart{
         std::vector<uint32_t> ind;
     };
 
-    /// @brief 작업을 비동기적으로 수행하기 위한 스레드 풀입니다. 스레드 수는 런타임에 정할 수 있으며 최대 스레드 수는 8입니다. 스레드 수를 0으로 정할 수도 있으며 이때는 post를 해도 아무 동작도 하지 않습니다.
+    /// @brief 작업 훔치기(work stealing) 방식의 작업 덱입니다. 소유 스레드만 push/pop으로 뒤쪽을 쓰고, 다른 스레드는 steal로 앞쪽에서 가져갑니다. (Chase-Lev)
+    /// 가득 차면 2배로 커지며, 교체된 배열은 다른 스레드가 아직 읽고 있을 수 있어 소멸 시에 해제합니다.
+    template<class T>
+    class WorkStealingDeque{
+        public:
+            inline WorkStealingDeque(int64_t capacity = 256) {
+                Array* a = new Array(capacity);
+                retired.emplace_back(a);
+                array.store(a, std::memory_order_relaxed);
+            }
+            /// @brief 뒤쪽에 넣습니다. 소유 스레드만 호출할 수 있습니다.
+            inline void push(T* item) {
+                const int64_t b = bottom.load(std::memory_order_relaxed);
+                const int64_t t = top.load(std::memory_order_acquire);
+                Array* a = array.load(std::memory_order_relaxed);
+                if(b - t > a->capacity - 1) {
+                    Array* grown = new Array(a->capacity * 2);
+                    for(int64_t i = t; i < b; i++) grown->put(i, a->get(i));
+                    retired.emplace_back(grown);
+                    array.store(grown, std::memory_order_release);
+                    a = grown;
+                }
+                a->put(b, item);
+                std::atomic_thread_fence(std::memory_order_release);
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            /// @brief 뒤쪽에서 꺼냅니다. 소유 스레드만 호출할 수 있습니다. 비었으면 nullptr
+            inline T* pop() {
+                const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+                Array* a = array.load(std::memory_order_relaxed);
+                bottom.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                int64_t t = top.load(std::memory_order_relaxed);
+                if(t > b) {
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                T* item = a->get(b);
+                if(t == b) { // 마지막 하나는 steal과 경쟁
+                    if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) item = nullptr;
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                }
+                return item;
+            }
+            /// @brief 앞쪽에서 가져옵니다. 어느 스레드든 호출할 수 있습니다. 비었거나 다른 스레드와의 경쟁에서 지면 nullptr
+            inline T* steal() {
+                int64_t t = top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                const int64_t b = bottom.load(std::memory_order_acquire);
+                if(t >= b) return nullptr;
+                Array* a = array.load(std::memory_order_acquire);
+                T* item = a->get(t);
+                if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+                return item;
+            }
+            /// @brief 대략적인 원소 수
+            inline size_t size() const {
+                const int64_t n = bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed);
+                return n > 0 ? (size_t)n : 0;
+            }
+        private:
+            struct Array{
+                int64_t capacity;
+                std::unique_ptr<std::atomic<T*>[]> slots;
+                inline Array(int64_t capacity):capacity(capacity), slots(new std::atomic<T*>[capacity]) {}
+                inline T* get(int64_t i) const { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+                inline void put(int64_t i, T* item) { slots[i & (capacity - 1)].store(item, std::memory_order_relaxed); }
+            };
+            alignas(64) std::atomic<int64_t> top{0};
+            alignas(64) std::atomic<int64_t> bottom{0};
+            std::atomic<Array*> array{};
+            std::vector<std::unique_ptr<Array>> retired;
+    };
+
+    /// @brief 작업을 비동기적으로 수행하기 위한 스레드 풀입니다. 스레드 수는 런타임에 정할 수 있습니다. 스레드 수를 0으로 정할 수도 있으며 이때는 post를 해도 아무 동작도 하지 않습니다.
+    /// 각 워커는 자기 작업 덱을 가지며, 워커 스레드 안에서 넣은 작업은 자기 덱에, 그 외 스레드에서 넣은 작업은 공용 큐에 들어갑니다.
+    /// 할 일이 없는 워커는 공용 큐와 다른 워커의 덱에서 작업을 훔쳐 오고, 잠시 돌며 기다린 뒤에도 없으면 잠듭니다.
+    /// strand는 각자의 FIFO 큐를 가지며 큐 전체가 하나의 작업으로 스케줄되므로, 같은 strand의 작업은 넣은 순서대로 한 번에 하나씩만 실행됩니다.
     class ThreadPool{
         public:
+            /// @brief 풀에서 실행되는 작업 단위입니다. 복사 없이 넣을 수 있도록 호출자가 수명을 관리합니다.
+            struct Job{
+                /// @brief 워커에서 호출됩니다. 이 함수가 리턴한 뒤에는 풀이 Job을 다시 건드리지 않습니다.
+                void (*run)(Job*) = nullptr;
+                /// @brief 실행되지 못하고 버려질 때(@ref cancelAll, 풀 소멸) 호출됩니다. nullptr이면 아무것도 하지 않습니다.
+                void (*discard)(Job*) = nullptr;
+            };
             inline ThreadPool(size_t n = 1) {
-                if(n > 8) n = 8;
                 if(n == 0) return;
-                workers.reserve(n);
                 afterService.reserve(256);
                 afterService2.reserve(256);
+                for(size_t i = 0; i < 256; i++) strands[i].pool = this;
+                queues.reserve(n);
+                for(size_t i = 0; i < n; i++) queues.emplace_back(new WorkStealingDeque<Job>);
+                workers.reserve(n);
                 for(size_t i = 0; i < n; i++){
                     workers.emplace_back([this, i](){execute(this, i);});
                 }
             }
             inline ~ThreadPool() {
-                stop = true;
-                cond.notify_all();
+                {
+                    std::unique_lock<std::mutex> _(parkGuard);
+                    stop = true;
+                }
+                parkCond.notify_all();
                 for(std::thread& t: workers) t.join();
+                for(auto& q: queues) { while(Job* j = q->pop()) drop(j); }
+                for(Job* j: injected) drop(j);
+                for(StrandQueue& sq: strands) { for(PostedWork* w: sq.works) delete w; }
             }
+            /// @brief 워커 스레드 수를 리턴합니다.
+            inline size_t size() const { return workers.size(); }
             /// @brief 스레드 풀에 진행 중이거나 대기 중인 작업이 있는지 리턴합니다.
             inline bool waiting(uint8_t strand = 0) const {
                 if(strand){
-                    return holders[strand] & 0xffff;
+                    return strands[strand].count.load() != 0;
                 }
                 else{
                     return workCount.load();
@@ -160,14 +259,57 @@ namespace onart{
             /// @brief 풀에 특정 함수를 요청합니다.
             /// @param work 스레드에서 실행할 함수입니다.
             /// @param completionHandler 함수가 완료되면 handleCompleted()에서 실행할 함수입니다. 주어지는 인수는 work 함수의 리턴값입니다.
-            /// @param strand 동시 실행이 불가능한 그룹입니다. 즉 같은 strand값이 주어진 것끼리 같은 스레드에 배치됩니다. 0을 주면 그룹에 속하지 않아 어떤 스레드에도 배치될 수 있습니다.
+            /// @param strand 동시 실행이 불가능한 그룹입니다. 즉 같은 strand값이 주어진 것끼리는 넣은 순서대로 하나씩 실행됩니다. 0을 주면 그룹에 속하지 않아 다른 작업과 동시에 실행될 수 있습니다.
             inline void post(const std::function<variant8()>& work, const std::function<void(variant8)>& completionHandler = {}, uint8_t strand = 0) {
-                if(!work) return;
+                if(!work || workers.empty()) return;
                 workCount++;
-                std::unique_lock<std::mutex> _(queueGuard);
-                const bool toSignal = works.empty();
-                works.enqueue({work, completionHandler, strand});
-                if(toSignal) cond.notify_one();
+                PostedWork* pw = new PostedWork;
+                pw->run = PostedWork::runFree;
+                pw->discard = PostedWork::discardFree;
+                pw->pool = this;
+                pw->work = work;
+                pw->handler = completionHandler;
+                pw->epoch = epoch.load(std::memory_order_relaxed);
+                if(strand){
+                    StrandQueue& sq = strands[strand];
+                    sq.count++;
+                    bool toSchedule;
+                    {
+                        std::unique_lock<std::mutex> _(sq.guard);
+                        sq.works.push_back(pw);
+                        toSchedule = !sq.scheduled;
+                        sq.scheduled = true;
+                    }
+                    if(toSchedule) submit(&sq);
+                }
+                else{
+                    submit(pw);
+                }
+            }
+            /// @brief 작업 단위를 그대로 넣습니다. 완료 처리와 strand가 없으며 @ref waiting 에 포함되지 않습니다. job은 run이 리턴할 때까지 유효해야 합니다.
+            inline void submit(Job* job) {
+                if(workers.empty()) return;
+                if(local.pool == this) {
+                    queues[local.index]->push(job);
+                }
+                else{
+                    std::unique_lock<std::mutex> _(injectGuard);
+                    injected.push_back(job);
+                }
+                pending.fetch_add(1);
+                if(sleepers.load() > 0) {
+                    std::unique_lock<std::mutex> _(parkGuard);
+                    parkCond.notify_one();
+                }
+            }
+            /// @brief 대기 중인 작업을 하나 가져와 현재 스레드에서 실행합니다. 다른 작업을 기다리는 동안 호출하면 교착 없이 진행을 돕습니다.
+            /// @return 실행한 작업이 있으면 true
+            inline bool runOne() {
+                const size_t self = local.pool == this ? local.index : SIZE_MAX;
+                Job* job = find(self);
+                if(!job) return false;
+                job->run(job);
+                return true;
             }
             /// @brief 완료된 동작에 대하여 등록한 후처리를 수행합니다.
             inline void handleCompleted(){
@@ -179,87 +321,343 @@ namespace onart{
             }
             /// @brief 대기 중인 함수를 모두 제거합니다. 실행 중인 함수는 제거되지 않습니다.
             inline void cancelAll(){
-                std::unique_lock<std::mutex> _(queueGuard);
-                works.clear();
-                workCount = 0;
+                epoch++; // 이미 덱에 들어간 작업은 꺼낼 때 버림
+                for(StrandQueue& sq: strands){
+                    std::unique_lock<std::mutex> _(sq.guard);
+                    for(PostedWork* w: sq.works) {
+                        sq.count--;
+                        workCount--;
+                        delete w;
+                    }
+                    sq.works.clear();
+                }
             }
         private:
-            inline static void execute(ThreadPool* pool, const size_t tid) {
-                while(!pool->stop){
-                    std::unique_lock<std::mutex> _(pool->queueGuard);
-                    WorkWithStrand wws = pool->getWork(tid);
-                    if (!wws.work) {
-                        pool->cond.wait(_);
-                        if (pool->stop) return;
-                        continue;
-                    }
-                    _.unlock();
-                    if(wws.work){
-                        variant8 result = wws.work();
-                        pool->release(wws.strand, tid);
-                        if(wws.handler){
-                            std::unique_lock<std::mutex> _(pool->asGuard);
-                            pool->afterService.push_back({wws.handler, result});
+            /// @brief 유휴 워커가 잠들기 전에 작업을 찾아 도는 횟수
+            constexpr static int SPIN_BEFORE_PARK = 256;
+            struct PostedWork: Job{
+                ThreadPool* pool;
+                std::function<variant8()> work;
+                std::function<void(variant8)> handler;
+                uint32_t epoch;
+                inline static void runFree(Job* j) {
+                    PostedWork* self = static_cast<PostedWork*>(j);
+                    self->pool->runPosted(self);
+                    self->pool->workCount--;
+                    delete self;
+                }
+                inline static void discardFree(Job* j) {
+                    PostedWork* self = static_cast<PostedWork*>(j);
+                    self->pool->workCount--;
+                    delete self;
+                }
+            };
+            /// @brief strand 하나의 대기열. 비어 있지 않은 동안 자신이 하나의 Job으로 풀에 들어가 있습니다.
+            struct StrandQueue: Job{
+                ThreadPool* pool = nullptr;
+                std::mutex guard;
+                std::deque<PostedWork*> works;
+                std::atomic_uint32_t count{};
+                bool scheduled = false;
+                inline StrandQueue() { run = runFree; }
+                inline static void runFree(Job* j) {
+                    StrandQueue* self = static_cast<StrandQueue*>(j);
+                    PostedWork* pw = nullptr;
+                    {
+                        std::unique_lock<std::mutex> _(self->guard);
+                        if(!self->works.empty()) {
+                            pw = self->works.front();
+                            self->works.pop_front();
                         }
                     }
+                    ThreadPool* pool = self->pool;
+                    if(pw) {
+                        pool->runPosted(pw);
+                        self->count--;
+                        pool->workCount--;
+                        delete pw;
+                    }
+                    bool again;
+                    {
+                        std::unique_lock<std::mutex> _(self->guard);
+                        again = !self->works.empty();
+                        self->scheduled = again;
+                    }
+                    if(again) pool->submit(self); // 남은 것은 다시 하나의 Job으로. 다른 워커가 훔쳐 가도 순서는 유지됨
+                }
+            };
+            struct WorkCompleteHandler{
+                std::function<void(variant8)> handler;
+                variant8 param;
+            };
+            struct WorkerLocal{
+                ThreadPool* pool;
+                size_t index;
+            };
+            inline void runPosted(PostedWork* pw) {
+                if(pw->epoch != epoch.load(std::memory_order_relaxed)) return; // cancelAll 이전에 들어온 것
+                variant8 result = pw->work();
+                if(pw->handler){
+                    std::unique_lock<std::mutex> _(asGuard);
+                    afterService.push_back({std::move(pw->handler), result});
                 }
             }
-            struct WorkWithStrand;
-            inline WorkWithStrand getWork(size_t tid){
-                const WorkWithStrand* prev = nullptr;
-                const WorkWithStrand* node = works.peek();
-                while(node){
-                    if(node->strand) {
-                        std::unique_lock<std::mutex> _(strandGuard);
-                        if((holders[node->strand] >> 16) == tid) {
-                            holders[node->strand]++;
-                            works.erase(prev);
-                            return *node;
-                        }
-                        else if((holders[node->strand] & 0xffff) == 0){
-                            holders[node->strand] = ((uint32_t)tid << 16) + 1;
-                            works.erase(prev);
-                            return *node;
-                        }
-                        else{
-                            prev = node;
-                            node = works.next(node);
-                        }
+            inline static void drop(Job* j) {
+                if(j->discard) j->discard(j);
+            }
+            /// @brief 자기 덱, 공용 큐, 다른 워커의 덱 순서로 작업을 찾습니다.
+            inline Job* find(size_t self) {
+                Job* job = nullptr;
+                if(self < queues.size()) job = queues[self]->pop();
+                if(!job) {
+                    std::unique_lock<std::mutex> _(injectGuard, std::try_to_lock);
+                    if(_.owns_lock() && !injected.empty()) {
+                        job = injected.front();
+                        injected.pop_front();
                     }
-                    else{
-                        works.erase(prev);
-                        return *node;
+                }
+                if(!job) {
+                    const size_t n = queues.size();
+                    const size_t start = self < n ? self + 1 : 0;
+                    for(size_t i = 0; i < n && !job; i++) {
+                        const size_t victim = (start + i) % n;
+                        if(victim != self) job = queues[victim]->steal();
                     }
                 }
-                return {};
+                if(job) pending.fetch_sub(1);
+                return job;
             }
-            inline void release(uint32_t strand, size_t tid) {
-                workCount--;
-                if(strand){
-                    std::unique_lock<std::mutex> _(strandGuard);
-                    holders[strand]--;
+            inline static void execute(ThreadPool* pool, const size_t tid) {
+                local.pool = pool;
+                local.index = tid;
+                int idle = 0;
+                while(!pool->stop){
+                    if(Job* job = pool->find(tid)) {
+                        job->run(job);
+                        idle = 0;
+                        continue;
+                    }
+                    if(++idle < SPIN_BEFORE_PARK) {
+                        if(pool->pending.load(std::memory_order_relaxed) == 0) std::this_thread::yield();
+                        continue;
+                    }
+                    idle = 0;
+                    std::unique_lock<std::mutex> _(pool->parkGuard);
+                    pool->sleepers++;
+                    while(!pool->stop && pool->pending.load() == 0) pool->parkCond.wait(_);
+                    pool->sleepers--;
                 }
+                local.pool = nullptr;
             }
-            std::mutex queueGuard;
-            std::mutex strandGuard;
+            inline static thread_local WorkerLocal local; // 정적 수명이므로 0으로 초기화됨
+            std::vector<std::unique_ptr<WorkStealingDeque<Job>>> queues;
+            std::mutex injectGuard;
+            std::deque<Job*> injected;
+            std::mutex parkGuard;
+            std::condition_variable parkCond;
             std::mutex asGuard;
-            std::condition_variable cond;
-            struct WorkWithStrand{
-                std::function<variant8()> work;
-                std::function<void(variant8)> handler;
-                uint32_t strand;
-            };
-            struct WorkCompleteHandler{
-                std::function<void(variant8)> handler;
-                variant8 param;
-            };
-            ReservedQueue<WorkWithStrand> works;
             std::vector<WorkCompleteHandler> afterService;
             std::vector<WorkCompleteHandler> afterService2;
             std::vector<std::thread> workers;
-            uint32_t holders[256]{};
+            StrandQueue strands[256];
             std::atomic_uint32_t workCount{};
-            bool stop = false;
+            std::atomic_uint32_t epoch{};
+            std::atomic_int64_t pending{}; // 덱과 공용 큐에 들어 있는 Job 수
+            std::atomic_int32_t sleepers{};
+            std::atomic_bool stop{false};
+    };
+
+    /// @brief @ref parallel_for 가 한 번에 풀에 넣는 도우미 수의 상한
+    constexpr size_t MAX_PARALLEL_HELPERS = 63;
+
+    /// @brief 구간 [begin, end)를 grain 크기 조각으로 나누어 풀의 워커와 호출 스레드가 함께 처리하고, 모두 끝나면 리턴합니다.
+    /// 조각 수만큼 Job을 만들지 않고 워커 수만큼의 도우미가 공유 카운터에서 조각을 가져가므로 작업 단위마다 할당이 없습니다.
+    /// 워커 안에서 호출해도 기다리는 동안 다른 작업을 실행하므로 교착되지 않습니다.
+    /// @param fn void(size_t begin, size_t end) 형태로, 서로 다른 조각에 대해 동시에 호출될 수 있습니다.
+    template<class F>
+    inline void parallel_for(ThreadPool& pool, size_t begin, size_t end, size_t grain, const F& fn) {
+        if(begin >= end) return;
+        if(grain == 0) grain = 1;
+        const size_t chunks = (end - begin + grain - 1) / grain;
+        const size_t helpers = std::min(chunks - 1, std::min(pool.size(), (size_t)MAX_PARALLEL_HELPERS));
+        if(helpers == 0) {
+            fn(begin, end);
+            return;
+        }
+        struct Shared{
+            const F* fn;
+            size_t end, grain;
+            std::atomic<size_t> next;
+            std::atomic<size_t> running;
+            inline void work() {
+                size_t b;
+                while((b = next.fetch_add(grain, std::memory_order_relaxed)) < end) {
+                    (*fn)(b, std::min(b + grain, end));
+                }
+            }
+        } shared{&fn, end, grain, {begin}, {helpers}};
+        struct Helper: ThreadPool::Job{
+            Shared* shared;
+        } helperJobs[MAX_PARALLEL_HELPERS];
+        for(size_t i = 0; i < helpers; i++) {
+            helperJobs[i].shared = &shared;
+            helperJobs[i].run = [](ThreadPool::Job* j) {
+                Shared* sh = static_cast<Helper*>(j)->shared;
+                sh->work();
+                sh->running.fetch_sub(1, std::memory_order_release);
+            };
+            pool.submit(&helperJobs[i]);
+        }
+        shared.work();
+        // 아직 시작하지 않은 도우미도 스택의 Job을 참조하므로 모두 끝날 때까지 기다림
+        while(shared.running.load(std::memory_order_acquire)) {
+            if(!pool.runOne()) std::this_thread::yield();
+        }
+    }
+
+    /// @brief 여러 작업을 풀에 나누어 넣고 한꺼번에 기다리는 fork/join 그룹입니다. 작은 함수 객체는 그룹 안의 저장소에 두므로 작업마다 할당하지 않습니다.
+    /// 소멸 시 남은 작업을 기다립니다. 풀의 스레드 수가 0이면 run에서 바로 실행합니다.
+    class TaskGroup{
+        public:
+            inline TaskGroup(ThreadPool& pool):pool(pool) {}
+            inline ~TaskGroup() { wait(); }
+            TaskGroup(const TaskGroup&) = delete;
+            TaskGroup& operator=(const TaskGroup&) = delete;
+            /// @brief 작업을 넣습니다. 함수 객체는 @ref wait 가 리턴할 때까지 유지됩니다.
+            /// @param fn void() 형태
+            template<class F>
+            inline void run(F&& fn) {
+                using Fn = typename std::decay<F>::type;
+                if(pool.size() == 0) {
+                    fn();
+                    return;
+                }
+                Slot& slot = nextSlot();
+                if constexpr(sizeof(Fn) <= Slot::INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t)) {
+                    new(slot.storage) Fn(std::forward<F>(fn));
+                    slot.invoke = [](Slot* s) { (*std::launder(reinterpret_cast<Fn*>(s->storage)))(); };
+                    slot.destroy = [](Slot* s) { std::launder(reinterpret_cast<Fn*>(s->storage))->~Fn(); };
+                }
+                else {
+                    *reinterpret_cast<Fn**>(slot.storage) = new Fn(std::forward<F>(fn));
+                    slot.invoke = [](Slot* s) { (**reinterpret_cast<Fn**>(s->storage))(); };
+                    slot.destroy = [](Slot* s) { delete *reinterpret_cast<Fn**>(s->storage); };
+                }
+                slot.group = this;
+                slot.run = [](ThreadPool::Job* j) {
+                    Slot* s = static_cast<Slot*>(j);
+                    TaskGroup* g = s->group;
+                    s->invoke(s);
+                    g->pending.fetch_sub(1, std::memory_order_release);
+                };
+                pending.fetch_add(1, std::memory_order_relaxed);
+                pool.submit(&slot);
+            }
+            /// @brief 넣은 작업이 모두 끝날 때까지 기다립니다. 기다리는 동안 호출 스레드도 풀의 작업을 실행합니다.
+            inline void wait() {
+                while(pending.load(std::memory_order_acquire)) {
+                    if(!pool.runOne()) std::this_thread::yield();
+                }
+                for(size_t i = 0; i < used; i++) {
+                    Slot& s = slots[i / CHUNK][i % CHUNK];
+                    s.destroy(&s);
+                }
+                used = 0;
+            }
+        private:
+            struct Slot: ThreadPool::Job{
+                constexpr static size_t INLINE_SIZE = 64;
+                alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+                void (*invoke)(Slot*);
+                void (*destroy)(Slot*);
+                TaskGroup* group;
+            };
+            constexpr static size_t CHUNK = 32;
+            inline Slot& nextSlot() {
+                if(used / CHUNK >= slots.size()) slots.emplace_back(new Slot[CHUNK]);
+                Slot& s = slots[used / CHUNK][used % CHUNK];
+                used++;
+                return s;
+            }
+            ThreadPool& pool;
+            std::vector<std::unique_ptr<Slot[]>> slots; // 자리를 옮기지 않도록 묶음 단위로 늘림
+            size_t used = 0;
+            std::atomic<size_t> pending{};
+    };
+
+    /// @brief 의존 관계가 있는 작업들의 그래프입니다. 한 번 구성해 두고 매 프레임 @ref run 으로 반복 실행하는 용도이며, 실행 중에는 할당이 없습니다.
+    /// 선행 작업이 모두 끝난 노드부터 풀에 들어가고, run은 모든 노드가 끝나면 리턴합니다. 순환이 있으면 안 됩니다.
+    class TaskGraph{
+        public:
+            using Node = size_t;
+            /// @brief 노드를 추가합니다.
+            /// @param fn 실행할 함수
+            /// @return 의존 관계 지정에 쓰이는 노드 번호
+            inline Node add(std::function<void()> fn) {
+                nodes.emplace_back(new Vertex);
+                nodes.back()->fn = std::move(fn);
+                nodes.back()->graph = this;
+                nodes.back()->run = runFree;
+                return nodes.size() - 1;
+            }
+            /// @brief before가 끝난 뒤에 after가 실행되도록 합니다.
+            inline void precede(Node before, Node after) {
+                nodes[before]->successors.push_back(after);
+                nodes[after]->predecessors++;
+            }
+            /// @brief 노드 수
+            inline size_t size() const { return nodes.size(); }
+            /// @brief 그래프 전체를 실행하고 끝날 때까지 기다립니다. 기다리는 동안 호출 스레드도 풀의 작업을 실행합니다.
+            inline void run(ThreadPool& pool) {
+                if(nodes.empty()) return;
+                this->pool = &pool;
+                for(auto& v: nodes) v->remaining.store(v->predecessors, std::memory_order_relaxed);
+                left.store(nodes.size(), std::memory_order_relaxed);
+                if(pool.size() == 0) {
+                    runSerial();
+                    return;
+                }
+                for(auto& v: nodes) {
+                    if(v->predecessors == 0) pool.submit(v.get());
+                }
+                while(left.load(std::memory_order_acquire)) {
+                    if(!pool.runOne()) std::this_thread::yield();
+                }
+            }
+        private:
+            struct Vertex: ThreadPool::Job{
+                std::function<void()> fn;
+                std::vector<Node> successors;
+                uint32_t predecessors = 0;
+                std::atomic<uint32_t> remaining{};
+                TaskGraph* graph;
+            };
+            inline static void runFree(ThreadPool::Job* j) {
+                Vertex* v = static_cast<Vertex*>(j);
+                TaskGraph* g = v->graph;
+                if(v->fn) v->fn();
+                for(Node n: v->successors) {
+                    Vertex* next = g->nodes[n].get();
+                    if(next->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) g->pool->submit(next);
+                }
+                g->left.fetch_sub(1, std::memory_order_release);
+            }
+            inline void runSerial() {
+                std::vector<Node> ready;
+                for(Node i = 0; i < nodes.size(); i++) { if(nodes[i]->predecessors == 0) ready.push_back(i); }
+                while(!ready.empty()) {
+                    Vertex* v = nodes[ready.back()].get();
+                    ready.pop_back();
+                    if(v->fn) v->fn();
+                    for(Node n: v->successors) {
+                        if(nodes[n]->remaining.fetch_sub(1, std::memory_order_relaxed) == 1) ready.push_back(n);
+                    }
+                }
+                left.store(0, std::memory_order_relaxed);
+            }
+            std::vector<std::unique_ptr<Vertex>> nodes;
+            ThreadPool* pool = nullptr;
+            std::atomic<size_t> left{};
     };
 }
 
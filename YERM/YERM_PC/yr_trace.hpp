@@ -0,0 +1,226 @@
+// Copyright 2022 onart@github. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef __YR_TRACE_HPP__
+#define __YR_TRACE_HPP__
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace onart {
+
+    /// @brief 구간 이벤트를 스레드별로 모아 Chrome/Perfetto의 trace event JSON으로 기록합니다.
+    /// 기록 중에는 각 스레드가 자기 버퍼에만 쓰므로 잠금이 없으며, 스레드가 처음 기록할 때만 버퍼 등록을 위해 잠급니다.
+    /// 버퍼가 가득 차면 이후 이벤트는 버리고 그 수를 셉니다.
+    class Tracer {
+        public:
+            /// @brief 기록을 시작합니다. 이미 시작된 경우 아무것도 하지 않습니다. 프로그램 종료 시 자동으로 @ref stop 이 호출됩니다.
+            /// @param path 결과 JSON 파일 경로. 비어 있으면 파일을 쓰지 않으며, 이벤트는 @ref forEachEvent 로 읽습니다.
+            /// @param eventsPerThread 스레드당 최대 이벤트 수. 이전 기록부터 살아 있는 스레드는 처음 받은 버퍼 크기를 넘지 않습니다.
+            inline static void start(const char* path, uint32_t eventsPerThread = 1 << 18) {
+                Registry& reg = registry();
+                std::unique_lock<std::mutex> _(reg.guard);
+                if (reg.enabled) return;
+                // 스레드가 버퍼 주소를 계속 갖고 있으므로 버퍼는 해제하지 않고 비우기만 함. 끝난 스레드의 버퍼는 새 스레드가 다시 씀
+                for (auto& buf : reg.buffers) {
+                    buf->count.store(0, std::memory_order_relaxed);
+                    buf->dropped.store(0, std::memory_order_relaxed);
+                    buf->capacity = std::min(buf->allocated, eventsPerThread); // 살아 있는 스레드의 버퍼는 크기를 바꿀 수 없음
+                    if (!buf->owned) {
+                        buf->tid = 0;
+                        buf->name.clear();
+                    }
+                }
+                reg.path = path;
+                reg.capacity = eventsPerThread;
+                reg.origin = now();
+                if (!reg.atExit) {
+                    std::atexit([]() { stop(); });
+                    reg.atExit = true;
+                }
+                reg.enabled.store(true, std::memory_order_release);
+            }
+            /// @brief 기록을 멈추고 지금까지의 이벤트를 파일로 씁니다. 시작되지 않았으면 아무것도 하지 않습니다.
+            /// @return 파일을 썼으면 true
+            inline static bool stop() {
+                Registry& reg = registry();
+                std::unique_lock<std::mutex> _(reg.guard);
+                if (!reg.enabled) return false;
+                reg.enabled.store(false, std::memory_order_release);
+                if (reg.path.empty()) return false;
+                FILE* fp = std::fopen(reg.path.c_str(), "wb");
+                if (!fp) return false;
+                std::fputs("{\"traceEvents\":[\n", fp);
+                bool first = true;
+                uint64_t dropped = 0;
+                for (auto& buf : reg.buffers) {
+                    if (!buf->tid) continue;
+                    const uint32_t count = buf->count.load(std::memory_order_acquire);
+                    dropped += buf->dropped.load(std::memory_order_relaxed);
+                    if (!buf->name.empty()) {
+                        std::fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", buf->tid, buf->name.c_str());
+                        first = false;
+                    }
+                    for (uint32_t i = 0; i < count; i++) {
+                        const Event& ev = buf->events[i];
+                        std::fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld}", first ? "" : ",\n", ev.name, buf->tid, (long long)(ev.begin - reg.origin), (long long)(ev.end - ev.begin));
+                        first = false;
+                    }
+                }
+                std::fprintf(fp, "\n],\"otherData\":{\"dropped\":%llu}}\n", (unsigned long long)dropped);
+                std::fclose(fp);
+                return true;
+            }
+            /// @brief 마지막 기록의 이벤트마다 함수를 호출합니다. @ref stop 이후, 다음 @ref start 전에 호출해야 합니다.
+            /// @param fn void(const char* name, int64_t begin, int64_t end, uint32_t tid) 형태. 한 스레드의 이벤트는 끝난 순서로 옵니다.
+            template<class F>
+            inline static void forEachEvent(F&& fn) {
+                Registry& reg = registry();
+                std::unique_lock<std::mutex> _(reg.guard);
+                for (auto& buf : reg.buffers) {
+                    if (!buf->tid) continue;
+                    const uint32_t count = buf->count.load(std::memory_order_acquire);
+                    for (uint32_t i = 0; i < count; i++) fn(buf->events[i].name, buf->events[i].begin, buf->events[i].end, buf->tid);
+                }
+            }
+            /// @brief 기록 중인지 리턴합니다.
+            inline static bool enabled() { return registry().enabled.load(std::memory_order_relaxed); }
+            /// @brief 현재 스레드에 표시될 이름을 붙입니다. 기록 중이 아니면 무시됩니다.
+            inline static void nameThread(const char* name) {
+                if (ThreadBuffer* buf = local()) buf->name = name;
+            }
+            /// @brief 현재 스레드에 완료된 구간 하나를 기록합니다.
+            /// @param name 이벤트 이름. 정적 수명의 문자열이어야 하며 JSON 이스케이프가 필요 없어야 합니다.
+            /// @param begin, end @ref now 로 얻은 시각(us)
+            inline static void record(const char* name, int64_t begin, int64_t end) {
+                ThreadBuffer* buf = local();
+                if (!buf) return;
+                const uint32_t i = buf->count.load(std::memory_order_relaxed);
+                if (i >= buf->capacity) {
+                    buf->dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                buf->events[i] = { name, begin, end };
+                buf->count.store(i + 1, std::memory_order_release);
+            }
+            /// @brief 단조 증가 시각(us)
+            inline static int64_t now() {
+                return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            }
+        private:
+            struct Event {
+                const char* name;
+                int64_t begin, end;
+            };
+            struct ThreadBuffer {
+                std::unique_ptr<Event[]> events;
+                uint32_t allocated;
+                uint32_t capacity; // 이번 기록에서 쓸 수 있는 수. allocated 이하
+                uint32_t tid; // 0이면 다음 스레드가 가져갈 수 있음
+                bool owned = true; // 버퍼를 가진 스레드가 살아 있음. guard로 보호
+                std::atomic<uint32_t> count{ 0 };
+                std::atomic<uint64_t> dropped{ 0 };
+                std::string name;
+            };
+            struct Registry {
+                std::mutex guard;
+                std::atomic<bool> enabled{ false };
+                bool atExit = false;
+                uint32_t capacity = 0;
+                uint32_t nextTid = 1;
+                int64_t origin = 0;
+                std::string path;
+                std::vector<std::unique_ptr<ThreadBuffer>> buffers; // 프로그램이 끝날 때까지 유지
+            };
+            /// @brief 스레드가 끝날 때 버퍼를 다음 start 이후의 새 스레드에 넘깁니다.
+            struct Owner {
+                ThreadBuffer* buf = nullptr;
+                ~Owner() {
+                    if (!buf) return;
+                    Registry& reg = registry();
+                    std::unique_lock<std::mutex> _(reg.guard);
+                    buf->owned = false;
+                }
+            };
+            inline static Registry& registry() {
+                static Registry reg;
+                return reg;
+            }
+            /// @brief 현재 스레드의 버퍼. 기록 중이 아니면 nullptr
+            inline static ThreadBuffer* local() {
+                Registry& reg = registry();
+                if (!reg.enabled.load(std::memory_order_acquire)) return nullptr;
+                thread_local Owner mine;
+                if (mine.buf) return mine.buf;
+                std::unique_lock<std::mutex> _(reg.guard);
+                if (!reg.enabled) return nullptr;
+                ThreadBuffer* buf = nullptr;
+                for (auto& b : reg.buffers) {
+                    if (!b->tid) {
+                        buf = b.get();
+                        break;
+                    }
+                }
+                if (!buf) {
+                    reg.buffers.push_back(std::make_unique<ThreadBuffer>());
+                    buf = reg.buffers.back().get();
+                    buf->allocated = 0;
+                }
+                if (buf->allocated < reg.capacity) { // 아무 스레드도 쓰지 않는 버퍼이므로 바꿔도 됨
+                    buf->events.reset(new Event[reg.capacity]);
+                    buf->allocated = reg.capacity;
+                }
+                buf->capacity = reg.capacity;
+                buf->owned = true;
+                buf->tid = reg.nextTid++;
+                mine.buf = buf;
+                return buf;
+            }
+    };
+
+    /// @brief 생성부터 소멸(또는 @ref end)까지를 하나의 구간 이벤트로 기록합니다. 기록 중이 아니면 시각도 읽지 않습니다.
+    class TraceScope {
+        public:
+            inline TraceScope(const char* name) : name(name), begin(Tracer::enabled() ? Tracer::now() : 0) {}
+            inline ~TraceScope() { end(); }
+            /// @brief 구간을 일찍 끝냅니다.
+            inline void end() {
+                if (begin) Tracer::record(name, begin, Tracer::now());
+                begin = 0;
+            }
+            TraceScope(const TraceScope&) = delete;
+            TraceScope& operator=(const TraceScope&) = delete;
+        private:
+            const char* name;
+            int64_t begin;
+    };
+}
+
+#define __YR_TRACE_CAT2(a, b) a##b
+#define __YR_TRACE_CAT(a, b) __YR_TRACE_CAT2(a, b)
+#ifdef YR_NO_TRACE
+    #define YR_TRACE(name)
+#else
+    /// @brief 현재 블록을 주어진 이름의 구간으로 기록합니다.
+    #define YR_TRACE(name) ::onart::TraceScope __YR_TRACE_CAT(__yrTrace, __LINE__)(name)
+#endif
+
+#endif
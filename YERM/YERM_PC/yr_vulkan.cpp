@@ -26,6 +26,8 @@
 #endif
 #include "../externals/ktx/include/ktx.h"
 
+#include "yr_trace.hpp"
+
 #include <algorithm>
 #include <vector>
 
@@ -37,8 +39,14 @@ namespace onart {
     static VkPhysicalDevice findPhysicalDevice(VkInstance, bool*, uint32_t*, uint32_t*, uint32_t*, uint32_t*, uint64_t*);
     /// @brief 주어진 Vulkan 물리 장치에 대한 우선도를 매깁니다. 높을수록 좋게 취급합니다. 대부분의 경우 물리 장치는 하나일 것이므로 함수가 아주 중요하지는 않을 거라 생각됩니다.
     static uint64_t assessPhysicalDevice(VkPhysicalDevice);
-    /// @brief 주어진 장치에 대한 가상 장치를 생성합니다.
-    static VkDevice createDevice(VkPhysicalDevice, int, int, int, int);
+    /// @brief 주어진 장치에 대한 가상 장치를 생성합니다. 마지막 인수가 true면 호스트 메모리 가져오기 확장을 함께 활성화합니다.
+    static VkDevice createDevice(VkPhysicalDevice, int, int, int, int, bool, bool);
+    /// @brief 주어진 장치가 호스트 메모리 가져오기(VK_EXT_external_memory_host)를 지원하는 경우 가져올 메모리의 정렬 단위를 리턴합니다. 지원하지 않으면 0을 리턴합니다.
+    static uint64_t queryHostImportAlignment(VkInstance, VkPhysicalDevice);
+    /// @brief 타임라인 세마포어(VK_KHR_timeline_semaphore)를 사용할 수 있는지 확인합니다.
+    static bool queryTimelineSupport(VkInstance, VkPhysicalDevice);
+    /// @brief 주어진 장치 확장이 모두 지원되는지 확인합니다.
+    static bool supportsDeviceExtensions(VkPhysicalDevice, const char* const*, size_t);
     /// @brief 주어진 장치에 대한 메모리 관리자를 세팅합니다.
     static VmaAllocator createAllocator(VkInstance, VkPhysicalDevice, VkDevice);
     /// @brief 명령 풀을 생성합니다.
@@ -51,9 +59,17 @@ namespace onart {
     static VkFormat textureFormatFallback(VkPhysicalDevice physicalDevice, int x, int y, uint32_t nChannels, bool srgb, VkMachine::TextureFormatOptions hq, VkImageCreateFlagBits flags);
     /// @brief VkResult를 스트링으로 표현합니다. 리턴되는 문자열은 텍스트(코드) 영역에 존재합니다.
     inline static const char* resultAsString(VkResult);
+    /// @brief 주어진 색 타겟 생성 정보를 linear 타일링의 호스트 가시 이미지로 만들 수 있고 그것이 이득인 장치(통합 메모리 또는 CPU)인지 확인합니다.
+    static bool linearTargetUsable(VkPhysicalDevice, const VkImageCreateInfo&);
 
     /// @brief 활성화할 장치 확장
     constexpr const char* VK_DESIRED_DEVICE_EXT[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+    /// @brief 지원되는 경우 활성화할 장치 확장 (호스트 메모리 가져오기)
+    constexpr const char* VK_HOST_IMPORT_DEVICE_EXT[] = { VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME };
+    /// @brief 지원되는 경우 활성화할 장치 확장 (큐 간 동기화)
+    constexpr const char* VK_TIMELINE_DEVICE_EXT[] = { VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME };
+    /// @brief 지원되는 경우 활성화할 인스턴스 확장 (호스트 메모리 가져오기, 타임라인 세마포어 확인의 전제 조건)
+    constexpr const char* VK_OPTIONAL_INSTANCE_EXT[] = { VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME, VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME };
 
 
     VkMachine* VkMachine::singleton = nullptr;
@@ -86,17 +102,44 @@ namespace onart {
         // properties.limits.minMemorymapAlignment, minTexelBufferOffsetAlignment, minUniformBufferOffsetAlignment, minStorageBufferOffsetAlignment, optimalBufferCopyOffsetAlignment, optimalBufferCopyRowPitchAlignment를 저장
 
         vkGetPhysicalDeviceFeatures(physicalDevice.card, &physicalDevice.features);
+        {
+            VkPhysicalDeviceProperties props;
+            vkGetPhysicalDeviceProperties(physicalDevice.card, &props);
+            uint32_t qfcount;
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice.card, &qfcount, nullptr);
+            std::vector<VkQueueFamilyProperties> qfs(qfcount);
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice.card, &qfcount, qfs.data());
+            physicalDevice.timestampPeriod = props.limits.timestampPeriod;
+            physicalDevice.gqTimestampBits = qfs[physicalDevice.gq].timestampValidBits;
+            // 쿼리 초기화(vkCmdResetQueryPool)는 그래픽스/컴퓨트 큐에서만 가능
+            physicalDevice.subqTimestampBits = (qfs[physicalDevice.subq].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) ? qfs[physicalDevice.subq].timestampValidBits : 0;
+        }
+        physicalDevice.minImportedHostPointerAlignment = queryHostImportAlignment(instance, physicalDevice.card);
+
+        bool timeline = queryTimelineSupport(instance, physicalDevice.card);
 
-        if(!(device = createDevice(physicalDevice.card, physicalDevice.gq, physicalDevice.pq, physicalDevice.subq, physicalDevice.subqIndex))) {
+        if(!(device = createDevice(physicalDevice.card, physicalDevice.gq, physicalDevice.pq, physicalDevice.subq, physicalDevice.subqIndex, physicalDevice.minImportedHostPointerAlignment != 0, timeline))) {
             free();
             return;
         }
+        if(physicalDevice.minImportedHostPointerAlignment) {
+            getMemoryHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+            if(!getMemoryHostPointerProperties) physicalDevice.minImportedHostPointerAlignment = 0;
+        }
 
         vkGetDeviceQueue(device, physicalDevice.gq, 0, &graphicsQueue);
         vkGetDeviceQueue(device, physicalDevice.pq, 0, &presentQueue);
         vkGetDeviceQueue(device, physicalDevice.subq, physicalDevice.subqIndex, &transferQueue);
         gqIsTq = (graphicsQueue == transferQueue);
         pqIsTq = (graphicsQueue == presentQueue);
+
+        if(timeline && (waitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR"))) {
+            for(VkSemaphore& sm: timelines) sm = createSemaphore(true);
+            if(!timelines[0] || !timelines[1]) { // 이진 세마포어 + 펜스로 진행
+                for(VkSemaphore& sm: timelines) { vkDestroySemaphore(device, sm, nullptr); sm = VK_NULL_HANDLE; }
+            }
+        }
+        if(!timelines[0]) LOGWITH("Warning: timeline semaphore is not available. Stream texture uploads will be synchronized by CPU");
         //LOGRAW(physicalDevice.subqIndex, graphicsQueue, transferQueue, presentQueue);
         //LOGRAW(physicalDevice.gq, physicalDevice.pq, physicalDevice.subq);
 
@@ -191,9 +234,14 @@ namespace onart {
         return ret;
     }
 
-    VkSemaphore VkMachine::createSemaphore(){
+    VkSemaphore VkMachine::createSemaphore(bool timeline){
+        VkSemaphoreTypeCreateInfoKHR typeInfo{};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+        typeInfo.initialValue = 0;
         VkSemaphoreCreateInfo smInfo{};
         smInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        if(timeline) smInfo.pNext = &typeInfo;
         VkSemaphore ret;
         reason = vkCreateSemaphore(device, &smInfo, VK_NULL_HANDLE, &ret);
         if(reason != VK_SUCCESS){
@@ -449,6 +497,8 @@ namespace onart {
         }
         windowSystems.clear();
 
+        for(VkSemaphore& sm: timelines) { vkDestroySemaphore(device, sm, nullptr); sm = VK_NULL_HANDLE; }
+        timelineValues[0] = timelineValues[1] = 0;
         vmaDestroyAllocator(allocator);
         vkDestroyCommandPool(device, gCommandPool, nullptr);
         vkDestroyCommandPool(device, tCommandPool, nullptr);
@@ -501,20 +551,91 @@ namespace onart {
         }
     }
 
+    std::mutex& VkMachine::queueGuard(VkQueue queue){
+        if(queue == graphicsQueue) return gqGuard;
+        if(queue == transferQueue) return tqGuard;
+        return pqGuard;
+    }
+
     VkResult VkMachine::qSubmit(bool gq_or_tq, uint32_t submitCount, const VkSubmitInfo* submitInfos, VkFence fence){
-        bool shouldLock = gqIsTq && loadThread.waiting(); // 스레드 풀에 포스트를 한 스레드에서만 하는 경우라면 이걸로 안전, 아닌 경우 낮은 확률로 큐에 동시 제출
-        if(shouldLock) { qGuard.lock(); }
-        VkResult ret = vkQueueSubmit(gq_or_tq ? graphicsQueue : transferQueue, submitCount, submitInfos, fence);
-        if(shouldLock) { qGuard.unlock(); }
+        VkQueue queue = gq_or_tq ? graphicsQueue : transferQueue;
+        std::unique_lock<std::mutex> _(queueGuard(queue));
+        return vkQueueSubmit(queue, submitCount, submitInfos, fence);
+    }
+
+    VkResult VkMachine::qSubmit(bool gq_or_tq, const VkSubmitInfo& submitInfo, VkFence fence, uint64_t waitGraphics, uint64_t waitTransfer, VkPipelineStageFlags waitStage, uint64_t* signaled){
+        const int t = gq_or_tq ? 0 : 1;
+        if(!timelines[t]) {
+            if(signaled) *signaled = 0;
+            return qSubmit(gq_or_tq, 1, &submitInfo, fence);
+        }
+        if(submitInfo.waitSemaphoreCount > 2 || submitInfo.signalSemaphoreCount > 2) {
+            LOGWITH("Too many semaphores:", submitInfo.waitSemaphoreCount, submitInfo.signalSemaphoreCount);
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        VkSemaphore waits[4];
+        uint64_t waitValues[4] = {}; // 이진 세마포어에 대한 값은 무시됨
+        VkPipelineStageFlags waitStages[4];
+        uint32_t waitCount = submitInfo.waitSemaphoreCount;
+        for(uint32_t i = 0; i < waitCount; i++) {
+            waits[i] = submitInfo.pWaitSemaphores[i];
+            waitStages[i] = submitInfo.pWaitDstStageMask[i];
+        }
+        if(waitGraphics) {
+            waits[waitCount] = timelines[0];
+            waitValues[waitCount] = waitGraphics;
+            waitStages[waitCount++] = waitStage;
+        }
+        if(waitTransfer) {
+            waits[waitCount] = timelines[1];
+            waitValues[waitCount] = waitTransfer;
+            waitStages[waitCount++] = waitStage;
+        }
+        VkSemaphore signals[3];
+        uint64_t signalValues[3] = {};
+        uint32_t signalCount = submitInfo.signalSemaphoreCount;
+        for(uint32_t i = 0; i < signalCount; i++) signals[i] = submitInfo.pSignalSemaphores[i];
+        signals[signalCount] = timelines[t];
+
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timelineInfo.pNext = submitInfo.pNext;
+        timelineInfo.waitSemaphoreValueCount = waitCount;
+        timelineInfo.pWaitSemaphoreValues = waitValues;
+        timelineInfo.signalSemaphoreValueCount = signalCount + 1;
+        timelineInfo.pSignalSemaphoreValues = signalValues;
+
+        VkSubmitInfo info = submitInfo;
+        info.pNext = &timelineInfo;
+        info.waitSemaphoreCount = waitCount;
+        info.pWaitSemaphores = waits;
+        info.pWaitDstStageMask = waitStages;
+        info.signalSemaphoreCount = signalCount + 1;
+        info.pSignalSemaphores = signals;
+
+        VkQueue queue = gq_or_tq ? graphicsQueue : transferQueue;
+        std::unique_lock<std::mutex> _(queueGuard(queue));
+        signalValues[signalCount] = timelineValues[t] + 1; // 같은 큐에 대한 제출 순서와 타임라인 값의 순서가 일치해야 하므로 잠금 안에서 정함
+        VkResult ret = vkQueueSubmit(queue, 1, &info, fence);
+        if(ret == VK_SUCCESS) timelineValues[t]++;
+        if(signaled) *signaled = ret == VK_SUCCESS ? timelineValues[t] : 0;
         return ret;
     }
 
+    bool VkMachine::waitTimeline(bool gq_or_tq, uint64_t value, uint64_t timeout){
+        if(value == 0) return true;
+        VkSemaphore sm = timelines[gq_or_tq ? 0 : 1];
+        VkSemaphoreWaitInfoKHR waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &sm;
+        waitInfo.pValues = &value;
+        return waitSemaphores(device, &waitInfo, timeout) == VK_SUCCESS; // VK_TIMEOUT이나 VK_ERROR_DEVICE_LOST
+    }
+
     VkResult VkMachine::qSubmit(const VkPresentInfoKHR* present){
-        bool shouldLock = pqIsTq && loadThread.waiting(); // 스레드 풀에 포스트를 한 스레드에서만 하는 경우라면 이걸로 안전, 아닌 경우 낮은 확률로 큐에 동시 제출
-        if(shouldLock) { qGuard.lock(); }
-        VkResult ret = vkQueuePresentKHR(presentQueue, present);
-        if(shouldLock) { qGuard.unlock(); }
-        return ret;
+        std::unique_lock<std::mutex> _(queueGuard(presentQueue));
+        return vkQueuePresentKHR(presentQueue, present);
     }
 
     bool VkMachine::createSamplers(){
@@ -699,7 +820,7 @@ namespace onart {
         return singleton->meshes[key] = std::make_shared<publicmesh>(vib, viba, opts.vertexCount, opts.indexCount, VBSIZE, nullptr, opts.singleIndexSize == 4);
     }
 
-    VkMachine::RenderTarget* VkMachine::createRenderTarget2D(int width, int height, RenderTargetType type, bool useDepthInput, bool sampled, bool linear, bool canRead){
+    VkMachine::RenderTarget* VkMachine::createRenderTarget2D(int width, int height, RenderTargetType type, bool useDepthInput, bool sampled, bool linear, bool canRead, bool hostVisible){
         if(!singleton->allocator) {
             LOGWITH("Warning: Tried to create image before initialization");
             return nullptr;
@@ -743,9 +864,29 @@ namespace onart {
         if((int)type & 0b1){
             color1 = new ImageSet;
             imgInfo.usage = VkImageUsageFlagBits::VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (sampled ? VkImageUsageFlagBits::VK_IMAGE_USAGE_SAMPLED_BIT : VkImageUsageFlagBits::VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT);
-            if (canRead && sampled) imgInfo.usage |= VkImageUsageFlagBits::VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            if (canRead && sampled) imgInfo.usage |= VkImageUsageFlagBits::VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VkImageUsageFlagBits::VK_IMAGE_USAGE_TRANSFER_DST_BIT; // 읽기 복사, 축소 복사
             imgInfo.format = singleton->baseSurfaceRendertargetFormat;
-            reason = vmaCreateImage(singleton->allocator, &imgInfo, &allocInfo, &color1->img, &color1->alloc, nullptr);
+            if (hostVisible && sampled && linearTargetUsable(singleton->physicalDevice.card, imgInfo)) {
+                VkImageCreateInfo linearInfo = imgInfo;
+                linearInfo.tiling = VkImageTiling::VK_IMAGE_TILING_LINEAR;
+                VmaAllocationCreateInfo hostAllocInfo{};
+                hostAllocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+                hostAllocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+                hostAllocInfo.requiredFlags = VkMemoryPropertyFlagBits::VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+                VmaAllocationInfo mapInfo{};
+                if ((reason = vmaCreateImage(singleton->allocator, &linearInfo, &hostAllocInfo, &color1->img, &color1->alloc, &mapInfo)) == VK_SUCCESS) {
+                    VkImageSubresource subresource{};
+                    subresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                    VkSubresourceLayout layout;
+                    vkGetImageSubresourceLayout(singleton->device, color1->img, &subresource, &layout);
+                    color1->mapped = (uint8_t*)mapInfo.pMappedData + layout.offset;
+                    color1->rowPitch = (uint32_t)layout.rowPitch;
+                }
+                else {
+                    LOGWITH("Failed to create host visible target. Falling back to optimal tiling:", reason, resultAsString(reason));
+                }
+            }
+            if (!color1->mapped) reason = vmaCreateImage(singleton->allocator, &imgInfo, &allocInfo, &color1->img, &color1->alloc, nullptr);
             if(reason != VK_SUCCESS) {
                 LOGWITH("Failed to create image:", reason,resultAsString(reason));
                 delete color1;
@@ -868,8 +1009,10 @@ namespace onart {
         nim = 0;
         if(color1){
             imageInfo.imageView = color1->view;
+            if (color1->mapped) imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL; // 호스트에서 읽으려면 GENERAL이어야 함
             wr.dstBinding = nim++;
             vkUpdateDescriptorSets(singleton->device, 1, &wr, 0, nullptr);
+            imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
             if(color2){
                 wr.dstBinding = nim++;
                 imageInfo.imageView = color2->view;
@@ -1332,8 +1475,10 @@ namespace onart {
     }
 
     VkMachine::StreamTexture::~StreamTexture() {
+        detachCopy();
         vkWaitForFences(singleton->device, 1, &fence, VK_FALSE, UINT64_MAX);
         vkDestroyFence(singleton->device, fence, nullptr);
+        vkDestroyQueryPool(singleton->device, queryPool, nullptr);
         vmaUnmapMemory(singleton->allocator, allocb);
         vkFreeCommandBuffers(singleton->device, singleton->tCommandPool, 1, &cb);
         singleton->reaper.push(dset, singleton->descriptorPool);
@@ -1342,11 +1487,7 @@ namespace onart {
         singleton->reaper.push(buf, allocb);
     }
 
-    void VkMachine::StreamTexture::afterCopy() {
-        vmaInvalidateAllocation(singleton->allocator, alloc, 0, VK_WHOLE_SIZE);
-        vmaFlushAllocation(singleton->allocator, alloc, 0, VK_WHOLE_SIZE);
-        VkCommandBuffer cb;
-        VkMachine::singleton->allocateCommandBuffers(1, true, false, &cb);
+    void VkMachine::StreamTexture::buildRegions(VkDeviceSize offset, uint32_t rowLength) {
         VkBufferImageCopy region{};
         region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         region.imageSubresource.mipLevel = 0;
@@ -1355,34 +1496,279 @@ namespace onart {
         region.imageExtent.width = width;
         region.imageExtent.height = height;
         region.imageExtent.depth = 1;
-        region.bufferOffset = 0;
+        region.bufferOffset = offset;
+        region.bufferRowLength = rowLength;
         region.bufferImageHeight = 0;
+        regions.clear();
+        if (updateAreas.empty()) {
+            regions.push_back(region);
+            return;
+        }
+        const uint32_t pitch = rowLength ? rowLength : width;
+        for (const TextureArea2D& area : updateAreas) {
+            if (area.x >= width || area.y >= height) continue;
+            region.imageOffset.x = (int32_t)area.x;
+            region.imageOffset.y = (int32_t)area.y;
+            region.imageExtent.width = std::min<uint32_t>(area.width, width - area.x);
+            region.imageExtent.height = std::min<uint32_t>(area.height, height - area.y);
+            region.bufferOffset = offset + ((VkDeviceSize)area.y * pitch + area.x) * 4;
+            if (region.imageExtent.width && region.imageExtent.height) regions.push_back(region);
+        }
+        updateAreas.clear();
+    }
+
+    void VkMachine::StreamTexture::setUpdateAreas(const TextureArea2D* areas, uint32_t count) {
+        updateAreas.clear();
+        for (uint32_t i = 0; i < count; i++) {
+            if (areas[i].width && areas[i].height) updateAreas.push_back(areas[i]);
+        }
+        if (count && updateAreas.empty()) updateAreas.push_back({ 0, 0, 0, 0 }); // 모두 비었으면 아무것도 복사하지 않음
+    }
+
+    void VkMachine::StreamTexture::afterCopy(VkBuffer src, VkDeviceSize offset, uint32_t rowLength) {
+        YR_TRACE("upload submit");
+        if (src == buf) vmaFlushAllocation(singleton->allocator, allocb, 0, VK_WHOLE_SIZE);
+        buildRegions(offset, rowLength);
+        if (regions.empty()) return;
+        if (deferred) { // startFrame에서 기록
+            pendingSrc = src;
+            return;
+        }
+        submitCopy(src);
+    }
 
+    void VkMachine::StreamTexture::submitCopy(VkBuffer src) {
         vkWaitForFences(singleton->device, 1, &fence, VK_FALSE, UINT64_MAX);
         vkResetFences(singleton->device, 1, &fence);
+        collectTiming();
         vkResetCommandBuffer(cb, 0);
 
         VkCommandBufferBeginInfo beginInfo{};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
         vkBeginCommandBuffer(cb, &beginInfo);
-        vkCmdCopyBufferToImage(cb, buf, img, VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+        const bool timed = singleton->gpuTiming && singleton->physicalDevice.subqTimestampBits && (queryPool || (queryPool = singleton->createTimestampPool(2)));
+        if (timed) {
+            vkCmdResetQueryPool(cb, queryPool, 0, 2);
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        }
+        vkCmdCopyBufferToImage(cb, src, img, VK_IMAGE_LAYOUT_GENERAL, (uint32_t)regions.size(), regions.data());
+        if (timed) vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+        queryWritten = timed;
         vkEndCommandBuffer(cb);
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &cb;
-        VkMachine::singleton->qSubmit(false, 1, &submitInfo, fence);
+        if ((reason = singleton->qSubmit(false, submitInfo, fence, 0, 0, 0, &uploaded)) != VK_SUCCESS) {
+            LOGWITH("Failed to submit copy command:", reason, resultAsString(reason));
+        }
+    }
+
+    uint64_t VkMachine::StreamTexture::readyPoint(uint64_t prev) {
+        if (!singleton->timelines[1]) {
+            vkWaitForFences(singleton->device, 1, &fence, VK_FALSE, UINT64_MAX);
+            return prev;
+        }
+        return uploaded > prev ? uploaded : prev;
+    }
+
+    void VkMachine::StreamTexture::recordCopy(VkCommandBuffer cb, RenderPass* by) {
+        if (!pendingSrc) return;
+        vkCmdCopyBufferToImage(cb, pendingSrc, img, VK_IMAGE_LAYOUT_GENERAL, (uint32_t)regions.size(), regions.data());
+
+        VkImageMemoryBarrier imgBarrier{};
+        imgBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imgBarrier.image = img;
+        imgBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imgBarrier.subresourceRange.levelCount = 1;
+        imgBarrier.subresourceRange.layerCount = 1;
+        imgBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imgBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        imgBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imgBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imgBarrier);
+
+        pendingSrc = VK_NULL_HANDLE;
+        if (copiedBy != by) {
+            detachCopy();
+            copiedBy = by;
+            by->deferredCopies.push_back(this);
+        }
+    }
+
+    void VkMachine::StreamTexture::detachCopy() {
+        if (!copiedBy) return;
+        std::vector<StreamTexture*>& copies = copiedBy->deferredCopies;
+        copies.erase(std::remove(copies.begin(), copies.end(), this), copies.end());
+        copiedBy = nullptr;
+    }
+
+    void VkMachine::StreamTexture::collectTiming() {
+        if (!queryWritten) return;
+        queryWritten = false;
+        uint64_t result[2];
+        if (vkGetQueryPoolResults(singleton->device, queryPool, 0, 2, sizeof(result), result, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) return;
+        timing.uploadMs += singleton->timestampMs(false, result[0], result[1]);
+        timing.frames++;
+    }
+
+    VkMachine::GpuTiming VkMachine::StreamTexture::getGpuTiming() {
+        if (queryWritten && vkGetFenceStatus(singleton->device, fence) == VK_SUCCESS) collectTiming();
+        return timing;
+    }
+
+    void VkMachine::StreamTexture::wait() {
+        YR_TRACE("upload wait");
+        vkWaitForFences(singleton->device, 1, &fence, VK_FALSE, UINT64_MAX);
+        if (copiedBy) copiedBy->wait();
+    }
+
+    void VkMachine::StreamTexture::setDeferred(bool deferred) {
+        this->deferred = deferred;
+        if (!deferred && pendingSrc) {
+            VkBuffer src = pendingSrc;
+            pendingSrc = VK_NULL_HANDLE;
+            submitCopy(src);
+        }
     }
 
     void VkMachine::StreamTexture::update(void* src) {
+        wait();
         memcpy(mmap, src, (size_t)width * height * 4);
-        afterCopy();
+        afterCopy(buf, 0, 0);
     }
 
-    void VkMachine::StreamTexture::updateBy(std::function<void(void*, uint32_t)> function) {
+    void VkMachine::StreamTexture::updateBy(FunctionRef<void(void*, uint32_t)> function) {
+        wait();
         function(mmap, width * 4);
-        afterCopy();
+        afterCopy(buf, 0, 0);
+    }
+
+    struct VkMachine::ImportedHostMemory {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        void* ptr;
+        uint64_t size;
+    };
+
+    void VkMachine::StreamTexture::update(const ImportedHostMemory* src, uint64_t offset, uint32_t rowPitch) {
+        if (rowPitch == 0) rowPitch = width * 4;
+        if (!src || (rowPitch & 3) || offset + (uint64_t)rowPitch * (height - 1) + (uint64_t)width * 4 > src->size) {
+            LOGWITH("Invalid imported memory range");
+            return;
+        }
+        afterCopy(src->buffer, offset, rowPitch / 4);
+    }
+
+    bool VkMachine::setGpuTiming(bool on) {
+        if (on && (!singleton->physicalDevice.gqTimestampBits || singleton->physicalDevice.timestampPeriod <= 0)) {
+            LOGWITH("This device does not support timestamp queries on the graphics queue");
+            on = false;
+        }
+        singleton->gpuTiming = on;
+        return on;
+    }
+
+    VkQueryPool VkMachine::createTimestampPool(uint32_t count) {
+        VkQueryPoolCreateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        info.queryCount = count;
+        VkQueryPool ret;
+        if ((reason = vkCreateQueryPool(device, &info, nullptr, &ret)) != VK_SUCCESS) {
+            LOGWITH("Failed to create query pool:", reason, resultAsString(reason));
+            return VK_NULL_HANDLE;
+        }
+        return ret;
+    }
+
+    double VkMachine::timestampMs(bool gq_or_tq, uint64_t begin, uint64_t end) {
+        const uint32_t bits = gq_or_tq ? physicalDevice.gqTimestampBits : physicalDevice.subqTimestampBits;
+        const uint64_t mask = bits >= 64 ? ~0ULL : ((1ULL << bits) - 1);
+        return (double)((end - begin) & mask) * physicalDevice.timestampPeriod / 1e6;
+    }
+
+    uint64_t VkMachine::getHostImportAlignment() {
+        return singleton->physicalDevice.minImportedHostPointerAlignment;
+    }
+
+    VkMachine::ImportedHostMemory* VkMachine::importHostMemory(void* ptr, uint64_t size) {
+        const uint64_t alignment = singleton->physicalDevice.minImportedHostPointerAlignment;
+        if (alignment == 0) return nullptr;
+        if (((uintptr_t)ptr % alignment) || (size % alignment) || size == 0) {
+            LOGWITH("Host memory should be aligned by", alignment);
+            return nullptr;
+        }
+        VkMemoryHostPointerPropertiesEXT hostProps{};
+        hostProps.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+        if ((reason = singleton->getMemoryHostPointerProperties(singleton->device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, ptr, &hostProps)) != VK_SUCCESS) {
+            LOGWITH("Failed to get host pointer properties:", reason, resultAsString(reason));
+            return nullptr;
+        }
+
+        VkExternalMemoryBufferCreateInfoKHR extInfo{};
+        extInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO_KHR;
+        extInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+        VkBufferCreateInfo bufInfo{};
+        bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufInfo.pNext = &extInfo;
+        bufInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        bufInfo.size = size;
+        bufInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        VkBuffer buffer;
+        if ((reason = vkCreateBuffer(singleton->device, &bufInfo, nullptr, &buffer)) != VK_SUCCESS) {
+            LOGWITH("Failed to create buffer:", reason, resultAsString(reason));
+            return nullptr;
+        }
+        VkMemoryRequirements req;
+        vkGetBufferMemoryRequirements(singleton->device, buffer, &req);
+        const uint32_t typeBits = req.memoryTypeBits & hostProps.memoryTypeBits;
+        uint32_t typeIndex = UINT32_MAX;
+        VkPhysicalDeviceMemoryProperties memProps;
+        vkGetPhysicalDeviceMemoryProperties(singleton->physicalDevice.card, &memProps);
+        for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+            if (typeBits & (1u << i)) {
+                typeIndex = i;
+                if (memProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) break;
+            }
+        }
+        if (typeIndex == UINT32_MAX) {
+            LOGWITH("No memory type can import the host memory");
+            vkDestroyBuffer(singleton->device, buffer, nullptr);
+            return nullptr;
+        }
+
+        VkImportMemoryHostPointerInfoEXT importInfo{};
+        importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+        importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+        importInfo.pHostPointer = ptr;
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.pNext = &importInfo;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = typeIndex;
+        VkDeviceMemory memory;
+        if ((reason = vkAllocateMemory(singleton->device, &allocInfo, nullptr, &memory)) != VK_SUCCESS) {
+            LOGWITH("Failed to import host memory:", reason, resultAsString(reason));
+            vkDestroyBuffer(singleton->device, buffer, nullptr);
+            return nullptr;
+        }
+        if ((reason = vkBindBufferMemory(singleton->device, buffer, memory, 0)) != VK_SUCCESS) {
+            LOGWITH("Failed to bind imported memory:", reason, resultAsString(reason));
+            vkFreeMemory(singleton->device, memory, nullptr);
+            vkDestroyBuffer(singleton->device, buffer, nullptr);
+            return nullptr;
+        }
+        return new ImportedHostMemory{ buffer, memory, ptr, size };
+    }
+
+    void VkMachine::releaseHostMemory(ImportedHostMemory* mem) {
+        if (!mem) return;
+        vkDestroyBuffer(singleton->device, mem->buffer, nullptr);
+        vkFreeMemory(singleton->device, mem->memory, nullptr);
+        delete mem;
     }
 
     VkMachine::TextureSet::~TextureSet() {
@@ -1849,6 +2235,7 @@ namespace onart {
                     colorCount = 3;
                 }
             }
+            if (forSample && color1->mapped) arr[0].finalLayout = VK_IMAGE_LAYOUT_GENERAL;
         }
         if(depthstencil) {
             arr[colorCount].format = VkFormat::VK_FORMAT_D24_UNORM_S8_UINT;
@@ -2351,7 +2738,7 @@ namespace onart {
         for (uint32_t i = 0; i < opts.subpassCount; i++) {
             RenderTargetType rtype = opts.targets ? opts.targets[i] : RenderTargetType::RTT_COLOR1;
             bool diType = opts.depthInput ? opts.depthInput[i] : false;
-            targets[i] = createRenderTarget2D(opts.width, opts.height, rtype, diType, i == opts.subpassCount - 1, opts.linearSampled, opts.canCopy);
+            targets[i] = createRenderTarget2D(opts.width, opts.height, rtype, diType, i == opts.subpassCount - 1, opts.linearSampled, opts.canCopy, opts.hostVisibleTarget && i == opts.subpassCount - 1);
             if (!targets[i]) {
                 LOGHERE;
                 for (uint32_t j = 0; j < i; j++) {
@@ -2423,6 +2810,10 @@ namespace onart {
         dependencies[0].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
         dependencies[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
         dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+        if (targets[opts.subpassCount - 1]->color1 && targets[opts.subpassCount - 1]->color1->mapped) { // 펜스만으로는 호스트에 보이지 않음
+            dependencies[0].dstStageMask |= VK_PIPELINE_STAGE_HOST_BIT;
+            dependencies[0].dstAccessMask |= VK_ACCESS_HOST_READ_BIT;
+        }
 
         VkRenderPassCreateInfo rpInfo{};
         rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -2914,6 +3305,14 @@ namespace onart {
     }
 
     VkMachine::RenderPass::~RenderPass(){
+        for (StreamTexture* tex : deferredCopies) tex->copiedBy = nullptr;
+        for (RenderPass* rung : downscaleChain) rung->chainOwner = nullptr;
+        if (chainOwner) {
+            std::vector<RenderPass*>& chain = chainOwner->downscaleChain;
+            chain.erase(std::remove(chain.begin(), chain.end(), this), chain.end());
+        }
+        vmaDestroyBuffer(singleton->allocator, readBuffer, readAlloc);
+        vkDestroyQueryPool(singleton->device, queryPool, nullptr);
         vkFreeCommandBuffers(singleton->device, singleton->gCommandPool, 1, &cb);
         vkDestroySemaphore(singleton->device, semaphore, nullptr);
         vkDestroyFence(singleton->device, fence, nullptr);
@@ -2935,15 +3334,24 @@ namespace onart {
 
     void VkMachine::RenderPass::resize(int width, int height, bool linear) {
         wait();
+        for (StreamTexture* tex : deferredCopies) tex->copiedBy = nullptr; // 기록한 복사는 위에서 끝남
+        deferredCopies.clear();
+        vmaDestroyBuffer(singleton->allocator, readBuffer, readAlloc);
+        readBuffer = VK_NULL_HANDLE;
+        readAlloc = nullptr;
+        readMap = nullptr;
+        frameReadBack = false;
         RenderTarget* targets[16]{};
+        const bool hostVisible = this->targets.back()->color1 && this->targets.back()->color1->mapped;
+        const uint32_t lastStage = (uint32_t)stageCount - 1;
         for (uint32_t i = 0; i < stageCount; i++) {
             RenderTargetType rtype = this->targets[i]->type;
             bool diType = this->targets[i]->depthInput;
-            targets[i] = createRenderTarget2D(width, height, rtype, diType, i == stageCount - 1, linear, canBeRead);
+            targets[i] = createRenderTarget2D(width, height, rtype, diType, i == lastStage, linear, canBeRead, hostVisible && i == lastStage);
             if (!targets[i]) {
                 LOGHERE;
                 for (uint32_t j = 0; j < i; j++) {
-                    delete targets[i];
+                    delete targets[j];
                 }
                 return;
             }
@@ -3039,7 +3447,7 @@ namespace onart {
         imgBarrier.image = srcSet->img;
         imgBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT; // 이전 렌더패스 종료 이후
         imgBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        imgBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // 이전 렌더패스 종료 이후
+        imgBarrier.oldLayout = srcSet->mapped ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // 이전 렌더패스 종료 이후
         imgBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
         vkCmdPipelineBarrier(tcb, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imgBarrier);
@@ -3076,7 +3484,7 @@ namespace onart {
 
         VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 
-        bool needSemaphore = !wait(0);
+        bool needSemaphore = !executed && !wait(0); // 타임라인이 없을 때만 이진 세마포어 사용
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submitInfo.commandBufferCount = 1;
@@ -3086,7 +3494,7 @@ namespace onart {
         submitInfo.pWaitDstStageMask = &waitStage;
         
         VkFence fence = singleton->createFence();
-        result = singleton->qSubmit(false, 1, &submitInfo, fence);
+        result = singleton->qSubmit(false, submitInfo, fence, executed, 0, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, nullptr);
         if (result != VK_SUCCESS) {
             LOGWITH("Failed to submit commands:", result, resultAsString(result));
             return {};
@@ -3185,9 +3593,26 @@ namespace onart {
     }
 
     std::unique_ptr<uint8_t[]> VkMachine::RenderPass::readBack(uint32_t index, const TextureArea2D& area) {
+        RenderTarget* targ = targets.back();
+        const size_t size = (area.width && area.height) ? (size_t)area.width * area.height * 4 : (size_t)targ->width * targ->height * 4;
+        std::unique_ptr<uint8_t[]> ptr(new uint8_t[size]);
+        if (!readBackTo(ptr.get(), index, area)) return {};
+        return ptr;
+    }
+
+    uint8_t* VkMachine::RenderPass::readBack(uint32_t index, FrameArena& arena, const TextureArea2D& area) {
+        RenderTarget* targ = targets.back();
+        const size_t size = (area.width && area.height) ? (size_t)area.width * area.height * 4 : (size_t)targ->width * targ->height * 4;
+        uint8_t* dst = (uint8_t*)arena.allocate(size, 64);
+        if (!dst || !readBackTo(dst, index, area)) return nullptr;
+        return dst;
+    }
+
+    bool VkMachine::RenderPass::readBackTo(uint8_t* dst, uint32_t index, const TextureArea2D& area) {
+        YR_TRACE("readback");
         if (!canBeRead) {
             LOGWITH("Can\'t copy the target. Create this render pass with canCopy flag");
-            return {};
+            return false;
         }
         RenderTarget* targ = targets.back();
         ImageSet* srcSet{};
@@ -3197,7 +3622,22 @@ namespace onart {
         }
         if (!srcSet) {
             LOGWITH("Invalid index");
-            return {};
+            return false;
+        }
+
+        if (srcSet->mapped && srcSet == targ->color1) { // mapTarget은 마지막 타겟의 color1만 읽으므로 그 밖의 요청은 스테이징 복사로 처리
+            uint32_t rowPitch;
+            const uint8_t* src = mapTarget(&rowPitch);
+            const uint32_t x = (area.width && area.height) ? area.x : 0;
+            const uint32_t y = (area.width && area.height) ? area.y : 0;
+            const uint32_t w = (area.width && area.height) ? area.width : targ->width;
+            const uint32_t h = (area.width && area.height) ? area.height : targ->height;
+            src += (size_t)y * rowPitch + (size_t)x * 4;
+            for (uint32_t row = 0; row < h; row++) {
+                std::memcpy(dst + (size_t)row * w * 4, src, (size_t)w * 4);
+                src += rowPitch;
+            }
+            return true;
         }
 
         VkBufferCreateInfo bufInfo{};
@@ -3220,14 +3660,14 @@ namespace onart {
         if (result != VK_SUCCESS) {
             singleton->reason = result;
             LOGWITH("Failed to create intermediate buffer:", result, resultAsString(result));
-            return {};
+            return false;
         }
 
         VkCommandBuffer tcb{};
         singleton->allocateCommandBuffers(1, true, false, &tcb);
         if (!tcb) {
             LOGWITH("Failed to allocate transfer command buffer");
-            return {};
+            return false;
         }
 
         VkCommandBufferBeginInfo info{};
@@ -3238,7 +3678,7 @@ namespace onart {
             singleton->reason = result;
             LOGWITH("Failed to begin transfer command buffer:", result, resultAsString(result));
             vmaDestroyBuffer(singleton->allocator, buf, alloc);
-            return {};
+            return false;
         }
 
         VkImageMemoryBarrier imgBarrier{};
@@ -3250,7 +3690,7 @@ namespace onart {
         imgBarrier.subresourceRange.layerCount = 1;
         imgBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT; // 이전 렌더패스 종료 이후
         imgBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        imgBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // 이전 렌더패스 종료 이후
+        imgBarrier.oldLayout = srcSet->mapped ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // 이전 렌더패스 종료 이후
         imgBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
         vkCmdPipelineBarrier(tcb, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imgBarrier);
@@ -3282,7 +3722,7 @@ namespace onart {
 
         VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 
-        bool needSemaphore = !wait(0);
+        bool needSemaphore = !executed && !wait(0); // 타임라인이 없을 때만 이진 세마포어 사용
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submitInfo.commandBufferCount = 1;
@@ -3291,17 +3731,24 @@ namespace onart {
         submitInfo.pWaitSemaphores = &semaphore;
         submitInfo.pWaitDstStageMask = &waitStage;
 
-        VkFence fence = singleton->createFence();
-        result = singleton->qSubmit(false, 1, &submitInfo, fence);
+        VkFence fence = singleton->timelines[1] ? VK_NULL_HANDLE : singleton->createFence(); // 타임라인이 있으면 그것으로 기다림
+        uint64_t copied = 0;
+        result = singleton->qSubmit(false, submitInfo, fence, executed, 0, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, &copied);
         if (result != VK_SUCCESS) {
             LOGWITH("Failed to submit commands:", result, resultAsString(result));
-            return {};
+            if (fence) vkDestroyFence(singleton->device, fence, nullptr);
+            vkFreeCommandBuffers(singleton->device, singleton->tCommandPool, 1, &tcb);
+            vmaDestroyBuffer(singleton->allocator, buf, alloc);
+            return false;
         }
 
-        std::unique_ptr<uint8_t[]> ptr(new uint8_t[bufInfo.size]);
-        
-        result = vkWaitForFences(singleton->device, 1, &fence, VK_FALSE, UINT64_MAX);
-        vkDestroyFence(singleton->device, fence, nullptr);
+        if (fence) {
+            result = vkWaitForFences(singleton->device, 1, &fence, VK_FALSE, UINT64_MAX);
+            vkDestroyFence(singleton->device, fence, nullptr);
+        }
+        else {
+            singleton->waitTimeline(false, copied);
+        }
         vkFreeCommandBuffers(singleton->device, singleton->tCommandPool, 1, &tcb);
 
         void* mapped{};
@@ -3309,13 +3756,108 @@ namespace onart {
         if (result != VK_SUCCESS) {
             LOGWITH("Failed to map buffer memory");
             vmaDestroyBuffer(singleton->allocator, buf, alloc);
-            return {};
+            return false;
         }
-        std::memcpy(ptr.get(), mapped, bufInfo.size);
+        std::memcpy(dst, mapped, bufInfo.size);
         vmaUnmapMemory(singleton->allocator, alloc);
 
         vmaDestroyBuffer(singleton->allocator, buf, alloc);
-        return ptr;
+        return true;
+    }
+
+    const uint8_t* VkMachine::RenderPass::mapTarget(uint32_t* rowPitch) {
+        YR_TRACE("map target");
+        ImageSet* target = targets.back()->color1;
+        if (target && target->mapped) {
+            wait();
+            vmaInvalidateAllocation(singleton->allocator, target->alloc, 0, VK_WHOLE_SIZE);
+            *rowPitch = target->rowPitch;
+            return target->mapped;
+        }
+        if (frameReadBack) {
+            wait();
+            vmaInvalidateAllocation(singleton->allocator, readAlloc, 0, VK_WHOLE_SIZE);
+            *rowPitch = targets.back()->width * 4;
+            return readMap;
+        }
+        return nullptr;
+    }
+
+    bool VkMachine::RenderPass::recordReadBack(VkCommandBuffer cmd) {
+        RenderTarget* targ = targets.back();
+        ImageSet* srcSet = targ->color1;
+        if (!canBeRead || !srcSet) {
+            LOGWITH("Can\'t copy the target. Create this render pass with canCopy flag and a color target");
+            return false;
+        }
+        if (srcSet->mapped) return false; // mapTarget이 타겟을 직접 읽음
+        if (!readBuffer) {
+            VkBufferCreateInfo bufInfo{};
+            bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            bufInfo.size = (VkDeviceSize)targ->width * targ->height * 4;
+            bufInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            VmaAllocationCreateInfo allocInfo{};
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            VmaAllocationInfo mapInfo{};
+            if ((reason = vmaCreateBuffer(singleton->allocator, &bufInfo, &allocInfo, &readBuffer, &readAlloc, &mapInfo)) != VK_SUCCESS) {
+                LOGWITH("Failed to create readback buffer:", reason, resultAsString(reason));
+                readBuffer = VK_NULL_HANDLE;
+                readAlloc = nullptr;
+                return false;
+            }
+            readMap = (uint8_t*)mapInfo.pMappedData;
+        }
+
+        VkImageMemoryBarrier imgBarrier{};
+        imgBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imgBarrier.image = srcSet->img;
+        imgBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imgBarrier.subresourceRange.levelCount = 1;
+        imgBarrier.subresourceRange.layerCount = 1;
+        imgBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT; // 축소 복사된 타겟은 전송으로 작성됨
+        imgBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        imgBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // 렌더패스 종료 이후
+        imgBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imgBarrier);
+
+        VkBufferImageCopy copyArea{};
+        copyArea.imageExtent.width = targ->width;
+        copyArea.imageExtent.height = targ->height;
+        copyArea.imageExtent.depth = 1;
+        copyArea.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copyArea.imageSubresource.layerCount = 1;
+        if (frameReadAreas) { // 영역마다 전체 배치에서의 위치로 복사
+            readRegions.clear();
+            copyArea.bufferRowLength = targ->width;
+            for (uint32_t i = 0; i < frameReadAreaCount; i++) {
+                const TextureArea2D& area = frameReadAreas[i];
+                if (area.x >= targ->width || area.y >= targ->height) continue;
+                copyArea.imageOffset.x = (int32_t)area.x;
+                copyArea.imageOffset.y = (int32_t)area.y;
+                copyArea.imageExtent.width = std::min<uint32_t>(area.width, targ->width - area.x);
+                copyArea.imageExtent.height = std::min<uint32_t>(area.height, targ->height - area.y);
+                copyArea.bufferOffset = ((VkDeviceSize)area.y * targ->width + area.x) * 4;
+                if (copyArea.imageExtent.width && copyArea.imageExtent.height) readRegions.push_back(copyArea);
+            }
+            if (!readRegions.empty()) vkCmdCopyImageToBuffer(cmd, srcSet->img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readBuffer, (uint32_t)readRegions.size(), readRegions.data());
+        }
+        else {
+            vkCmdCopyImageToBuffer(cmd, srcSet->img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readBuffer, 1, &copyArea);
+        }
+
+        imgBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        imgBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        std::swap(imgBarrier.oldLayout, imgBarrier.newLayout);
+        VkBufferMemoryBarrier bufBarrier{};
+        bufBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufBarrier.buffer = readBuffer;
+        bufBarrier.size = VK_WHOLE_SIZE;
+        bufBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bufBarrier, 1, &imgBarrier);
+        return true;
     }
 
     void VkMachine::RenderPass::asyncReadBack(int32_t key, uint32_t index, std::function<void(variant8)> handler, const TextureArea2D& area) {
@@ -3324,16 +3866,27 @@ namespace onart {
             return;
         }
         TextureArea2D _area = area;
-        singleton->loadThread.post([key, index, this, _area]() {
-            ReadBackBuffer* ret = new ReadBackBuffer;
+        const size_t size = (area.width && area.height) ? (size_t)area.width * area.height * 4 : (size_t)targets.back()->width * targets.back()->height * 4;
+        if (!readBackBlocks || readBackBlocks->blockSize() < size) {
+            readBackBlocks = std::make_shared<LockFreeBlockPool>(size, 64, 1);
+        }
+        std::shared_ptr<LockFreeBlockPool> blocks = readBackBlocks;
+        singleton->loadThread.post([key, index, this, _area, blocks]() {
+            ReadBackBuffer* ret = readBackBuffers.getRaw();
+            if (!ret) return variant8();
             ret->key = key;
-            std::unique_ptr<uint8_t[]> p = readBack(index, _area);
-            ret->data = p.release();
+            ret->data = (uint8_t*)blocks->acquire();
+            if (ret->data && !readBackTo(ret->data, index, _area)) {
+                blocks->release(ret->data);
+                ret->data = nullptr;
+            }
             return variant8(ret);
-            }, [handler](variant8 param) {
+            }, [handler, blocks, this](variant8 param) {
                 if (handler) handler(param);
                 ReadBackBuffer* result = (ReadBackBuffer*)param.vp;
-                delete result;
+                if (!result) return;
+                blocks->release(result->data);
+                readBackBuffers.returnRaw(result);
             }, vkm_strand::GENERAL);
     }
 
@@ -3422,6 +3975,7 @@ namespace onart {
             LOGWITH("Invalid call: render pass not begun");
             return;
         }
+        uploadWait = tx->readyPoint(uploadWait);
         vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[currentPass]->pipelineLayout, pos, 1, &tx->dset, 0, nullptr);
     }
 
@@ -3529,12 +4083,50 @@ namespace onart {
     }
 
     void VkMachine::RenderPass::execute(RenderPass* other){
+        executeFrame(false, other);
+    }
+
+    void VkMachine::RenderPass::startFrame(const pStreamTexture* uploads, uint32_t uploadCount, uint32_t pos) {
+        if (currentPass != -1) {
+            LOGWITH("Invalid call: render pass already begun");
+            return;
+        }
+        frameUploads = uploads;
+        frameUploadCount = uploadCount;
+        start(pos);
+        frameUploads = nullptr;
+        frameUploadCount = 0;
+    }
+
+    void VkMachine::RenderPass::executeFrame(const TextureArea2D* readAreas, uint32_t areaCount, RenderPass* other) {
+        if (!readAreas || areaCount == 0) {
+            executeFrame(false, other);
+            return;
+        }
+        frameReadAreas = readAreas;
+        frameReadAreaCount = areaCount;
+        executeFrame(true, other);
+        frameReadAreas = nullptr;
+        frameReadAreaCount = 0;
+    }
+
+    void VkMachine::RenderPass::executeFrame(bool readBack, RenderPass* other){
         if(currentPass != pipelines.size() - 1){
             LOGWITH("Renderpass not started. This message can be ignored safely if the rendering goes fine after now");
             return;
         }
+        YR_TRACE("render submit");
         vkCmdEndRenderPass(cb);
         bound = nullptr;
+        writeTimestamp(2);
+        frameReadBack = readBack && recordReadBack(cb);
+        RenderPass* from = this;
+        for (RenderPass* rung : downscaleChain) {
+            rung->recordBlit(cb, from);
+            rung->frameReadBack = readBack && rung->recordReadBack(cb);
+            from = rung;
+        }
+        if (frameReadBack || !downscaleChain.empty()) writeTimestamp(3);
 
         if((reason = vkEndCommandBuffer(cb)) != VK_SUCCESS){
             LOGWITH("Failed to end command buffer:",reason);
@@ -3545,20 +4137,24 @@ namespace onart {
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &cb;
-        if(other){
+        const bool timeline = singleton->timelines[0] != VK_NULL_HANDLE; // 타임라인이 있으면 이진 세마포어는 쓰지 않음
+        if(other && !timeline){
             submitInfo.waitSemaphoreCount = 1;
             submitInfo.pWaitSemaphores = &other->semaphore;
             submitInfo.pWaitDstStageMask = waitStages;
         }
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &semaphore;
+        if(!timeline){
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &semaphore;
+        }
 
         if((reason = vkResetFences(singleton->device, 1, &fence)) != VK_SUCCESS){
             LOGWITH("Failed to reset fence. waiting or other operations will play incorrect");
             return;
         }
 
-        if ((reason = singleton->qSubmit(true, 1, &submitInfo, fence)) != VK_SUCCESS) {
+        recordingSlot = -1;
+        if ((reason = singleton->qSubmit(true, submitInfo, fence, other ? other->executed : 0, uploadWait, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, &executed)) != VK_SUCCESS) {
             LOGWITH("Failed to submit command buffer");
             return;
         }
@@ -3566,7 +4162,122 @@ namespace onart {
         currentPass = -1;
     }
 
+    bool VkMachine::RenderPass::setDownscaleChain(RenderPass* const* passes, uint32_t count) {
+        for (RenderPass* rung : downscaleChain) rung->chainOwner = nullptr;
+        downscaleChain.clear();
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(singleton->physicalDevice.card, singleton->baseSurfaceRendertargetFormat, &props);
+        auto features = [&props](RenderPass* p) { return p->targets.back()->color1->mapped ? props.linearTilingFeatures : props.optimalTilingFeatures; };
+        constexpr VkFormatFeatureFlags SOURCE = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        RenderPass* from = this;
+        for (uint32_t i = 0; i < count; i++) {
+            RenderPass* rung = passes[i];
+            if (!rung || rung == this || !rung->canBeRead || !rung->targets.back()->color1 || !from->targets.back()->color1) {
+                LOGWITH("Downscale targets must be render passes created with canCopy flag and a color target");
+                return false;
+            }
+            if ((features(from) & SOURCE) != SOURCE || !(features(rung) & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+                LOGWITH("This device can\'t blit the render target format with linear filter");
+                return false;
+            }
+            from = rung;
+        }
+        downscaleChain.assign(passes, passes + count);
+        for (RenderPass* rung : downscaleChain) rung->chainOwner = this;
+        return true;
+    }
+
+    void VkMachine::RenderPass::recordBlit(VkCommandBuffer cmd, RenderPass* from) {
+        RenderTarget* src = from->targets.back();
+        RenderTarget* dst = targets.back();
+        VkImageMemoryBarrier barriers[2]{};
+        for (VkImageMemoryBarrier& b : barriers) {
+            b.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            b.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            b.subresourceRange.levelCount = 1;
+            b.subresourceRange.layerCount = 1;
+        }
+        barriers[0].image = src->color1->img;
+        barriers[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barriers[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barriers[1].image = dst->color1->img;
+        barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED; // 전체를 덮어씀
+        barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+        VkImageBlit blit{};
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.layerCount = 1;
+        blit.srcOffsets[1] = { (int32_t)src->width, (int32_t)src->height, 1 };
+        blit.dstSubresource = blit.srcSubresource;
+        blit.dstOffsets[1] = { (int32_t)dst->width, (int32_t)dst->height, 1 };
+        vkCmdBlitImage(cmd, src->color1->img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst->color1->img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        std::swap(barriers[0].oldLayout, barriers[0].newLayout);
+        barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+        barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+    }
+
+    void VkMachine::RenderPass::beginTiming() {
+        recordingSlot = -1;
+        if (!singleton->gpuTiming) return;
+        if (!queryPool && !(queryPool = singleton->createTimestampPool(GPU_TIMING_SLOTS * 4))) return;
+        const uint32_t slot = nextSlot;
+        nextSlot = (nextSlot + 1) % GPU_TIMING_SLOTS;
+        if (slotWritten[slot]) collectTiming(slot); // GPU_TIMING_SLOTS 프레임 전의 결과. 준비되지 않았으면 버림
+        slotWritten[slot] = true;
+        vkCmdResetQueryPool(cb, queryPool, slot * 4, 4);
+        recordingSlot = (int32_t)slot;
+    }
+
+    void VkMachine::RenderPass::writeTimestamp(uint32_t index) {
+        if (recordingSlot < 0) return;
+        vkCmdWriteTimestamp(cb, index == 0 ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, (uint32_t)recordingSlot * 4 + index);
+    }
+
+    bool VkMachine::RenderPass::collectTiming(uint32_t slot) {
+        uint64_t result[8]; // (값, 가용성) x 4
+        reason = vkGetQueryPoolResults(singleton->device, queryPool, slot * 4, 4, sizeof(result), result, sizeof(uint64_t) * 2, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (reason != VK_SUCCESS && reason != VK_NOT_READY) return false;
+        if (!result[1] || !result[3] || !result[5]) return false; // 아직 끝나지 않음. 읽기 복사(3번)는 없을 수 있음
+        slotWritten[slot] = false;
+        const double passMs = singleton->timestampMs(true, result[2], result[4]);
+        timing.uploadMs += singleton->timestampMs(true, result[0], result[2]);
+        timing.passMs += passMs;
+        timing.lastPassMs = passMs;
+        if (result[7]) timing.readBackMs += singleton->timestampMs(true, result[4], result[6]);
+        timing.frames++;
+        return true;
+    }
+
+    VkMachine::GpuTiming VkMachine::RenderPass::getGpuTiming() {
+        if (currentPass == -1) { // 기록 중인 슬롯이 없으면 끝난 것을 오래된 순으로 반영
+            for (uint32_t i = 0; i < GPU_TIMING_SLOTS; i++) {
+                const uint32_t slot = (nextSlot + i) % GPU_TIMING_SLOTS;
+                if (slotWritten[slot]) collectTiming(slot);
+            }
+        }
+        return timing;
+    }
+
+    void VkMachine::RenderPass::resetGpuTiming() {
+        timing = {};
+    }
+
     bool VkMachine::RenderPass::wait(uint64_t timeout){
+        if (chainOwner) return chainOwner->wait(timeout); // 축소 복사는 연결한 패스의 제출에 포함됨
+        YR_TRACE("fence wait");
+        if(executed) return singleton->waitTimeline(true, executed, timeout);
         return vkWaitForFences(singleton->device, 1, &fence, VK_FALSE, timeout) == VK_SUCCESS; // VK_TIMEOUT이나 VK_ERROR_DEVICE_LOST
     }
 
@@ -3640,6 +4351,7 @@ namespace onart {
 
         if(currentPass == 0){
             wait();
+            uploadWait = 0;
             vkResetCommandBuffer(cb, 0);
             VkCommandBufferBeginInfo cbInfo{};
             cbInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -3650,6 +4362,12 @@ namespace onart {
                 currentPass = -1;
                 return;
             }
+            beginTiming();
+            writeTimestamp(0);
+            for(uint32_t i = 0; i < frameUploadCount; i++) { // startFrame: 렌더패스 밖에서 복사
+                if(frameUploads[i]) frameUploads[i]->recordCopy(cb, this);
+            }
+            writeTimestamp(1);
             VkRenderPassBeginInfo rpInfo{};
             std::vector<VkClearValue> clearValues;
             if (autoclear) {
@@ -3752,6 +4470,7 @@ namespace onart {
             LOGWITH("Invalid call: render pass not begun");
             return;
         }
+        uploadWait = tx->readyPoint(uploadWait);
         vkCmdBindDescriptorSets(scb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipelineLayout, pos, 1, &tx->dset, 0, nullptr);
     }
 
@@ -3900,20 +4619,23 @@ namespace onart {
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &cb;
-        if(other){
+        const bool timeline = singleton->timelines[0] != VK_NULL_HANDLE;
+        if(other && !timeline){
             submitInfo.waitSemaphoreCount = 1;
             submitInfo.pWaitSemaphores = &other->semaphore;
             submitInfo.pWaitDstStageMask = waitStages;
         }
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &semaphore;
+        if(!timeline){
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &semaphore;
+        }
 
         if((reason = vkResetFences(singleton->device, 1, &fence)) != VK_SUCCESS){
             LOGWITH("Failed to reset fence. waiting or other operations will play incorrect");
             return;
         }
 
-        if ((reason = singleton->qSubmit(true, 1, &submitInfo, fence)) != VK_SUCCESS) {
+        if ((reason = singleton->qSubmit(true, submitInfo, fence, other ? other->executed : 0, uploadWait, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, nullptr)) != VK_SUCCESS) {
             LOGWITH("Failed to submit command buffer");
             return;
         }
@@ -3937,6 +4659,7 @@ namespace onart {
         }
         wait();
         recording = true;
+        uploadWait = 0;
         vkResetCommandBuffer(cb, 0);
         vkResetCommandBuffer(scb, 0);
         VkCommandBufferInheritanceInfo ciInfo{};
@@ -4082,6 +4805,7 @@ namespace onart {
             LOGWITH("Invalid call: render pass not begun");
             return;
         }
+        uploadWait = tx->readyPoint(uploadWait);
         vkCmdBindDescriptorSets(cbs[currentCB], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[currentPass]->pipelineLayout, pos, 1, &tx->dset, 0, nullptr);
     }
 
@@ -4259,6 +4983,7 @@ namespace onart {
             }
 
             vkWaitForFences(singleton->device, 1, &fences[currentCB], VK_FALSE, UINT64_MAX);
+            uploadWait = 0;
             vkResetCommandBuffer(cbs[currentCB], 0);
             VkCommandBufferBeginInfo cbInfo{};
             cbInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -4339,7 +5064,8 @@ namespace onart {
         submitInfo.pWaitSemaphores = waits;
         submitInfo.waitSemaphoreCount = 1;
         submitInfo.pWaitDstStageMask = waitStages;
-        if(other){
+        const bool timeline = singleton->timelines[0] != VK_NULL_HANDLE;
+        if(other && !timeline){
             submitInfo.waitSemaphoreCount = 2;
             waits[1] = other->semaphore;
         }
@@ -4351,7 +5077,7 @@ namespace onart {
             return;
         }
 
-        if ((reason = singleton->qSubmit(true, 1, &submitInfo, fences[currentCB])) != VK_SUCCESS) {
+        if ((reason = singleton->qSubmit(true, submitInfo, fences[currentCB], other ? other->executed : 0, uploadWait, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, nullptr)) != VK_SUCCESS) {
             LOGWITH("Failed to submit command buffer:",reason,resultAsString(reason));
             return;
         }
@@ -4504,6 +5230,20 @@ namespace onart {
         appInfo.engineVersion = VK_MAKE_API_VERSION(0,0,1,0);
 
         std::vector<const char*> windowExt = Window::requiredInstanceExentsions();
+        {
+            uint32_t count;
+            vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+            std::vector<VkExtensionProperties> available(count);
+            vkEnumerateInstanceExtensionProperties(nullptr, &count, available.data());
+            for(const char* ext: VK_OPTIONAL_INSTANCE_EXT) {
+                for(VkExtensionProperties& prop: available) {
+                    if(std::strcmp(prop.extensionName, ext) == 0) {
+                        windowExt.push_back(ext);
+                        break;
+                    }
+                }
+            }
+        }
 
         instInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
         instInfo.pApplicationInfo = &appInfo;
@@ -4580,7 +5320,7 @@ namespace onart {
             if(subq == ~0ULL) subq = gq;
 
             uint64_t score = assessPhysicalDevice(card);
-            if(score > maxScore) {
+            if(!goodCard || score > maxScore) { // 소프트웨어 장치는 0점일 수 있음
                 maxScore = score;
                 goodCard = card;
                 maxGq = (uint32_t)gq;
@@ -4600,6 +5340,20 @@ namespace onart {
         return goodCard;
     }
 
+    bool linearTargetUsable(VkPhysicalDevice card, const VkImageCreateInfo& info) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(card, &properties);
+        if (properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU && properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_CPU) return false; // 외장 GPU에서는 PCIe 너머로 그리게 되어 오히려 느림
+        VkFormatProperties formatProps;
+        vkGetPhysicalDeviceFormatProperties(card, info.format, &formatProps);
+        VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT;
+        if (info.usage & VK_IMAGE_USAGE_SAMPLED_BIT) needed |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+        if ((formatProps.linearTilingFeatures & needed) != needed) return false;
+        VkImageFormatProperties imageProps;
+        if (vkGetPhysicalDeviceImageFormatProperties(card, info.format, info.imageType, VK_IMAGE_TILING_LINEAR, info.usage, info.flags, &imageProps) != VK_SUCCESS) return false;
+        return imageProps.maxExtent.width >= info.extent.width && imageProps.maxExtent.height >= info.extent.height;
+    }
+
     uint64_t assessPhysicalDevice(VkPhysicalDevice card) {
         VkPhysicalDeviceProperties properties;
         VkPhysicalDeviceFeatures features;
@@ -4635,38 +5389,71 @@ namespace onart {
         return score;
     }
 
-    VkDevice createDevice(VkPhysicalDevice card, int gq, int pq, int tq, int tqi) {
-        VkDeviceQueueCreateInfo qInfo[3]{};
-        float queuePriority[] = { 1.0f, 1.0f, 1.0f };
-        qInfo[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        qInfo[0].queueFamilyIndex = gq;
-        qInfo[0].queueCount = 1 + tqi;
-        qInfo[0].pQueuePriorities = queuePriority;
-
-        uint32_t qInfoCount = 1;
-        
-        if(gq == pq) {
-            qInfo[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            qInfo[1].queueFamilyIndex = tq;
-            qInfo[1].queueCount = 1;
-            qInfo[1].pQueuePriorities = queuePriority;
-            qInfoCount += (1 - tqi);
+    bool supportsDeviceExtensions(VkPhysicalDevice card, const char* const* exts, size_t extCount) {
+        uint32_t count;
+        vkEnumerateDeviceExtensionProperties(card, nullptr, &count, nullptr);
+        std::vector<VkExtensionProperties> available(count);
+        vkEnumerateDeviceExtensionProperties(card, nullptr, &count, available.data());
+        for(size_t i = 0; i < extCount; i++) {
+            bool found = false;
+            for(VkExtensionProperties& prop: available) {
+                if(std::strcmp(prop.extensionName, exts[i]) == 0) {
+                    found = true;
+                    break;
+                }
+            }
+            if(!found) return false;
         }
-        else{
-            qInfo[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            qInfo[1].queueFamilyIndex = pq;
-            qInfo[1].queueCount = 1;
-            qInfo[1].pQueuePriorities = queuePriority;
-
-            qInfoCount = 2;
+        return true;
+    }
 
-            qInfo[2].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            qInfo[2].queueFamilyIndex = tq;
-            qInfo[2].queueCount = 1;
-            qInfo[2].pQueuePriorities = queuePriority;
-            
-            qInfoCount += (1 - tqi);
-        }
+    uint64_t queryHostImportAlignment(VkInstance instance, VkPhysicalDevice card) {
+        PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+        if(!getProperties2) return 0;
+        if(!supportsDeviceExtensions(card, VK_HOST_IMPORT_DEVICE_EXT, std::size(VK_HOST_IMPORT_DEVICE_EXT))) return 0;
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProps{};
+        hostProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2KHR props{};
+        props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+        props.pNext = &hostProps;
+        getProperties2(card, &props);
+        return hostProps.minImportedHostPointerAlignment;
+    }
+
+    bool queryTimelineSupport(VkInstance instance, VkPhysicalDevice card) {
+        PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+        if(!getFeatures2) return false;
+        if(!supportsDeviceExtensions(card, VK_TIMELINE_DEVICE_EXT, std::size(VK_TIMELINE_DEVICE_EXT))) return false;
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        VkPhysicalDeviceFeatures2KHR features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features.pNext = &timelineFeatures;
+        getFeatures2(card, &features);
+        return timelineFeatures.timelineSemaphore == VK_TRUE;
+    }
+
+    VkDevice createDevice(VkPhysicalDevice card, int gq, int pq, int tq, int tqi, bool hostImport, bool timeline) {
+        VkDeviceQueueCreateInfo qInfo[3]{};
+        float queuePriority[] = { 1.0f, 1.0f, 1.0f };
+        uint32_t qInfoCount = 0;
+        // 같은 큐 계열은 한 번만 기술해야 함
+        auto addQueue = [&](int family, uint32_t count) {
+            for(uint32_t i = 0; i < qInfoCount; i++) {
+                if(qInfo[i].queueFamilyIndex == (uint32_t)family) {
+                    if(qInfo[i].queueCount < count) qInfo[i].queueCount = count;
+                    return;
+                }
+            }
+            qInfo[qInfoCount].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            qInfo[qInfoCount].queueFamilyIndex = family;
+            qInfo[qInfoCount].queueCount = count;
+            qInfo[qInfoCount].pQueuePriorities = queuePriority;
+            qInfoCount++;
+        };
+        addQueue(gq, 1);
+        addQueue(pq, 1);
+        addQueue(tq, 1 + tqi);
 
         VkPhysicalDeviceFeatures wantedFeatures{};
         VkPhysicalDeviceFeatures availableFeatures;
@@ -4682,8 +5469,17 @@ namespace onart {
         deviceInfo.pQueueCreateInfos = qInfo;
         deviceInfo.queueCreateInfoCount = qInfoCount;
         deviceInfo.pEnabledFeatures = &wantedFeatures;
-        deviceInfo.ppEnabledExtensionNames = VK_DESIRED_DEVICE_EXT;
-        deviceInfo.enabledExtensionCount = sizeof(VK_DESIRED_DEVICE_EXT) / sizeof(VK_DESIRED_DEVICE_EXT[0]);
+        std::vector<const char*> extensions(std::begin(VK_DESIRED_DEVICE_EXT), std::end(VK_DESIRED_DEVICE_EXT));
+        if(hostImport) extensions.insert(extensions.end(), std::begin(VK_HOST_IMPORT_DEVICE_EXT), std::end(VK_HOST_IMPORT_DEVICE_EXT));
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        timelineFeatures.timelineSemaphore = VK_TRUE;
+        if(timeline) {
+            extensions.insert(extensions.end(), std::begin(VK_TIMELINE_DEVICE_EXT), std::end(VK_TIMELINE_DEVICE_EXT));
+            deviceInfo.pNext = &timelineFeatures;
+        }
+        deviceInfo.ppEnabledExtensionNames = extensions.data();
+        deviceInfo.enabledExtensionCount = (uint32_t)extensions.size();
 
         VkDevice ret;
         VkResult result;
@@ -26,6 +26,8 @@
 
 #include "yr_math.hpp"
 #include "yr_threadpool.hpp"
+#include "yr_arena.hpp"
+#include "yr_pool.hpp"
 
 #include <type_traits>
 #include <vector>
@@ -86,6 +88,8 @@ namespace onart {
             /// @brief 메모리 맵으로 고정된 텍스처입니다. 실시간으로 CPU단에서 데이터를 수정할 수 있습니다. 동영상이나 다른 창의 화면 등을 텍스처로 사용할 때 적합합니다.
             class StreamTexture;
             using pStreamTexture = std::shared_ptr<StreamTexture>;
+            /// @brief 호스트 메모리를 복사 없이 전송 원본으로 사용하기 위해 가져온 버퍼입니다. @ref importHostMemory로 생성합니다.
+            struct ImportedHostMemory;
             /// @brief 속성을 직접 정의하는 정점 객체입니다.
             template<class, class...>
             struct Vertex;
@@ -176,6 +180,9 @@ namespace onart {
                 RenderTargetType screenDepthStencil = RenderTargetType::RTT_COLOR1;
                 /// @brief true일 경우 내용을 CPU 메모리로 읽어오거나 텍스처로 추출할 수 있습니다. RenderPass2Screen 및 RenderPass2Cube 생성 시에는 무시됩니다. 기본값 false
                 bool canCopy = false;
+                /// @brief true일 경우 장치가 지원하면 최종 서브패스의 첫 번째 색 타겟을 linear 타일링의 호스트 가시 메모리에 생성하여 @ref RenderPass::mapTarget 으로 복사 없이 읽을 수 있게 합니다.
+                /// 통합 메모리 GPU나 CPU 기반 장치에서 readBack의 복사를 줄이기 위한 것으로, 지원되지 않는 경우 무시됩니다. RenderPass2Screen 및 RenderPass2Cube 생성 시에는 무시됩니다. 기본값 false
+                bool hostVisibleTarget = false;
                 /// @brief 렌더패스 시작 시 모든 서브패스 타겟(색/깊이/스텐실)을 주어진 색으로 클리어합니다. 깊이/스텐실은 항상 1, 0으로 클리어합니다. vulkan API의 경우 autoclear를 사용하는 것이 더 성능이 높을 수 있습니다.
                 struct {
                     bool use = true;
@@ -343,6 +350,20 @@ namespace onart {
                 TextureArea2D area;
             };
 
+            /// @brief GPU 타임스탬프로 잰 누적 시간입니다. @ref setGpuTiming 으로 측정을 켠 동안만 채워지며, 결과는 GPU를 기다리지 않도록 몇 프레임 늦게 반영됩니다.
+            struct GpuTiming {
+                /// @brief 결과가 반영된 제출 수입니다.
+                uint32_t frames = 0;
+                /// @brief 렌더패스 구간의 누적 시간(ms)입니다.
+                double passMs = 0;
+                /// @brief 스트림 텍스처 복사의 누적 시간(ms)입니다.
+                double uploadMs = 0;
+                /// @brief @ref RenderPass::executeFrame 의 읽기 복사 누적 시간(ms)입니다.
+                double readBackMs = 0;
+                /// @brief 가장 최근에 반영된 렌더패스 구간의 시간(ms)입니다.
+                double lastPassMs = 0;
+            };
+
             /// @brief 요청한 비동기 동작 중 완료된 것이 있으면 처리합니다.
             static void handle();
             /// @brief 원하는 비동기 동작을 요청합니다.
@@ -400,6 +421,18 @@ namespace onart {
             static pTexture createTexture(int32_t key, const uint8_t* mem, size_t size, const TextureCreationOptions& opts = {});
             /// @brief 빈 텍스처를 만듭니다. 메모리 맵으로 데이터를 올릴 수 있습니다. 올리는 데이터의 기본 형태는 BGRA 순서이며, 필요한 경우 셰이더에서 직접 스위즐링하여 사용합니다.
             static pStreamTexture createStreamTexture(int32_t key, uint32_t width, uint32_t height, bool linearSampler = true);
+            /// @brief 호스트 메모리 가져오기(VK_EXT_external_memory_host)에 필요한 주소/크기 정렬 단위(바이트)를 리턴합니다. 장치가 지원하지 않으면 0을 리턴합니다.
+            static uint64_t getHostImportAlignment();
+            /// @brief 주어진 호스트 메모리를 전송 원본 버퍼로 가져옵니다. 가져온 메모리는 @ref StreamTexture::update 에 복사 없이 사용할 수 있습니다.
+            /// @param ptr 가져올 메모리의 시작 주소입니다. @ref getHostImportAlignment 의 배수여야 합니다.
+            /// @param size 가져올 메모리의 크기(바이트)입니다. @ref getHostImportAlignment 의 배수여야 합니다.
+            /// @return 가져온 메모리 객체입니다. 장치가 지원하지 않거나 실패하면 nullptr를 리턴합니다. 원본 메모리는 @ref releaseHostMemory 를 호출할 때까지 해제하면 안 됩니다.
+            static ImportedHostMemory* importHostMemory(void* ptr, uint64_t size);
+            /// @brief 가져온 호스트 메모리 객체를 해제합니다. 원본 메모리는 해제하지 않으며, 이 객체를 사용하는 전송이 모두 끝난 다음에 호출해야 합니다.
+            static void releaseHostMemory(ImportedHostMemory* mem);
+            /// @brief 렌더패스와 스트림 텍스처 복사의 GPU 시간 측정(타임스탬프 쿼리)을 켜거나 끕니다. 기본값은 꺼짐입니다.
+            /// @return 측정이 켜진 상태이면 true입니다. 그래픽스 큐가 타임스탬프를 지원하지 않으면 켜지 않고 false를 리턴합니다.
+            static bool setGpuTiming(bool on);
             /// @brief createTexture를 비동기적으로 실행합니다. 핸들러에 주어지는 매개변수는 하위 32비트 key, 상위 32비트 VkResult입니다(key를 가리키는 포인터가 아니라 그냥 key). 매개변수 설명은 createTexture를 참고하세요.
             static void asyncCreateTexture(int32_t key, const uint8_t* mem, size_t size, std::function<void(variant8)> handler, const TextureCreationOptions& opts = {});
             /// @brief 여러 개의 텍스처를 한 set으로 바인드하는 집합을 생성합니다.
@@ -485,7 +518,8 @@ namespace onart {
             /// @brief 펜스를 생성합니다. (해제는 알아서)
             VkFence createFence(bool signaled = false);
             /// @brief 세마포어를 생성합니다. (해제는 알아서)
-            VkSemaphore createSemaphore();
+            /// @param timeline true면 초깃값 0의 타임라인 세마포어를 생성합니다. 장치가 VK_KHR_timeline_semaphore를 지원해야 합니다.
+            VkSemaphore createSemaphore(bool timeline = false);
             /// @brief ktxTexture2 객체로 텍스처를 생성합니다.
             pTexture createTexture(void* ktxObj, int32_t key, const TextureCreationOptions& opts);
             /// @brief 그래픽스 또는 전송 큐에 명령을 제출합니다. 필요한 경우 cpu단 동기화를 수행합니다.
@@ -494,12 +528,29 @@ namespace onart {
             /// @param submitInfos 제출할 명령 정보
             /// @param fence 제출된 것이 종료하면 신호가 주어질 펜스
             VkResult qSubmit(bool gq_or_tq, uint32_t submitCount, const VkSubmitInfo* submitInfos, VkFence fence);
+            /// @brief 그래픽스 또는 전송 큐에 명령을 제출하며, 타임라인 세마포어를 지원하는 경우 다른 큐의 타임라인 값을 GPU에서 기다리고 제출한 큐의 타임라인을 올립니다.
+            /// submitInfo에 주어진 (이진) 세마포어 대기/신호는 그대로 유지됩니다. 대기 세마포어는 최대 2개, 신호 세마포어는 최대 2개까지 줄 수 있습니다.
+            /// @param waitGraphics 기다릴 그래픽스 큐 타임라인 값입니다. 0이면 기다리지 않습니다.
+            /// @param waitTransfer 기다릴 전송 큐 타임라인 값입니다. 0이면 기다리지 않습니다.
+            /// @param waitStage 타임라인 값을 기다릴 파이프라인 단계입니다.
+            /// @param signaled 제출한 명령이 끝나면 해당 큐의 타임라인이 도달할 값을 받습니다. 타임라인 세마포어를 지원하지 않는 경우 0이 들어가며, 이때는 펜스로만 동기화할 수 있습니다.
+            VkResult qSubmit(bool gq_or_tq, const VkSubmitInfo& submitInfo, VkFence fence, uint64_t waitGraphics, uint64_t waitTransfer, VkPipelineStageFlags waitStage, uint64_t* signaled);
             /// @brief 표시 큐에 명령을 제출합니다. 필요한 경우 cpu단 동기화를 수행합니다.
             VkResult qSubmit(const VkPresentInfoKHR* present);
+            /// @brief 그래픽스 또는 전송 큐의 타임라인이 주어진 값에 도달할 때까지 기다립니다.
+            /// @return 도달했으면 true, 시간 초과나 오류 시 false입니다. value가 0이면 즉시 true를 리턴합니다.
+            bool waitTimeline(bool gq_or_tq, uint64_t value, uint64_t timeout = UINT64_MAX);
+            /// @brief 주어진 큐에 대한 제출 시 잡아야 하는 잠금을 리턴합니다. 같은 큐를 가리키는 경우 같은 잠금이 리턴됩니다.
+            std::mutex& queueGuard(VkQueue queue);
+            /// @brief 주어진 수의 타임스탬프 쿼리 풀을 생성합니다. 실패하면 VK_NULL_HANDLE을 리턴합니다.
+            VkQueryPool createTimestampPool(uint32_t count);
+            /// @brief 두 타임스탬프 값의 차이를 ms 단위로 리턴합니다.
+            /// @param gq_or_tq 값을 기록한 큐 계열. true면 그래픽스, false면 전송입니다.
+            double timestampMs(bool gq_or_tq, uint64_t begin, uint64_t end);
             /// @brief vulkan 객체를 없앱니다.
             void free();
         private:
-            static RenderTarget* createRenderTarget2D(int width, int height, RenderTargetType type, bool useDepthInput, bool sampled, bool linear, bool canRead);
+            static RenderTarget* createRenderTarget2D(int width, int height, RenderTargetType type, bool useDepthInput, bool sampled, bool linear, bool canRead, bool hostVisible = false);
             static VkPipelineLayout createPipelineLayout(const PipelineLayoutOptions& options);
             static VkDescriptorSetLayout getDescriptorSetLayout(ShaderResourceType);
             ~VkMachine();
@@ -518,9 +569,18 @@ namespace onart {
                 uint32_t gq, pq, subq;
                 uint32_t subqIndex;
                 uint64_t minUBOffsetAlignment;
+                uint64_t minImportedHostPointerAlignment; // 0이면 호스트 메모리 가져오기를 지원하지 않음
+                float timestampPeriod; // 타임스탬프 1 증가당 ns
+                uint32_t gqTimestampBits, subqTimestampBits; // 큐 계열별 타임스탬프 유효 비트 수. 0이면 지원하지 않음
                 VkPhysicalDeviceFeatures features;
             } physicalDevice{};
             VkDevice device = VK_NULL_HANDLE;
+            PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerProperties = nullptr;
+            PFN_vkWaitSemaphoresKHR waitSemaphores = nullptr;
+            VkSemaphore timelines[2] = {}; // 그래픽스, 전송 큐 순서. 타임라인 세마포어를 지원하지 않으면 VK_NULL_HANDLE
+            uint64_t timelineValues[2] = {}; // 각 큐의 마지막 제출에 부여한 값. 해당 큐의 잠금 하에서만 수정
+            bool gpuTiming = false; // @ref setGpuTiming
+
             VkQueue graphicsQueue = VK_NULL_HANDLE;
             VkQueue presentQueue = VK_NULL_HANDLE;
             VkQueue transferQueue = VK_NULL_HANDLE;
@@ -563,12 +623,14 @@ namespace onart {
             } reaper;
 
             std::mutex textureGuard;
-            std::mutex qGuard; // gq와 tq에 동시 제출을 시도하는데 gq == tq일 때는 동기화가 필요함
+            std::mutex gqGuard, tqGuard, pqGuard; // 큐마다의 제출 잠금. 큐가 같으면 같은 잠금을 사용 (@ref queueGuard)
 
             struct ImageSet{
                 VkImage img = VK_NULL_HANDLE;
                 VkImageView view = VK_NULL_HANDLE;
                 VmaAllocation alloc = nullptr;
+                uint8_t* mapped = nullptr; // linear 타일링의 호스트 가시 이미지인 경우 첫 픽셀 주소
+                uint32_t rowPitch = 0;
                 void free();
             };
             std::set<ImageSet*> images;
@@ -715,6 +777,25 @@ namespace onart {
             /// @brief 기록된 명령을 모두 수행합니다. 동작이 완료되지 않아도 즉시 리턴합니다.
             /// @param other 이 패스가 시작하기 전에 기다릴 다른 렌더패스입니다. 전후 의존성이 존재할 경우 사용하는 것이 좋습니다. (Vk세마포어 동기화를 사용) 현재 버전에서 기다리는 단계는 VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT 하나로 고정입니다.
             void execute(RenderPass* other = nullptr);
+            /// @brief 업로드, 그리기, 읽기를 한 번의 제출로 처리하는 프레임을 시작합니다. start와 같되, 렌더패스 시작 전에 주어진 스트림 텍스처들의 대기 중인 복사를 같은 명령 버퍼에 기록합니다.
+            /// @param uploads 이번 프레임에 올릴 스트림 텍스처 목록입니다. @ref StreamTexture::setDeferred 로 지연 모드가 되지 않았거나 대기 중인 복사가 없는 텍스처는 무시됩니다.
+            /// @param uploadCount uploads의 길이입니다.
+            /// @param pos @ref start 의 pos와 같습니다.
+            void startFrame(const pStreamTexture* uploads, uint32_t uploadCount, uint32_t pos = 0);
+            /// @brief startFrame으로 시작한 프레임을 제출합니다. execute와 같되, readBack이 true이면 최종 색 타겟을 내부 버퍼로 복사하는 명령까지 같은 명령 버퍼에 기록하여, 프레임 전체가 한 번의 제출과 하나의 완료 신호로 끝납니다.
+            /// 복사된 내용은 @ref mapTarget 으로 읽을 수 있습니다. 타겟이 호스트 가시 메모리에 있는 경우 복사는 생략됩니다.
+            void executeFrame(bool readBack, RenderPass* other = nullptr);
+            /// @brief readBack을 켠 executeFrame과 같되, 최종 색 타겟 중 주어진 영역만 내부 버퍼로 복사합니다. 복사된 영역은 @ref mapTarget 이 리턴하는 전체 크기의 배치에서 같은 위치에 놓이며, 나머지 부분의 내용은 정해지지 않습니다.
+            /// 바뀐 부분만 시저로 다시 그린 프레임을 읽을 때 씁니다.
+            /// @param readAreas 복사할 영역 목록입니다. 가로나 세로 길이가 0인 영역은 무시됩니다.
+            /// @param areaCount readAreas의 길이입니다. 0이면 아무것도 복사하지 않습니다.
+            void executeFrame(const TextureArea2D* readAreas, uint32_t areaCount, RenderPass* other = nullptr);
+            /// @brief 이후의 executeFrame이 최종 색 타겟을 주어진 패스들의 타겟으로 차례로 축소 복사(선형 필터 blit)하는 명령까지 같은 명령 버퍼에 기록하게 합니다. 각 패스는 바로 앞 단계(첫 패스는 이 패스)의 결과를 원본으로 하므로 큰 것부터 주어야 합니다.
+            /// readBack을 켠 경우 각 패스의 타겟도 그 패스의 내부 버퍼로 읽어 오며, 각 패스의 @ref mapTarget 과 @ref wait 은 이 패스의 제출을 기다립니다. 연결된 패스는 직접 실행하지 않아야 합니다.
+            /// @param passes 축소 결과를 받을 패스 목록입니다. canCopy로 생성되어야 합니다.
+            /// @param count passes의 길이입니다. 0이면 연결을 해제합니다.
+            /// @return 장치가 타겟 포맷의 선형 blit을 지원하지 않거나 조건에 맞지 않는 패스가 있으면 false를 리턴하며, 이 경우 아무것도 연결되지 않습니다.
+            bool setDownscaleChain(RenderPass* const* passes, uint32_t count);
             /// @brief draw 수행 이후에 호출되면 그리기가 끝나고 나서 리턴합니다. 그 외의 경우는 그냥 리턴합니다.
             /// @param timeout 기다릴 최대 시간(ns), UINT64_MAX (~0) 값이 입력되면 무한정 기다립니다.
             /// @return 렌더패스 동작이 실제로 끝나서 리턴했으면 true입니다.
@@ -728,14 +809,42 @@ namespace onart {
             void asyncCopy2Texture(int32_t key, std::function<void(variant8)> handler, const RenderTarget2TextureOptions& opts = {});
             /// @brief 렌더타겟에 직전 execute 이후 그려진 내용을 CPU 메모리에 작성합니다. 포맷은 렌더타겟과 동일합니다. 현재 depth/stencil 버퍼는 항상 24/8 포맷임에 유의해 주세요.
             std::unique_ptr<uint8_t[]> readBack(uint32_t index, const TextureArea2D& area = {});
+            /// @brief @ref readBack 과 같되 주어진 메모리에 작성합니다. 매번 할당하지 않도록 호출자가 버퍼를 재사용할 때 씁니다.
+            /// @param dst 작성할 위치로, (영역의 가로 × 세로 × 4)바이트 이상이어야 합니다. 영역이 없으면 렌더타겟 전체 크기입니다.
+            /// @return 성공 여부
+            bool readBackTo(uint8_t* dst, uint32_t index, const TextureArea2D& area = {});
+            /// @brief @ref readBack 과 같되 프레임 아레나에서 메모리를 받습니다. 리턴된 메모리는 아레나가 reset될 때까지 유효합니다.
+            /// @return 실패 시 nullptr
+            uint8_t* readBack(uint32_t index, FrameArena& arena, const TextureArea2D& area = {});
+            /// @brief hostVisibleTarget 옵션으로 생성된 패스의 최종 색 타겟을 복사 없이 읽을 수 있는 주소를 리턴합니다. 직전 execute가 끝날 때까지 기다린 후 리턴합니다.
+            /// 직전 제출이 readBack을 켠 @ref executeFrame 이었다면 그때 복사된 내부 버퍼의 주소를 리턴합니다.
+            /// 리턴된 메모리는 다음 execute 또는 resize 전까지만 유효하며, 포맷은 렌더타겟과 동일합니다.
+            /// @param rowPitch 한 행의 길이(바이트)를 받을 위치입니다.
+            /// @return 첫 픽셀의 주소입니다. 타겟이 호스트 가시 메모리에 있지 않으면 nullptr를 리턴하며, 이 경우 @ref readBack 을 사용해야 합니다.
+            const uint8_t* mapTarget(uint32_t* rowPitch);
             /// @brief 렌더타겟에 그려진 내용을 CPU 메모리에 비동기로 작성합니다. asyncReadBack 호출 시점보다 뒤에 그려진 내용이 캡처될 수 있으며 이 사양은 추후 변할 수 있습니다. 포맷은 렌더타겟과 동일합니다.
             /// @param key 핸들러에 전달될 키입니다.
-            /// @param handler 비동기 핸들러입니다. @ref ReadBackBuffer의 포인터가 전달되며 해당 메모리는 자동으로 해제되므로 핸들러에서는 읽기만 가능합니다.
+            /// @param handler 비동기 핸들러입니다. @ref ReadBackBuffer의 포인터가 전달되며 해당 메모리는 핸들러가 끝나면 풀로 돌아가므로 핸들러에서는 읽기만 가능합니다.
             void asyncReadBack(int32_t key, uint32_t index, std::function<void(variant8)> handler, const TextureArea2D& area = {});
+            /// @brief 이 패스의 누적 GPU 시간을 리턴합니다. @ref setGpuTiming 이 켜진 동안 기록된 제출만 반영되며, 최근 몇 프레임은 아직 반영되지 않았을 수 있습니다.
+            GpuTiming getGpuTiming();
+            /// @brief 누적 GPU 시간을 0으로 되돌립니다.
+            void resetGpuTiming();
         private:
             RenderPass(VkRenderPass rp, VkFramebuffer fb, uint16_t stageCount, bool canBeRead, float* autoclear); // 이후 다수의 서브패스를 쓸 수 있도록 변경
             ~RenderPass();
             void reconstructFB(RenderTarget** targets);
+            /// @brief 렌더패스 종료 후 최종 색 타겟을 readBuffer로 복사하는 명령을 기록합니다. frameReadAreas가 있으면 그 영역만 복사합니다. 기록하지 않았으면 false를 리턴합니다.
+            bool recordReadBack(VkCommandBuffer cmd);
+            /// @brief from의 최종 색 타겟을 이 패스의 최종 색 타겟 크기로 축소 복사하는 명령을 기록합니다.
+            void recordBlit(VkCommandBuffer cmd, RenderPass* from);
+            /// @brief 시간 측정이 켜져 있으면 이번 기록에 쓸 쿼리 슬롯을 정하고 초기화합니다. 같은 슬롯의 이전 결과를 먼저 반영합니다. 명령 버퍼 기록 중 렌더패스 밖에서 호출해야 합니다.
+            void beginTiming();
+            /// @brief 이번 기록의 슬롯에 타임스탬프를 기록합니다. 측정 중이 아니면 아무것도 하지 않습니다.
+            /// @param index 0: 시작, 1: 업로드 끝, 2: 렌더패스 끝, 3: 읽기 복사 끝
+            void writeTimestamp(uint32_t index);
+            /// @brief 주어진 슬롯의 결과가 준비되었으면 누적 시간에 반영하고 true를 리턴합니다. GPU를 기다리지 않습니다.
+            bool collectTiming(uint32_t slot);
             const uint16_t stageCount;
             VkFramebuffer fb = VK_NULL_HANDLE;
             VkRenderPass rp = VK_NULL_HANDLE;
@@ -752,6 +861,31 @@ namespace onart {
             
             VkFence fence = VK_NULL_HANDLE;
             VkSemaphore semaphore = VK_NULL_HANDLE;
+            uint64_t uploadWait = 0; // 이번 기록에서 바인드된 스트림 텍스처들이 기다려야 할 전송 타임라인 값
+            uint64_t executed = 0; // 마지막 execute의 그래픽스 타임라인 값
+
+            const pStreamTexture* frameUploads = nullptr; // startFrame 동안에만 유효
+            uint32_t frameUploadCount = 0;
+            VkBuffer readBuffer = VK_NULL_HANDLE; // executeFrame의 읽기 대상
+            VmaAllocation readAlloc = nullptr;
+            uint8_t* readMap = nullptr;
+            bool frameReadBack = false; // 직전 제출이 readBuffer로 복사했는지
+            const TextureArea2D* frameReadAreas = nullptr; // 영역을 지정한 executeFrame 동안에만 유효
+            uint32_t frameReadAreaCount = 0;
+            std::vector<VkBufferImageCopy> readRegions; // 영역별 읽기 복사. 매 프레임 재사용
+            std::vector<RenderPass*> downscaleChain; // executeFrame에서 차례로 축소 복사할 패스
+            RenderPass* chainOwner = nullptr; // 이 패스를 축소 대상으로 연결한 패스
+            std::vector<StreamTexture*> deferredCopies; // copiedBy가 이 패스를 가리키는 텍스처
+
+            static constexpr uint32_t GPU_TIMING_SLOTS = 3; // 결과를 읽기 전까지 지나는 프레임 수
+            VkQueryPool queryPool = VK_NULL_HANDLE; // 슬롯마다 타임스탬프 4개
+            uint32_t nextSlot = 0;
+            int32_t recordingSlot = -1; // 이번 기록의 슬롯. 측정하지 않으면 -1
+            bool slotWritten[GPU_TIMING_SLOTS] = {};
+            GpuTiming timing{};
+
+            LockFreePool<ReadBackBuffer, 16> readBackBuffers; // asyncReadBack의 결과 객체
+            std::shared_ptr<LockFreeBlockPool> readBackBlocks; // asyncReadBack의 픽셀 메모리. 더 큰 영역을 요청하면 교체되며, 진행 중인 것은 이전 풀을 잡고 있음
     };
 
     /// @brief 큐브맵 대상의 렌더패스입니다.
@@ -825,6 +959,7 @@ namespace onart {
             VkSemaphore semaphore = VK_NULL_HANDLE;
             VkCommandBuffer cb = VK_NULL_HANDLE, scb = VK_NULL_HANDLE; // 0번이 주 버퍼, 1번이 보조 버퍼
             VkCommandBuffer facewise[6]={};
+            uint64_t uploadWait = 0; // 이번 기록에서 바인드된 스트림 텍스처들이 기다려야 할 전송 타임라인 값
 
             VkDescriptorSet csamp = VK_NULL_HANDLE;
 
@@ -930,6 +1065,7 @@ namespace onart {
             VkFence fences[COMMANDBUFFER_COUNT] = {};
             VkSemaphore acquireSm[COMMANDBUFFER_COUNT] = {};
             VkSemaphore drawSm[COMMANDBUFFER_COUNT] = {}; // 하나로 같이 쓰면 낮은 확률로 화면 프레젠트가 먼저 실행될 수도 있음
+            uint64_t uploadWait = 0; // 이번 기록에서 바인드된 스트림 텍스처들이 기다려야 할 전송 타임라인 값
             const Mesh* bound = nullptr;
 
             uint32_t currentCB = 0;
@@ -987,14 +1123,44 @@ namespace onart {
         public:
             const uint16_t width, height;
             void update(void* img);
-            void updateBy(std::function<void(void*, uint32_t)> function);
+            /// @brief 텍스처의 매핑된 메모리에 직접 작성하는 함수로 이미지 데이터를 다시 설정합니다. 함수는 이 호출 안에서만 실행되며 복사되지 않으므로 큰 캡처도 할당 없이 넘길 수 있습니다.
+            void updateBy(FunctionRef<void(void*, uint32_t)> function);
+            /// @brief 가져온 호스트 메모리로부터 스테이징 복사 없이 텍스처를 갱신합니다. 메모리 내용은 다음 갱신 호출 전까지, 그리고 이 텍스처를 사용한 렌더패스가 끝날 때까지 유지되어야 합니다.
+            /// @param src @ref VkMachine::importHostMemory 로 가져온 메모리입니다.
+            /// @param offset src 안에서 첫 픽셀의 위치(바이트)입니다.
+            /// @param rowPitch 한 행의 길이(바이트)입니다. 4의 배수여야 하며, 0이면 width * 4로 간주합니다.
+            void update(const ImportedHostMemory* src, uint64_t offset, uint32_t rowPitch);
+            /// @brief 다음 갱신 호출 하나가 텍스처 중 주어진 영역만 복사하도록 합니다. 원본(매핑된 메모리나 가져온 메모리)의 배치는 그대로 전체 크기이며, 영역 밖의 텍스처 내용은 이전 것이 유지됩니다.
+            /// updateBy의 함수는 이 영역만 작성해도 됩니다. 갱신 호출 후에는 다시 전체 복사로 돌아갑니다.
+            /// @param areas 복사할 영역 목록입니다. 가로나 세로 길이가 0인 영역은 무시됩니다.
+            /// @param count areas의 길이입니다. 0이면 지정을 취소합니다.
+            void setUpdateAreas(const TextureArea2D* areas, uint32_t count);
+            /// @brief true로 설정하면 update 계열 함수가 복사를 따로 제출하지 않고 기억만 해 두며, 복사는 이 텍스처를 넘긴 @ref RenderPass::startFrame 에서 그리기와 같은 명령 버퍼에 기록됩니다.
+            /// false로 되돌릴 때 대기 중인 복사가 있으면 즉시 제출합니다. 기본값 false
+            void setDeferred(bool deferred);
+            /// @brief 마지막 갱신의 복사가 끝나 스테이징 버퍼를 다시 써도 될 때까지 기다립니다. 지연 모드에서는 복사를 기록한 렌더패스를 기다립니다.
+            void wait();
+            /// @brief 이 텍스처의 (지연 모드가 아닌) 복사에 걸린 누적 GPU 시간을 리턴합니다. uploadMs와 frames만 채워집니다. 지연 모드의 복사는 렌더패스 쪽에 집계됩니다.
+            GpuTiming getGpuTiming();
             static void drop(int32_t key);
         protected:
             StreamTexture(VkImage img, VkImageView imgView, VmaAllocation alloc, VkDescriptorSet dst, uint32_t binding, uint16_t width, uint16_t height);
             VkDescriptorSetLayout getLayout();
             ~StreamTexture();
         private:
-            void afterCopy();
+            void afterCopy(VkBuffer src, VkDeviceSize offset, uint32_t rowLength);
+            /// @brief 이번 복사의 영역들을 regions에 만들고 지정된 영역을 비웁니다.
+            void buildRegions(VkDeviceSize offset, uint32_t rowLength);
+            /// @brief regions의 복사를 별도로 제출합니다.
+            void submitCopy(VkBuffer src);
+            /// @brief 대기 중인 복사를 주어진 명령 버퍼에 기록합니다.
+            void recordCopy(VkCommandBuffer cb, RenderPass* by);
+            /// @brief copiedBy와의 연결을 양쪽에서 끊습니다.
+            void detachCopy();
+            /// @brief 이 텍스처를 읽는 렌더패스가 기다려야 할 전송 타임라인 값을 prev와 합쳐 리턴합니다. 타임라인 세마포어를 지원하지 않으면 마지막 복사를 CPU에서 기다리고 prev를 리턴합니다.
+            uint64_t readyPoint(uint64_t prev);
+            /// @brief 끝난 복사의 타임스탬프를 누적 시간에 반영합니다. 펜스가 신호된 후에 호출해야 합니다.
+            void collectTiming();
             VkBuffer buf;
             VkImage img;
             VkImageView view;
@@ -1004,6 +1170,15 @@ namespace onart {
             uint32_t binding;
             VkCommandBuffer cb;
             void* mmap;
+            uint64_t uploaded = 0; // 마지막 복사의 전송 타임라인 값
+            bool deferred = false;
+            VkBuffer pendingSrc = VK_NULL_HANDLE; // 지연 모드에서 아직 기록되지 않은 복사
+            std::vector<TextureArea2D> updateAreas; // 다음 갱신에서 복사할 영역. 비었으면 전체
+            std::vector<VkBufferImageCopy> regions; // 마지막 갱신의 복사 영역
+            RenderPass* copiedBy = nullptr; // 지연 모드에서 마지막 복사를 기록한 패스
+            VkQueryPool queryPool = VK_NULL_HANDLE; // 복사 전후 타임스탬프 2개
+            bool queryWritten = false;
+            GpuTiming timing{};
     };
 
     class VkMachine::Mesh{
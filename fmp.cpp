@@ -1,17 +1,58 @@
 #include "fmp.h"
 #include <list>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <future>
+
+#include "YERM/externals/boost/predef/os.h"
+#if BOOST_OS_WINDOWS
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <Windows.h>
+#else
+	#include <cerrno>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#if BOOST_OS_LINUX
+		#include <sys/vfs.h>
+		#include <sys/syscall.h>
+		#if defined(__has_include)
+			#if __has_include(<linux/io_uring.h>)
+				#include <linux/io_uring.h>
+			#endif
+		#endif
+		#if defined(IORING_OFF_SQ_RING) && defined(__NR_io_uring_setup)
+			#define FMP_IO_URING 1
+		#endif
+	#endif
+#endif
+#ifndef FMP_IO_URING
+	#define FMP_IO_URING 0
+#endif
 
 extern "C" {
 	#include "YERM/externals/ffmpeg/include/libavformat/avformat.h"
 	#include "YERM/externals/ffmpeg/include/libavcodec/avcodec.h"
 	#include "YERM/externals/ffmpeg/include/libswscale/swscale.h"
 	#include "YERM/externals/ffmpeg/include/libavutil/imgutils.h"
+	#include "YERM/externals/ffmpeg/include/libavutil/pixdesc.h"
+	#include "YERM/externals/ffmpeg/include/libavutil/opt.h"
 }
 
 #include "YERM/YERM_PC/yr_graphics.h"
 #include "YERM/YERM_PC/yr_input.h"
 
 #include "YERM/YERM_PC/logger.hpp"
+#include "YERM/YERM_PC/yr_compiler_specific.hpp"
+#include "YERM/YERM_PC/yr_pool.hpp"
+#include "YERM/YERM_PC/yr_framemem.h"
+#include "YERM/YERM_PC/yr_hash.hpp"
+#include "YERM/YERM_PC/yr_trace.hpp"
 
 namespace onart {
 
@@ -51,6 +92,1047 @@ namespace onart {
 	template<> void freec<SwsContext>(SwsContext* ctx) { sws_freeContext(ctx); }
 	template<> void freec<AVPacket>(AVPacket* pkt) { av_packet_free(&pkt); }
 
+	static std::atomic<bool> measuring{ true };
+
+	void setStatsEnabled(bool enabled) { measuring = enabled; }
+	bool statsEnabled() { return measuring.load(std::memory_order_relaxed); }
+
+	static int64_t nowUS() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	StageMeter::Scope::Scope(StageMeter& meter, State state) :Scope(&meter, state) {}
+	StageMeter::Scope::Scope(StageMeter* meter, State state) : meter(statsEnabled() ? meter : nullptr), state(state), begin(0) {
+		if (this->meter) begin = nowUS();
+	}
+	StageMeter::Scope::~Scope() { end(); }
+	void StageMeter::Scope::end() {
+		if (!meter) return;
+		const int64_t now = nowUS();
+		meter->addSpan(state, begin, now);
+		meter = nullptr;
+	}
+
+	void StageMeter::add(State state, uint64_t us) {
+		if (!statsEnabled()) return;
+		const int64_t now = nowUS();
+		addSpan(state, now - (int64_t)us, now);
+	}
+
+	void StageMeter::addSpan(State state, int64_t begin, int64_t end) {
+		(state == State::BUSY ? busyUS : blockedUS).fetch_add((uint64_t)(end - begin), std::memory_order_relaxed);
+		int64_t zero = 0;
+		firstUS.compare_exchange_strong(zero, begin, std::memory_order_relaxed);
+		lastUS.store(end, std::memory_order_relaxed);
+	}
+
+	void StageMeter::count(uint64_t frames) { items.fetch_add(frames, std::memory_order_relaxed); }
+
+	WorkerStats StageMeter::snapshot() const {
+		WorkerStats ret;
+		ret.items = items.load(std::memory_order_relaxed);
+		ret.busyUS = busyUS.load(std::memory_order_relaxed);
+		ret.blockedUS = blockedUS.load(std::memory_order_relaxed);
+		const int64_t first = firstUS.load(std::memory_order_relaxed);
+		if (first) ret.wallUS = (uint64_t)(lastUS.load(std::memory_order_relaxed) - first);
+		return ret;
+	}
+
+	void StageMeter::reset() {
+		items = 0; busyUS = 0; blockedUS = 0; firstUS = 0; lastUS = 0;
+	}
+
+	std::string StatsSnapshot::table() const {
+		std::string ret;
+		char row[160];
+		std::snprintf(row, sizeof(row), "%-12s %8s %9s %7s %9s %9s\n", "stage", "frames", "fps", "busy%", "blocked%", "wall(s)");
+		ret += row;
+		for (auto& [name, st] : stages) {
+			const double wall = st.wallUS ? (double)st.wallUS : 1.0;
+			std::snprintf(row, sizeof(row), "%-12s %8llu %9.2f %6.1f%% %8.1f%% %9.3f\n", name.c_str(), (unsigned long long)st.items,
+				st.items * 1e6 / wall, st.busyUS * 100.0 / wall, st.blockedUS * 100.0 / wall, st.wallUS / 1e6);
+			ret += row;
+		}
+		if (!rings.empty()) {
+			std::snprintf(row, sizeof(row), "%-12s %8s %14s %14s %10s %6s\n", "ring", "frames", "write wait(ms)", "read wait(ms)", "mean load", "full%");
+			ret += row;
+		}
+		for (auto& [name, rb] : rings) {
+			uint64_t writes = 0, weighted = 0;
+			for (size_t i = 0; i < rb.occupancy.size(); i++) {
+				writes += rb.occupancy[i];
+				weighted += rb.occupancy[i] * i;
+			}
+			const double full = (writes && !rb.occupancy.empty()) ? rb.occupancy.back() * 100.0 / writes : 0;
+			std::snprintf(row, sizeof(row), "%-12s %8llu %14.1f %14.1f %10.2f %5.1f%%\n", name.c_str(), (unsigned long long)rb.items,
+				rb.writeWaitUS / 1e3, rb.readWaitUS / 1e3, writes ? (double)weighted / writes : 0.0, full);
+			ret += row;
+		}
+		if (!io.empty()) {
+			std::snprintf(row, sizeof(row), "%-12s %10s %8s %6s %13s %9s %12s\n", "file", "MB", "calls", "seeks", "io wait(ms)", "disk(ms)", "disk(MB/s)");
+			ret += row;
+		}
+		for (auto& [name, st] : io) {
+			std::snprintf(row, sizeof(row), "%-12s %10.1f %8llu %6llu %13.1f %9.1f %12.1f\n", name.c_str(), st.bytes / 1e6, (unsigned long long)st.calls,
+				(unsigned long long)st.seeks, st.waitUS / 1e3, st.diskUS / 1e3, st.diskUS ? st.diskBytes / (double)st.diskUS : 0.0);
+			ret += row;
+		}
+		return ret;
+	}
+
+	constexpr uint64_t LATENCY_BIN_US = 500;
+	constexpr size_t LATENCY_BINS = 4000;
+
+	LatencyMeter::LatencyMeter() :bins(LATENCY_BINS) {}
+
+	void LatencyMeter::add(int64_t us) {
+		if (us < 0) us = 0;
+		bins[std::min<size_t>((size_t)us / LATENCY_BIN_US, LATENCY_BINS - 1)]++;
+		frames++;
+		totalUS += (uint64_t)us;
+		maxUS = std::max<uint64_t>(maxUS, (uint64_t)us);
+	}
+
+	LatencyStats LatencyMeter::stats() const {
+		LatencyStats ret;
+		ret.frames = frames;
+		if (!frames) return ret;
+		ret.meanMs = totalUS / 1e3 / frames;
+		ret.maxMs = maxUS / 1e3;
+		// upper edge of the bin holding the ceil(percent * frames / 100)th sample, not above the max
+		auto percentile = [this](uint64_t percent) {
+			const uint64_t rank = std::max<uint64_t>(1, (percent * frames + 99) / 100);
+			uint64_t seen = 0;
+			for (size_t i = 0; i < bins.size(); i++) {
+				if ((seen += bins[i]) >= rank) return std::min<uint64_t>((i + 1) * LATENCY_BIN_US, maxUS) / 1e3;
+			}
+			return maxUS / 1e3;
+		};
+		ret.p50Ms = percentile(50);
+		ret.p95Ms = percentile(95);
+		ret.p99Ms = percentile(99);
+		return ret;
+	}
+
+	void LatencyMeter::reset() {
+		std::fill(bins.begin(), bins.end(), 0);
+		frames = 0; totalUS = 0; maxUS = 0;
+	}
+
+	std::string LatencyStats::line() const {
+		char ret[160];
+		std::snprintf(ret, sizeof(ret), "%llu frames, mean %.1f ms, p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f ms", (unsigned long long)frames,
+			meanMs, p50Ms, p95Ms, p99Ms, maxMs);
+		return ret;
+	}
+
+	std::string EncodeReport::line(const std::string& name) const {
+		char ret[160];
+		std::snprintf(ret, sizeof(ret), "%s: %llu frames, %.1f fps, %.2f MB, %.0f kbps", name.c_str(), (unsigned long long)frames,
+			wallSeconds > 0 ? frames / wallSeconds : 0.0, bytes / 1e6, mediaSeconds > 0 ? bytes * 8 / 1e3 / mediaSeconds : 0.0);
+		return ret;
+	}
+
+	std::string StatsSnapshot::line() const {
+		std::string ret;
+		char part[96];
+		for (auto& [name, st] : stages) {
+			const double wall = st.wallUS ? (double)st.wallUS : 1.0;
+			std::snprintf(part, sizeof(part), "%s%s %llu %.0f%%", ret.empty() ? "" : " | ", name.c_str(), (unsigned long long)st.items, st.busyUS * 100.0 / wall);
+			ret += part;
+		}
+		for (auto& [name, rb] : rings) {
+			std::snprintf(part, sizeof(part), "%s%s w%.0fms r%.0fms", ret.empty() ? "" : " | ", name.c_str(), rb.writeWaitUS / 1e3, rb.readWaitUS / 1e3);
+			ret += part;
+		}
+		for (auto& [name, st] : io) {
+			std::snprintf(part, sizeof(part), "%s%s %.1fMB io-wait %.0fms", ret.empty() ? "" : " | ", name.c_str(), st.bytes / 1e6, st.waitUS / 1e3);
+			ret += part;
+		}
+		return ret;
+	}
+
+	// ---- input I/O
+
+	struct InputFileBase {
+		struct Slot {
+			uint8_t* data = nullptr;
+			int64_t index = -1; // block held or being read into this slot
+			size_t length = 0;
+			bool ready = false;
+			bool failed = false;
+		};
+		InputFile::Mode mode = InputFile::Mode::DEFAULT;
+		AVIOContext* pb = nullptr;
+		int64_t size = 0;
+		int64_t pos = 0; // demuxer read position. only touched by the demuxing thread
+		size_t blockSize = 0;
+		size_t prefetchBlocks = 0;
+		// MMAP
+		uint8_t* mapped = nullptr;
+		int64_t advisedTo = 0;
+		// READ_AHEAD: block i of the file goes to slots[i % slots.size()] while base <= i < base + slots.size()
+		std::vector<Slot> slots;
+		int64_t base = 0;
+		bool stop = false;
+		std::thread* worker = nullptr;
+		std::mutex guard;
+		std::condition_variable dataCV, workCV;
+#if BOOST_OS_WINDOWS
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#else
+		int fd = -1;
+#endif
+		std::atomic<uint64_t> bytes{ 0 }, calls{ 0 }, seeks{ 0 }, waitUS{ 0 }, diskUS{ 0 }, diskBytes{ 0 };
+		~InputFileBase();
+	};
+
+	constexpr size_t AVIO_BUFFER_SIZE = 1 << 16;
+	constexpr size_t IO_BLOCK_ALIGN = 4096;
+
+#if BOOST_OS_WINDOWS
+	static bool openInputFile(InputFileBase* b, const char* fileName) {
+		b->file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (b->file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(b->file, &size)) return false;
+		b->size = size.QuadPart;
+		return true;
+	}
+
+	static bool isRegularFile(const char* fileName) {
+		if (std::strncmp(fileName, "\\\\.\\", 4) == 0) return false; // device or named pipe
+		const DWORD attr = GetFileAttributesA(fileName);
+		return attr != INVALID_FILE_ATTRIBUTES && !(attr & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE));
+	}
+
+	static bool isRemoteInput(InputFileBase*, const char* fileName) {
+		if ((fileName[0] == '\\' || fileName[0] == '/') && fileName[0] == fileName[1]) return true; // UNC path
+		char root[MAX_PATH];
+		if (!GetVolumePathNameA(fileName, root, MAX_PATH)) return false;
+		return GetDriveTypeA(root) == DRIVE_REMOTE;
+	}
+
+	static int64_t readInputAt(InputFileBase* b, uint8_t* dst, size_t length, int64_t offset) {
+		size_t done = 0;
+		while (done < length) {
+			OVERLAPPED ov{};
+			ov.Offset = (DWORD)(offset + done);
+			ov.OffsetHigh = (DWORD)((uint64_t)(offset + done) >> 32);
+			DWORD got = 0;
+			if (!ReadFile(b->file, dst + done, (DWORD)std::min<size_t>(length - done, 1u << 30), &got, &ov)) return -1;
+			if (got == 0) break;
+			done += got;
+		}
+		return (int64_t)done;
+	}
+
+	static bool mapInputFile(InputFileBase* b) {
+		if (b->size == 0) return false;
+		b->mapping = CreateFileMappingA(b->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!b->mapping) return false;
+		b->mapped = (uint8_t*)MapViewOfFile(b->mapping, FILE_MAP_READ, 0, 0, 0);
+		return b->mapped != nullptr;
+	}
+
+	static void adviseInput(InputFileBase* b, int64_t offset, size_t length) {
+#if _WIN32_WINNT >= 0x0602
+		WIN32_MEMORY_RANGE_ENTRY range{ b->mapped + offset, length };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+	}
+
+	InputFileBase::~InputFileBase() {
+		if (worker) {
+			{
+				std::unique_lock _(guard);
+				stop = true;
+			}
+			workCV.notify_all();
+			worker->join();
+			delete worker;
+		}
+		for (Slot& s : slots) FrameMemory::free(s.data);
+		if (mapped) UnmapViewOfFile(mapped);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		if (pb) {
+			av_freep(&pb->buffer);
+			avio_context_free(&pb);
+		}
+	}
+#else
+	static bool openInputFile(InputFileBase* b, const char* fileName) {
+		b->fd = ::open(fileName, O_RDONLY | O_CLOEXEC);
+		if (b->fd < 0) return false;
+		struct stat st;
+		if (fstat(b->fd, &st) != 0) return false;
+		b->size = st.st_size;
+		return true;
+	}
+
+	// stat, not fstat: opening a FIFO blocks until its writer shows up, and FFmpeg opens it again afterwards
+	static bool isRegularFile(const char* fileName) {
+		struct stat st;
+		return stat(fileName, &st) == 0 && S_ISREG(st.st_mode);
+	}
+
+	static bool isRemoteInput(InputFileBase* b, const char*) {
+#if BOOST_OS_LINUX
+		struct statfs fs;
+		if (fstatfs(b->fd, &fs) != 0) return false;
+		switch ((uint32_t)fs.f_type) {
+		case 0x6969u:     // NFS
+		case 0xFF534D42u: // CIFS
+		case 0xFE534D42u: // SMB2
+		case 0x517Bu:     // SMB
+		case 0x65735546u: // FUSE (sshfs, s3fs, ...)
+		case 0x01021997u: // 9P
+		case 0x00C36400u: // Ceph
+			return true;
+		default:
+			return false;
+		}
+#else
+		return false;
+#endif
+	}
+
+	static int64_t readInputAt(InputFileBase* b, uint8_t* dst, size_t length, int64_t offset) {
+		size_t done = 0;
+		while (done < length) {
+			const ssize_t got = pread(b->fd, dst + done, length - done, (off_t)(offset + done));
+			if (got < 0) {
+				if (errno == EINTR) continue;
+				return -1;
+			}
+			if (got == 0) break;
+			done += (size_t)got;
+		}
+		return (int64_t)done;
+	}
+
+	static bool mapInputFile(InputFileBase* b) {
+		if (b->size == 0) return false;
+		void* p = mmap(nullptr, (size_t)b->size, PROT_READ, MAP_PRIVATE, b->fd, 0);
+		if (p == MAP_FAILED) return false;
+		madvise(p, (size_t)b->size, MADV_SEQUENTIAL); // larger kernel read-ahead, pages behind may be dropped early
+		b->mapped = (uint8_t*)p;
+		return true;
+	}
+
+	static void adviseInput(InputFileBase* b, int64_t offset, size_t length) {
+		const int64_t page = (int64_t)sysconf(_SC_PAGESIZE);
+		const int64_t begin = offset / page * page;
+		madvise(b->mapped + begin, (size_t)(offset + (int64_t)length - begin), MADV_WILLNEED); // starts reading without waiting
+	}
+
+	InputFileBase::~InputFileBase() {
+		if (worker) {
+			{
+				std::unique_lock _(guard);
+				stop = true;
+			}
+			workCV.notify_all();
+			worker->join();
+			delete worker;
+		}
+		for (Slot& s : slots) FrameMemory::free(s.data);
+		if (mapped) munmap(mapped, (size_t)size);
+		if (fd >= 0) ::close(fd);
+		if (pb) {
+			av_freep(&pb->buffer);
+			avio_context_free(&pb);
+		}
+	}
+#endif
+
+	// keeps prefetchBlocks blocks ahead of the read position in the page cache
+	static int readMapped(InputFileBase* b, uint8_t* buf, int size) {
+		const int64_t window = std::min<int64_t>(b->size, b->pos + (int64_t)(b->blockSize * b->prefetchBlocks));
+		if (b->advisedTo < b->pos) b->advisedTo = b->pos;
+		while (b->advisedTo < window) {
+			const size_t length = (size_t)std::min<int64_t>((int64_t)b->blockSize, b->size - b->advisedTo);
+			adviseInput(b, b->advisedTo, length);
+			b->advisedTo += length;
+		}
+		// page faults can't be told apart from the copy, so all of it counts as waiting
+		const int64_t begin = statsEnabled() ? nowUS() : 0;
+		std::memcpy(buf, b->mapped + b->pos, size);
+		if (begin) b->waitUS.fetch_add((uint64_t)(nowUS() - begin), std::memory_order_relaxed);
+		return size;
+	}
+
+	static int readAhead(InputFileBase* b, uint8_t* buf, int size) {
+		const int64_t blockSize = (int64_t)b->blockSize;
+		const int64_t slotCount = (int64_t)b->slots.size();
+		int done = 0;
+		std::unique_lock _(b->guard);
+		while (done < size) {
+			const int64_t at = b->pos + done;
+			const int64_t index = at / blockSize;
+			if (index != b->base) {
+				b->base = index;
+				b->workCV.notify_one();
+			}
+			InputFileBase::Slot& s = b->slots[index % slotCount];
+			if (s.index != index || !s.ready) {
+				if (done) break; // hand over what is there instead of waiting
+				const bool measure = statsEnabled();
+				const int64_t begin = measure ? nowUS() : 0;
+				while (!b->stop && (s.index != index || !s.ready)) b->dataCV.wait(_);
+				if (measure) b->waitUS.fetch_add((uint64_t)(nowUS() - begin), std::memory_order_relaxed);
+				if (b->stop) return AVERROR_EXIT;
+				continue;
+			}
+			const size_t offset = (size_t)(at - index * blockSize);
+			if (s.failed || offset >= s.length) {
+				if (done) break;
+				return s.failed ? AVERROR(EIO) : AVERROR_EOF;
+			}
+			const size_t n = std::min(s.length - offset, (size_t)(size - done));
+			std::memcpy(buf + done, s.data + offset, n);
+			done += (int)n;
+		}
+		return done;
+	}
+
+	// fills the window from its first missing block
+	static void readAheadLoop(InputFileBase* b) {
+		Tracer::nameThread("read-ahead");
+		const int64_t blockSize = (int64_t)b->blockSize;
+		const int64_t slotCount = (int64_t)b->slots.size();
+		const int64_t blockCount = (b->size + blockSize - 1) / blockSize;
+		std::unique_lock _(b->guard);
+		while (!b->stop) {
+			InputFileBase::Slot* target = nullptr;
+			int64_t index = b->base;
+			for (; index < b->base + slotCount && index < blockCount; index++) {
+				InputFileBase::Slot& s = b->slots[index % slotCount];
+				if (s.index != index) { // anything else in this slot is out of the window
+					target = &s;
+					break;
+				}
+			}
+			if (!target) {
+				b->workCV.wait(_);
+				continue;
+			}
+			target->index = index;
+			target->ready = false;
+			const size_t length = (size_t)std::min(blockSize, b->size - index * blockSize);
+			_.unlock();
+			int64_t got;
+			{
+				YR_TRACE("read ahead");
+				const bool measure = statsEnabled();
+				const int64_t begin = measure ? nowUS() : 0;
+				got = readInputAt(b, target->data, length, index * blockSize);
+				if (measure) b->diskUS.fetch_add((uint64_t)(nowUS() - begin), std::memory_order_relaxed);
+			}
+			if (got > 0) b->diskBytes.fetch_add((uint64_t)got, std::memory_order_relaxed);
+			_.lock();
+			target->failed = got < 0;
+			target->length = got < 0 ? 0 : (size_t)got;
+			target->ready = true;
+			b->dataCV.notify_all();
+		}
+		b->dataCV.notify_all();
+	}
+
+	static int readInput(void* opaque, uint8_t* buf, int size) {
+		InputFileBase* b = reinterpret_cast<InputFileBase*>(opaque);
+		if (b->pos >= b->size) return AVERROR_EOF;
+		size = (int)std::min<int64_t>(size, b->size - b->pos);
+		b->calls.fetch_add(1, std::memory_order_relaxed);
+		const int ret = b->mode == InputFile::Mode::MMAP ? readMapped(b, buf, size) : readAhead(b, buf, size);
+		if (ret > 0) {
+			b->pos += ret;
+			b->bytes.fetch_add((uint64_t)ret, std::memory_order_relaxed);
+		}
+		return ret;
+	}
+
+	static int64_t seekInput(void* opaque, int64_t offset, int whence) {
+		InputFileBase* b = reinterpret_cast<InputFileBase*>(opaque);
+		if (whence & AVSEEK_SIZE) return b->size;
+		int64_t target;
+		switch (whence & ~AVSEEK_FORCE) {
+		case SEEK_SET: target = offset; break;
+		case SEEK_CUR: target = b->pos + offset; break;
+		case SEEK_END: target = b->size + offset; break;
+		default: return AVERROR(EINVAL);
+		}
+		if (target < 0) return AVERROR(EINVAL);
+		b->pos = target;
+		b->seeks.fetch_add(1, std::memory_order_relaxed);
+		return target;
+	}
+
+#define _THIS reinterpret_cast<InputFileBase*>(structure)
+	InputFile::InputFile() { structure = new InputFileBase; }
+	InputFile::~InputFile() { delete _THIS; }
+
+	bool InputFile::open(const char* fileName) { return open(fileName, Options{}); }
+
+	bool InputFile::open(const char* fileName, const Options& opts) {
+		close();
+		if (opts.mode == Mode::DEFAULT) return true;
+		// URLs, pipes and devices have no size to map or blocks to read ahead; FFmpeg's protocols stream them
+		if (opts.mode == Mode::AUTO && (std::strstr(fileName, "://") || !isRegularFile(fileName))) return true;
+		if (!openInputFile(_THIS, fileName)) {
+			LOGRAW(fileName, "could not be opened for reading");
+			return false;
+		}
+		Mode mode = opts.mode;
+		if (mode == Mode::AUTO) mode = isRemoteInput(_THIS, fileName) ? Mode::READ_AHEAD : Mode::MMAP;
+		_THIS->blockSize = (std::max<size_t>(opts.blockSize, AVIO_BUFFER_SIZE) + IO_BLOCK_ALIGN - 1) & ~(IO_BLOCK_ALIGN - 1);
+		_THIS->prefetchBlocks = std::max<size_t>(opts.prefetchBlocks, 2);
+		if (mode == Mode::MMAP && !mapInputFile(_THIS)) {
+			LOGRAW(fileName, "could not be mapped; reading ahead instead");
+			mode = Mode::READ_AHEAD;
+		}
+		if (mode == Mode::READ_AHEAD) {
+			FrameMemory::Options memOpts;
+			memOpts.alignment = IO_BLOCK_ALIGN;
+			_THIS->slots.resize(_THIS->prefetchBlocks);
+			for (InputFileBase::Slot& s : _THIS->slots) {
+				if (!(s.data = (uint8_t*)FrameMemory::allocate(_THIS->blockSize, memOpts))) {
+					LOGRAW("Failed to allocate read-ahead buffers");
+					close();
+					return false;
+				}
+			}
+		}
+		uint8_t* buffer = (uint8_t*)av_malloc(AVIO_BUFFER_SIZE);
+		_THIS->pb = buffer ? avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 0, _THIS, readInput, nullptr, seekInput) : nullptr;
+		if (!_THIS->pb) {
+			av_free(buffer);
+			LOGRAW("Failed to allocate input I/O context");
+			close();
+			return false;
+		}
+		_THIS->mode = mode;
+		if (mode == Mode::READ_AHEAD) {
+			InputFileBase* b = _THIS;
+			_THIS->worker = new std::thread([b]() { readAheadLoop(b); });
+		}
+		return true;
+	}
+
+	void InputFile::close() {
+		delete _THIS;
+		structure = new InputFileBase;
+	}
+
+	AVIOContext* InputFile::context() { return _THIS->pb; }
+
+	InputFile::Mode InputFile::mode() { return _THIS->mode; }
+
+	IOStats InputFile::stats() {
+		IOStats ret;
+		ret.bytes = _THIS->bytes.load(std::memory_order_relaxed);
+		ret.calls = _THIS->calls.load(std::memory_order_relaxed);
+		ret.seeks = _THIS->seeks.load(std::memory_order_relaxed);
+		ret.waitUS = _THIS->waitUS.load(std::memory_order_relaxed);
+		ret.diskUS = _THIS->diskUS.load(std::memory_order_relaxed);
+		ret.diskBytes = _THIS->diskBytes.load(std::memory_order_relaxed);
+		return ret;
+	}
+#undef _THIS
+
+	// ---- output I/O
+
+#if FMP_IO_URING
+	// the few io_uring calls the writer needs, without liburing. one thread submits and reaps
+	struct IoUring {
+		int fd = -1;
+		unsigned entries = 0;
+		uint8_t* sqRing = nullptr;
+		uint8_t* cqRing = nullptr;
+		size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+		unsigned *sqTail, *sqMask, *sqArray;
+		unsigned *cqHead, *cqTail, *cqMask;
+		io_uring_sqe* sqes = nullptr;
+		io_uring_cqe* cqes;
+
+		bool init(unsigned depth) {
+			io_uring_params p{};
+			fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+			if (fd < 0) return false;
+			entries = p.sq_entries;
+			sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+			cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+			const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+			if (single) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+			void* sq = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			if (sq == MAP_FAILED) return false;
+			sqRing = (uint8_t*)sq;
+			if (single) {
+				cqRing = sqRing;
+			}
+			else {
+				void* cq = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+				if (cq == MAP_FAILED) return false;
+				cqRing = (uint8_t*)cq;
+			}
+			sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+			void* se = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+			if (se == MAP_FAILED) return false;
+			sqes = (io_uring_sqe*)se;
+			sqTail = (unsigned*)(sqRing + p.sq_off.tail);
+			sqMask = (unsigned*)(sqRing + p.sq_off.ring_mask);
+			sqArray = (unsigned*)(sqRing + p.sq_off.array);
+			cqHead = (unsigned*)(cqRing + p.cq_off.head);
+			cqTail = (unsigned*)(cqRing + p.cq_off.tail);
+			cqMask = (unsigned*)(cqRing + p.cq_off.ring_mask);
+			cqes = (io_uring_cqe*)(cqRing + p.cq_off.cqes);
+			return true;
+		}
+		// drain: starts only after every earlier write has completed
+		void prepWrite(int file, const void* data, unsigned length, uint64_t offset, uint64_t userData, bool drain) {
+			const unsigned tail = *sqTail;
+			const unsigned i = tail & *sqMask;
+			io_uring_sqe& e = sqes[i];
+			std::memset(&e, 0, sizeof(e));
+			e.opcode = IORING_OP_WRITE;
+			e.fd = file;
+			e.addr = (uint64_t)(uintptr_t)data;
+			e.len = length;
+			e.off = offset;
+			e.user_data = userData;
+			e.flags = drain ? IOSQE_IO_DRAIN : 0;
+			sqArray[i] = i;
+			__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		}
+		// returns the number of entries submitted, or -1 with errno
+		int enter(unsigned toSubmit, unsigned minComplete) {
+			return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		}
+		// calls f(userData, result) for each completion
+		template<class F>
+		void reap(F&& f) {
+			unsigned head = *cqHead;
+			const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+			for (; head != tail; head++) {
+				const io_uring_cqe& c = cqes[head & *cqMask];
+				f(c.user_data, c.res);
+			}
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+		}
+		~IoUring() {
+			if (sqes) munmap(sqes, sqesSize);
+			if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+			if (sqRing) munmap(sqRing, sqRingSize);
+			if (fd >= 0) ::close(fd);
+		}
+	};
+#endif
+
+	struct OutputFileBase {
+		struct Chunk {
+			uint8_t* data = nullptr;
+			int64_t offset = 0;
+			size_t length = 0;
+			bool drain = false; // doesn't continue the previous chunk, so it may overlap an earlier one
+		};
+		OutputFile::Mode mode = OutputFile::Mode::DEFAULT;
+		AVIOContext* pb = nullptr;
+		size_t chunkSize = 0;
+		std::vector<Chunk> chunks;
+		// muxer side
+		Chunk* filling = nullptr;
+		int64_t pos = 0;
+		int64_t end = 0;
+		int64_t queuedEnd = 0; // where the last queued chunk ends
+		// shared with the writer thread
+		std::deque<Chunk*> queued;
+		std::vector<Chunk*> spare;
+		size_t inFlight = 0; // queued or being written
+		bool stop = false;
+		bool failed = false;
+		std::thread* worker = nullptr;
+		std::mutex guard;
+		std::condition_variable workCV, doneCV;
+#if BOOST_OS_WINDOWS
+		HANDLE file = INVALID_HANDLE_VALUE;
+#else
+		int fd = -1;
+#endif
+#if FMP_IO_URING
+		std::unique_ptr<IoUring> ring;
+#endif
+		std::atomic<uint64_t> bytes{ 0 }, calls{ 0 }, seeks{ 0 }, waitUS{ 0 }, diskUS{ 0 }, diskBytes{ 0 };
+		bool release();
+		~OutputFileBase() { release(); }
+	};
+
+#if BOOST_OS_WINDOWS
+	static bool createOutputFile(OutputFileBase* b, const char* fileName) {
+		b->file = CreateFileA(fileName, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		return b->file != INVALID_HANDLE_VALUE;
+	}
+
+	static bool writeOutputAt(OutputFileBase* b, const uint8_t* src, size_t length, int64_t offset) {
+		size_t done = 0;
+		while (done < length) {
+			OVERLAPPED ov{};
+			ov.Offset = (DWORD)(offset + done);
+			ov.OffsetHigh = (DWORD)((uint64_t)(offset + done) >> 32);
+			DWORD put = 0;
+			if (!WriteFile(b->file, src + done, (DWORD)std::min<size_t>(length - done, 1u << 30), &put, &ov) || put == 0) return false;
+			done += put;
+		}
+		return true;
+	}
+
+	static void closeOutputFile(OutputFileBase* b) {
+		if (b->file != INVALID_HANDLE_VALUE) CloseHandle(b->file);
+		b->file = INVALID_HANDLE_VALUE;
+	}
+#else
+	static bool createOutputFile(OutputFileBase* b, const char* fileName) {
+		b->fd = ::open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		return b->fd >= 0;
+	}
+
+	static bool writeOutputAt(OutputFileBase* b, const uint8_t* src, size_t length, int64_t offset) {
+		size_t done = 0;
+		while (done < length) {
+			const ssize_t put = pwrite(b->fd, src + done, length - done, (off_t)(offset + done));
+			if (put < 0) {
+				if (errno == EINTR) continue;
+				return false;
+			}
+			if (put == 0) return false;
+			done += (size_t)put;
+		}
+		return true;
+	}
+
+	static void closeOutputFile(OutputFileBase* b) {
+		if (b->fd >= 0) ::close(b->fd);
+		b->fd = -1;
+	}
+#endif
+
+	// returns a written (or failed) chunk for reuse
+	static void retireChunk(OutputFileBase* b, OutputFileBase::Chunk* c, bool ok) {
+		if (ok) b->diskBytes.fetch_add(c->length, std::memory_order_relaxed);
+		else b->failed = true;
+		b->spare.push_back(c);
+		b->inFlight--;
+		b->doneCV.notify_all();
+	}
+
+	// writes chunks in queue order, so overlapping ones land in the order the muxer wrote them
+	static void writeBehindLoop(OutputFileBase* b) {
+		Tracer::nameThread("write-behind");
+		std::unique_lock _(b->guard);
+		while (true) {
+			if (b->queued.empty()) {
+				if (b->stop) break;
+				b->workCV.wait(_);
+				continue;
+			}
+			OutputFileBase::Chunk* c = b->queued.front();
+			b->queued.pop_front();
+			_.unlock();
+			bool ok;
+			{
+				YR_TRACE("write behind");
+				const bool measure = statsEnabled();
+				const int64_t begin = measure ? nowUS() : 0;
+				ok = writeOutputAt(b, c->data, c->length, c->offset);
+				if (measure) b->diskUS.fetch_add((uint64_t)(nowUS() - begin), std::memory_order_relaxed);
+			}
+			_.lock();
+			retireChunk(b, c, ok);
+		}
+	}
+
+#if FMP_IO_URING
+	// keeps every queued chunk in flight at once. disk time is the time any write was in flight
+	static void uringWriteLoop(OutputFileBase* b) {
+		Tracer::nameThread("write-behind");
+		IoUring& ring = *b->ring;
+		std::vector<std::pair<OutputFileBase::Chunk*, int>> done;
+		done.reserve(b->chunks.size());
+		unsigned inRing = 0, unsubmitted = 0;
+		int64_t activeSince = 0;
+		std::unique_lock _(b->guard);
+		while (true) {
+			while (!b->queued.empty() && inRing < ring.entries) {
+				OutputFileBase::Chunk* c = b->queued.front();
+				b->queued.pop_front();
+				ring.prepWrite(b->fd, c->data, (unsigned)c->length, (uint64_t)c->offset, (uint64_t)(uintptr_t)c, c->drain);
+				inRing++;
+				unsubmitted++;
+			}
+			if (!inRing) {
+				if (b->stop) break;
+				b->workCV.wait(_);
+				continue;
+			}
+			_.unlock();
+			if (!activeSince && statsEnabled()) activeSince = nowUS();
+			const int submitted = ring.enter(unsubmitted, 1);
+			if (submitted >= 0) {
+				unsubmitted -= (unsigned)submitted;
+			}
+			else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				LOGWITH("io_uring_enter failed:", errno);
+				// writes submitted earlier still point into their chunks, so wait them out before release() can free those
+				for (unsigned pending = inRing - unsubmitted; pending;) {
+					if (ring.enter(0, 1) < 0 && errno != EINTR) std::this_thread::sleep_for(std::chrono::milliseconds(1)); // the completion ring is read directly either way
+					ring.reap([&](uint64_t, int) { pending--; });
+				}
+				_.lock();
+				b->failed = true;
+				b->queued.clear();
+				b->inFlight = 0;
+				b->doneCV.notify_all();
+				break;
+			}
+			ring.reap([&](uint64_t userData, int res) { done.emplace_back((OutputFileBase::Chunk*)(uintptr_t)userData, res); });
+			for (auto& [c, res] : done) { // a short write is finished synchronously
+				if (res >= 0 && (size_t)res < c->length) res = writeOutputAt(b, c->data + res, c->length - res, c->offset + res) ? (int)c->length : -EIO;
+			}
+			_.lock();
+			for (auto& [c, res] : done) retireChunk(b, c, res >= 0);
+			inRing -= (unsigned)done.size();
+			done.clear();
+			if (!inRing && activeSince) {
+				b->diskUS.fetch_add((uint64_t)(nowUS() - activeSince), std::memory_order_relaxed);
+				activeSince = 0;
+			}
+		}
+	}
+
+	// IORING_OP_WRITE needs Linux 5.6. a zero-length write tells whether it is there
+	static bool probeUringWrite(OutputFileBase* b) {
+		IoUring& ring = *b->ring;
+		static const uint8_t nothing = 0;
+		ring.prepWrite(b->fd, &nothing, 0, 0, 0, false);
+		if (ring.enter(1, 1) != 1) return false;
+		bool ok = false;
+		ring.reap([&](uint64_t, int res) { ok = res == 0; });
+		return ok;
+	}
+#endif
+
+	// hands the chunk being filled to the writer
+	static void queueFilling(OutputFileBase* b) {
+		OutputFileBase::Chunk* c = b->filling;
+		if (!c) return;
+		b->filling = nullptr;
+		std::unique_lock _(b->guard);
+		if (c->length == 0) {
+			b->spare.push_back(c);
+			return;
+		}
+		c->drain = c->offset != b->queuedEnd;
+		b->queuedEnd = c->offset + (int64_t)c->length;
+		b->queued.push_back(c);
+		b->inFlight++;
+		b->workCV.notify_one();
+	}
+
+	static OutputFileBase::Chunk* takeChunk(OutputFileBase* b) {
+		std::unique_lock _(b->guard);
+		if (b->spare.empty() && !b->failed) {
+			const bool measure = statsEnabled();
+			const int64_t begin = measure ? nowUS() : 0;
+			while (b->spare.empty() && !b->failed) b->doneCV.wait(_);
+			if (measure) b->waitUS.fetch_add((uint64_t)(nowUS() - begin), std::memory_order_relaxed);
+		}
+		if (b->failed) return nullptr;
+		OutputFileBase::Chunk* c = b->spare.back();
+		b->spare.pop_back();
+		return c;
+	}
+
+	static bool flushOutput(OutputFileBase* b) {
+		queueFilling(b);
+		std::unique_lock _(b->guard);
+		while (b->inFlight) b->doneCV.wait(_);
+		return !b->failed;
+	}
+
+#if FF_API_AVIO_WRITE_NONCONST
+	static int writeOutput(void* opaque, uint8_t* buf, int size) {
+#else
+	static int writeOutput(void* opaque, const uint8_t* buf, int size) {
+#endif
+		OutputFileBase* b = reinterpret_cast<OutputFileBase*>(opaque);
+		b->calls.fetch_add(1, std::memory_order_relaxed);
+		int done = 0;
+		while (done < size) {
+			OutputFileBase::Chunk* c = b->filling;
+			if (c && (c->length == b->chunkSize || c->offset + (int64_t)c->length != b->pos)) { // full, or the muxer has seeked
+				queueFilling(b);
+				c = nullptr;
+			}
+			if (!c) {
+				if (!(c = takeChunk(b))) return AVERROR(EIO);
+				c->offset = b->pos;
+				c->length = 0;
+				b->filling = c;
+			}
+			const size_t n = std::min(b->chunkSize - c->length, (size_t)(size - done));
+			std::memcpy(c->data + c->length, buf + done, n);
+			c->length += n;
+			done += (int)n;
+			b->pos += (int64_t)n;
+		}
+		if (b->pos > b->end) b->end = b->pos;
+		b->bytes.fetch_add((uint64_t)size, std::memory_order_relaxed);
+		return size;
+	}
+
+	// same, with the muxer's markers. a sync or boundary point starts a fragment (a moof, a matroska cluster), which means the
+	// one before is complete; queuing it now puts it on the file while the new one is being filled
+#if FF_API_AVIO_WRITE_NONCONST
+	static int writeOutputMarked(void* opaque, uint8_t* buf, int size, AVIODataMarkerType type, int64_t) {
+#else
+	static int writeOutputMarked(void* opaque, const uint8_t* buf, int size, AVIODataMarkerType type, int64_t) {
+#endif
+		if (type == AVIO_DATA_MARKER_SYNC_POINT || type == AVIO_DATA_MARKER_BOUNDARY_POINT) queueFilling(reinterpret_cast<OutputFileBase*>(opaque));
+		return writeOutput(opaque, buf, size);
+	}
+
+	static int64_t seekOutput(void* opaque, int64_t offset, int whence) {
+		OutputFileBase* b = reinterpret_cast<OutputFileBase*>(opaque);
+		if (whence & AVSEEK_SIZE) return b->end;
+		int64_t target;
+		switch (whence & ~AVSEEK_FORCE) {
+		case SEEK_SET: target = offset; break;
+		case SEEK_CUR: target = b->pos + offset; break;
+		case SEEK_END: target = b->end + offset; break;
+		default: return AVERROR(EINVAL);
+		}
+		if (target < 0) return AVERROR(EINVAL);
+		b->pos = target; // the next write starts a new chunk
+		b->seeks.fetch_add(1, std::memory_order_relaxed);
+		return target;
+	}
+
+	bool OutputFileBase::release() {
+		bool ok = !failed;
+		if (pb) {
+			avio_flush(pb);
+			ok = flushOutput(this);
+		}
+		if (worker) {
+			{
+				std::unique_lock _(guard);
+				stop = true;
+			}
+			workCV.notify_all();
+			worker->join();
+			delete worker;
+			worker = nullptr;
+		}
+#if FMP_IO_URING
+		ring.reset();
+#endif
+		for (Chunk& c : chunks) FrameMemory::free(c.data);
+		chunks.clear();
+		spare.clear();
+		filling = nullptr;
+		closeOutputFile(this);
+		if (pb) {
+			av_freep(&pb->buffer);
+			avio_context_free(&pb);
+		}
+		return ok;
+	}
+
+#define _THIS reinterpret_cast<OutputFileBase*>(structure)
+	OutputFile::OutputFile() { structure = new OutputFileBase; }
+	OutputFile::~OutputFile() { delete _THIS; }
+
+	bool OutputFile::open(const char* fileName) { return open(fileName, Options{}); }
+
+	bool OutputFile::open(const char* fileName, const Options& opts) {
+		delete _THIS;
+		structure = new OutputFileBase;
+		if (opts.mode == Mode::DEFAULT) return true;
+		if (!createOutputFile(_THIS, fileName)) {
+			LOGRAW(fileName, "could not be opened for writing");
+			return false;
+		}
+		Mode mode = opts.mode == Mode::AUTO ? Mode::IO_URING : opts.mode;
+		_THIS->chunkSize = (std::max<size_t>(opts.chunkSize, AVIO_BUFFER_SIZE) + IO_BLOCK_ALIGN - 1) & ~(IO_BLOCK_ALIGN - 1);
+		_THIS->chunks.resize(std::max<size_t>(opts.chunks, 2));
+		FrameMemory::Options memOpts;
+		memOpts.alignment = IO_BLOCK_ALIGN;
+		for (OutputFileBase::Chunk& c : _THIS->chunks) {
+			if (!(c.data = (uint8_t*)FrameMemory::allocate(_THIS->chunkSize, memOpts))) {
+				LOGRAW("Failed to allocate write-behind buffers");
+				_THIS->release();
+				return false;
+			}
+			_THIS->spare.push_back(&c);
+		}
+		if (mode == Mode::IO_URING) {
+#if FMP_IO_URING
+			_THIS->ring = std::make_unique<IoUring>();
+			if (!_THIS->ring->init((unsigned)_THIS->chunks.size()) || !probeUringWrite(_THIS)) {
+				_THIS->ring.reset();
+				mode = Mode::THREAD;
+			}
+#else
+			mode = Mode::THREAD;
+#endif
+			if (mode == Mode::THREAD && opts.mode == Mode::IO_URING) LOGRAW("io_uring is not available; writing on a thread instead");
+		}
+		uint8_t* buffer = (uint8_t*)av_malloc(AVIO_BUFFER_SIZE);
+		_THIS->pb = buffer ? avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 1, _THIS, nullptr, writeOutput, seekOutput) : nullptr;
+		if (!_THIS->pb) {
+			av_free(buffer);
+			LOGRAW("Failed to allocate output I/O context");
+			_THIS->release();
+			return false;
+		}
+		_THIS->pb->write_data_type = writeOutputMarked;
+		_THIS->mode = mode;
+		OutputFileBase* b = _THIS;
+#if FMP_IO_URING
+		if (mode == Mode::IO_URING) {
+			_THIS->worker = new std::thread([b]() { uringWriteLoop(b); });
+			return true;
+		}
+#endif
+		_THIS->worker = new std::thread([b]() { writeBehindLoop(b); });
+		return true;
+	}
+
+	AVIOContext* OutputFile::context() { return _THIS->pb; }
+
+	OutputFile::Mode OutputFile::mode() { return _THIS->mode; }
+
+	bool OutputFile::flush() {
+		if (!_THIS->pb) return true;
+		avio_flush(_THIS->pb);
+		return flushOutput(_THIS);
+	}
+
+	bool OutputFile::close() { return _THIS->release(); }
+
+	IOStats OutputFile::stats() {
+		IOStats ret;
+		ret.bytes = _THIS->bytes.load(std::memory_order_relaxed);
+		ret.calls = _THIS->calls.load(std::memory_order_relaxed);
+		ret.seeks = _THIS->seeks.load(std::memory_order_relaxed);
+		ret.waitUS = _THIS->waitUS.load(std::memory_order_relaxed);
+		ret.diskUS = _THIS->diskUS.load(std::memory_order_relaxed);
+		ret.diskBytes = _THIS->diskBytes.load(std::memory_order_relaxed);
+		return ret;
+	}
+#undef _THIS
+
 	template<class T>
 	struct _1v1rb {
 		std::vector<T> buffer;
@@ -62,31 +1144,66 @@ namespace onart {
 		std::mutex mtx;
 		std::condition_variable rcv;
 		std::condition_variable wcv;
+		// statistics. occupancy is only written by the writer
+		std::unique_ptr<std::atomic<uint64_t>[]> occupancy;
+		std::atomic<uint64_t> passed{ 0 }, writeWaitUS{ 0 }, readWaitUS{ 0 };
+		// NUMA node of the reader, for memory the writer allocates for it
+		std::atomic<int> consumerNode{ FrameMemory::CURRENT_NODE };
+
+		inline void resize(size_t length) {
+			if (length < 2) length = 2;
+			buffer.resize(length);
+			size = (int)length;
+			occupancy.reset(new std::atomic<uint64_t>[length]);
+			for (size_t i = 0; i < length; i++) occupancy[i] = 0;
+		}
 
 		inline int getNext(int i) const { return i + 1 < size ? i + 1 : 0; }
+		inline int count() const {
+			int diff = input - output;
+			return diff < 0 ? diff + size : diff;
+		}
 
-		inline auto& get2Write() {
+		// meter: stage to charge the waiting time to as blocked
+		inline auto& get2Write(StageMeter* meter = nullptr) {
 			int ni = getNext(input);
+			const bool measure = statsEnabled();
+			if (measure) occupancy[count()].fetch_add(1, std::memory_order_relaxed);
 			if (ni == output) {
+				const int64_t begin = measure ? nowUS() : 0;
 				std::unique_lock _(mtx);
 				while (ni == output) {
 					wcv.wait(_);
 				}
+				if (measure) {
+					const uint64_t waited = (uint64_t)(nowUS() - begin);
+					writeWaitUS.fetch_add(waited, std::memory_order_relaxed);
+					if (meter) meter->add(StageMeter::State::BLOCKED, waited);
+				}
 			}
 			return buffer[input];
 		}
 		inline void return2write() {
 			std::unique_lock _(mtx);
 			input = getNext(input);
+			passed.fetch_add(1, std::memory_order_relaxed);
 			rcv.notify_one();
 		}
-		inline const T& get2Read() {
+		inline const T& get2Read(StageMeter* meter = nullptr) {
 			if (input == output) {
 				if (done) return nullObject;
+				const bool measure = statsEnabled();
+				const int64_t begin = measure ? nowUS() : 0;
 				std::unique_lock _(mtx);
-				while (input == output) {
+				while (input == output && !done) {
 					rcv.wait(_);
 				}
+				if (measure) {
+					const uint64_t waited = (uint64_t)(nowUS() - begin);
+					readWaitUS.fetch_add(waited, std::memory_order_relaxed);
+					if (meter) meter->add(StageMeter::State::BLOCKED, waited);
+				}
+				if (input == output) return nullObject;
 			}
 			return buffer[output];
 		}
@@ -95,85 +1212,653 @@ namespace onart {
 			output = getNext(output);
 			wcv.notify_one();
 		}
-	};
+		// called by the writer after its last write. wakes a reader waiting on the empty ring
+		inline void finish() {
+			std::unique_lock _(mtx);
+			done = true;
+			rcv.notify_all();
+		}
+
+		inline RingStats stats() const {
+			RingStats ret;
+			ret.items = passed.load(std::memory_order_relaxed);
+			ret.writeWaitUS = writeWaitUS.load(std::memory_order_relaxed);
+			ret.readWaitUS = readWaitUS.load(std::memory_order_relaxed);
+			ret.occupancy.resize(size);
+			for (int i = 0; i < size; i++) ret.occupancy[i] = occupancy[i].load(std::memory_order_relaxed);
+			return ret;
+		}
+	};
+
+#define _THIS reinterpret_cast<_rb4f*>(structure)
+
+	struct _rb4f : public _1v1rb<AVFrame*> {
+		const HostImportFramePool* importPool = nullptr; // set by the decoder before its first frame when frames are imported
+		// shells only: the decoder refs its own frames into them, whose memory get_buffer2 already placed
+		inline void init() {
+			for (auto& fr : buffer) fr = av_frame_alloc();
+		}
+	};
+
+	RingBuffer4Frame::RingBuffer4Frame(size_t size) {
+		structure = new _rb4f;
+		_THIS->resize(size);
+	}
+
+	RingBuffer4Frame::~RingBuffer4Frame() {
+		for (AVFrame* f : _THIS->buffer) {
+			av_frame_free(&f);
+		}
+		delete _THIS;
+	}
+
+	size_t RingBuffer4Frame::load() { return _THIS->count(); }
+	RingStats RingBuffer4Frame::stats() { return _THIS->stats(); }
+#undef _THIS
+
+#define _THIS reinterpret_cast<_rb4t*>(structure)
+
+	struct _rb4t :public _1v1rb<YRGraphics::pStreamTexture> {
+		inline void init(int width, int height, bool linear) {
+			for (auto& tx : buffer) {
+				tx = YRGraphics::createStreamTexture(INT32_MIN, width, height, linear);
+			}
+		}
+	};
+
+	RingBuffer4Texture::RingBuffer4Texture(size_t size) {
+		structure = new _rb4t;
+		_THIS->resize(size);
+	}
+
+	RingBuffer4Texture::~RingBuffer4Texture() {
+		delete _THIS;
+		structure = nullptr;
+	}
+
+	size_t RingBuffer4Texture::load() { return _THIS->count(); }
+	RingStats RingBuffer4Texture::stats() { return _THIS->stats(); }
+
+#undef _THIS
+
+#define _THIS reinterpret_cast<_rb4r*>(structure)
+	struct _rb4r :public _1v1rb<std::vector<uint32_t, FrameAllocator<uint32_t>>> {
+		inline void init(int width, int height) {
+			for (auto& img : buffer) {
+				img.resize(width * height);
+			}
+		}
+	};
+
+	RingBuffer4RGBA::RingBuffer4RGBA(size_t size) {
+		structure = new _rb4r;
+		_THIS->resize(size);
+	}
+
+	size_t RingBuffer4RGBA::load() { return _THIS->count(); }
+	RingStats RingBuffer4RGBA::stats() { return _THIS->stats(); }
+#undef _THIS
+
+	static void freeFrameMemory(void*, uint8_t* data) { FrameMemory::free(data); }
+
+	// plane layout of a decoder frame with 64-byte aligned rows. returns the buffer size, or a negative error code
+	static int alignedFrameLayout(AVCodecContext* ctx, AVFrame* frame, int linesize[4], ptrdiff_t offsets[4]) {
+		int w = frame->width, h = frame->height;
+		int linesizeAlign[AV_NUM_DATA_POINTERS];
+		avcodec_align_dimensions2(ctx, &w, &h, linesizeAlign);
+		FMCALL_BASIC(av_image_fill_linesizes(linesize, (AVPixelFormat)frame->format, w));
+		if (errorCode < 0) return errorCode;
+		for (int i = 0; i < 4; i++) { linesize[i] = FFALIGN(linesize[i], 64); }
+		uint8_t* data[4];
+		FMCALL_BASIC(av_image_fill_pointers(data, (AVPixelFormat)frame->format, h, nullptr, linesize));
+		if (errorCode < 0) return errorCode;
+		for (int i = 0; i < 4; i++) { offsets[i] = data[i] ? data[i] - data[0] : -1; }
+		return errorCode + 64; // decoders may read/write a little past the last plane
+	}
+
+	static void setFramePlanes(AVFrame* frame, const int linesize[4], const ptrdiff_t offsets[4]) {
+		for (int i = 0; i < 4; i++) {
+			frame->data[i] = offsets[i] >= 0 ? frame->buf[0]->data + offsets[i] : nullptr;
+			frame->linesize[i] = offsets[i] >= 0 ? linesize[i] : 0;
+		}
+		frame->extended_data = frame->data;
+	}
+
+	int getFrameBuffer(AVFrame* frame) {
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+		if (!desc || frame->width <= 0 || frame->height <= 0) return AVERROR(EINVAL);
+		if (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL)) return av_frame_get_buffer(frame, 64);
+		int linesize[4];
+		FMCALL_BASIC(av_image_fill_linesizes(linesize, (AVPixelFormat)frame->format, FFALIGN(frame->width, 64)));
+		if (errorCode < 0) return errorCode;
+		for (int i = 0; i < 4; i++) { linesize[i] = FFALIGN(linesize[i], 64); }
+		uint8_t* planes[4];
+		FMCALL_BASIC(av_image_fill_pointers(planes, (AVPixelFormat)frame->format, FFALIGN(frame->height, 32), nullptr, linesize));
+		if (errorCode < 0) return errorCode;
+		const size_t size = (size_t)errorCode + 64;
+		ptrdiff_t offsets[4];
+		for (int i = 0; i < 4; i++) { offsets[i] = planes[i] ? planes[i] - planes[0] : -1; }
+		uint8_t* data = (uint8_t*)FrameMemory::allocate(size);
+		if (!data) return AVERROR(ENOMEM);
+		frame->buf[0] = av_buffer_create(data, size, freeFrameMemory, nullptr, 0);
+		if (!frame->buf[0]) {
+			FrameMemory::free(data);
+			return AVERROR(ENOMEM);
+		}
+		setFramePlanes(frame, linesize, offsets);
+		return 0;
+	}
+
+	uint64_t hashFrame(const AVFrame* frame) {
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+		if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) || !frame->data[0]) return 0;
+		int rowBytes[4];
+		if (av_image_fill_linesizes(rowBytes, (AVPixelFormat)frame->format, frame->width) < 0) return 0;
+		uint64_t h = ((uint64_t)frame->format << 48) ^ ((uint64_t)frame->width << 24) ^ (uint64_t)frame->height;
+		for (int p = 0; p < 4 && frame->data[p]; p++) {
+			if (p == 1 && (desc->flags & AV_PIX_FMT_FLAG_PAL)) { // palette
+				h = hash64(frame->data[1], 256 * 4, h);
+				break;
+			}
+			const int rows = (p == 1 || p == 2) ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+			for (int y = 0; y < rows; y++) {
+				h = hash64(frame->data[p] + (ptrdiff_t)y * frame->linesize[p], rowBytes[p], h);
+			}
+		}
+		return h ? h : 1;
+	}
+
+	// formats whose planes can be addressed per pixel column: not hardware, paletted or bit-packed
+	static const AVPixFmtDescriptor* addressableFormat(int format) {
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)format);
+		if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM))) return nullptr;
+		return desc;
+	}
+
+	static inline int planeRowShift(const AVPixFmtDescriptor* desc, int plane) { return (plane == 1 || plane == 2) ? desc->log2_chroma_h : 0; }
+
+	// byte offset of pixel column x in a row of each plane
+	static bool planeColumns(int format, int x, int offsets[4]) {
+		if (x == 0) {
+			std::fill(offsets, offsets + 4, 0);
+			return true;
+		}
+		return av_image_fill_linesizes(offsets, (AVPixelFormat)format, x) >= 0;
+	}
+
+	struct FrameTilesBase {
+		int tileSize;
+		int format = -1, width = 0, height = 0;
+		int columns = 0, rows = 0, planes = 0;
+		std::vector<int> columnBytes[4]; // byte offset of each tile column boundary in each plane
+		std::vector<uint64_t> hashes;
+		std::vector<uint8_t> dirty;
+		size_t dirtyCount = 0;
+		bool valid = false; // hashes are from the previous frame
+		void markAll() {
+			std::fill(dirty.begin(), dirty.end(), 1);
+			dirtyCount = dirty.size();
+			valid = false;
+		}
+	};
+
+	static bool layoutTiles(FrameTilesBase* b, const AVFrame* frame) {
+		b->format = frame->format;
+		b->width = frame->width;
+		b->height = frame->height;
+		b->columns = (frame->width + b->tileSize - 1) / b->tileSize;
+		b->rows = (frame->height + b->tileSize - 1) / b->tileSize;
+		b->planes = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+		b->hashes.assign((size_t)b->columns * b->rows, 0);
+		b->dirty.assign(b->hashes.size(), 1);
+		b->valid = false;
+		for (int p = 0; p < 4; p++) { b->columnBytes[p].resize(b->columns + 1); }
+		for (int c = 0; c <= b->columns; c++) {
+			int offsets[4];
+			if (!planeColumns(frame->format, std::min(c * b->tileSize, frame->width), offsets)) return false;
+			for (int p = 0; p < 4; p++) { b->columnBytes[p][c] = offsets[p]; }
+		}
+		return true;
+	}
+
+#define _THIS reinterpret_cast<FrameTilesBase*>(structure)
+
+	FrameTiles::FrameTiles(int tileSize) : structure(new FrameTilesBase) { _THIS->tileSize = std::max(16, (tileSize + 15) & ~15); }
+
+	FrameTiles::~FrameTiles() { delete _THIS; }
+
+	bool FrameTiles::update(const AVFrame* frame) {
+		FrameTilesBase* b = _THIS;
+		const AVPixFmtDescriptor* desc = addressableFormat(frame->format);
+		if (frame->format != b->format || frame->width != b->width || frame->height != b->height) {
+			if (!desc || frame->width <= 0 || frame->height <= 0 || !layoutTiles(b, frame)) {
+				b->format = -1;
+				b->columns = b->rows = 0;
+				b->hashes.clear();
+				b->dirty.clear();
+				b->markAll();
+				return false;
+			}
+		}
+		if (!desc || !frame->data[0]) {
+			b->markAll();
+			return false;
+		}
+		b->dirtyCount = 0;
+		for (int r = 0; r < b->rows; r++) {
+			const int y0 = r * b->tileSize, y1 = std::min(y0 + b->tileSize, b->height);
+			for (int c = 0; c < b->columns; c++) {
+				uint64_t h = 0;
+				for (int p = 0; p < b->planes; p++) {
+					const int shift = planeRowShift(desc, p);
+					const int begin = b->columnBytes[p][c], bytes = b->columnBytes[p][c + 1] - begin;
+					for (int y = y0 >> shift; y < AV_CEIL_RSHIFT(y1, shift); y++) {
+						h = hash64(frame->data[p] + (ptrdiff_t)y * frame->linesize[p] + begin, bytes, h);
+					}
+				}
+				const size_t i = (size_t)r * b->columns + c;
+				const bool changed = !b->valid || b->hashes[i] != h;
+				b->hashes[i] = h;
+				b->dirty[i] = changed;
+				b->dirtyCount += changed;
+			}
+		}
+		b->valid = true;
+		return true;
+	}
+
+	void FrameTiles::invalidate() { _THIS->valid = false; }
+
+	int FrameTiles::tileSize() const { return _THIS->tileSize; }
+
+	int FrameTiles::columns() const { return _THIS->columns; }
+
+	int FrameTiles::rows() const { return _THIS->rows; }
+
+	bool FrameTiles::dirty(int column, int row) const {
+		if (column < 0 || row < 0 || column >= _THIS->columns || row >= _THIS->rows) return false;
+		return _THIS->dirty[(size_t)row * _THIS->columns + column];
+	}
+
+	size_t FrameTiles::dirtyCount() const { return _THIS->dirtyCount; }
+
+#undef _THIS
+
+	constexpr int SCENE_BLOCK = 8;
+	constexpr int SCENE_BINS = 32;
+
+	struct SceneCutBase {
+		double threshold;
+		int minInterval;
+		int format = -1, width = 0, height = 0;
+		int columns = 0, rows = 0;
+		std::vector<uint8_t> blocks, lastBlocks; // block means
+		uint32_t histogram[SCENE_BINS]{}, lastHistogram[SCENE_BINS]{};
+		double motion = 0; // running mean block difference within the shot
+		double score = 0;
+		int sinceCut = 0;
+		bool valid = false; // lastBlocks is from the previous frame
+		std::vector<int64_t> cuts;
+	};
+
+	// means of 8x8 blocks of 8-bit samples
+	static void blockMeans8(const uint8_t* plane, int stride, int columns, int rows, uint8_t* out) {
+		for (int by = 0; by < rows; by++, out += columns) {
+			const uint8_t* top = plane + (ptrdiff_t)by * SCENE_BLOCK * stride;
+			int bx = 0;
+#ifdef YR_USING_SIMD
+			const __m128i zero = _mm_setzero_si128();
+			for (; bx + 2 <= columns; bx += 2) { // two blocks per row load; each 64-bit lane sums one block
+				__m128i sum = zero;
+				for (int y = 0; y < SCENE_BLOCK; y++) {
+					sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(top + (ptrdiff_t)y * stride + bx * SCENE_BLOCK)), zero));
+				}
+				out[bx] = (uint8_t)((_mm_cvtsi128_si32(sum) + 32) >> 6);
+				out[bx + 1] = (uint8_t)((_mm_extract_epi16(sum, 4) + 32) >> 6);
+			}
+#endif
+			for (; bx < columns; bx++) {
+				uint32_t sum = 0;
+				for (int y = 0; y < SCENE_BLOCK; y++) {
+					const uint8_t* p = top + (ptrdiff_t)y * stride + bx * SCENE_BLOCK;
+					for (int x = 0; x < SCENE_BLOCK; x++) sum += p[x];
+				}
+				out[bx] = (uint8_t)((sum + 32) >> 6);
+			}
+		}
+	}
+
+	// means of 8x8 blocks of little endian samples with depth bits, scaled to 8 bits
+	static void blockMeans16(const uint8_t* plane, int stride, int columns, int rows, int depth, uint8_t* out) {
+		for (int by = 0; by < rows; by++, out += columns) {
+			for (int bx = 0; bx < columns; bx++) {
+				uint32_t sum = 0;
+				for (int y = 0; y < SCENE_BLOCK; y++) {
+					const uint16_t* p = (const uint16_t*)(plane + (ptrdiff_t)(by * SCENE_BLOCK + y) * stride) + bx * SCENE_BLOCK;
+					for (int x = 0; x < SCENE_BLOCK; x++) sum += p[x];
+				}
+				out[bx] = (uint8_t)std::min<uint32_t>(255, ((sum + 32) >> 6) >> (depth - 8));
+			}
+		}
+	}
+
+	static uint64_t sumAbsDiff(const uint8_t* a, const uint8_t* b, size_t size) {
+		uint64_t ret = 0;
+		size_t i = 0;
+#ifdef YR_USING_SIMD
+		__m128i sum = _mm_setzero_si128();
+		for (; i + 16 <= size; i += 16) {
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+		}
+		alignas(16) uint64_t lanes[2];
+		_mm_store_si128((__m128i*)lanes, sum);
+		ret = lanes[0] + lanes[1];
+#endif
+		for (; i < size; i++) ret += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+		return ret;
+	}
+
+#define _THIS reinterpret_cast<SceneCutBase*>(structure)
+
+	SceneCutDetector::SceneCutDetector(double threshold, int minInterval) : structure(new SceneCutBase) {
+		_THIS->threshold = threshold;
+		_THIS->minInterval = std::max(1, minInterval);
+	}
+
+	SceneCutDetector::~SceneCutDetector() { delete _THIS; }
+
+	bool SceneCutDetector::update(const AVFrame* frame) {
+		SceneCutBase* b = _THIS;
+		b->score = 0;
+		const AVPixFmtDescriptor* desc = addressableFormat(frame->format);
+		if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BE)) || desc->comp[0].plane != 0 || !frame->data[0]) return false;
+		const int depth = desc->comp[0].depth, step = desc->comp[0].step;
+		if (!((step == 1 && depth == 8) || (step == 2 && depth > 8))) return false; // packed YUV and the like
+		if (frame->format != b->format || frame->width != b->width || frame->height != b->height) {
+			b->format = frame->format;
+			b->width = frame->width;
+			b->height = frame->height;
+			b->columns = frame->width / SCENE_BLOCK;
+			b->rows = frame->height / SCENE_BLOCK;
+			b->blocks.resize((size_t)b->columns * b->rows);
+			b->lastBlocks.resize(b->blocks.size());
+			b->valid = false;
+		}
+		if (b->blocks.empty()) return false;
+		{
+			YR_TRACE("scene blocks");
+			if (step == 1) blockMeans8(frame->data[0], frame->linesize[0], b->columns, b->rows, b->blocks.data());
+			else blockMeans16(frame->data[0], frame->linesize[0], b->columns, b->rows, depth, b->blocks.data());
+		}
+		std::fill(b->histogram, b->histogram + SCENE_BINS, 0);
+		for (uint8_t v : b->blocks) b->histogram[v * SCENE_BINS / 256]++;
+		bool cut = false;
+		if (b->valid) {
+			const double n = (double)b->blocks.size();
+			const double difference = sumAbsDiff(b->blocks.data(), b->lastBlocks.data(), b->blocks.size()) / (255.0 * n);
+			uint64_t moved = 0;
+			for (int i = 0; i < SCENE_BINS; i++) moved += b->histogram[i] > b->lastHistogram[i] ? b->histogram[i] - b->lastHistogram[i] : b->lastHistogram[i] - b->histogram[i];
+			b->score = moved / (2.0 * n);
+			cut = ++b->sinceCut >= b->minInterval && b->score >= b->threshold && difference >= std::max(0.03, 2.0 * b->motion);
+			if (cut) {
+				b->sinceCut = 0;
+				b->motion = 0;
+				b->cuts.push_back(frame->pts);
+			}
+			else {
+				b->motion += (difference - b->motion) * 0.1;
+			}
+		}
+		b->blocks.swap(b->lastBlocks);
+		std::copy(b->histogram, b->histogram + SCENE_BINS, b->lastHistogram);
+		b->valid = true;
+		return cut;
+	}
 
-#define _THIS reinterpret_cast<_rb4f*>(structure)
+	double SceneCutDetector::score() const { return _THIS->score; }
 
-	struct _rb4f : public _1v1rb<AVFrame*> {
-		inline void init(int format, int width, int height) {
-			for (auto& fr : buffer) {
-				fr = av_frame_alloc();
-				fr->format = format;
-				fr->width = width;
-				fr->height = height;
-				av_frame_get_buffer(fr, 0); // align 32?
-			}
+	const std::vector<int64_t>& SceneCutDetector::cuts() const { return _THIS->cuts; }
+
+#undef _THIS
+
+	std::vector<section> sectionsAtCuts(const std::vector<int64_t>& cuts, int64_t duration, int64_t minLength) {
+		std::vector<section> ret;
+		int64_t start = 0;
+		for (int64_t cut : cuts) {
+			if (cut - start < minLength || duration - cut < minLength) continue;
+			ret.push_back(section{ start, cut - 1 }); // the cut frame starts the next one
+			start = cut;
 		}
+		ret.push_back(section{ start, duration });
+		return ret;
+	}
+
+	struct AreaConverterBase {
+		struct Scaler {
+			int width, height;
+			SwsContext* context;
+		};
+		int srcFormat, dstFormat;
+		std::vector<Scaler> scalers; // least recently created first
+		~AreaConverterBase() { for (Scaler& s : scalers) sws_freeContext(s.context); }
 	};
 
-	RingBuffer4Frame::RingBuffer4Frame(size_t size) {
-		structure = new _rb4f;
-		if (size < 2) size = 2;
-		_THIS->buffer.resize(size);
-		_THIS->size = size;
+	constexpr size_t AREA_SCALERS = 8;
+
+	static SwsContext* areaScaler(AreaConverterBase* b, int width, int height) {
+		for (AreaConverterBase::Scaler& s : b->scalers) {
+			if (s.width == width && s.height == height) return s.context;
+		}
+		if (b->scalers.size() >= AREA_SCALERS) {
+			sws_freeContext(b->scalers.front().context);
+			b->scalers.erase(b->scalers.begin());
+		}
+		SwsContext* ctx = sws_getContext(width, height, (AVPixelFormat)b->srcFormat, width, height, (AVPixelFormat)b->dstFormat, SWS_POINT, nullptr, nullptr, nullptr);
+		if (ctx) b->scalers.push_back({ width, height, ctx });
+		return ctx;
 	}
 
-	RingBuffer4Frame::~RingBuffer4Frame() {
-		for (AVFrame* f : _THIS->buffer) {
-			av_frame_free(&f);
+	// plane pointers to pixel (x, y)
+	static bool areaPlanes(int format, const uint8_t* const planes[], const int strides[], int x, int y, const uint8_t* out[4]) {
+		const AVPixFmtDescriptor* desc = addressableFormat(format);
+		int columns[4];
+		if (!desc || !planeColumns(format, x, columns)) return false;
+		const int count = av_pix_fmt_count_planes((AVPixelFormat)format);
+		for (int p = 0; p < 4; p++) {
+			out[p] = p < count ? planes[p] + (ptrdiff_t)(y >> planeRowShift(desc, p)) * strides[p] + columns[p] : nullptr;
 		}
-		delete _THIS;
+		return true;
 	}
 
-	size_t RingBuffer4Frame::load() {
-		int diff = _THIS->input - _THIS->output;
-		return diff < 0 ? diff : diff + _THIS->size;
+#define _THIS reinterpret_cast<AreaConverterBase*>(structure)
+
+	AreaConverter::AreaConverter(int srcFormat, int dstFormat) : structure(new AreaConverterBase) {
+		_THIS->srcFormat = srcFormat;
+		_THIS->dstFormat = dstFormat;
 	}
-#undef _THIS
 
-#define _THIS reinterpret_cast<_rb4t*>(structure)
+	AreaConverter::~AreaConverter() { delete _THIS; }
 
-	struct _rb4t :public _1v1rb<YRGraphics::pStreamTexture> {
-		inline void init(int width, int height, bool linear) {
-			for (auto& tx : buffer) {
-				tx = YRGraphics::createStreamTexture(INT32_MIN, width, height, linear);
+	bool AreaConverter::convert(const uint8_t* const src[], const int srcStride[], uint8_t* const dst[], const int dstStride[], int x, int y, int width, int height) {
+		if (width <= 0 || height <= 0) return true;
+		const uint8_t* from[4];
+		const uint8_t* to[4];
+		if (!areaPlanes(_THIS->srcFormat, src, srcStride, x, y, from) || !areaPlanes(_THIS->dstFormat, dst, dstStride, x, y, to)) return false;
+		if (_THIS->srcFormat == _THIS->dstFormat) {
+			const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)_THIS->srcFormat);
+			int begin[4], end[4];
+			if (!planeColumns(_THIS->srcFormat, x, begin) || !planeColumns(_THIS->srcFormat, x + width, end)) return false;
+			for (int p = 0; p < 4 && from[p]; p++) {
+				const int shift = planeRowShift(desc, p);
+				const int rows = AV_CEIL_RSHIFT(y + height, shift) - (y >> shift);
+				for (int r = 0; r < rows; r++) {
+					std::memcpy((uint8_t*)to[p] + (ptrdiff_t)r * dstStride[p], from[p] + (ptrdiff_t)r * srcStride[p], end[p] - begin[p]);
+				}
 			}
+			return true;
 		}
+		SwsContext* ctx = areaScaler(_THIS, width, height);
+		if (!ctx) return false;
+		uint8_t* const out[4] = { (uint8_t*)to[0], (uint8_t*)to[1], (uint8_t*)to[2], (uint8_t*)to[3] };
+		return sws_scale(ctx, from, srcStride, 0, height, out, dstStride) > 0;
+	}
+
+#undef _THIS
+
+	// decoder frames that are not imported into the GPU: FrameMemory buffers recycled by an AVBufferPool,
+	// placed on the NUMA node of the thread reading the decoder's output ring
+	struct FrameMemoryPoolBase {
+		AVBufferPool* pool = nullptr;
+		size_t bufferSize = 0;
+		const std::atomic<int>* consumerNode = nullptr;
+		~FrameMemoryPoolBase() { av_buffer_pool_uninit(&pool); }
 	};
 
-	RingBuffer4Texture::RingBuffer4Texture(size_t size) {
-		structure = new _rb4t;
-		if (size < 2) size = 2;
-		_THIS->buffer.resize(size);
-		_THIS->size = size;
+	static AVBufferRef* allocFrameMemoryBuffer(void* opaque, size_t size) {
+		auto base = reinterpret_cast<FrameMemoryPoolBase*>(opaque);
+		FrameMemory::Options opts;
+		if (base->consumerNode) opts.numaNode = base->consumerNode->load(std::memory_order_relaxed);
+		uint8_t* data = (uint8_t*)FrameMemory::allocate(size, opts);
+		if (!data) return nullptr;
+		AVBufferRef* ret = av_buffer_create(data, size, freeFrameMemory, nullptr, 0);
+		if (!ret) FrameMemory::free(data);
+		return ret;
 	}
 
-	RingBuffer4Texture::~RingBuffer4Texture() {
-		delete _THIS;
-		structure = nullptr;
+	static int getFrameMemoryBuffer(AVCodecContext* ctx, AVFrame* frame, int flags) {
+		auto base = reinterpret_cast<FrameMemoryPoolBase*>(ctx->opaque);
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+		if (!base || !desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL))) {
+			return avcodec_default_get_buffer2(ctx, frame, flags);
+		}
+		int linesize[4];
+		ptrdiff_t offsets[4];
+		const int size = alignedFrameLayout(ctx, frame, linesize, offsets);
+		if (size < 0) return size;
+		if (base->bufferSize != (size_t)size) {
+			av_buffer_pool_uninit(&base->pool);
+			base->pool = av_buffer_pool_init2(size, base, allocFrameMemoryBuffer, nullptr);
+			base->bufferSize = size;
+		}
+		frame->buf[0] = av_buffer_pool_get(base->pool);
+		if (!frame->buf[0]) return AVERROR(ENOMEM);
+		setFramePlanes(frame, linesize, offsets);
+		return 0;
 	}
 
-#undef _THIS
-
-#define _THIS reinterpret_cast<_rb4r*>(structure)
-	struct _rb4r :public _1v1rb<std::vector<uint32_t>> {
-		inline void init(int width, int height) {
-			for (auto& img : buffer) {
-				img.resize(width * height);
-			}
+	// decoder frame memory, used in place of an AVBufferPool so that getting and returning a frame never takes a lock.
+	// a block keeps its host import while it cycles through the pool; imports are released when the last frame using the pool is gone
+	struct HostImportBlocks {
+		LockFreeBlockPool blocks;
+		std::atomic<int> refs{ 1 }; // the owning decoder + every frame buffer out of the pool
+		HostImportBlocks(size_t size, size_t alignment) :blocks(size, alignment, 1) {}
+		~HostImportBlocks() {
+			blocks.forEachBlock([](void*, void*& imported) {
+				if (!imported) return;
+#ifdef YR_USE_VULKAN
+				YRGraphics::releaseHostMemory(reinterpret_cast<YRGraphics::ImportedHostMemory*>(imported));
+#endif
+				imported = nullptr;
+			});
 		}
+		void unref() { if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this; }
 	};
 
-	RingBuffer4RGBA::RingBuffer4RGBA(size_t size) {
-		structure = new _rb4r;
-		if (size < 2) size = 2;
-		_THIS->buffer.resize(size);
-		_THIS->size = size;
+	struct HostImportPoolBase {
+		std::atomic<HostImportBlocks*> blocks{ nullptr }; // replaced by the decoder thread when the frame size changes
+		size_t bufferSize = 0;
+		~HostImportPoolBase() { if (HostImportBlocks* b = blocks.load()) b->unref(); }
+	};
+
+	static void releaseHostImportedBlock(void* opaque, uint8_t* data) {
+		auto owner = reinterpret_cast<HostImportBlocks*>(opaque);
+		owner->blocks.release(data);
+		owner->unref();
+	}
+
+	static uint8_t* acquireHostImportedBlock(HostImportBlocks* owner) {
+		uint8_t* data = (uint8_t*)owner->blocks.acquire();
+		if (!data) return nullptr;
+#ifdef YR_USE_VULKAN
+		void*& imported = owner->blocks.userData(data);
+		if (!imported) {
+			imported = YRGraphics::importHostMemory(data, owner->blocks.blockSize());
+		}
+#endif
+		return data;
+	}
+
+	static int getHostImportedBuffer(AVCodecContext* ctx, AVFrame* frame, int flags) {
+		auto base = reinterpret_cast<HostImportPoolBase*>(ctx->opaque);
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+		if (!base || !desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL))) {
+			return avcodec_default_get_buffer2(ctx, frame, flags);
+		}
+		int linesize[4];
+		ptrdiff_t offsets[4];
+		const int layout = alignedFrameLayout(ctx, frame, linesize, offsets);
+		if (layout < 0) return layout;
+		const size_t size = (size_t)layout;
+
+		HostImportBlocks* owner = base->blocks.load(std::memory_order_relaxed);
+		if (!owner || base->bufferSize != size) {
+			size_t alignment = 4096;
+#ifdef YR_USE_VULKAN
+			alignment = (size_t)YRGraphics::getHostImportAlignment();
+#endif
+			if (owner) owner->unref();
+			owner = new HostImportBlocks((size + alignment - 1) / alignment * alignment, alignment);
+			base->blocks.store(owner, std::memory_order_release);
+			base->bufferSize = size;
+		}
+		uint8_t* block = acquireHostImportedBlock(owner);
+		if (!block) return AVERROR(ENOMEM);
+		owner->refs.fetch_add(1, std::memory_order_relaxed);
+		frame->buf[0] = av_buffer_create(block, (int)size, releaseHostImportedBlock, owner, 0);
+		if (!frame->buf[0]) {
+			releaseHostImportedBlock(owner, block);
+			return AVERROR(ENOMEM);
+		}
+		setFramePlanes(frame, linesize, offsets);
+		return 0;
+	}
+
+#define _THIS reinterpret_cast<HostImportPoolBase*>(structure)
+	HostImportFramePool::HostImportFramePool() { structure = new HostImportPoolBase; }
+	HostImportFramePool::~HostImportFramePool() { delete _THIS; }
+
+	bool HostImportFramePool::attach(AVCodecContext* decoder) {
+#ifdef YR_USE_VULKAN
+		if (!YRGraphics::getHostImportAlignment()) return false;
+#else
+		return false;
+#endif
+		if (!(decoder->codec->capabilities & AV_CODEC_CAP_DR1)) return false;
+		// only frames the stream texture takes as-is benefit from importing
+		if (decoder->pix_fmt != AV_PIX_FMT_BGRA && decoder->pix_fmt != AV_PIX_FMT_BGR0) return false;
+		decoder->opaque = _THIS;
+		decoder->get_buffer2 = getHostImportedBuffer;
+		return true;
+	}
+
+	void* HostImportFramePool::importedMemory(const AVFrame* frame, uint64_t* offset) const {
+		if (!frame->buf[0] || !frame->data[0]) return nullptr;
+		// the buffer's opaque is the block set it came from. frames of a set retired by a size change keep it alive,
+		// but are no longer matched and take the copying path
+		HostImportBlocks* owner = _THIS->blocks.load(std::memory_order_acquire);
+		if (!owner || av_buffer_get_opaque(frame->buf[0]) != owner) return nullptr;
+		void* imported = owner->blocks.userData(frame->buf[0]->data);
+		if (!imported) return nullptr;
+		*offset = (uint64_t)(frame->data[0] - frame->buf[0]->data);
+		return imported;
 	}
 #undef _THIS
 
 	struct DecoderBase {
 		DecoderBase() = default;
+		HostImportFramePool importPool;
+		FrameMemoryPoolBase framePool;
+		InputFile input; // outlives fmt, which may read through it
 		smp<AVFormatContext> fmt{ nullptr };
 		smp<AVCodecContext> codecCtx{ nullptr };
 		std::vector<section> sections;
@@ -185,17 +1870,178 @@ namespace onart {
 		AVPixelFormat pixelFormat;
 		std::thread* worker;
 		bool forcedStop = false;
+		StageMeter meter;
 	};
 
 	struct ConverterBase {
 		smp<SwsContext> preprocessor{ nullptr };
+		std::vector<AVFrame*> uploading; // per texture slot: the imported frame its last copy reads from
 		int width, height;
 		std::thread* worker;
 		bool forcedStop = false;
+		StageMeter meter;
+		~ConverterBase() { for (AVFrame* f : uploading) av_frame_free(&f); }
 	};
 
+	// ---- encoder settings
+
+	void EncoderOptions::parsePrivateOptions(const char* list) {
+		std::string item;
+		for (const char* c = list;; c++) {
+			if (*c && *c != ':') {
+				item += *c;
+				continue;
+			}
+			const size_t eq = item.find('=');
+			if (eq != std::string::npos && eq > 0) privateOptions.emplace_back(item.substr(0, eq), item.substr(eq + 1));
+			else if (!item.empty()) LOGRAW("Encoder option", item, "is not key=value. Ignored");
+			item.clear();
+			if (!*c) break;
+		}
+	}
+
+	const AVCodec* findEncoder(const EncoderOptions& opts, int codecId) {
+		if (opts.codec.empty()) return avcodec_find_encoder((AVCodecID)codecId);
+		if (const AVCodec* ret = avcodec_find_encoder_by_name(opts.codec.c_str())) return ret;
+		if (const AVCodecDescriptor* desc = avcodec_descriptor_get_by_name(opts.codec.c_str())) return avcodec_find_encoder(desc->id);
+		return nullptr;
+	}
+
+	int encoderPixelFormat(const AVCodec* encoder, int preferred) {
+		if (!encoder->pix_fmts) return preferred;
+		for (const AVPixelFormat* f = encoder->pix_fmts; *f != AV_PIX_FMT_NONE; f++) {
+			if (*f == preferred) return preferred;
+		}
+		return avcodec_find_best_pix_fmt_of_list(encoder->pix_fmts, (AVPixelFormat)preferred, 0, nullptr);
+	}
+
+	// the encoder's own quality option if it has one, otherwise the generic quantizer scale
+	static void setQuality(AVCodecContext* ctx, const char* option, int quality, AVDictionary** dict) {
+		if (ctx->priv_data && av_opt_find(ctx->priv_data, option, nullptr, 0, 0)) {
+			av_dict_set_int(dict, option, quality, 0);
+		}
+		else {
+			ctx->flags |= AV_CODEC_FLAG_QSCALE;
+			ctx->global_quality = FF_QP2LAMBDA * quality;
+		}
+	}
+
+	void configureEncoder(AVCodecContext* ctx, const EncoderOptions& opts, int64_t autoBitRate, AVDictionary** dict) {
+		const int64_t bitRate = opts.bitRate > 0 ? opts.bitRate : autoBitRate;
+		switch (opts.rateControl) {
+		case EncoderOptions::RateControl::AUTO:
+		case EncoderOptions::RateControl::ABR:
+			ctx->bit_rate = bitRate;
+			break;
+		case EncoderOptions::RateControl::CBR:
+			ctx->bit_rate = ctx->rc_min_rate = ctx->rc_max_rate = bitRate;
+			ctx->rc_buffer_size = (int)std::min<int64_t>(bitRate, INT32_MAX);
+			if (ctx->priv_data && av_opt_find(ctx->priv_data, "nal-hrd", nullptr, 0, 0)) av_dict_set(dict, "nal-hrd", "cbr", 0);
+			break;
+		case EncoderOptions::RateControl::CRF:
+			ctx->bit_rate = 0;
+			setQuality(ctx, "crf", opts.quality, dict);
+			break;
+		case EncoderOptions::RateControl::CQP:
+			ctx->bit_rate = 0;
+			setQuality(ctx, "qp", opts.quality, dict);
+			break;
+		}
+		if (opts.gopSize > 0) ctx->gop_size = opts.gopSize;
+		if (opts.maxBFrames >= 0) ctx->max_b_frames = opts.maxBFrames;
+		ctx->thread_count = opts.threads;
+		if (opts.forceIdr && ctx->priv_data && av_opt_find(ctx->priv_data, "forced-idr", nullptr, 0, 0)) av_dict_set(dict, "forced-idr", "1", 0);
+		if (opts.lowLatency) {
+			ctx->max_b_frames = 0;
+			ctx->thread_type = FF_THREAD_SLICE; // frame threads hold back a frame each
+			// codec specific settings, matched by encoder name and set where the encoder has the option
+			static const struct { const char* encoder; const char* key; const char* value; } LOW_LATENCY[] = {
+				{ "libx264", "tune", "zerolatency" }, { "libx265", "tune", "zerolatency" },
+				{ "nvenc", "tune", "ull" }, { "nvenc", "zerolatency", "1" }, { "nvenc", "delay", "0" }, { "nvenc", "rc-lookahead", "0" },
+				{ "libvpx", "deadline", "realtime" }, { "libvpx", "lag-in-frames", "0" },
+				{ "libaom", "usage", "realtime" }, { "libaom", "lag-in-frames", "0" },
+			};
+			for (auto& setting : LOW_LATENCY) {
+				if (ctx->codec && std::strstr(ctx->codec->name, setting.encoder) && ctx->priv_data && av_opt_find(ctx->priv_data, setting.key, nullptr, 0, 0)) {
+					av_dict_set(dict, setting.key, setting.value, 0);
+				}
+			}
+		}
+		for (auto& [key, value] : opts.privateOptions) av_dict_set(dict, key.c_str(), value.c_str(), 0);
+	}
+
+	int openEncoder(AVCodecContext* ctx, const AVCodec* encoder, AVDictionary** dict) {
+		const int ret = avcodec_open2(ctx, encoder, dict);
+		for (const AVDictionaryEntry* e = nullptr; (e = av_dict_get(*dict, "", e, AV_DICT_IGNORE_SUFFIX));) {
+			LOGRAW("Encoder", encoder->name, "does not take option", e->key);
+		}
+		return ret;
+	}
+
+	const char* SegmentOptions::format() const {
+		switch (mode) {
+		case Mode::FRAGMENTED_MP4: return "mp4";
+		case Mode::HLS: return "hls";
+		case Mode::DASH: return "dash";
+		default: return nullptr;
+		}
+	}
+
+	void SegmentOptions::muxerOptions(const char* fileName, int codecId, AVDictionary** dict) const {
+		// file name without directory and extension
+		const char* base = fileName;
+		for (const char* c = fileName; *c; c++) {
+			if (*c == '/' || *c == '\\') base = c + 1;
+		}
+		std::string stem(base);
+		const size_t dot = stem.rfind('.');
+		if (dot != std::string::npos && dot > 0) stem.resize(dot);
+		char seconds[32];
+		std::snprintf(seconds, sizeof(seconds), "%g", segmentSeconds);
+		switch (mode) {
+		case Mode::FILE:
+			break;
+		case Mode::FRAGMENTED_MP4:
+			av_dict_set(dict, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+			av_dict_set_int(dict, "min_frag_duration", (int64_t)(segmentSeconds * 1e6), 0);
+			break;
+		case Mode::HLS:
+			av_dict_set(dict, "hls_time", seconds, 0);
+			av_dict_set_int(dict, "hls_list_size", window, 0);
+			if (window > 0) {
+				av_dict_set(dict, "hls_flags", "delete_segments+independent_segments", 0);
+			}
+			else { // a growing playlist that players may start on before it ends
+				av_dict_set(dict, "hls_playlist_type", "event", 0);
+				av_dict_set(dict, "hls_flags", "independent_segments", 0);
+			}
+			if (codecId != AV_CODEC_ID_H264) {
+				av_dict_set(dict, "hls_segment_type", "fmp4", 0);
+				av_dict_set(dict, "hls_fmp4_init_filename", (stem + "_init.mp4").c_str(), 0);
+			}
+			break;
+		case Mode::DASH:
+			av_dict_set(dict, "seg_duration", seconds, 0);
+			av_dict_set_int(dict, "window_size", window, 0);
+			av_dict_set(dict, "use_template", "1", 0);
+			av_dict_set(dict, "use_timeline", "1", 0);
+			av_dict_set(dict, "init_seg_name", (stem + "_init_$RepresentationID$.$ext$").c_str(), 0);
+			av_dict_set(dict, "media_seg_name", (stem + "_$RepresentationID$_$Number%05d$.$ext$").c_str(), 0);
+			break;
+		}
+	}
+
+	int openMuxer(AVFormatContext* fmt, AVDictionary** dict) {
+		const int ret = avformat_write_header(fmt, dict);
+		for (const AVDictionaryEntry* e = nullptr; (e = av_dict_get(*dict, "", e, AV_DICT_IGNORE_SUFFIX));) {
+			LOGRAW("Muxer", fmt->oformat->name, "does not take option", e->key);
+		}
+		return ret;
+	}
+
 	struct EncoderBase {
 		smp<SwsContext> preprocessor{ nullptr };
+		OutputFile output; // outlives fmt, which writes through it
 		smp<AVFormatContext> fmt{ nullptr };
 		smp<AVCodecContext> codecCtx{ nullptr };
 		AVStream* videoStream{ nullptr };
@@ -204,6 +2050,12 @@ namespace onart {
 		smp<AVPacket> compressedFrame{ nullptr };
 		std::vector<section> sections;
 		const AVCodec* encoder{ nullptr };
+		smp<AVDictionary> codecOptions{ nullptr }; // for avcodec_open2 in start
+		int64_t nextPts = 0;
+		int64_t firstFrameUS = 0;
+		bool pictured = false; // a picture has been encoded, so there is one to repeat
+		EncodeReport report;
+		StageMeter meter;
 	};
 
 #define _THIS reinterpret_cast<DecoderBase*>(structure)
@@ -216,9 +2068,25 @@ namespace onart {
 		delete _THIS;
 	}
 
-	bool VideoDecoder::open(const char* fileName) {
+	bool VideoDecoder::open(const char* fileName) { return open(fileName, InputFile::Options{}); }
+
+	bool VideoDecoder::open(const char* fileName, const InputFile::Options& io) {
 		if (isOpened()) return false;
+		if (!_THIS->input.open(fileName, io)) return false;
+		return openStream(fileName, _THIS->input.context());
+	}
+
+	bool VideoDecoder::open(AVIOContext* io, const char* name) {
+		if (isOpened() || !io) return false;
+		return openStream(name, io);
+	}
+
+	bool VideoDecoder::openStream(const char* fileName, AVIOContext* pb) {
 		_THIS->fmt = avformat_alloc_context();
+		if (pb) {
+			_THIS->fmt->pb = pb;
+			_THIS->fmt->flags |= AVFMT_FLAG_CUSTOM_IO;
+		}
 		FMCALL(avformat_open_input(&_THIS->fmt.ptr, fileName, nullptr, nullptr));
 		if (errorCode < 0) {
 			LOGRAW(errstr("open"));
@@ -288,41 +2156,53 @@ namespace onart {
 		return ret;
 	}
 
-	std::unique_ptr<VideoEncoder> VideoDecoder::makeEncoder(int w, int h) {
+	std::unique_ptr<VideoEncoder> VideoDecoder::makeEncoder(int w, int h, const EncoderOptions& opts) {
 		if (!isOpened()) return {};
+		return makeEncoder(_THIS->fmt->streams[_THIS->videoStreamIndex]->codecpar, _THIS->timeBase, _THIS->codecCtx->framerate, w, h, opts);
+	}
+
+	std::unique_ptr<VideoEncoder> VideoDecoder::makeEncoder(const AVCodecParameters* stream, AVRational timeBase, AVRational frameRate, int w, int h, const EncoderOptions& opts) {
+		if (!stream || stream->width <= 0 || stream->height <= 0) return {};
+		const AVCodec* encoder = findEncoder(opts, stream->codec_id);
+		if (!encoder) {
+			LOGRAW("Failed to find encoder", opts.codec.empty() ? avcodec_get_name(stream->codec_id) : opts.codec.c_str());
+			return {};
+		}
+		// keep the decoded format when the encoder takes it, so both conversions stay cheap
+		const AVPixelFormat format = (AVPixelFormat)encoderPixelFormat(encoder, stream->format);
 		struct _enc :VideoEncoder {};
 		std::unique_ptr<VideoEncoder> ret = std::make_unique<_enc>();
 		auto base = new EncoderBase;
-		base->encoder = avcodec_find_encoder(_THIS->codecCtx->codec_id);
+		base->encoder = encoder;
 		base->codecCtx = avcodec_alloc_context3(base->encoder);
-		base->codecCtx->bit_rate = _THIS->codecCtx->bit_rate * w * h / _THIS->width / _THIS->height;
-		if (base->codecCtx->bit_rate == 0) {
-			base->codecCtx->bit_rate = (int64_t)w * h * _THIS->codecCtx->framerate.num / _THIS->codecCtx->framerate.den;
+		int64_t autoBitRate = stream->bit_rate * w * h / stream->width / stream->height;
+		if (autoBitRate == 0 && frameRate.num > 0 && frameRate.den > 0) {
+			autoBitRate = (int64_t)w * h * frameRate.num / frameRate.den;
 		}
 		base->codecCtx->width = w;
 		base->codecCtx->height = h;
-		base->codecCtx->time_base = _THIS->timeBase;
-		base->codecCtx->framerate = _THIS->codecCtx->framerate;
-		base->codecCtx->gop_size = 4;
-		base->codecCtx->max_b_frames = 1;
-		base->codecCtx->pix_fmt = _THIS->pixelFormat;
-
-		base->rgbaFrame = av_frame_alloc();
-		base->rgbaFrame->format = AV_PIX_FMT_RGBA;
-		base->rgbaFrame->width = w;
-		base->rgbaFrame->height = h;
-		FMCALL(av_frame_get_buffer(base->rgbaFrame, 0));
-		if (errorCode < 0) {
-			LOGRAW(errstr("frame container allocation"));
-		}
+		base->codecCtx->time_base = timeBase;
+		base->codecCtx->framerate = frameRate;
+		base->codecCtx->pix_fmt = format;
+		configureEncoder(base->codecCtx, opts, autoBitRate, &base->codecOptions.ptr);
 
-		if (_THIS->pixelFormat != AV_PIX_FMT_RGBA) {
-			base->preprocessor = sws_getContext(w, h, AV_PIX_FMT_RGBA, w, h, _THIS->pixelFormat, SWS_POINT, nullptr, nullptr, nullptr);
+		if (format == AV_PIX_FMT_RGBA) {
+			base->rgbaFrame = av_frame_alloc();
+			base->rgbaFrame->format = AV_PIX_FMT_RGBA;
+			base->rgbaFrame->width = w;
+			base->rgbaFrame->height = h;
+			FMCALL(getFrameBuffer(base->rgbaFrame));
+			if (errorCode < 0) {
+				LOGRAW(errstr("frame container allocation"));
+			}
+		}
+		else { // converted straight from the pushed rows
+			base->preprocessor = sws_getContext(w, h, AV_PIX_FMT_RGBA, w, h, format, SWS_POINT, nullptr, nullptr, nullptr);
 			base->preprocessedFrame = av_frame_alloc();
-			base->preprocessedFrame->format = _THIS->pixelFormat;
+			base->preprocessedFrame->format = format;
 			base->preprocessedFrame->width = w;
 			base->preprocessedFrame->height = h;
-			FMCALL(av_frame_get_buffer(base->preprocessedFrame, 0));
+			FMCALL(getFrameBuffer(base->preprocessedFrame));
 			if (errorCode < 0) {
 				LOGRAW(errstr("frame container allocation"));
 			}
@@ -339,6 +2219,10 @@ namespace onart {
 		return _THIS->durationUS;
 	}
 
+	WorkerStats VideoDecoder::stats() { return _THIS->meter.snapshot(); }
+
+	IOStats VideoDecoder::ioStats() { return _THIS->input.stats(); }
+
 	int VideoDecoder::getWidth() { return _THIS->width; }
 	int VideoDecoder::getHeight() { return _THIS->height; }
 
@@ -348,15 +2232,25 @@ namespace onart {
 		// validate sections (no overlapping / no start > end case)
 		_THIS->sections = sections;
 		if (_THIS->sections.empty()) {
-			_THIS->sections.push_back(section{ 0,(int)_THIS->durationUS });
+			_THIS->sections.push_back(section{ 0, (int64_t)_THIS->durationUS });
 		}
 		
 		auto work = [this, output]() {
+			Tracer::nameThread("decoder");
 			auto outputRing = reinterpret_cast<_rb4f*>(output->structure);
-			outputRing->init(_THIS->pixelFormat, _THIS->width, _THIS->height);
+			outputRing->init();
+			if (_THIS->importPool.attach(_THIS->codecCtx)) {
+				outputRing->importPool = &_THIS->importPool;
+			}
+			else {
+				_THIS->framePool.consumerNode = &outputRing->consumerNode;
+				_THIS->codecCtx->opaque = &_THIS->framePool;
+				_THIS->codecCtx->get_buffer2 = getFrameMemoryBuffer;
+			}
 			FMCALL(avcodec_open2(_THIS->codecCtx.ptr, _THIS->decoder, nullptr));
 			if (errorCode < 0) {
 				LOGRAW(errstr("codec open"));
+				outputRing->finish();
 				return;
 			}
 			// decode time section
@@ -366,20 +2260,29 @@ namespace onart {
 				int64_t sectionTick = s.start;
 				avcodec_flush_buffers(_THIS->codecCtx);
 				int err = av_seek_frame(_THIS->fmt, -1, s.start, AVSEEK_FLAG_BACKWARD);
-				while (av_read_frame(_THIS->fmt, packet) == 0) {
-					if (_THIS->forcedStop) return;
+				while (true) {
+					StageMeter::Scope busy(_THIS->meter, StageMeter::State::BUSY);
+					{
+						YR_TRACE("demux");
+						if (av_read_frame(_THIS->fmt, packet) != 0) break;
+					}
+					if (_THIS->forcedStop) {
+						outputRing->finish();
+						return;
+					}
 					if (packet->stream_index != _THIS->videoStreamIndex) {
 						continue;
 					}
+					TraceScope decoding("decode packet");
 					int err = avcodec_send_packet(_THIS->codecCtx, packet);
 					if (err == AVERROR(EAGAIN)) {}
 					else if (err == AVERROR_EOF) {
-						LOGRAW("EOF detected", s.start, s.end);
+						LOGINFO("EOF detected", s.start, s.end);
 						break;
 					}
 					else if (err) {
 						av_make_error_string(errorString, sizeof(errorString), err);
-						LOGRAW(errorString);
+						LOGERR("decode:", errorString);
 						break;
 					}
 					err = avcodec_receive_frame(_THIS->codecCtx, frame);
@@ -392,16 +2295,19 @@ namespace onart {
 					int64_t highEnd = lowEnd + frame->duration;
 					if (getTimeInMicro(highEnd) < s.start) { continue; }
 					else if (getTimeInMicro(lowEnd) > s.end) { break; }
-					AVFrame* cloned = outputRing->get2Write();
-					av_frame_copy(cloned, frame);
-					av_frame_copy_props(cloned, frame);
+					busy.end();
+					decoding.end();
+					AVFrame* cloned = outputRing->get2Write(&_THIS->meter);
+					av_frame_unref(cloned);
+					av_frame_ref(cloned, frame);
 					cloned->pts = getTimeInMicro(lowEnd);
 					cloned->duration = getTimeInMicro(highEnd);
 					outputRing->return2write();
+					_THIS->meter.count();
 					av_packet_unref(packet);
 				}
 			}
-			outputRing->done = true;
+			outputRing->finish();
 		};
 
 		if (extraWorker) { 
@@ -423,38 +2329,73 @@ namespace onart {
 		delete _THIS;
 	}
 	void Converter::start(RingBuffer4Frame* input, RingBuffer4Texture* output, bool linear, bool extraWorker) {
-		auto work = [this, input, output, linear]() {
+		auto placed = std::make_shared<std::promise<void>>();
+		std::future<void> nodeTaken = placed->get_future();
+		auto work = [this, input, output, linear, placed]() {
+			Tracer::nameThread("converter");
 			auto irb = reinterpret_cast<_rb4f*>(input->structure);
 			auto orb = reinterpret_cast<_rb4t*>(output->structure);
+			irb->consumerNode = FrameMemory::currentNode(); // decoded frames go to this node
+			placed->set_value();
 			orb->init(_THIS->width, _THIS->height, linear);
 			int pitch = _THIS->width * 4;
-			while (AVFrame* fr = irb->get2Read()) {
-				YRGraphics::pStreamTexture& tex = orb->get2Write();
-				tex->updateBy([this, pitch, fr](void* data, uint32_t) {
-					uint8_t* castedData = (uint8_t*)data;
-					sws_scale(_THIS->preprocessor, fr->data, fr->linesize, 0, fr->height, &castedData, &pitch);
-				});
+			for (AVFrame* f : _THIS->uploading) av_frame_free(&f);
+			_THIS->uploading.assign(orb->buffer.size(), nullptr);
+			for (AVFrame*& f : _THIS->uploading) f = av_frame_alloc();
+			while (AVFrame* fr = irb->get2Read(&_THIS->meter)) {
+				YRGraphics::pStreamTexture& tex = orb->get2Write(&_THIS->meter);
+				StageMeter::Scope busy(_THIS->meter, StageMeter::State::BUSY);
+				YR_TRACE("upload");
+				AVFrame* held = _THIS->uploading[&tex - orb->buffer.data()];
+				uint64_t offset;
+				void* imported = irb->importPool ? irb->importPool->importedMemory(fr, &offset) : nullptr;
+#ifdef YR_USE_VULKAN
+				if (imported) {
+					// the previous copy of this slot may still be reading the frame it holds
+					tex->wait();
+					av_frame_unref(held);
+					av_frame_ref(held, fr);
+					tex->update(reinterpret_cast<YRGraphics::ImportedHostMemory*>(imported), offset, fr->linesize[0]);
+				}
+#endif
+				if (!imported) {
+					tex->updateBy([this, pitch, fr](void* data, uint32_t) {
+						YR_TRACE("decode convert");
+						uint8_t* castedData = (uint8_t*)data;
+						sws_scale(_THIS->preprocessor, fr->data, fr->linesize, 0, fr->height, &castedData, &pitch);
+					});
+					av_frame_unref(held); // updateBy waited for the previous copy
+				}
 				irb->return2Read();
 				orb->return2write();
+				_THIS->meter.count();
 			}
-			orb->done = true;
+			orb->finish();
 		};
 		if (extraWorker) {
 			_THIS->worker = new std::thread(work);
+			nodeTaken.wait(); // the decoder started after this allocates its first frame on the worker's node
 		}
 		else {
 			work();
 		}
 	}
 
+	WorkerStats Converter::stats() { return _THIS->meter.snapshot(); }
+
 #undef _THIS
 
 #define _THIS reinterpret_cast<FilterBase*>(structure)
 
+	// full-screen triangle without vertex input, and a fragment shader sampling texture 0
+	static const uint32_t NULL3_VERT[276] = { 119734787,65536,851979,51,0,131089,1,393227,1,1280527431,1685353262,808793134,0,196622,0,1,524303,0,4,1852399981,0,13,26,41,327752,11,0,11,0,327752,11,1,11,1,327752,11,2,11,3,327752,11,3,11,4,196679,11,2,262215,26,11,42,262215,41,30,0,131091,2,196641,3,2,196630,6,32,262167,7,6,4,262165,8,32,0,262187,8,9,1,262172,10,6,9,393246,11,7,6,10,10,262176,12,3,11,262203,12,13,3,262165,14,32,1,262187,14,15,0,262167,16,6,2,262187,8,17,3,262172,18,16,17,262187,6,19,3212836864,327724,16,20,19,19,262187,6,21,1077936128,327724,16,22,19,21,327724,16,23,21,19,393260,18,24,20,22,23,262176,25,1,14,262203,25,26,1,262176,28,7,18,262176,30,7,16,262187,6,33,0,262187,6,34,1065353216,262176,38,3,7,262176,40,3,16,262203,40,41,3,327724,16,42,33,33,262187,6,43,1073741824,327724,16,44,33,43,327724,16,45,43,33,393260,18,46,42,44,45,327734,2,4,0,3,131320,5,262203,28,29,7,262203,28,48,7,262205,14,27,26,196670,29,24,327745,30,31,29,27,262205,16,32,31,327761,6,35,32,0,327761,6,36,32,1,458832,7,37,35,36,33,34,327745,38,39,13,15,196670,39,37,196670,48,46,327745,30,49,48,27,262205,16,50,49,196670,41,50,65789,65592 };
+	static const uint32_t COPY_FRAG[119] = { 119734787,65536,851979,20,0,131089,1,393227,1,1280527431,1685353262,808793134,0,196622,0,1,458767,4,4,1852399981,0,9,17,196624,4,7,262215,9,30,0,262215,13,34,0,262215,13,33,0,262215,17,30,0,131091,2,196641,3,2,196630,6,32,262167,7,6,4,262176,8,3,7,262203,8,9,3,589849,10,6,1,0,0,0,1,0,196635,11,10,262176,12,0,11,262203,12,13,0,262167,15,6,2,262176,16,1,15,262203,16,17,1,327734,2,4,0,3,131320,5,262205,11,14,13,262205,15,18,17,327767,7,19,14,18,196670,9,19,65789,65592 };
+
 	struct FilterBase {
 		YRGraphics::RenderPass2Screen* scr;
 		YRGraphics::Pipeline* pp;
 		YRGraphics::pMesh mesh;
+		StageMeter meter;
 	};
 
 	FrameFilter::FrameFilter(int w, int h) {
@@ -465,12 +2406,10 @@ namespace onart {
 		}
 		{
 			YRGraphics::ShaderModuleCreationOptions opts;
-			const uint32_t NULL3_VERT[276] = { 119734787,65536,851979,51,0,131089,1,393227,1,1280527431,1685353262,808793134,0,196622,0,1,524303,0,4,1852399981,0,13,26,41,327752,11,0,11,0,327752,11,1,11,1,327752,11,2,11,3,327752,11,3,11,4,196679,11,2,262215,26,11,42,262215,41,30,0,131091,2,196641,3,2,196630,6,32,262167,7,6,4,262165,8,32,0,262187,8,9,1,262172,10,6,9,393246,11,7,6,10,10,262176,12,3,11,262203,12,13,3,262165,14,32,1,262187,14,15,0,262167,16,6,2,262187,8,17,3,262172,18,16,17,262187,6,19,3212836864,327724,16,20,19,19,262187,6,21,1077936128,327724,16,22,19,21,327724,16,23,21,19,393260,18,24,20,22,23,262176,25,1,14,262203,25,26,1,262176,28,7,18,262176,30,7,16,262187,6,33,0,262187,6,34,1065353216,262176,38,3,7,262176,40,3,16,262203,40,41,3,327724,16,42,33,33,262187,6,43,1073741824,327724,16,44,33,43,327724,16,45,43,33,393260,18,46,42,44,45,327734,2,4,0,3,131320,5,262203,28,29,7,262203,28,48,7,262205,14,27,26,196670,29,24,327745,30,31,29,27,262205,16,32,31,327761,6,35,32,0,327761,6,36,32,1,458832,7,37,35,36,33,34,327745,38,39,13,15,196670,39,37,196670,48,46,327745,30,49,48,27,262205,16,50,49,196670,41,50,65789,65592 };
 			opts.size = sizeof(NULL3_VERT);
 			opts.stage = YRGraphics::ShaderStage::VERTEX;
 			opts.source = NULL3_VERT;
 			auto vs = YRGraphics::createShader(0, opts);
-			const uint32_t COPY_FRAG[119] = { 119734787,65536,851979,20,0,131089,1,393227,1,1280527431,1685353262,808793134,0,196622,0,1,458767,4,4,1852399981,0,9,17,196624,4,7,262215,9,30,0,262215,13,34,0,262215,13,33,0,262215,17,30,0,131091,2,196641,3,2,196630,6,32,262167,7,6,4,262176,8,3,7,262203,8,9,3,589849,10,6,1,0,0,0,1,0,196635,11,10,262176,12,0,11,262203,12,13,0,262167,15,6,2,262176,16,1,15,262203,16,17,1,327734,2,4,0,3,131320,5,262205,11,14,13,262205,15,18,17,327767,7,19,14,18,196670,9,19,65789,65592 };
 			opts.size = sizeof(COPY_FRAG);
 			opts.stage = YRGraphics::ShaderStage::FRAGMENT;
 			opts.source = COPY_FRAG;
@@ -491,28 +2430,189 @@ namespace onart {
 	void FrameFilter::onLoop(RingBuffer4Texture* input) {
 		auto irb = reinterpret_cast<_rb4t*>(input->structure);
 		if (!Input::isKeyDown(Input::KeyCode::space)) return;
-		YRGraphics::pStreamTexture tx = irb->get2Read();
+		YRGraphics::pStreamTexture tx = irb->get2Read(&_THIS->meter);
 		if (!tx) {
 			return;
 		}
-		_THIS->scr->start();
-		_THIS->scr->bind(0, tx);
-		_THIS->scr->invoke(_THIS->mesh);
-		_THIS->scr->execute();
-		_THIS->scr->wait();
+		{
+			StageMeter::Scope busy(_THIS->meter, StageMeter::State::BUSY);
+			YR_TRACE("render submit");
+			_THIS->scr->start();
+			_THIS->scr->bind(0, tx);
+			_THIS->scr->invoke(_THIS->mesh);
+			_THIS->scr->execute();
+		}
+		{
+			StageMeter::Scope blocked(_THIS->meter, StageMeter::State::BLOCKED);
+			YR_TRACE("fence wait");
+			_THIS->scr->wait();
+		}
 		irb->return2Read();
+		_THIS->meter.count();
 	}
 
+	WorkerStats FrameFilter::stats() { return _THIS->meter.snapshot(); }
+
 	FrameFilter::~FrameFilter() {
 		delete _THIS;
 	}
 
 #undef _THIS
 
+#define _THIS reinterpret_cast<OffscreenFilterBase*>(structure)
+
+	struct OffscreenFilterBase {
+		YRGraphics::RenderPass* pass;
+		YRGraphics::pMesh mesh;
+		std::vector<uint8_t, FrameAllocator<uint8_t>> pixels;
+		StageMeter meter;
+	};
+
+	// keys of the objects every OffscreenFilter shares. the pass is resized for each filter
+	constexpr int32_t OFFSCREEN_VERT_KEY = INT32_MIN + 1, OFFSCREEN_FRAG_KEY = INT32_MIN + 2, OFFSCREEN_KEY = INT32_MIN + 1;
+
+	OffscreenFilter::OffscreenFilter(int w, int h) {
+		structure = new OffscreenFilterBase;
+		_THIS->pixels.resize((size_t)w * h * 4);
+		_THIS->mesh = YRGraphics::createNullMesh(INT32_MIN, 3);
+		if ((_THIS->pass = YRGraphics::getRenderPass(OFFSCREEN_KEY))) {
+			_THIS->pass->resize(w, h, false);
+			return;
+		}
+		YRGraphics::RenderPassCreationOptions rpOpts{};
+		rpOpts.width = w;
+		rpOpts.height = h;
+		rpOpts.linearSampled = false;
+		rpOpts.canCopy = true;
+		_THIS->pass = YRGraphics::createRenderPass(OFFSCREEN_KEY, rpOpts);
+		if (!_THIS->pass) {
+			LOGRAW("Failed to create offscreen render pass");
+			return;
+		}
+		YRGraphics::ShaderModuleCreationOptions opts;
+		opts.size = sizeof(NULL3_VERT);
+		opts.stage = YRGraphics::ShaderStage::VERTEX;
+		opts.source = NULL3_VERT;
+		auto vs = YRGraphics::createShader(OFFSCREEN_VERT_KEY, opts);
+		opts.size = sizeof(COPY_FRAG);
+		opts.stage = YRGraphics::ShaderStage::FRAGMENT;
+		opts.source = COPY_FRAG;
+		auto fs = YRGraphics::createShader(OFFSCREEN_FRAG_KEY, opts);
+		YRGraphics::PipelineCreationOptions pco;
+		pco.vertexShader = vs;
+		pco.fragmentShader = fs;
+		pco.pass = _THIS->pass;
+		pco.shaderResources.usePush = false;
+		pco.shaderResources.pos0 = YRGraphics::ShaderResourceType::TEXTURE_1;
+		_THIS->pass->usePipeline(YRGraphics::createPipeline(OFFSCREEN_KEY, pco), 0);
+	}
+
+	bool OffscreenFilter::onLoop(RingBuffer4Texture* input, VideoEncoder* output, size_t duration) {
+		auto irb = reinterpret_cast<_rb4t*>(input->structure);
+		YRGraphics::pStreamTexture tx = irb->get2Read(&_THIS->meter);
+		if (!tx || !_THIS->pass) return false;
+		TraceScope rendering("render");
+		{
+			StageMeter::Scope busy(_THIS->meter, StageMeter::State::BUSY);
+			YR_TRACE("render submit");
+			_THIS->pass->start();
+			_THIS->pass->bind(0, tx);
+			_THIS->pass->invoke(_THIS->mesh);
+			_THIS->pass->execute();
+		}
+		{
+			StageMeter::Scope blocked(_THIS->meter, StageMeter::State::BLOCKED);
+			YR_TRACE("fence wait");
+			_THIS->pass->wait();
+		}
+		rendering.end();
+		irb->return2Read();
+		{
+			StageMeter::Scope busy(_THIS->meter, StageMeter::State::BUSY);
+			YR_TRACE("readback");
+			_THIS->pass->readBackTo(_THIS->pixels.data(), 0);
+		}
+		_THIS->meter.count();
+		output->push(_THIS->pixels.data(), duration);
+		return true;
+	}
+
+	WorkerStats OffscreenFilter::stats() { return _THIS->meter.snapshot(); }
+
+	OffscreenFilter::~OffscreenFilter() {
+		delete _THIS;
+	}
+
+#undef _THIS
+
 #define _THIS reinterpret_cast<EncoderBase*>(structure)
-	
-	void VideoEncoder::start(const char* fileName) {
-		FMCALL(avformat_alloc_output_context2(&_THIS->fmt.ptr, nullptr, nullptr, fileName));
+
+	// muxes every packet the encoder has ready
+	static void drainPackets(EncoderBase* base) {
+		int err;
+		while (true) {
+			{
+				YR_TRACE("encode receive");
+				err = avcodec_receive_packet(base->codecCtx, base->compressedFrame);
+			}
+			if (err < 0) break;
+			base->report.bytes += base->compressedFrame->size;
+			base->compressedFrame->stream_index = 0; // video index == 0(which I've just added)
+			av_packet_rescale_ts(base->compressedFrame, base->codecCtx->time_base, base->videoStream->time_base);
+			YR_TRACE("mux write");
+			av_interleaved_write_frame(base->fmt, base->compressedFrame);
+		}
+		if (err != AVERROR(EAGAIN) && err != AVERROR_EOF) {
+			LOGERR("Failed to recieve packet");
+		}
+	}
+
+	// converts the rows to the encoder's format (nullptr keeps the last picture) and encodes them
+	static void encodeRGBA(EncoderBase* base, const uint8_t* rgba, int pitch, size_t duration, bool keyframe) {
+		if (!rgba && !base->pictured) return;
+		StageMeter::Scope busy(base->meter, StageMeter::State::BUSY);
+		base->meter.count();
+		AVFrame* pFrame = base->preprocessor ? base->preprocessedFrame.ptr : base->rgbaFrame.ptr;
+		av_frame_make_writable(pFrame); // the encoder may still reference the last picture
+		if (rgba) {
+			const int w = base->codecCtx->width, h = base->codecCtx->height;
+			if (pitch <= 0) pitch = w * 4;
+			if (base->preprocessor) {
+				YR_TRACE("encode convert");
+				sws_scale(base->preprocessor, &rgba, &pitch, 0, h, pFrame->data, pFrame->linesize);
+			}
+			else {
+				for (int i = 0; i < h; i++) std::memcpy(pFrame->data[0] + (ptrdiff_t)i * pFrame->linesize[0], rgba + (ptrdiff_t)i * pitch, (size_t)w * 4);
+			}
+			base->pictured = true;
+		}
+		if (!duration) { // one frame at the stream rate, so the pts still advances
+			const AVRational rate = base->codecCtx->framerate;
+			duration = rate.num > 0 && rate.den > 0 ? (size_t)std::max<int64_t>(av_rescale_q(1, av_inv_q(rate), base->codecCtx->time_base), 1) : 1;
+		}
+		pFrame->pts = base->nextPts;
+		pFrame->duration = duration;
+		pFrame->pict_type = keyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+		base->nextPts += duration;
+		if (!base->report.frames++) base->firstFrameUS = nowUS();
+		base->report.mediaSeconds += (double)duration * base->codecCtx->time_base.num / base->codecCtx->time_base.den;
+		YR_TRACE("encode");
+		int err;
+		{
+			YR_TRACE("encode send");
+			err = avcodec_send_frame(base->codecCtx, pFrame);
+		}
+		if (err < 0) {
+			LOGERR("Failed to send frame");
+			return;
+		}
+		drainPackets(base);
+	}
+
+	VideoEncoder::~VideoEncoder() { delete _THIS; }
+
+	void VideoEncoder::start(const char* fileName, const SegmentOptions& segments, const OutputFile::Options& io) {
+		FMCALL(avformat_alloc_output_context2(&_THIS->fmt.ptr, nullptr, segments.format(), fileName));
 		if (errorCode < 0) {
 			LOGRAW(errstr("video encoder start"));
 			return;
@@ -520,47 +2620,59 @@ namespace onart {
 		_THIS->videoStream = avformat_new_stream(_THIS->fmt, _THIS->encoder);
 		if (!_THIS->videoStream) {
 			LOGRAW("Failed to add new stream");
+			_THIS->fmt = nullptr;
 			return;
 		}
-		FMCALL(avcodec_open2(_THIS->codecCtx, _THIS->encoder, nullptr));
+		if (_THIS->fmt->oformat->flags & AVFMT_GLOBALHEADER) _THIS->codecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+		FMCALL(openEncoder(_THIS->codecCtx, _THIS->encoder, &_THIS->codecOptions.ptr));
 		if (errorCode < 0) {
 			LOGRAW(errstr("codec open"));
+			_THIS->fmt = nullptr;
 			return;
 		}
-		FMCALL(avformat_write_header(_THIS->fmt, nullptr));
+		avcodec_parameters_from_context(_THIS->videoStream->codecpar, _THIS->codecCtx);
+		_THIS->videoStream->time_base = _THIS->codecCtx->time_base;
+		if (!(_THIS->fmt->oformat->flags & AVFMT_NOFILE)) {
+			if (!_THIS->output.open(fileName, io)) {
+				_THIS->fmt = nullptr;
+				return;
+			}
+			if (AVIOContext* pb = _THIS->output.context()) {
+				_THIS->fmt->pb = pb;
+				_THIS->fmt->flags |= AVFMT_FLAG_CUSTOM_IO;
+			}
+			else {
+				FMCALL(avio_open(&_THIS->fmt->pb, fileName, AVIO_FLAG_WRITE));
+				if (errorCode < 0) {
+					LOGRAW(errstr("output open"));
+					_THIS->fmt = nullptr;
+					return;
+				}
+			}
+		}
+		smp<AVDictionary> muxerOptions(nullptr);
+		segments.muxerOptions(fileName, _THIS->codecCtx->codec_id, &muxerOptions.ptr);
+		FMCALL(openMuxer(_THIS->fmt, &muxerOptions.ptr));
 		if (errorCode < 0) {
 			LOGRAW(errstr("file header"));
+			if (_THIS->output.context()) {
+				_THIS->fmt->pb = nullptr;
+				_THIS->output.close();
+			}
+			else if (!(_THIS->fmt->oformat->flags & AVFMT_NOFILE)) {
+				avio_closep(&_THIS->fmt->pb);
+			}
+			_THIS->fmt = nullptr; // so push() and end() see an encoder that never started
 			return;
 		}
 	}
 
-	void VideoEncoder::push(const uint8_t* rgba, size_t duration) {
+	void VideoEncoder::push(const uint8_t* rgba, size_t duration, int pitch, bool keyframe) {
 		if (!_THIS->fmt) {
-			LOGRAW("You must start the encoder before pushing frame data");
-			return;
-		}
-		AVFrame* pFrame{};
-		std::memcpy(_THIS->rgbaFrame->data, rgba, _THIS->codecCtx->width * _THIS->codecCtx->height * 4);
-		if (_THIS->preprocessor) {
-			sws_scale(_THIS->preprocessor, _THIS->rgbaFrame->data, _THIS->rgbaFrame->linesize, 0, _THIS->rgbaFrame->height, _THIS->preprocessedFrame->data, _THIS->preprocessedFrame->linesize);
-			pFrame = _THIS->preprocessedFrame;
-		}
-		else {
-			pFrame = _THIS->rgbaFrame;
-		}
-		int err = avcodec_send_frame(_THIS->codecCtx, pFrame);
-		if (err < 0) {
-			LOGRAW("Failed to send frame");
-			return;
-		}
-		err = avcodec_receive_packet(_THIS->codecCtx, _THIS->compressedFrame);
-		if (err < 0) {
-			LOGRAW("Failed to recieve packet");
+			LOGERR("You must start the encoder before pushing frame data");
 			return;
 		}
-		_THIS->compressedFrame->stream_index = 0; // video index == 0(which I've just added)
-		_THIS->compressedFrame->duration = duration;
-		av_interleaved_write_frame(_THIS->fmt, _THIS->compressedFrame);
+		encodeRGBA(_THIS, rgba, pitch, duration, keyframe);
 	}
 
 	void VideoEncoder::end() {
@@ -568,14 +2680,204 @@ namespace onart {
 			LOGRAW("You must start the encoder before pushing frame data");
 			return;
 		}
+		if (avcodec_send_frame(_THIS->codecCtx, nullptr) == 0) drainPackets(_THIS);
+		if (_THIS->report.frames) _THIS->report.wallSeconds = (nowUS() - _THIS->firstFrameUS) / 1e6;
 		FMCALL(av_write_trailer(_THIS->fmt));
 		if (errorCode < 0) {
 			LOGRAW(errstr("file trailer"));
 			return;
 		}
+		if (_THIS->output.context()) {
+			_THIS->fmt->pb = nullptr;
+			if (!_THIS->output.close()) LOGRAW("Failed to write the output file");
+		}
+		else if (!(_THIS->fmt->oformat->flags & AVFMT_NOFILE)) {
+			avio_closep(&_THIS->fmt->pb);
+		}
 		_THIS->fmt = {};
 	}
 
+	WorkerStats VideoEncoder::stats() { return _THIS->meter.snapshot(); }
+
+	IOStats VideoEncoder::ioStats() { return _THIS->output.stats(); }
+
+	EncodeReport VideoEncoder::report() { return _THIS->report; }
+
+#undef _THIS
+
+	// one writer, a reader per encoder. every reader sees every frame; a slot is written again once all of them released it.
+	// positions are sequence numbers rather than ring indices, so a reader a whole ring behind is not mistaken for an idle one
+	struct FanOutBase {
+		std::vector<AVFrame*> slots;
+		std::vector<size_t> durations;
+		std::vector<uint8_t> repeats; // the slot carries no picture; encoders keep their last one
+		std::vector<uint8_t> keyframes;
+		std::vector<int> refs; // readers yet to release the slot
+		std::vector<VideoEncoder*> encoders;
+		std::vector<uint64_t> positions; // next sequence number of each reader
+		std::vector<std::thread> workers;
+		uint64_t head = 0; // sequence number of the next write
+		bool done = false;
+		bool pictured = false; // a picture has been pushed. repeats before it are dropped
+		std::mutex mtx;
+		std::condition_variable rcv;
+		std::condition_variable wcv;
+		// statistics. occupancy is the lag of the slowest reader at each write
+		std::unique_ptr<std::atomic<uint64_t>[]> occupancy;
+		std::atomic<uint64_t> writeWaitUS{ 0 }, readWaitUS{ 0 };
+
+		inline size_t lag() const {
+			uint64_t slowest = head;
+			for (uint64_t p : positions) slowest = std::min(slowest, p);
+			return (size_t)(head - slowest);
+		}
+
+		void work(size_t reader, VideoEncoder* encoder, EncoderBase* base) {
+			Tracer::nameThread("encoder");
+			while (true) {
+				AVFrame* frame;
+				size_t slot;
+				{
+					std::unique_lock _(mtx);
+					if (positions[reader] == head && !done) {
+						const bool measure = statsEnabled();
+						const int64_t begin = measure ? nowUS() : 0;
+						rcv.wait(_, [this, reader]() { return positions[reader] < head || done; });
+						if (measure) {
+							const uint64_t waited = (uint64_t)(nowUS() - begin);
+							readWaitUS.fetch_add(waited, std::memory_order_relaxed);
+							base->meter.add(StageMeter::State::BLOCKED, waited);
+						}
+					}
+					if (positions[reader] == head) break;
+					slot = positions[reader] % slots.size();
+					frame = slots[slot];
+				}
+				encodeRGBA(base, repeats[slot] ? nullptr : frame->data[0], frame->linesize[0], durations[slot], keyframes[slot]);
+				std::unique_lock _(mtx);
+				positions[reader]++;
+				if (--refs[slot] == 0) wcv.notify_one();
+			}
+			encoder->end();
+		}
+	};
+
+#define _THIS reinterpret_cast<FanOutBase*>(structure)
+	EncoderFanOut::EncoderFanOut(size_t queueLength) {
+		structure = new FanOutBase;
+		if (queueLength < 2) queueLength = 2;
+		_THIS->slots.resize(queueLength, nullptr);
+		_THIS->durations.resize(queueLength);
+		_THIS->repeats.resize(queueLength);
+		_THIS->keyframes.resize(queueLength);
+		_THIS->refs.resize(queueLength);
+		_THIS->occupancy.reset(new std::atomic<uint64_t>[queueLength + 1]);
+		for (size_t i = 0; i <= queueLength; i++) _THIS->occupancy[i] = 0;
+	}
+
+	EncoderFanOut::~EncoderFanOut() {
+		end();
+		for (AVFrame* f : _THIS->slots) av_frame_free(&f);
+		delete _THIS;
+	}
+
+	void EncoderFanOut::add(VideoEncoder* encoder) {
+		if (_THIS->head || _THIS->done) {
+			LOGERR("Encoders must be added before the first frame");
+			return;
+		}
+		EncoderBase* base = reinterpret_cast<EncoderBase*>(encoder->structure);
+		if (!base->fmt) {
+			LOGERR("You must start the encoder before adding it");
+			return;
+		}
+		if (!_THIS->encoders.empty()) {
+			EncoderBase* first = reinterpret_cast<EncoderBase*>(_THIS->encoders[0]->structure);
+			if (first->codecCtx->width != base->codecCtx->width || first->codecCtx->height != base->codecCtx->height) {
+				LOGERR("Encoders of a fan-out must have the same size");
+				return;
+			}
+		}
+		std::unique_lock _(_THIS->mtx);
+		_THIS->encoders.push_back(encoder);
+		_THIS->positions.push_back(0);
+		_THIS->workers.emplace_back(&FanOutBase::work, _THIS, _THIS->encoders.size() - 1, encoder, base);
+	}
+
+	void EncoderFanOut::push(const uint8_t* rgba, size_t duration, int pitch, bool keyframe) {
+		if (_THIS->encoders.empty() || _THIS->done) return;
+		if (!rgba && !_THIS->pictured) return; // nothing to repeat yet
+		_THIS->pictured |= rgba != nullptr;
+		const size_t slot = _THIS->head % _THIS->slots.size();
+		const bool measure = statsEnabled();
+		{
+			std::unique_lock _(_THIS->mtx);
+			if (measure) _THIS->occupancy[_THIS->lag()].fetch_add(1, std::memory_order_relaxed);
+			if (_THIS->refs[slot]) { // the slowest encoder is a whole queue behind
+				YR_TRACE("fan-out wait");
+				const int64_t begin = measure ? nowUS() : 0;
+				_THIS->wcv.wait(_, [this, slot]() { return _THIS->refs[slot] == 0; });
+				if (measure) _THIS->writeWaitUS.fetch_add((uint64_t)(nowUS() - begin), std::memory_order_relaxed);
+			}
+		}
+		AVFrame*& frame = _THIS->slots[slot];
+		if (rgba) {
+			const EncoderBase* base = reinterpret_cast<EncoderBase*>(_THIS->encoders[0]->structure);
+			const int w = base->codecCtx->width, h = base->codecCtx->height;
+			if (!frame) frame = av_frame_alloc();
+			if (!frame->data[0]) { // first picture in this slot, which may have carried repeats before
+				frame->format = AV_PIX_FMT_RGBA;
+				frame->width = w;
+				frame->height = h;
+				if (getFrameBuffer(frame) < 0) {
+					LOGERR("Failed to allocate a fan-out frame");
+					return;
+				}
+			}
+			if (pitch <= 0) pitch = w * 4;
+			YR_TRACE("fan-out copy");
+			for (int i = 0; i < h; i++) std::memcpy(frame->data[0] + (ptrdiff_t)i * frame->linesize[0], rgba + (ptrdiff_t)i * pitch, (size_t)w * 4);
+		}
+		else if (!frame) {
+			frame = av_frame_alloc(); // carries nothing; the repeat flag is what encoders read
+		}
+		_THIS->durations[slot] = duration;
+		_THIS->repeats[slot] = !rgba;
+		_THIS->keyframes[slot] = keyframe;
+		std::unique_lock _(_THIS->mtx);
+		_THIS->refs[slot] = (int)_THIS->encoders.size();
+		_THIS->head++;
+		_THIS->rcv.notify_all();
+	}
+
+	void EncoderFanOut::end() {
+		{
+			std::unique_lock _(_THIS->mtx);
+			if (_THIS->done) return;
+			_THIS->done = true;
+			_THIS->rcv.notify_all();
+		}
+		for (std::thread& t : _THIS->workers) t.join();
+		_THIS->workers.clear();
+	}
+
+	size_t EncoderFanOut::load() {
+		std::unique_lock _(_THIS->mtx);
+		return _THIS->lag();
+	}
+
+	RingStats EncoderFanOut::stats() {
+		RingStats ret;
+		{
+			std::unique_lock _(_THIS->mtx);
+			ret.items = _THIS->head;
+		}
+		ret.writeWaitUS = _THIS->writeWaitUS.load(std::memory_order_relaxed);
+		ret.readWaitUS = _THIS->readWaitUS.load(std::memory_order_relaxed);
+		ret.occupancy.resize(_THIS->slots.size() + 1);
+		for (size_t i = 0; i < ret.occupancy.size(); i++) ret.occupancy[i] = _THIS->occupancy[i].load(std::memory_order_relaxed);
+		return ret;
+	}
 #undef _THIS
 
 }
\ No newline at end of file
@@ -6,9 +6,224 @@
 
 #include <vector>
 #include <thread>
+#include <atomic>
+#include <string>
+
+struct AVCodec;
+struct AVCodecContext;
+struct AVCodecParameters;
+struct AVDictionary;
+struct AVFormatContext;
+struct AVFrame;
+struct AVIOContext;
+struct AVRational;
 
 namespace onart {
 
+	// stage instrumentation. all times are in microseconds
+	struct WorkerStats {
+		uint64_t items = 0;     // frames processed
+		uint64_t busyUS = 0;    // time spent on frames
+		uint64_t blockedUS = 0; // time spent waiting on rings (or the GPU)
+		uint64_t wallUS = 0;    // from the first frame to the last (or now)
+	};
+
+	struct RingStats {
+		uint64_t items = 0;       // frames passed from writer to reader
+		uint64_t writeWaitUS = 0; // writer waiting on a full ring
+		uint64_t readWaitUS = 0;  // reader waiting on an empty ring
+		std::vector<uint64_t> occupancy; // occupancy[n]: writes that found n frames queued
+	};
+
+	// file I/O under a demuxer or muxer
+	struct IOStats {
+		uint64_t bytes = 0;    // bytes passed to the demuxer / from the muxer
+		uint64_t calls = 0;    // read / write callbacks from it
+		uint64_t seeks = 0;
+		uint64_t waitUS = 0;   // demuxer waiting for data not read yet / muxer waiting for a free buffer
+		uint64_t diskUS = 0;   // time OS reads or writes were in progress on the I/O thread
+		uint64_t diskBytes = 0;
+	};
+
+	struct StatsSnapshot {
+		std::vector<std::pair<std::string, WorkerStats>> stages;
+		std::vector<std::pair<std::string, RingStats>> rings;
+		std::vector<std::pair<std::string, IOStats>> io;
+		// multi-line utilisation table for the end of a job
+		std::string table() const;
+		// one-line summary for periodic printing
+		std::string line() const;
+	};
+
+	// turns all measuring off/on (on by default). when off, meters and rings don't read the clock at all
+	void setStatsEnabled(bool enabled);
+	bool statsEnabled();
+
+	// busy/blocked time of one stage. updated by its own thread, can be read from any thread
+	class StageMeter {
+	public:
+		enum class State { BUSY, BLOCKED };
+		// adds the lifetime of the scope to busy or blocked time
+		class Scope {
+		public:
+			Scope(StageMeter& meter, State state);
+			Scope(StageMeter* meter, State state); // meter may be null
+			~Scope();
+			// stops measuring before the scope ends
+			void end();
+		private:
+			StageMeter* meter;
+			State state;
+			int64_t begin;
+		};
+		void add(State state, uint64_t us);
+		void count(uint64_t frames = 1);
+		WorkerStats snapshot() const;
+		void reset();
+	private:
+		void addSpan(State state, int64_t begin, int64_t end);
+		std::atomic<uint64_t> items{ 0 }, busyUS{ 0 }, blockedUS{ 0 };
+		std::atomic<int64_t> firstUS{ 0 }, lastUS{ 0 };
+	};
+
+	struct LatencyStats {
+		uint64_t frames = 0;
+		double meanMs = 0, p50Ms = 0, p95Ms = 0, p99Ms = 0, maxMs = 0;
+		// "frames, mean, p50, p95, p99, max ms"
+		std::string line() const;
+	};
+
+	// distribution of per-frame latencies in 0.5 ms bins up to 2 s. longer ones share the last bin, so percentiles that
+	// land there read as 2 s, but the max is exact. not thread safe
+	class LatencyMeter {
+	public:
+		LatencyMeter();
+		void add(int64_t us);
+		LatencyStats stats() const;
+		void reset();
+	private:
+		std::vector<uint32_t> bins;
+		uint64_t frames = 0, totalUS = 0, maxUS = 0;
+	};
+
+	// Input layer under the demuxer, so demuxing doesn't stall on small synchronous reads.
+	// MMAP maps the whole file and advises the kernel to fetch the pages ahead of the read position.
+	// READ_AHEAD reads large aligned blocks on a background thread, keeping a window of blocks ahead of the read position.
+	// AUTO uses MMAP for local files and READ_AHEAD for network-mounted ones, and DEFAULT for URLs, pipes and devices.
+	// DEFAULT leaves the file to FFmpeg's own protocol.
+	class InputFile {
+	public:
+		enum class Mode { AUTO, MMAP, READ_AHEAD, DEFAULT };
+		struct Options {
+			Mode mode = Mode::AUTO;
+			size_t blockSize = 4 << 20; // bytes per OS read (READ_AHEAD) or per advice (MMAP)
+			size_t prefetchBlocks = 8;  // blocks kept ahead of the read position
+		};
+		InputFile();
+		~InputFile();
+		InputFile(const InputFile&) = delete;
+		bool open(const char* fileName, const Options& opts);
+		bool open(const char* fileName);
+		// set as AVFormatContext::pb with AVFMT_FLAG_CUSTOM_IO before avformat_open_input. nullptr in DEFAULT mode.
+		// owned by this object, which must outlive the format context
+		AVIOContext* context();
+		// the mode actually in use (never AUTO once opened)
+		Mode mode();
+		IOStats stats();
+		void close();
+	private:
+		void* structure;
+	};
+
+	// Output layer under the muxer, so muxing doesn't stall on disk writes. Writes are gathered into large aligned chunks
+	// which a writer thread puts on the file, through io_uring when the kernel allows it (IO_URING) or plain writes (THREAD).
+	// The muxer only waits when all chunks are still queued. Seeking back (e.g. to patch MP4 box sizes) starts a new chunk
+	// that is written after everything before it. A chunk is also queued where the muxer marks the start of a fragment or
+	// cluster, so fragmented outputs reach the file a whole fragment at a time instead of a whole chunk at a time.
+	// movflags=faststart is not supported, since it reopens the file to read back what may not be written yet.
+	class OutputFile {
+	public:
+		enum class Mode { AUTO, IO_URING, THREAD, DEFAULT };
+		struct Options {
+			Mode mode = Mode::AUTO;
+			size_t chunkSize = 4 << 20; // bytes per OS write at most
+			size_t chunks = 8;          // chunks that may be filled or queued at once
+		};
+		OutputFile();
+		~OutputFile();
+		OutputFile(const OutputFile&) = delete;
+		bool open(const char* fileName, const Options& opts);
+		bool open(const char* fileName);
+		// set as AVFormatContext::pb. nullptr in DEFAULT mode. owned by this object, which must outlive the format context
+		AVIOContext* context();
+		// the mode actually in use (never AUTO once opened)
+		Mode mode();
+		// waits until everything written so far is in the file. false if any write failed
+		bool flush();
+		// flushes and closes the file. statistics are kept until the next open. false if any write failed
+		bool close();
+		IOStats stats();
+	private:
+		void* structure;
+	};
+
+	// Lets a decoder allocate its frames in page-aligned memory that is imported into the GPU once per buffer,
+	// so BGRA frames can be uploaded without a staging copy. Must outlive the codec context it is attached to.
+	class HostImportFramePool {
+	public:
+		HostImportFramePool();
+		~HostImportFramePool();
+		// call before avcodec_open2. returns false (and leaves the default allocator) if the device or the pixel format can't use it
+		bool attach(AVCodecContext* decoder);
+		// imported GPU memory handle (YRGraphics::ImportedHostMemory*) holding frame->data[0] and the plane offset in it,
+		// or nullptr if the frame's buffer did not come from this pool. the frame must stay referenced until the copy from it is done
+		void* importedMemory(const AVFrame* frame, uint64_t* offset) const;
+	private:
+		void* structure;
+	};
+
+	// av_frame_get_buffer with FrameMemory: 64-byte aligned rows in huge pages on the calling thread's NUMA node when available.
+	// format, width and height must be set. returns 0 or a negative AVERROR
+	int getFrameBuffer(AVFrame* frame);
+
+	// 64-bit hash of the visible pixels of a frame (and its size and format), ignoring row padding.
+	// equal hashes mean the frames are identical for all practical purposes. returns 0 for frames it can't read (e.g. hardware frames)
+	uint64_t hashFrame(const AVFrame* frame);
+
+	// Per-tile change detection between consecutive frames of a stream. Tiles are tileSize x tileSize pixels (the last
+	// column and row may be smaller), and each tile's hash covers its share of every plane.
+	class FrameTiles {
+	public:
+		FrameTiles(int tileSize = 64);
+		~FrameTiles();
+		FrameTiles(const FrameTiles&) = delete;
+		// hashes the tiles of frame and marks those that differ from the previous call. every tile is dirty on the first call,
+		// after a size or format change and after invalidate(). returns false for frames hashFrame can't read, which are all dirty
+		bool update(const AVFrame* frame);
+		// makes the next update mark every tile dirty
+		void invalidate();
+		int tileSize() const;
+		int columns() const;
+		int rows() const;
+		bool dirty(int column, int row) const;
+		size_t dirtyCount() const;
+	private:
+		void* structure;
+	};
+
+	// Converts (or copies, for equal formats) a rectangle of an image into the same rectangle of another, leaving the rest
+	// of the destination as it is. Both images have the full frame layout. For subsampled formats the rectangle should
+	// start on a chroma sample, which tile boundaries do. Keeps a scaler per rectangle size, so a few fixed sizes are cheap.
+	class AreaConverter {
+	public:
+		AreaConverter(int srcFormat, int dstFormat); // AVPixelFormat values
+		~AreaConverter();
+		AreaConverter(const AreaConverter&) = delete;
+		bool convert(const uint8_t* const src[], const int srcStride[], uint8_t* const dst[], const int dstStride[], int x, int y, int width, int height);
+	private:
+		void* structure;
+	};
+
 	class RingBuffer4Frame {
 		friend class VideoDecoder;
 		friend class Converter;
@@ -17,6 +232,7 @@ namespace onart {
 		RingBuffer4Frame(size_t bufferLength = 2);
 		~RingBuffer4Frame();
 		size_t load();
+		RingStats stats();
 	private:
 		void* structure;
 	};
@@ -24,10 +240,12 @@ namespace onart {
 	class RingBuffer4Texture {
 		friend class Converter;
 		friend class FrameFilter;
+		friend class OffscreenFilter;
 	public:
 		RingBuffer4Texture(size_t bufferLength = 2);
 		~RingBuffer4Texture();
 		size_t load();
+		RingStats stats();
 	private:
 		void* structure;
 	};
@@ -39,22 +257,143 @@ namespace onart {
 		RingBuffer4RGBA(size_t bufferLength = 2);
 		~RingBuffer4RGBA();
 		size_t load();
+		RingStats stats();
 	private:
 		void* structure;
 	};
 
+	// how an encoder trades speed for size. fields left at their defaults keep the codec's own defaults
+	struct EncoderOptions {
+		enum class RateControl {
+			AUTO, // the input's bitrate scaled by the pixel count
+			CRF,  // constant quality. quality is the crf, or the qp for codecs without one
+			CQP,  // constant quantizer. quality is the qp
+			ABR,  // average bitRate
+			CBR,  // constant bitRate with a one second buffer
+		};
+		std::string codec; // encoder or codec name such as "libx265" or "av1". empty keeps the input's codec
+		RateControl rateControl = RateControl::AUTO;
+		int quality = 23;
+		int64_t bitRate = 0;  // bits per second, for ABR and CBR. 0 falls back to AUTO's
+		int gopSize = 0;      // frames from one keyframe to the next. 0 keeps the codec default
+		int maxBFrames = -1;  // -1 keeps the codec default
+		int threads = 0;      // 0 lets the codec choose
+		bool forceIdr = false; // forced I frames (AVFrame::pict_type) become IDR, on encoders with a forced-idr option
+		// no B-frames, lookahead or frame threading, so each frame comes out as soon as it is sent. also applies the codec's
+		// zero-latency tuning where it has one (x264/x265 tune, nvenc, libvpx, libaom), which privateOptions may override
+		bool lowLatency = false;
+		std::vector<std::pair<std::string, std::string>> privateOptions; // codec specific, such as preset, tune or x265-params
+		// adds "key=value" pairs separated by ':' to privateOptions
+		void parsePrivateOptions(const char* list);
+	};
+
+	// encoder for opts.codec, or for codecId (an AVCodecID) when it is empty
+	const AVCodec* findEncoder(const EncoderOptions& opts, int codecId);
+	// preferred (an AVPixelFormat) if the encoder takes it, otherwise the closest one it does
+	int encoderPixelFormat(const AVCodec* encoder, int preferred);
+	// sets opts on a context that is not opened yet. private options go to *dict, to be passed to openEncoder
+	// autoBitRate: the bitrate for RateControl::AUTO
+	void configureEncoder(AVCodecContext* ctx, const EncoderOptions& opts, int64_t autoBitRate, AVDictionary** dict);
+	// avcodec_open2 that reports private options the encoder did not take. returns its error code
+	int openEncoder(AVCodecContext* ctx, const AVCodec* encoder, AVDictionary** dict);
+
+	// how an output is laid out as it is written. FILE is whatever the file name says, complete only after the trailer
+	// (which holds the moov of an MP4). The others can be read while the job runs and lose at most the last fragment or
+	// segment if it stops: FRAGMENTED_MP4 writes an empty moov first and then a fragment at each keyframe; HLS and DASH
+	// write segments next to the output and rewrite its playlist (.m3u8) or manifest (.mpd) after each one.
+	// Fragments and segments start at keyframes, so the encoder's GOP should be at most segmentSeconds long
+	struct SegmentOptions {
+		enum class Mode { FILE, FRAGMENTED_MP4, HLS, DASH };
+		Mode mode = Mode::FILE;
+		double segmentSeconds = 4; // shortest fragment or segment
+		int window = 0;            // HLS/DASH: segments listed, older ones are deleted. 0 lists and keeps all of them
+		// muxer name for avformat_alloc_output_context2. nullptr guesses from the file name
+		const char* format() const;
+		// muxer options for openMuxer. segment files are named after fileName, so outputs in one directory don't collide
+		// codecId (an AVCodecID): HLS puts codecs other than H.264 in fMP4 segments rather than MPEG-TS
+		void muxerOptions(const char* fileName, int codecId, AVDictionary** dict) const;
+	};
+	// avformat_write_header that reports options the muxer did not take. returns its error code
+	int openMuxer(AVFormatContext* fmt, AVDictionary** dict);
+
+	// what one encode produced, for comparing settings per job
+	struct EncodeReport {
+		uint64_t frames = 0;
+		uint64_t bytes = 0;      // compressed video
+		double mediaSeconds = 0; // duration of the frames encoded
+		double wallSeconds = 0;  // time taken
+		// "name: frames, fps, MB, kbps"
+		std::string line(const std::string& name) const;
+	};
+
 	class VideoFilter;
 	class FileVideoEncoder;
 
 	// in microseconds
-	struct section { int32_t start, end; };
+	struct section { int64_t start, end; };
+
+	// Scene cut detection on the luma of decoded frames. Each frame is reduced to the means of its 8x8 luma blocks; a cut is a
+	// frame whose block histogram moved by at least threshold (0~1) from the previous frame while the block difference is well
+	// above the shot's recent motion, so pans and flashes within a shot are not taken for cuts. Reads 8 to 16-bit planar YUV
+	// and gray formats; other frames are never cuts.
+	class SceneCutDetector {
+	public:
+		SceneCutDetector(double threshold = 0.3, int minInterval = 8);
+		~SceneCutDetector();
+		SceneCutDetector(const SceneCutDetector&) = delete;
+		// true when frame starts a new scene: not the first frame, and at least minInterval frames after the last cut
+		bool update(const AVFrame* frame);
+		// histogram change of the last update
+		double score() const;
+		// pts of the frames that started a scene, in the frames' time base
+		const std::vector<int64_t>& cuts() const;
+	private:
+		void* structure;
+	};
+
+	// sections for VideoDecoder::start that begin at scene cuts (in microseconds), skipping cuts that would make a section
+	// shorter than minLength. they cover [0, duration)
+	std::vector<section> sectionsAtCuts(const std::vector<int64_t>& cuts, int64_t duration, int64_t minLength);
 
 	class VideoEncoder {
 		friend class VideoDecoder;
+		friend class EncoderFanOut;
+	public:
+		VideoEncoder(const VideoEncoder&) = delete;
+		~VideoEncoder();
+		// io applies to the output file, unless the muxer writes its own files (segments)
+		void start(const char* fileName, const SegmentOptions& segments = SegmentOptions{}, const OutputFile::Options& io = OutputFile::Options{});
+		// rgba: packed rows of the encoder's size, or rows pitch bytes apart. nullptr repeats the last picture, and is dropped before the first one
+		// duration: in the encoder time base. 0 is taken as one frame at the stream rate
+		// keyframe: forces an I frame, an IDR one where EncoderOptions::forceIdr took effect
+		void push(const uint8_t* rgba, size_t duration, int pitch = 0, bool keyframe = false);
+		// flushes the encoder and closes the file
+		void end();
+		WorkerStats stats();
+		IOStats ioStats();
+		// complete after end()
+		EncodeReport report();
+	private:
+		VideoEncoder() = default;
+		void* structure;
+	};
+
+	// feeds one RGBA frame stream to several started encoders of the same size, each encoding and muxing on its own thread.
+	// a pushed frame is copied once into a shared queue slot, which is reused after every encoder has released it,
+	// so push blocks only while the slowest encoder is a whole queue behind
+	class EncoderFanOut {
 	public:
-		void start(const char* fileName);
-		void push(const uint8_t* rgba, size_t duration);
+		EncoderFanOut(size_t queueLength = 4);
+		EncoderFanOut(const EncoderFanOut&) = delete;
+		~EncoderFanOut(); // calls end()
+		// encoders must be started, added before the first push, and outlive this
+		void add(VideoEncoder* encoder);
+		// same as VideoEncoder::push
+		void push(const uint8_t* rgba, size_t duration, int pitch = 0, bool keyframe = false);
+		// lets every encoder drain the queue, then ends them
 		void end();
+		size_t load();
+		RingStats stats();
 	private:
 		void* structure;
 	};
@@ -64,6 +403,21 @@ namespace onart {
 		FrameFilter(int width, int height);
 		~FrameFilter();
 		void onLoop(RingBuffer4Texture* input);
+		WorkerStats stats();
+	private:
+		void* structure;
+	};
+
+	// windowless counterpart of FrameFilter: draws each uploaded texture into an offscreen target of the same size,
+	// reads it back and pushes it to an encoder. filters share one render pass, so only one may be in use at a time
+	class OffscreenFilter {
+	public:
+		OffscreenFilter(int width, int height);
+		~OffscreenFilter();
+		OffscreenFilter(const OffscreenFilter&) = delete;
+		// processes one texture. false once the converter is done and every texture has been processed
+		bool onLoop(RingBuffer4Texture* input, VideoEncoder* output, size_t duration);
+		WorkerStats stats();
 	private:
 		void* structure;
 	};
@@ -78,8 +432,11 @@ namespace onart {
 	public:
 		Converter(const Converter&) = delete;
 		~Converter();
+		// with extraWorker, returns once the worker has taken its NUMA node for the input ring's frames;
+		// start it before the decoder writing to input so that every decoded frame is allocated on that node
 		void start(RingBuffer4Frame* input, RingBuffer4Texture* output, bool minmagLinear = true, bool extraWorker = true);
 		void start(RingBuffer4Texture* input, RingBuffer4Frame* output, bool extraWorker = true);
+		WorkerStats stats();
 	private:
 		Converter() = default;
 		void* structure;
@@ -90,16 +447,24 @@ namespace onart {
 		VideoDecoder();
 		~VideoDecoder();
 		std::unique_ptr<Converter> makeFormatConverter();
-		std::unique_ptr<VideoEncoder> makeEncoder(int w, int h);
+		std::unique_ptr<VideoEncoder> makeEncoder(int w, int h, const EncoderOptions& opts = {});
+		// for a stream demuxed elsewhere, so an input that can only be read once isn't opened a second time
+		static std::unique_ptr<VideoEncoder> makeEncoder(const AVCodecParameters* stream, AVRational timeBase, AVRational frameRate, int w, int h, const EncoderOptions& opts = {});
 		bool open(const char* fileName);
+		bool open(const char* fileName, const InputFile::Options& io);
+		// reads through io, which the caller keeps until this is destroyed. name only shows in logs and guides probing
+		bool open(AVIOContext* io, const char* name = "");
 		void start(RingBuffer4Frame* output, const std::vector<section>& sections = {}, bool extraWorker = true);
 		void terminate();
 		size_t load();
+		WorkerStats stats();
+		IOStats ioStats();
 	public:
 		size_t getDuration();
 		int getWidth();
 		int getHeight();
 	private:
+		bool openStream(const char* fileName, AVIOContext* pb);
 		bool isOpened();
 		int64_t getTimeInMicro(int64_t);
 		void* structure;